@@ -0,0 +1,168 @@
+/* ata.c - ATA disk driver for the primary channel QEMU emulates. Transfers
+ * are polled PIO, one sector per data request, with the drives' interrupts off
+ * vim:ts=4 noexpandtab
+ */
+
+#include "ata.h"
+#include "lib.h"
+
+/* The drives found by ata_init, num_sectors is 0 for a drive that is missing */
+static block_dev_t ata_drives[ATA_NUM_DRIVES];
+/* Drive the channel last had selected, -1 before the first selection */
+static int32_t selected_drive = -1;
+
+static int32_t ata_read_sectors(block_dev_t* dev, uint32_t sector, uint32_t count, uint8_t* buf);
+
+/* ata_wait()
+   Poll the status register until the drive is no longer busy, and until
+   it requests data if data is expected
+   Input : want_data -- nonzero if the drive is about to transfer a sector
+   Output : 0 when the drive is ready, -1 on error, device fault or timeout
+   Side Effects : None
+ */
+static int32_t ata_wait(int32_t want_data) {
+	uint32_t i, status;
+	for (i = 0; i < ATA_POLL_LIMIT; i++) {
+		status = inb(ATA_PRIMARY_IO + ATA_REG_STATUS);
+		if (status & ATA_STATUS_BSY) {
+			continue;
+		}
+		if (status & (ATA_STATUS_ERR | ATA_STATUS_DF)) {
+			return -1;
+		}
+		if (!want_data || (status & ATA_STATUS_DRQ)) {
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/* ata_select()
+   Select a drive of the channel and load the high bits of an LBA28 address
+   Input : drive -- ATA_MASTER or ATA_SLAVE
+           lba_high -- bits 24-27 of the address
+   Output : None
+   Side Effects : Writes the drive register, and waits for the drive to take
+                  the selection if it changed
+ */
+static void ata_select(uint32_t drive, uint32_t lba_high) {
+	uint32_t i;
+	outb(ATA_DRIVE_LBA | (drive << ATA_DRIVE_SLAVE_BIT) | (lba_high & 0x0F), ATA_PRIMARY_IO + ATA_REG_DRIVE);
+	if (selected_drive != (int32_t) drive) {
+		for (i = 0; i < ATA_SELECT_DELAY_READS; i++) {
+			inb(ATA_PRIMARY_CTRL);
+		}
+		selected_drive = drive;
+	}
+}
+
+/* ata_identify()
+   Find out whether a drive is present and how many sectors it holds
+   Input : drive -- ATA_MASTER or ATA_SLAVE
+   Output : number of LBA28 addressable sectors, 0 if there is no ATA drive
+   Side Effects : Selects the drive
+ */
+static uint32_t ata_identify(uint32_t drive) {
+	uint16_t identify[ATA_IDENTIFY_WORDS];
+
+	ata_select(drive, 0);
+	outb(0, ATA_PRIMARY_IO + ATA_REG_SECTOR_COUNT);
+	outb(0, ATA_PRIMARY_IO + ATA_REG_LBA_LOW);
+	outb(0, ATA_PRIMARY_IO + ATA_REG_LBA_MID);
+	outb(0, ATA_PRIMARY_IO + ATA_REG_LBA_HIGH);
+	outb(ATA_CMD_IDENTIFY, ATA_PRIMARY_IO + ATA_REG_COMMAND);
+	if (inb(ATA_PRIMARY_IO + ATA_REG_STATUS) == 0 || ata_wait(0) != 0) {
+		/* No drive, or one that aborts IDENTIFY */
+		return 0;
+	}
+	if (inb(ATA_PRIMARY_IO + ATA_REG_LBA_MID) != 0 || inb(ATA_PRIMARY_IO + ATA_REG_LBA_HIGH) != 0) {
+		/* An ATAPI drive, such as a CD-ROM, answers with its signature instead */
+		return 0;
+	}
+	if (ata_wait(1) != 0) {
+		return 0;
+	}
+	insw(ATA_PRIMARY_IO + ATA_REG_DATA, identify, ATA_IDENTIFY_WORDS);
+	return identify[ATA_IDENTIFY_LBA28_SECTORS] | (identify[ATA_IDENTIFY_LBA28_SECTORS + 1] << 16);
+}
+
+/* ata_init()
+   Turn the primary channel's interrupts off and identify its two drives
+   Input : None
+   Output : None
+   Side Effects : Fills in ata_drives
+ */
+void ata_init(void) {
+	uint32_t i;
+
+	for (i = 0; i < ATA_NUM_DRIVES; i++) {
+		ata_drives[i].unit = i;
+		ata_drives[i].num_sectors = 0;
+		ata_drives[i].read_sectors = ata_read_sectors;
+		ata_drives[i].submit_read = NULL;
+		ata_drives[i].wait_request = NULL;
+	}
+	if (inb(ATA_PRIMARY_IO + ATA_REG_STATUS) == ATA_FLOATING_BUS) {
+		/* No controller on the primary channel */
+		return;
+	}
+	outb(ATA_CTRL_NIEN, ATA_PRIMARY_CTRL);
+	for (i = 0; i < ATA_NUM_DRIVES; i++) {
+		ata_drives[i].num_sectors = ata_identify(i);
+	}
+}
+
+/* ata_get_device()
+   Get a drive of the primary channel as a block device
+   Input : drive -- ATA_MASTER or ATA_SLAVE
+   Output : the drive, NULL if ata_init did not find it
+   Side Effects : None
+ */
+block_dev_t* ata_get_device(uint32_t drive) {
+	if (drive >= ATA_NUM_DRIVES || ata_drives[drive].num_sectors == 0) {
+		return NULL;
+	}
+	return &ata_drives[drive];
+}
+
+/* ata_read_sectors()
+   Read sectors with READ SECTORS commands of up to ATA_MAX_SECTORS_PER_CMD sectors,
+   copying each sector out of the data register as the drive requests it.
+   The caller keeps another read from starting on the channel meanwhile
+   Input : dev -- drive to read, from ata_get_device
+           sector -- LBA of the first sector
+           count -- number of sectors
+           buf -- array of count * SECTOR_SIZE bytes to be filled in
+   Output : 0 on success, -1 if a sector is out of range or the drive reports an error
+   Side Effects : buf filled in with the sectors
+ */
+static int32_t ata_read_sectors(block_dev_t* dev, uint32_t sector, uint32_t count, uint8_t* buf) {
+	uint32_t i;
+
+	if (sector > dev->num_sectors || count > dev->num_sectors - sector) {
+		return -1;
+	}
+	while (count > 0) {
+		uint32_t cmd_sectors = min(count, ATA_MAX_SECTORS_PER_CMD);
+		if (ata_wait(0) != 0) {
+			return -1;
+		}
+		ata_select(dev->unit, sector >> 24);
+		/* A sector count of 0 asks for ATA_MAX_SECTORS_PER_CMD sectors */
+		outb(cmd_sectors & 0xFF, ATA_PRIMARY_IO + ATA_REG_SECTOR_COUNT);
+		outb(sector & 0xFF, ATA_PRIMARY_IO + ATA_REG_LBA_LOW);
+		outb((sector >> 8) & 0xFF, ATA_PRIMARY_IO + ATA_REG_LBA_MID);
+		outb((sector >> 16) & 0xFF, ATA_PRIMARY_IO + ATA_REG_LBA_HIGH);
+		outb(ATA_CMD_READ_SECTORS, ATA_PRIMARY_IO + ATA_REG_COMMAND);
+		for (i = 0; i < cmd_sectors; i++) {
+			if (ata_wait(1) != 0) {
+				return -1;
+			}
+			insw(ATA_PRIMARY_IO + ATA_REG_DATA, buf, ATA_WORDS_PER_SECTOR);
+			buf += SECTOR_SIZE;
+		}
+		sector += cmd_sectors;
+		count -= cmd_sectors;
+	}
+	return 0;
+}
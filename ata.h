@@ -0,0 +1,58 @@
+/* ata.h - Defines for the ATA disk driver, polled PIO on the primary
+ * channel
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _ATA_H
+#define _ATA_H
+
+#include "types.h"
+#include "block_dev.h"
+
+/* Ports of the primary channel: its task file registers, and its device control register */
+#define ATA_PRIMARY_IO 0x1F0
+#define ATA_PRIMARY_CTRL 0x3F6
+#define ATA_REG_DATA 0
+#define ATA_REG_ERROR 1
+#define ATA_REG_SECTOR_COUNT 2
+#define ATA_REG_LBA_LOW 3
+#define ATA_REG_LBA_MID 4
+#define ATA_REG_LBA_HIGH 5
+#define ATA_REG_DRIVE 6
+#define ATA_REG_STATUS 7
+#define ATA_REG_COMMAND 7
+
+#define ATA_STATUS_ERR 0x01
+#define ATA_STATUS_DRQ 0x08
+#define ATA_STATUS_DF 0x20
+#define ATA_STATUS_BSY 0x80
+/* What the status register reads as when no controller drives the bus */
+#define ATA_FLOATING_BUS 0xFF
+
+#define ATA_CMD_READ_SECTORS 0x20
+#define ATA_CMD_IDENTIFY 0xEC
+
+/* Drive register: LBA addressing, bit 4 picks the slave, the low nibble holds LBA bits 24-27 */
+#define ATA_DRIVE_LBA 0xE0
+#define ATA_DRIVE_SLAVE_BIT 4
+/* Device control register: nIEN, the drives raise no interrupts since they are polled */
+#define ATA_CTRL_NIEN 0x02
+
+#define ATA_MASTER 0
+#define ATA_SLAVE 1
+#define ATA_NUM_DRIVES 2
+/* Words of the IDENTIFY data, and where the number of LBA28 sectors is kept in them */
+#define ATA_IDENTIFY_WORDS 256
+#define ATA_IDENTIFY_LBA28_SECTORS 60
+#define ATA_WORDS_PER_SECTOR 256
+/* Most sectors one LBA28 command transfers */
+#define ATA_MAX_SECTORS_PER_CMD 256
+/* Status reads before a drive that stays busy is given up on */
+#define ATA_POLL_LIMIT 1000000
+/* Status reads that take the 400ns a drive needs after being selected */
+#define ATA_SELECT_DELAY_READS 4
+
+void ata_init(void);
+block_dev_t* ata_get_device(uint32_t drive);
+
+#endif /* _ATA_H */
@@ -0,0 +1,142 @@
+/* block_dev.c - Reads file system blocks from a block device, whatever
+ * the driver behind it, and benchmarks the device
+ * vim:ts=4 noexpandtab
+ */
+
+#include "block_dev.h"
+#include "file_system.h"
+#include "lib.h"
+#include "debug.h"
+
+#define SECTORS_PER_BLOCK (BLOCK_SIZE / SECTOR_SIZE)
+/* Linear congruential generator of the random reads */
+#define BENCH_RAND_MULTIPLIER 1103515245U
+#define BENCH_RAND_INCREMENT 12345U
+
+/* get_num_blocks()
+   Number of whole file system blocks on a device
+   Input : dev -- the device
+   Output : number of blocks
+   Side Effects : None
+ */
+uint32_t get_num_blocks(const block_dev_t* dev) {
+	return dev->num_sectors / SECTORS_PER_BLOCK;
+}
+
+/* read_blocks()
+   Read file system blocks from a device
+   Input : dev -- the device
+           block -- index of the first block
+           num_blocks -- number of blocks to read
+           buf -- array of num_blocks * BLOCK_SIZE bytes to be filled in
+   Output : 0 on success, -1 if a block is past the end of the device or the read fails
+   Side Effects : buf filled in with the blocks
+ */
+int32_t read_blocks(block_dev_t* dev, uint32_t block, uint32_t num_blocks, uint8_t* buf) {
+	uint32_t dev_blocks = get_num_blocks(dev);
+	if (block > dev_blocks || num_blocks > dev_blocks - block) {
+		return -1;
+	}
+	return dev->read_sectors(dev, block * SECTORS_PER_BLOCK, num_blocks * SECTORS_PER_BLOCK, buf);
+}
+
+#if KERNEL_BENCH
+
+/* Blocks read by bench_block_dev, identity mapped kernel memory as drivers that
+   transfer on their own need */
+static uint8_t bench_buf[BENCH_MAX_QUEUE_DEPTH * BLOCK_SIZE];
+
+/* bench_random_block()
+   Pick the next block of the random reads, every run reads the same ones
+   Input : state -- state of the generator, updated
+           num_blocks -- blocks of the device
+   Output : index of a block
+ */
+static uint32_t bench_random_block(uint32_t* state, uint32_t num_blocks) {
+	*state = *state * BENCH_RAND_MULTIPLIER + BENCH_RAND_INCREMENT;
+	return (*state >> 8) % num_blocks;
+}
+
+/* bench_queued_reads()
+   Time BENCH_RANDOM_READS one block reads at random blocks, with depth of them in flight
+   at a time
+   Input : dev -- a device with submit_read and wait_request
+           depth -- reads in flight at a time, at most BENCH_MAX_QUEUE_DEPTH
+   Output : cycles taken, 0 if a read failed
+ */
+static uint32_t bench_queued_reads(block_dev_t* dev, uint32_t depth) {
+	int32_t reqs[BENCH_MAX_QUEUE_DEPTH];
+	uint32_t state = 1;
+	uint32_t num_blocks = get_num_blocks(dev);
+	uint32_t start = rdtsc();
+	uint32_t done, i, num_reqs;
+	int32_t result = 0;
+
+	for (done = 0; done < BENCH_RANDOM_READS; done += num_reqs) {
+		num_reqs = min(depth, BENCH_RANDOM_READS - done);
+		for (i = 0; i < num_reqs; i++) {
+			reqs[i] = dev->submit_read(dev, bench_random_block(&state, num_blocks) * SECTORS_PER_BLOCK,
+			                           SECTORS_PER_BLOCK, bench_buf + i * BLOCK_SIZE);
+		}
+		for (i = 0; i < num_reqs; i++) {
+			result |= (reqs[i] < 0)? -1 : dev->wait_request(dev, reqs[i]);
+		}
+	}
+	return (result == 0)? rdtsc() - start : 0;
+}
+
+/* bench_block_dev()
+   Print the cycles per KB of sequential reads, and the cycles per read of random one
+   block reads, which divided into the clock rate give the reads per second. On a device
+   that queues requests, the random reads are also made with several in flight at a time
+   Input : dev -- the device, NULL prints that there is none
+   Output : None
+   Side Effects : None
+ */
+void bench_block_dev(block_dev_t* dev) {
+	uint32_t num_blocks, block, cycles, depth;
+	uint32_t state = 1;
+	uint32_t start;
+
+	if (dev == NULL || get_num_blocks(dev) < BENCH_SEQUENTIAL_BLOCKS) {
+		printf("no disk to benchmark\n");
+		return;
+	}
+	num_blocks = min(get_num_blocks(dev), BENCH_SEQUENTIAL_BYTES / BLOCK_SIZE);
+	num_blocks -= num_blocks % BENCH_SEQUENTIAL_BLOCKS;
+	start = rdtsc();
+	for (block = 0; block < num_blocks; block += BENCH_SEQUENTIAL_BLOCKS) {
+		if (read_blocks(dev, block, BENCH_SEQUENTIAL_BLOCKS, bench_buf) != 0) {
+			printf("sequential read of block %u failed\n", block);
+			return;
+		}
+	}
+	cycles = rdtsc() - start;
+	printf("sequential: %u KB in %u KB reads, %u cycles/KB\n", num_blocks * BLOCK_SIZE / 1024,
+	       BENCH_SEQUENTIAL_BLOCKS * BLOCK_SIZE / 1024, cycles / (num_blocks * BLOCK_SIZE / 1024));
+
+	start = rdtsc();
+	for (block = 0; block < BENCH_RANDOM_READS; block++) {
+		if (read_blocks(dev, bench_random_block(&state, get_num_blocks(dev)), 1, bench_buf) != 0) {
+			printf("random read failed\n");
+			return;
+		}
+	}
+	cycles = rdtsc() - start;
+	printf("random: %u reads of %u bytes, %u cycles/read\n", BENCH_RANDOM_READS, BLOCK_SIZE,
+	       cycles / BENCH_RANDOM_READS);
+
+	if (dev->submit_read == NULL) {
+		return;
+	}
+	for (depth = 1; depth <= BENCH_MAX_QUEUE_DEPTH; depth *= 2) {
+		cycles = bench_queued_reads(dev, depth);
+		if (cycles == 0) {
+			printf("queued random read failed\n");
+			return;
+		}
+		printf("random, %u in flight: %u cycles/read\n", depth, cycles / BENCH_RANDOM_READS);
+	}
+}
+
+#endif /* KERNEL_BENCH */
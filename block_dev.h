@@ -0,0 +1,41 @@
+/* block_dev.h - Block devices the file system can be mounted from, read
+ * in blocks of the file system's size
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _BLOCK_DEV_H
+#define _BLOCK_DEV_H
+
+#include "types.h"
+#include "debug.h"
+
+#define SECTOR_SIZE 512
+
+/* Reads of the benchmark: sequential reads of BENCH_SEQUENTIAL_BLOCKS blocks per call over
+   BENCH_SEQUENTIAL_BYTES, then BENCH_RANDOM_READS one block reads, one at a time and, on a
+   device that queues requests, BENCH_MAX_QUEUE_DEPTH at a time */
+#define BENCH_SEQUENTIAL_BLOCKS 16
+#define BENCH_SEQUENTIAL_BYTES 0x400000
+#define BENCH_RANDOM_READS 512
+#define BENCH_MAX_QUEUE_DEPTH 16
+
+/* A disk, read in sectors of SECTOR_SIZE bytes by its driver */
+typedef struct block_dev_t {
+	uint32_t unit;			/* which disk of its driver the device is */
+	uint32_t num_sectors;
+	/* Read count sectors from sector onwards into buf, 0 on success, -1 on error */
+	int32_t (*read_sectors)(struct block_dev_t* dev, uint32_t sector, uint32_t count, uint8_t* buf);
+	/* Devices that keep several requests in flight: start a read without waiting for it,
+	   giving a request number or -1, and wait for a request, giving 0 if it succeeded.
+	   NULL for a device that does one request at a time */
+	int32_t (*submit_read)(struct block_dev_t* dev, uint32_t sector, uint32_t count, uint8_t* buf);
+	int32_t (*wait_request)(struct block_dev_t* dev, int32_t req);
+} block_dev_t;
+
+uint32_t get_num_blocks(const block_dev_t* dev);
+int32_t read_blocks(block_dev_t* dev, uint32_t block, uint32_t num_blocks, uint8_t* buf);
+#if KERNEL_BENCH
+void bench_block_dev(block_dev_t* dev);
+#endif
+
+#endif /* _BLOCK_DEV_H */
@@ -7,6 +7,11 @@
 
 #define DEBUG_MODE 0
 
+/* Set to 1 to build the benchmarks kernel.c can call, the kernel carries none of them otherwise */
+#ifndef KERNEL_BENCH
+#define KERNEL_BENCH 0
+#endif
+
 #ifndef LOG
 #define LOG(str, ...)                                                   \
     do { if (DEBUG_MODE) printf(str,  ## __VA_ARGS__); } while (0)
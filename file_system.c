@@ -4,6 +4,13 @@
 #include "lib.h"
 #include "paging.h"
 #include "pcb.h"
+#include "lz4.h"
+#include "block_dev.h"
+#include "keyboard.h"
+#include "debug.h"
+
+#define BENCH_LOOKUP_ROUNDS 1000
+#define BENCH_READ_CHUNK 1
 
 /* Contains file system's statistics information. 64 Bytes in size */
 fs_stat_t fs_stat;
@@ -13,6 +20,70 @@ dentry_t* dentries;
 inode_t* inodes;
 /* Array of data blocks. Each data block is 4KB in size */
 data_block_t* data_blocks;
+/* Directory with FS_FEATURE_LARGE_DIR: its header, NULL if the boot block holds the
+   directory, and the address of each of its blocks */
+static dir_header_t* dir_header;
+static uint8_t* dir_blocks[MAX_NUM_BLOCKS_IN_INODE];
+/* Name index over dentries, open addressing with linear probing */
+static dentry_hash_t dentry_index[DENTRY_HASH_SIZE];
+/* Indexes of the named directory entries, sorted by name. Not used when the directory
+   has more than MAX_NUM_SORTED_NAMES of them */
+static uint32_t name_order[MAX_NUM_SORTED_NAMES];
+static uint32_t num_sorted_names;
+static uint32_t name_order_valid;
+/* Runs of adjacent data blocks of every file, and which of them belong to each inode */
+static extent_t extents[MAX_NUM_EXTENTS];
+static inode_extents_t inode_extents[MAX_NUM_EXTENT_INODES];
+static uint32_t num_extents;
+/* Statistics in the image's boot block, kept in step with fs_stat when files are created */
+static fs_stat_t* image_stat;
+/* Allocation bitmaps, one bit per data block and per inode, set when in use */
+static uint32_t block_bitmap[MAX_NUM_BITMAP_BLOCKS / BITS_PER_WORD];
+static uint32_t inode_bitmap[MAX_NUM_BITMAP_INODES / BITS_PER_WORD];
+static uint32_t num_free_blocks;
+/* Blocks each inode holds past the end of its data, allocated ahead by writes */
+static uint32_t reserved_blocks[MAX_NUM_BITMAP_INODES];
+/* Images whose inodes have indirect blocks, and the largest file they can hold */
+static uint32_t fs_indirect;
+static uint32_t max_file_length;
+/* Whether read_data copies whole extents, or goes block by block */
+static uint32_t extent_map_enabled = 1;
+/* Compressed images: where each data block's compressed bytes start, and the bytes themselves */
+static uint32_t fs_compressed;
+static uint32_t* block_offsets;
+static uint8_t* compressed_data;
+static uint32_t compressed_size;
+/* Images mounted from a disk: the device, the block its data blocks start at, and the boot
+   block and inodes, which are read in at mount and kept */
+static block_dev_t* fs_dev;
+static uint32_t first_disk_data_block;
+static uint8_t disk_boot_block[BLOCK_SIZE];
+static inode_t disk_inodes[MAX_DISK_INODES];
+/* Blocks of a compressed image or of an image on a disk, which are not in memory.
+   The least recently used is replaced first */
+static cached_block_t block_cache[BLOCK_CACHE_SIZE];
+static uint32_t block_cache_clock;
+static block_cache_stats_t block_cache_stats;
+
+static uint32_t get_file_block(uint32_t inode, uint32_t block_num, indirect_cache_t* cache);
+static void mount_large_dir(void);
+static dentry_t* get_dentry(uint32_t index);
+static void build_dentry_index(void);
+static void insert_dentry_index(uint32_t dentry_idx);
+static int32_t find_large_dir_index(const uint8_t* fname, uint32_t hash, uint32_t length);
+static int32_t find_dentry_index(const uint8_t* fname);
+static void build_name_order(void);
+static void insert_name_order(uint32_t dentry_idx);
+static void build_extent_map(void);
+static const extent_t* find_extent(const inode_extents_t* map, uint32_t file_block);
+static void update_extent_map(uint32_t inode, uint32_t old_num_blocks);
+static void build_allocation_bitmaps(void);
+static void mount_file_system(void);
+static const uint8_t* get_data_block(uint32_t block_index);
+static int32_t read_data_cached(uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length,
+                                indirect_cache_t* cache);
+static int32_t visit_data(uint32_t inode, uint32_t offset, uint32_t length, indirect_cache_t* cache,
+                          int32_t (*visit)(const uint8_t* src, uint32_t length, void* arg), void* arg);
 
 /* init_file_system()
    Parse the file system using the starting address of the physical memory in file system
@@ -22,15 +93,1123 @@ data_block_t* data_blocks;
    Output : None
    Side Effects : Set up global variables fs_stat, dentries, inodes, data_blocks
                   by parsing the file system according to its protocol
+                  Use the directory's own blocks and hash index when the image has
+                  a large directory, or build the name index used by read_dentry_by_name
+                  Build the sorted names used by find_names
+                  Build the extent map used by read_data
+                  Build the free block and free inode bitmaps used by writes
+                  A compressed image is detected from its features and read through
+                  the block cache, and inodes with indirect blocks from the features too
+ */
+void init_file_system(uint32_t start_addr, uint32_t end_addr) {
+    fs_stat = *FS_STAT_ADDR(start_addr);
+    image_stat = FS_STAT_ADDR(start_addr);
+    dentries = DENTRIES_ADDR(start_addr);
+    inodes = INODES_ADDR(start_addr);
+    data_blocks = DATA_BLOCKS_ADDR(start_addr, fs_stat.num_inodes);
+    fs_dev = NULL;
+    fs_compressed = fs_stat.features & FS_FEATURE_COMPRESSED;
+    if (fs_compressed) {
+        block_offsets = BLOCK_OFFSETS_ADDR(start_addr, fs_stat.num_inodes);
+        compressed_data = COMPRESSED_DATA_ADDR(start_addr, fs_stat.num_inodes, fs_stat.num_data_blocks);
+        compressed_size = (end_addr > (uint32_t) compressed_data)? end_addr - (uint32_t) compressed_data : 0;
+        data_blocks = NULL;
+    }
+    mount_file_system();
+    
+    /* Enable file system image in the page directory & page table */
+    enable_global_pages(start_addr, end_addr);
+}
+
+/* init_disk_file_system()
+   Mount the file system image written at the start of a disk. Only the boot block
+   and the inodes are read in; data blocks are read through the block cache when
+   they are used, so the image does not have to fit in memory. The image is read only
+   Input : dev -- the disk
+   Output : 0 on success
+            -1 if dev is NULL, the disk cannot be read, the image is compressed, has no
+            inodes or more than MAX_DISK_INODES, or does not fit on the disk
+   Side Effects : Set up global variables fs_stat, dentries, inodes, as init_file_system
+                  does, and empties the block cache
+ */
+int32_t init_disk_file_system(block_dev_t* dev) {
+    fs_stat_t* stat = (fs_stat_t *) disk_boot_block;
+    if (dev == NULL || read_blocks(dev, 0, 1, disk_boot_block) != 0 ||
+        (stat->features & FS_FEATURE_COMPRESSED) || stat->num_inodes == 0 || stat->num_inodes > MAX_DISK_INODES ||
+        1 + stat->num_inodes > get_num_blocks(dev) ||
+        stat->num_data_blocks > get_num_blocks(dev) - 1 - stat->num_inodes ||
+        read_blocks(dev, 1, stat->num_inodes, (uint8_t *) disk_inodes) != 0) {
+        return -1;
+    }
+    fs_stat = *stat;
+    image_stat = stat;
+    dentries = DENTRIES_ADDR((uint32_t) disk_boot_block);
+    inodes = disk_inodes;
+    data_blocks = NULL;
+    fs_compressed = 0;
+    fs_dev = dev;
+    first_disk_data_block = 1 + fs_stat.num_inodes;
+    mount_file_system();
+    return 0;
+}
+
+/* is_disk_file_system()
+   Whether the mounted image is on a disk, so its data blocks are read by
+   polling the disk when they miss in the block cache
+   Output : 1 for a disk mount, 0 for an image in memory
+ */
+int32_t is_disk_file_system(void) {
+    return fs_dev != NULL;
+}
+
+/* mount_file_system()
+   Build what the driver keeps about an image whose statistics, entries and inodes
+   are set up
+   Input : None
+   Output : None
+   Side Effects : Reads the image's features, empties the block cache, and builds the
+                  name index, sorted names, extent map and allocation bitmaps
+ */
+static void mount_file_system(void) {
+    reset_block_cache();
+    fs_indirect = fs_stat.features & FS_FEATURE_INDIRECT;
+    max_file_length = fs_indirect? MAX_INDIRECT_FILE_LENGTH : MAX_NUM_BLOCKS_IN_INODE * BLOCK_SIZE;
+    mount_large_dir();
+    build_dentry_index();
+    build_name_order();
+    build_extent_map();
+    build_allocation_bitmaps();
+}
+
+/* hash_file_name()
+   Compute the FNV-1a hash of a file name. Hashing stops at the terminating NUL
+   or after max_length characters, whichever comes first
+   Input : fname -- file name to be hashed
+           max_length -- maximum number of characters to hash
+           length -- filled in with the number of characters hashed
+   Output : 32-bit hash of the name
+   Side Effects : None
+ */
+uint32_t hash_file_name(const uint8_t* fname, uint32_t max_length, uint32_t* length) {
+    uint32_t hash = FNV_OFFSET_BASIS;
+    uint32_t i;
+    for (i = 0; i < max_length && fname[i] != NULL; i++) {
+        hash = (hash ^ fname[i]) * FNV_PRIME;
+    }
+    *length = i;
+    return hash;
+}
+
+/* mount_large_dir()
+   Find the blocks of the directory of an image with FS_FEATURE_LARGE_DIR, and check
+   that its header fits in them. An image without the feature, one whose blocks are not
+   in memory, or one whose directory does not check out is read from the boot block's entries
+   Input : None
+   Output : None
+   Side Effects : Sets dir_header and dir_blocks, and fs_stat's number of entries
+ */
+static void mount_large_dir(void) {
+    uint32_t num_blocks, i;
+    dir_header = NULL;
+    if (!(fs_stat.features & FS_FEATURE_LARGE_DIR) || data_blocks == NULL || fs_stat.dir_inode >= fs_stat.num_inodes) {
+        return;
+    }
+
+    inode_t* dir_inode = &inodes[fs_stat.dir_inode];
+    num_blocks = (dir_inode->length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    if (num_blocks == 0 || num_blocks > MAX_NUM_BLOCKS_IN_INODE) {
+        return;
+    }
+    for (i = 0; i < num_blocks; i++) {
+        uint32_t block_index = get_file_block(fs_stat.dir_inode, i, NULL);
+        if (block_index >= fs_stat.num_data_blocks) {
+            return;
+        }
+        dir_blocks[i] = (uint8_t *) &data_blocks[block_index];
+    }
+
+    dir_header_t* header = (dir_header_t *) dir_blocks[0];
+    uint32_t hash_blocks = header->num_hash_slots / DIR_HASH_SLOTS_PER_BLOCK;
+    uint32_t entry_blocks = (header->max_entries + DENTRIES_PER_BLOCK - 1) / DENTRIES_PER_BLOCK;
+    if (header->num_entries > header->max_entries || header->max_entries > header->num_hash_slots / 2 ||
+        (header->num_hash_slots & (header->num_hash_slots - 1)) != 0 ||
+        header->num_hash_slots % DIR_HASH_SLOTS_PER_BLOCK != 0 || header->hash_block == 0 ||
+        header->hash_block > num_blocks || hash_blocks > num_blocks - header->hash_block ||
+        header->entry_block < header->hash_block + hash_blocks ||
+        header->entry_block > num_blocks || entry_blocks > num_blocks - header->entry_block) {
+        return;
+    }
+    dir_header = header;
+    fs_stat.num_dir_entries = header->num_entries;
+}
+
+/* get_dentry()
+   Get a directory entry from the boot block, or from the blocks of a large directory
+   Input : index -- index of the entry, less than the directory's number of entries
+                    or its room for them
+   Output : pointer to the entry
+   Side Effects : None
+ */
+static dentry_t* get_dentry(uint32_t index) {
+    if (dir_header == NULL) {
+        return &dentries[index];
+    }
+    return (dentry_t *) dir_blocks[dir_header->entry_block + index / DENTRIES_PER_BLOCK] +
+           index % DENTRIES_PER_BLOCK;
+}
+
+/* get_hash_slot()
+   Get a slot of a large directory's hash index
+   Input : slot -- index of the slot, less than the number of slots
+   Output : pointer to the slot
+   Side Effects : None
+ */
+static dir_hash_slot_t* get_hash_slot(uint32_t slot) {
+    return (dir_hash_slot_t *) dir_blocks[dir_header->hash_block + slot / DIR_HASH_SLOTS_PER_BLOCK] +
+           slot % DIR_HASH_SLOTS_PER_BLOCK;
+}
+
+/* build_dentry_index()
+   Insert every directory entry's name into the name index.
+   Called once at mount time, so lookups never have to scan the dentries array.
+   A large directory brings its own index, so there is nothing to build
+   Input : None
+   Output : None
+   Side Effects : Overwrites dentry_index
+ */
+static void build_dentry_index(void) {
+    uint32_t i;
+    uint32_t num_entries = min(fs_stat.num_dir_entries, MAX_NUM_DENTRIES);
+
+    for (i = 0; i < DENTRY_HASH_SIZE; i++) {
+        dentry_index[i].dentry_idx = DENTRY_HASH_EMPTY;
+    }
+    if (dir_header != NULL) {
+        return;
+    }
+    for (i = 0; i < num_entries; i++) {
+        insert_dentry_index(i);
+    }
+}
+
+/* insert_dentry_index()
+   Insert one directory entry's name into the name index, or into the hash index
+   of a large directory
+   Input : dentry_idx -- index of the entry in the directory
+   Output : None
+   Side Effects : Fills a free slot of dentry_index, or of the directory's hash index
+ */
+static void insert_dentry_index(uint32_t dentry_idx) {
+    uint32_t length;
+    uint32_t hash = hash_file_name(get_dentry(dentry_idx)->file_name, MAX_FILE_NAME_LENGTH, &length);
+    if (length == 0) {
+        /* Nameless entry can never be looked up */
+        return;
+    }
+    if (dir_header != NULL) {
+        /* Room for max_entries is checked at mount, and the index has twice as many slots */
+        uint32_t mask = dir_header->num_hash_slots - 1;
+        uint32_t large_slot = hash & mask;
+        while (get_hash_slot(large_slot)->dentry_idx != DIR_HASH_EMPTY) {
+            large_slot = (large_slot + 1) & mask;
+        }
+        get_hash_slot(large_slot)->hash = hash;
+        get_hash_slot(large_slot)->dentry_idx = dentry_idx;
+        return;
+    }
+    /* Table is at least twice as big as number of entries, so a free slot always exists.
+       Duplicated names keep the first entry in front of the probe chain */
+    uint32_t slot = hash & (DENTRY_HASH_SIZE - 1);
+    while (dentry_index[slot].dentry_idx != DENTRY_HASH_EMPTY) {
+        slot = (slot + 1) & (DENTRY_HASH_SIZE - 1);
+    }
+    dentry_index[slot].hash = hash;
+    dentry_index[slot].name_length = length;
+    dentry_index[slot].dentry_idx = dentry_idx;
+}
+
+/* find_large_dir_index()
+   Look up a large directory's hash index for an entry with the given name.
+   The index is read from the image, so probing stops after every slot was seen
+   Input : fname -- name of the file to be searched
+           hash, length -- hash and length of fname
+   Output : index of the matching entry in the directory
+            -1 if no entry matches
+   Side Effects : None
+ */
+static int32_t find_large_dir_index(const uint8_t* fname, uint32_t hash, uint32_t length) {
+    uint32_t mask = dir_header->num_hash_slots - 1;
+    uint32_t slot = hash & mask;
+    uint32_t n;
+    for (n = 0; n < dir_header->num_hash_slots; n++) {
+        dir_hash_slot_t* entry = get_hash_slot(slot);
+        if (entry->dentry_idx == DIR_HASH_EMPTY) {
+            break;
+        }
+        if (entry->hash == hash && entry->dentry_idx < fs_stat.num_dir_entries) {
+            const uint8_t* name = get_dentry(entry->dentry_idx)->file_name;
+            if (strncmp((int8_t*) fname, (int8_t*) name, length) == 0 &&
+                (length == MAX_FILE_NAME_LENGTH || name[length] == NULL)) {
+                return entry->dentry_idx;
+            }
+        }
+        slot = (slot + 1) & mask;
+    }
+    return -1;
+}
+
+/* find_dentry_index()
+   Look up the name index for a directory entry with the given name
+   Input : fname -- name of the file to be searched
+   Output : index of the matching entry in the directory
+            -1 if fname is too long or no entry matches
+   Side Effects : None
+ */
+static int32_t find_dentry_index(const uint8_t* fname) {
+    uint32_t length;
+    /* Hash one character more than the limit to detect names that are too long */
+    uint32_t hash = hash_file_name(fname, MAX_FILE_NAME_LENGTH + 1, &length);
+    if (length == 0 || length > MAX_FILE_NAME_LENGTH) {
+        return -1;
+    }
+    if (dir_header != NULL) {
+        return find_large_dir_index(fname, hash, length);
+    }
+
+    uint32_t slot = hash & (DENTRY_HASH_SIZE - 1);
+    while (dentry_index[slot].dentry_idx != DENTRY_HASH_EMPTY) {
+        dentry_hash_t* entry = &dentry_index[slot];
+        if (entry->hash == hash && entry->name_length == length &&
+            strncmp((int8_t*) fname, (int8_t*) dentries[entry->dentry_idx].file_name, length) == 0) {
+            return entry->dentry_idx;
+        }
+        slot = (slot + 1) & (DENTRY_HASH_SIZE - 1);
+    }
+    /* Not found */
+    return -1;
+}
+
+/* compare_names()
+   Order two directory entries by name, as strncmp orders the names
+   Input : a, b -- indexes of the entries in the directory
+   Output : less than, equal to or greater than 0 as a's name sorts before, with or after b's
+   Side Effects : None
+ */
+static int32_t compare_names(uint32_t a, uint32_t b) {
+    return strncmp((int8_t*) get_dentry(a)->file_name, (int8_t*) get_dentry(b)->file_name,
+                   MAX_FILE_NAME_LENGTH);
+}
+
+/* sift_down_name()
+   Move an entry of name_order down the heap of its first count entries until
+   neither child sorts after it
+   Input : root -- position of the entry
+           count -- number of entries in the heap
+   Output : None
+   Side Effects : Reorders name_order
+ */
+static void sift_down_name(uint32_t root, uint32_t count) {
+    uint32_t child, moved;
+    while ((child = 2 * root + 1) < count) {
+        if (child + 1 < count && compare_names(name_order[child], name_order[child + 1]) < 0) {
+            child++;
+        }
+        if (compare_names(name_order[root], name_order[child]) >= 0) {
+            return;
+        }
+        moved = name_order[root];
+        name_order[root] = name_order[child];
+        name_order[child] = moved;
+        root = child;
+    }
+}
+
+/* build_name_order()
+   Sort the named directory entries by name, with a heap sort so no more memory
+   is needed. Called once at mount time, so find_names can search the names
+   Input : None
+   Output : None
+   Side Effects : Overwrites name_order. It is not used if there are too many names
+ */
+static void build_name_order(void) {
+    uint32_t i, moved;
+
+    num_sorted_names = 0;
+    name_order_valid = 1;
+    for (i = 0; i < fs_stat.num_dir_entries; i++) {
+        if (get_dentry(i)->file_name[0] == NULL) {
+            continue;
+        }
+        if (num_sorted_names == MAX_NUM_SORTED_NAMES) {
+            name_order_valid = 0;
+            return;
+        }
+        name_order[num_sorted_names++] = i;
+    }
+    for (i = num_sorted_names / 2; i > 0; i--) {
+        sift_down_name(i - 1, num_sorted_names);
+    }
+    for (i = num_sorted_names; i > 1; i--) {
+        moved = name_order[0];
+        name_order[0] = name_order[i - 1];
+        name_order[i - 1] = moved;
+        sift_down_name(0, i - 1);
+    }
+}
+
+/* find_first_name()
+   Binary search the sorted names for the first one that does not sort before prefix
+   Input : prefix -- characters the names are compared with
+           length -- number of characters of prefix, at most MAX_FILE_NAME_LENGTH
+   Output : position in name_order, num_sorted_names if every name sorts before prefix
+   Side Effects : None
+ */
+static uint32_t find_first_name(const uint8_t* prefix, uint32_t length) {
+    uint32_t low = 0;
+    uint32_t high = num_sorted_names;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (strncmp((int8_t*) get_dentry(name_order[mid])->file_name, (int8_t*) prefix, length) < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+/* insert_name_order()
+   Insert a new directory entry's name where it sorts among the sorted names
+   Input : dentry_idx -- index of the entry in the directory
+   Output : None
+   Side Effects : Shifts the names that sort after it. Stops using the sorted names
+                  when they are full
+ */
+static void insert_name_order(uint32_t dentry_idx) {
+    dentry_t* dentry = get_dentry(dentry_idx);
+    if (!name_order_valid || dentry->file_name[0] == NULL) {
+        return;
+    }
+    if (num_sorted_names == MAX_NUM_SORTED_NAMES) {
+        name_order_valid = 0;
+        return;
+    }
+    uint32_t position = find_first_name(dentry->file_name, MAX_FILE_NAME_LENGTH);
+    memmove(&name_order[position + 1], &name_order[position],
+            (num_sorted_names - position) * sizeof(name_order[0]));
+    name_order[position] = dentry_idx;
+    num_sorted_names++;
+}
+
+/* match_glob()
+   Match a file name against a pattern where GLOB_ANY stands for any run of characters
+   and GLOB_ONE for any one character. After a mismatch only the last GLOB_ANY seen has
+   to take more characters, so the match is never exponential
+   Input : pattern -- NUL terminated pattern
+           name -- file name, NUL terminated or MAX_FILE_NAME_LENGTH characters long
+   Output : 1 if the whole name matches, 0 otherwise
+   Side Effects : None
+ */
+static int32_t match_glob(const uint8_t* pattern, const uint8_t* name) {
+    const uint8_t* star = NULL;
+    uint32_t star_name = 0;
+    uint32_t i = 0;
+
+    while (i < MAX_FILE_NAME_LENGTH && name[i] != NULL) {
+        if (*pattern == GLOB_ANY) {
+            star = ++pattern;
+            star_name = i;
+        } else if (*pattern != NULL && (*pattern == GLOB_ONE || *pattern == name[i])) {
+            pattern++;
+            i++;
+        } else if (star != NULL) {
+            pattern = star;
+            i = ++star_name;
+        } else {
+            return 0;
+        }
+    }
+    while (*pattern == GLOB_ANY) {
+        pattern++;
+    }
+    return *pattern == NULL;
+}
+
+/* find_names()
+   Find the directory entries whose names match a pattern, in name order. The
+   characters before the pattern's first wildcard are searched for in the sorted names,
+   so only names starting with them are matched: a pattern ending in its only GLOB_ANY,
+   a prefix search, costs O(log n + matches). A directory with too many names for the
+   sorted names is scanned instead, and its matches come in directory order
+   Input : pattern -- NUL terminated pattern, see match_glob
+           buf -- array filled with the names, each followed by a NUL
+           length -- size of buf in bytes
+           first -- number of matches to skip, so a full buf can be continued
+   Output : number of names put in buf, which stops at the first one that does not fit
+            -1 if pattern or buf is NULL, or pattern is empty or longer than MAX_GLOB_LENGTH
+   Side Effects : None
+ */
+int32_t find_names(const uint8_t* pattern, uint8_t* buf, uint32_t length, uint32_t first) {
+    uint32_t prefix_length, pattern_length, name_length, position, end, i;
+    uint32_t used = 0;
+    int32_t num_names = 0;
+
+    if (pattern == NULL || buf == NULL) {
+        return -1;
+    }
+    for (pattern_length = 0; pattern_length <= MAX_GLOB_LENGTH && pattern[pattern_length] != NULL; pattern_length++) {
+    }
+    if (pattern_length == 0 || pattern_length > MAX_GLOB_LENGTH) {
+        return -1;
+    }
+    for (prefix_length = 0; prefix_length < pattern_length && pattern[prefix_length] != GLOB_ANY &&
+         pattern[prefix_length] != GLOB_ONE; prefix_length++) {
+    }
+    if (prefix_length > MAX_FILE_NAME_LENGTH) {
+        return 0;
+    }
+
+    if (name_order_valid) {
+        position = find_first_name(pattern, prefix_length);
+        end = num_sorted_names;
+    } else {
+        position = 0;
+        end = fs_stat.num_dir_entries;
+    }
+    for (; position < end; position++) {
+        dentry_t* dentry = get_dentry(name_order_valid? name_order[position] : position);
+        if (strncmp((int8_t*) dentry->file_name, (int8_t*) pattern, prefix_length) != 0) {
+            if (name_order_valid) {
+                /* Past the names that start with the prefix */
+                break;
+            }
+            continue;
+        }
+        if (dentry->file_name[0] == NULL || !match_glob(pattern, dentry->file_name)) {
+            continue;
+        }
+        if (first > 0) {
+            first--;
+            continue;
+        }
+        for (name_length = 0; name_length < MAX_FILE_NAME_LENGTH && dentry->file_name[name_length] != NULL;
+             name_length++) {
+        }
+        if (name_length + 1 > length - used) {
+            break;
+        }
+        for (i = 0; i < name_length; i++) {
+            buf[used++] = dentry->file_name[i];
+        }
+        buf[used++] = NULL;
+        num_names++;
+    }
+    return num_names;
+}
+
+/* get_indirect_block()
+   Get the indexes held by an indirect block
+   Input : block_index -- index of the indirect block
+   Output : pointer to its INDICES_PER_BLOCK indexes
+            NULL if the index is out of range, or the image's blocks are not in memory
+            and cannot be pointed at
+   Side Effects : None
+ */
+static uint32_t* get_indirect_block(uint32_t block_index) {
+    if (data_blocks == NULL || block_index >= fs_stat.num_data_blocks) {
+        return NULL;
+    }
+    return (uint32_t *) &data_blocks[block_index];
+}
+
+/* read_block_entry()
+   Read one index of an indirect block that is not in memory, through the block cache
+   Input : block_index -- index of the indirect block
+           entry -- which of its INDICES_PER_BLOCK indexes to read
+   Output : the index, INVALID_BLOCK if the indirect block is out of range or cannot be read
+   Side Effects : May replace a block of the block cache
+ */
+static uint32_t read_block_entry(uint32_t block_index, uint32_t entry) {
+    uint32_t value = INVALID_BLOCK;
+    if (block_index >= fs_stat.num_data_blocks) {
+        return INVALID_BLOCK;
+    }
+    uint32_t flags = save_flags_and_cli();
+    const uint32_t* indices = (const uint32_t *) get_data_block(block_index);
+    if (indices != NULL) {
+        value = indices[entry];
+    }
+    restore_saved_flags(flags);
+    return value;
+}
+
+/* get_file_block()
+   Find the data block holding a block of a file, through the inode's indirect blocks
+   if the image has them. The single indirect block the lookup went through is kept in
+   cache, and a later lookup it covers reads it without going through the inode again.
+   Indirect blocks that are not in memory are read through the block cache on every
+   lookup instead, as the cache may replace them
+   Input : inode -- index of inode of the file
+           block_num -- index of the block inside the file
+           cache -- indirect block read last, or NULL
+   Output : index of the data block, which the caller range checks
+            INVALID_BLOCK if block_num is past what the inode can map or an
+            indirect block is out of range
+   Side Effects : May update cache
+ */
+static uint32_t get_file_block(uint32_t inode, uint32_t block_num, indirect_cache_t* cache) {
+    inode_t* my_inode = &inodes[inode];
+    uint32_t* indices;
+    uint32_t first_block;
+
+    if (!fs_indirect) {
+        return (block_num < MAX_NUM_BLOCKS_IN_INODE)? my_inode->block_idx[block_num] : INVALID_BLOCK;
+    }
+    if (block_num < NUM_DIRECT_BLOCKS) {
+        return my_inode->block_idx[block_num];
+    }
+    if (cache != NULL && cache->indices != NULL && cache->inode == inode &&
+        block_num >= cache->first_block && block_num - cache->first_block < INDICES_PER_BLOCK) {
+        return cache->indices[block_num - cache->first_block];
+    }
+
+    uint32_t rel_block = block_num - NUM_DIRECT_BLOCKS;
+    if (data_blocks == NULL) {
+        if (rel_block < INDICES_PER_BLOCK) {
+            return read_block_entry(my_inode->block_idx[SINGLE_INDIRECT_SLOT], rel_block);
+        }
+        rel_block -= INDICES_PER_BLOCK;
+        if (rel_block / INDICES_PER_BLOCK >= INDICES_PER_BLOCK) {
+            return INVALID_BLOCK;
+        }
+        return read_block_entry(read_block_entry(my_inode->block_idx[DOUBLE_INDIRECT_SLOT],
+                                                 rel_block / INDICES_PER_BLOCK), rel_block % INDICES_PER_BLOCK);
+    }
+    if (rel_block < INDICES_PER_BLOCK) {
+        indices = get_indirect_block(my_inode->block_idx[SINGLE_INDIRECT_SLOT]);
+        first_block = NUM_DIRECT_BLOCKS;
+    } else {
+        rel_block -= INDICES_PER_BLOCK;
+        uint32_t* root = get_indirect_block(my_inode->block_idx[DOUBLE_INDIRECT_SLOT]);
+        if (root == NULL || rel_block / INDICES_PER_BLOCK >= INDICES_PER_BLOCK) {
+            return INVALID_BLOCK;
+        }
+        indices = get_indirect_block(root[rel_block / INDICES_PER_BLOCK]);
+        first_block = block_num - rel_block % INDICES_PER_BLOCK;
+    }
+    if (indices == NULL) {
+        return INVALID_BLOCK;
+    }
+    if (cache != NULL) {
+        cache->inode = inode;
+        cache->first_block = first_block;
+        cache->indices = indices;
+    }
+    return indices[block_num - first_block];
+}
+
+/* visit_indirect_blocks()
+   Call visit on every indirect block a file of to_blocks blocks goes through, but a
+   file of from_blocks blocks does not. An indirect block is in use from the first
+   block of the file it maps
+   Input : inode -- index of inode of the file
+           from_blocks, to_blocks -- numbers of blocks of the file, from_blocks the smaller
+           visit -- called with the index of each indirect block, which it range checks
+   Output : None
+   Side Effects : Those of visit
+ */
+static void visit_indirect_blocks(uint32_t inode, uint32_t from_blocks, uint32_t to_blocks,
+                                  void (*visit)(uint32_t block_index)) {
+    inode_t* my_inode = &inodes[inode];
+    uint32_t first_block = NUM_DIRECT_BLOCKS + INDICES_PER_BLOCK;
+    uint32_t* root;
+    uint32_t i;
+
+    if (!fs_indirect) {
+        return;
+    }
+    if (from_blocks <= NUM_DIRECT_BLOCKS && to_blocks > NUM_DIRECT_BLOCKS) {
+        visit(my_inode->block_idx[SINGLE_INDIRECT_SLOT]);
+    }
+    if (to_blocks <= first_block || (root = get_indirect_block(my_inode->block_idx[DOUBLE_INDIRECT_SLOT])) == NULL) {
+        return;
+    }
+    for (i = 0; i < INDICES_PER_BLOCK && first_block + i * INDICES_PER_BLOCK < to_blocks; i++) {
+        if (from_blocks <= first_block + i * INDICES_PER_BLOCK) {
+            visit(root[i]);
+        }
+    }
+    if (from_blocks <= first_block) {
+        visit(my_inode->block_idx[DOUBLE_INDIRECT_SLOT]);
+    }
+}
+
+/* use_extent_map()
+   Turn copying whole extents off and on, so reading block by block can be measured
+   against it. Extents are still kept up to date while they are not used
+   Input : enabled -- nonzero to copy whole extents, the default
+   Output : None
+   Side Effects : Changes how read_data finds data blocks
+ */
+void use_extent_map(uint32_t enabled) {
+    extent_map_enabled = enabled;
+}
+
+/* build_extent_map()
+   Split the blocks of every file into runs of adjacent data blocks.
+   A file with a block index out of range gets no extents, so read_data still
+   walks it block by block and fails where it always did
+   Input : None
+   Output : None
+   Side Effects : Overwrites extents and inode_extents
+ */
+static void build_extent_map(void) {
+    indirect_cache_t cache;
+    uint32_t i, block_num;
+
+    num_extents = 0;
+    for (i = 0; i < MAX_NUM_EXTENT_INODES; i++) {
+        inode_extents_t* map = &inode_extents[i];
+        map->first_extent = num_extents;
+        map->num_extents = 0;
+        if (i >= fs_stat.num_inodes || data_blocks == NULL) {
+            /* Blocks of a compressed image or an image on a disk are not adjacent in memory */
+            continue;
+        }
+
+        uint32_t num_blocks = (inodes[i].length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        extent_t* extent = NULL;
+        cache.indices = NULL;
+        for (block_num = 0; block_num < num_blocks; block_num++) {
+            uint32_t block_index = get_file_block(i, block_num, &cache);
+            if (block_index >= fs_stat.num_data_blocks) {
+                break;
+            }
+            if (extent != NULL && extent->data_block + extent->num_blocks == block_index) {
+                extent->num_blocks++;
+                continue;
+            }
+            if (num_extents == MAX_NUM_EXTENTS) {
+                break;
+            }
+            extent = &extents[num_extents++];
+            extent->file_block = block_num;
+            extent->data_block = block_index;
+            extent->num_blocks = 1;
+        }
+
+        if (block_num < num_blocks) {
+            /* Give back the extents of a file that cannot be mapped completely */
+            num_extents = map->first_extent;
+        } else {
+            map->num_extents = num_extents - map->first_extent;
+        }
+    }
+}
+
+/* find_extent()
+   Binary search a file's extents for the one holding the given block of the file
+   Input : map -- extents of the file, at least one
+           file_block -- index of the block inside the file, covered by the file's extents
+   Output : pointer to the extent
+   Side Effects : None
+ */
+static const extent_t* find_extent(const inode_extents_t* map, uint32_t file_block) {
+    uint32_t low = map->first_extent;
+    uint32_t high = map->first_extent + map->num_extents - 1;
+    while (low < high) {
+        uint32_t mid = (low + high + 1) / 2;
+        if (extents[mid].file_block <= file_block) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return &extents[low];
+}
+
+/* update_extent_map()
+   Add the blocks a write appended to a file to its extents. The file's extents are
+   moved to the end of the pool when other files' extents follow them, and the whole
+   map is rebuilt when the pool runs out
+   Input : inode -- index of inode of the file, whose length was already updated
+           old_num_blocks -- number of blocks of the file before the write
+   Output : None
+   Side Effects : Updates extents and inode_extents
+ */
+static void update_extent_map(uint32_t inode, uint32_t old_num_blocks) {
+    uint32_t new_num_blocks = (inodes[inode].length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    uint32_t block_num;
+    indirect_cache_t cache;
+
+    if (inode >= MAX_NUM_EXTENT_INODES) {
+        return;
+    }
+    inode_extents_t* map = &inode_extents[inode];
+    if (map->num_extents == 0 && old_num_blocks > 0) {
+        /* File is read block by block */
+        return;
+    }
+    cache.indices = NULL;
+    for (block_num = old_num_blocks; block_num < new_num_blocks; block_num++) {
+        uint32_t block_index = get_file_block(inode, block_num, &cache);
+        extent_t* extent = (map->num_extents > 0)? &extents[map->first_extent + map->num_extents - 1] : NULL;
+        if (extent != NULL && extent->data_block + extent->num_blocks == block_index) {
+            extent->num_blocks++;
+            continue;
+        }
+        if (map->first_extent + map->num_extents != num_extents) {
+            if (num_extents + map->num_extents >= MAX_NUM_EXTENTS) {
+                build_extent_map();
+                return;
+            }
+            memcpy(&extents[num_extents], &extents[map->first_extent], map->num_extents * sizeof(extent_t));
+            map->first_extent = num_extents;
+            num_extents += map->num_extents;
+        } else if (num_extents == MAX_NUM_EXTENTS) {
+            build_extent_map();
+            return;
+        }
+        extent = &extents[num_extents++];
+        extent->file_block = block_num;
+        extent->data_block = block_index;
+        extent->num_blocks = 1;
+        map->num_extents++;
+    }
+}
+
+/* test_bit()
+   Check whether a bit of an allocation bitmap is set
+ */
+static uint32_t test_bit(const uint32_t* bitmap, uint32_t index) {
+    return bitmap[index / BITS_PER_WORD] & (1 << (index % BITS_PER_WORD));
+}
+
+/* set_bit()
+   Set a bit of an allocation bitmap
+ */
+static void set_bit(uint32_t* bitmap, uint32_t index) {
+    bitmap[index / BITS_PER_WORD] |= (1 << (index % BITS_PER_WORD));
+}
+
+/* clear_bit()
+   Clear a bit of an allocation bitmap
+ */
+static void clear_bit(uint32_t* bitmap, uint32_t index) {
+    bitmap[index / BITS_PER_WORD] &= ~(1 << (index % BITS_PER_WORD));
+}
+
+/* mark_block()
+   Mark a data block as in use, if it is in range of the free block bitmap
+ */
+static void mark_block(uint32_t block_index) {
+    if (block_index < min(fs_stat.num_data_blocks, MAX_NUM_BITMAP_BLOCKS)) {
+        set_bit(block_bitmap, block_index);
+    }
+}
+
+/* build_allocation_bitmaps()
+   Mark every data block and indirect block held by a file, and every inode that has
+   data or is named by a directory entry, as in use
+   Input : None
+   Output : None
+   Side Effects : Overwrites block_bitmap, inode_bitmap, num_free_blocks and reserved_blocks
+ */
+static void build_allocation_bitmaps(void) {
+    uint32_t num_blocks = min(fs_stat.num_data_blocks, MAX_NUM_BITMAP_BLOCKS);
+    indirect_cache_t cache;
+    uint32_t i, block_num;
+
+    memset(block_bitmap, 0, sizeof(block_bitmap));
+    memset(inode_bitmap, 0, sizeof(inode_bitmap));
+    memset(reserved_blocks, 0, sizeof(reserved_blocks));
+
+    for (i = 0; i < fs_stat.num_inodes; i++) {
+        if (inodes[i].length == 0) {
+            continue;
+        }
+        if (i < MAX_NUM_BITMAP_INODES) {
+            set_bit(inode_bitmap, i);
+        }
+        uint32_t file_blocks = (inodes[i].length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        cache.indices = NULL;
+        for (block_num = 0; block_num < file_blocks; block_num++) {
+            mark_block(get_file_block(i, block_num, &cache));
+        }
+        visit_indirect_blocks(i, 0, file_blocks, mark_block);
+    }
+    for (i = 0; i < fs_stat.num_dir_entries && (dir_header != NULL || i < MAX_NUM_DENTRIES); i++) {
+        dentry_t* dentry = get_dentry(i);
+        if (dentry->file_type == FILE_TYPE_FILE && dentry->inode_idx < MAX_NUM_BITMAP_INODES) {
+            set_bit(inode_bitmap, dentry->inode_idx);
+        }
+    }
+
+    num_free_blocks = 0;
+    for (i = 0; i < num_blocks && data_blocks != NULL; i++) {
+        num_free_blocks += !test_bit(block_bitmap, i);
+    }
+}
+
+/* decompress_block()
+   Decompress a data block of a compressed image
+   Input : block_index -- index of the data block
+           buf -- array of BLOCK_SIZE bytes to be filled in
+   Output : 0 on success, -1 if the block's offsets or compressed bytes are corrupt
+   Side Effects : buf filled in with the block
+ */
+static int32_t decompress_block(uint32_t block_index, uint8_t* buf) {
+    uint32_t start = block_offsets[block_index];
+    uint32_t end = block_offsets[block_index + 1];
+    if (start > end || end > compressed_size) {
+        return -1;
+    }
+    if (end - start == BLOCK_SIZE) {
+        /* Stored as is */
+        memcpy(buf, compressed_data + start, BLOCK_SIZE);
+        return 0;
+    }
+    return (lz4_decompress(compressed_data + start, end - start, buf, BLOCK_SIZE) == BLOCK_SIZE)? 0 : -1;
+}
+
+/* get_data_block()
+   Get the bytes of a data block. On a compressed image or an image on a disk the block
+   comes from the block cache, and is decompressed or read from the disk into the least
+   recently used slot on a miss.
+   The caller keeps interrupts disabled until it is done with the bytes,
+   so another read cannot replace the block under it
+   Input : block_index -- index of the data block, less than num_data_blocks
+   Output : pointer to the BLOCK_SIZE bytes of the block
+            NULL if the block could not be decompressed or read
+   Side Effects : May replace a block of the block cache, updates its statistics
+ */
+static const uint8_t* get_data_block(uint32_t block_index) {
+    cached_block_t* slot = &block_cache[0];
+    uint32_t i;
+
+    if (data_blocks != NULL) {
+        return (uint8_t *) &data_blocks[block_index];
+    }
+    for (i = 0; i < BLOCK_CACHE_SIZE; i++) {
+        if (block_cache[i].block_index == (int32_t) block_index) {
+            block_cache_stats.hits++;
+            block_cache[i].last_used = ++block_cache_clock;
+            return block_cache[i].data;
+        }
+        if (block_cache[i].last_used < slot->last_used) {
+            slot = &block_cache[i];
+        }
+    }
+
+    uint32_t start = rdtsc();
+    block_cache_stats.misses++;
+    slot->block_index = BLOCK_CACHE_EMPTY;
+    slot->last_used = 0;
+    if (fs_compressed) {
+        if (decompress_block(block_index, slot->data) != 0) {
+            return NULL;
+        }
+        block_cache_stats.compressed_bytes += block_offsets[block_index + 1] - block_offsets[block_index];
+    } else if (read_blocks(fs_dev, first_disk_data_block + block_index, 1, slot->data) != 0) {
+        return NULL;
+    }
+    slot->block_index = block_index;
+    slot->last_used = ++block_cache_clock;
+    block_cache_stats.fill_cycles += rdtsc() - start;
+    return slot->data;
+}
+
+/* get_block_cache_stats()
+   Copy the block cache statistics
+   Input : stats -- filled in with hits, misses and decompression cost
+   Output : None
+   Side Effects : None
+ */
+void get_block_cache_stats(block_cache_stats_t* stats) {
+    *stats = block_cache_stats;
+}
+
+/* reset_block_cache()
+   Empty the block cache and zero its statistics, so the next reads start cold
+   Input : None
+   Output : None
+   Side Effects : Clears block_cache and block_cache_stats
+ */
+void reset_block_cache(void) {
+    uint32_t i;
+    for (i = 0; i < BLOCK_CACHE_SIZE; i++) {
+        block_cache[i].block_index = BLOCK_CACHE_EMPTY;
+        block_cache[i].last_used = 0;
+    }
+    block_cache_clock = 0;
+    memset(&block_cache_stats, 0, sizeof(block_cache_stats));
+}
+
+/* alloc_block()
+   Claim a free data block, looking from hint onwards first so a file's blocks
+   stay adjacent when they can
+   Input : hint -- index of the data block to try first
+   Output : index of the claimed data block, -1 if every block is in use
+   Side Effects : Updates block_bitmap and num_free_blocks
+ */
+static int32_t alloc_block(uint32_t hint) {
+    uint32_t num_blocks = min(fs_stat.num_data_blocks, MAX_NUM_BITMAP_BLOCKS);
+    uint32_t i, n;
+
+    if (num_free_blocks == 0) {
+        return -1;
+    }
+    i = (hint < num_blocks)? hint : 0;
+    for (n = 0; n < num_blocks; n++) {
+        if (!test_bit(block_bitmap, i)) {
+            set_bit(block_bitmap, i);
+            num_free_blocks--;
+            return i;
+        }
+        i = (i + 1 == num_blocks)? 0 : i + 1;
+    }
+    return -1;
+}
+
+/* free_block()
+   Give a data block back to the free block bitmap
+ */
+static void free_block(uint32_t block_index) {
+    if (block_index < MAX_NUM_BITMAP_BLOCKS && test_bit(block_bitmap, block_index)) {
+        clear_bit(block_bitmap, block_index);
+        num_free_blocks++;
+    }
+}
+
+/* alloc_inode()
+   Claim a free inode and make it an empty file
+   Output : index of the claimed inode, -1 if every inode is in use
+   Side Effects : Updates inode_bitmap
+ */
+static int32_t alloc_inode(void) {
+    uint32_t num_inodes = min(fs_stat.num_inodes, MAX_NUM_BITMAP_INODES);
+    uint32_t i;
+    for (i = 0; i < num_inodes; i++) {
+        if (!test_bit(inode_bitmap, i)) {
+            set_bit(inode_bitmap, i);
+            inodes[i].length = 0;
+            reserved_blocks[i] = 0;
+            if (i < MAX_NUM_EXTENT_INODES) {
+                inode_extents[i].num_extents = 0;
+            }
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* alloc_indirect_block()
+   Claim a free data block for an indirect block
+   Input : slot -- where the indirect block's index goes
+           hint -- index of the data block to try first
+   Output : 0 on success, -1 if every block is in use
+   Side Effects : slot set to the block's index, INVALID_BLOCK on failure
+ */
+static int32_t alloc_indirect_block(uint32_t* slot, uint32_t hint) {
+    int32_t block_index = alloc_block(hint);
+    *slot = (block_index == -1)? INVALID_BLOCK : block_index;
+    return (block_index == -1)? -1 : 0;
+}
+
+/* append_file_block()
+   Allocate the next block of a file, and the indirect blocks it goes through when it
+   is the first block they map. Indirect blocks take the hint first, so the data blocks
+   that follow stay adjacent
+   Input : inode -- index of inode of the file
+           block_num -- number of blocks the file holds, less than the most it can hold
+           hint -- index of the data block to try first
+   Output : index of the data block, -1 if the file system is full
+   Side Effects : Updates block_bitmap, and the inode or its indirect blocks
+ */
+static int32_t append_file_block(uint32_t inode, uint32_t block_num, uint32_t hint) {
+    inode_t* my_inode = &inodes[inode];
+    uint32_t* slot = NULL;
+    int32_t block_index = -1;
+
+    if (!fs_indirect || block_num < NUM_DIRECT_BLOCKS) {
+        slot = &my_inode->block_idx[block_num];
+    } else if (block_num - NUM_DIRECT_BLOCKS < INDICES_PER_BLOCK) {
+        if (block_num > NUM_DIRECT_BLOCKS ||
+            alloc_indirect_block(&my_inode->block_idx[SINGLE_INDIRECT_SLOT], hint) == 0) {
+            slot = get_indirect_block(my_inode->block_idx[SINGLE_INDIRECT_SLOT]);
+        }
+        slot = (slot != NULL)? slot + block_num - NUM_DIRECT_BLOCKS : NULL;
+    } else {
+        uint32_t rel_block = block_num - NUM_DIRECT_BLOCKS - INDICES_PER_BLOCK;
+        uint32_t* root = NULL;
+        if (rel_block > 0 || alloc_indirect_block(&my_inode->block_idx[DOUBLE_INDIRECT_SLOT], hint) == 0) {
+            root = get_indirect_block(my_inode->block_idx[DOUBLE_INDIRECT_SLOT]);
+        }
+        if (root != NULL && (rel_block % INDICES_PER_BLOCK > 0 ||
+                             alloc_indirect_block(&root[rel_block / INDICES_PER_BLOCK], hint) == 0)) {
+            slot = get_indirect_block(root[rel_block / INDICES_PER_BLOCK]);
+        }
+        slot = (slot != NULL)? slot + rel_block % INDICES_PER_BLOCK : NULL;
+    }
+
+    if (slot == NULL || (block_index = alloc_block(hint)) == -1) {
+        /* Give back the indirect blocks claimed for this block */
+        visit_indirect_blocks(inode, block_num, block_num + 1, free_block);
+        return -1;
+    }
+    *slot = block_index;
+    return block_index;
+}
+
+/* reserve_blocks()
+   Make sure a file holds at least num_blocks blocks. When it does not, a batch of
+   at least WRITE_BATCH_BLOCKS blocks is allocated, so appending many small records
+   goes to the allocator once per batch
+   Input : inode -- index of inode of the file
+           num_blocks -- number of blocks needed
+   Output : number of blocks the file holds, less than num_blocks if the file system is full
+   Side Effects : Allocates blocks and records them in the inode past the end of its data,
+                  along with the indirect blocks they need
+ */
+static uint32_t reserve_blocks(uint32_t inode, uint32_t num_blocks) {
+    inode_t* my_inode = &inodes[inode];
+    uint32_t file_blocks = (my_inode->length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    uint32_t held_blocks = file_blocks + reserved_blocks[inode];
+    int32_t block_index;
+
+    if (num_blocks <= held_blocks) {
+        return held_blocks;
+    }
+    uint32_t target = held_blocks + WRITE_BATCH_BLOCKS;
+    target = (num_blocks > target)? num_blocks : target;
+    target = (target > max_file_length / BLOCK_SIZE)? max_file_length / BLOCK_SIZE : target;
+
+    uint32_t hint = (held_blocks > 0)? get_file_block(inode, held_blocks - 1, NULL) + 1 : 0;
+    while (held_blocks < target && (block_index = append_file_block(inode, held_blocks, hint)) != -1) {
+        held_blocks++;
+        hint = block_index + 1;
+    }
+    reserved_blocks[inode] = held_blocks - file_blocks;
+    return held_blocks;
+}
+
+/* release_reserved_blocks()
+   Free the blocks a file holds past the end of its data, and the indirect blocks
+   only they needed
+   Input : inode -- index of inode of the file
+   Output : None
+   Side Effects : Updates block_bitmap and reserved_blocks
  */
-void init_file_system(uint32_t start_addr, uint32_t end_addr) {
-    fs_stat = *FS_STAT_ADDR(start_addr);
-    dentries = DENTRIES_ADDR(start_addr);
-    inodes = INODES_ADDR(start_addr);
-    data_blocks = DATA_BLOCKS_ADDR(start_addr, fs_stat.num_inodes);
-    
-    /* Enable file system image in the page directory & page table */
-    enable_global_pages(start_addr, end_addr);
+static void release_reserved_blocks(uint32_t inode) {
+    uint32_t file_blocks = (inodes[inode].length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    indirect_cache_t cache;
+    uint32_t i;
+    cache.indices = NULL;
+    for (i = 0; i < reserved_blocks[inode]; i++) {
+        free_block(get_file_block(inode, file_blocks + i, &cache));
+    }
+    visit_indirect_blocks(inode, file_blocks, file_blocks + reserved_blocks[inode], free_block);
+    reserved_blocks[inode] = 0;
 }
 
 /* read_dentry_by_name()
@@ -43,41 +1222,16 @@ void init_file_system(uint32_t start_addr, uint32_t end_addr) {
    Side Effects : Fills in the directory entry pointed by dentry
  */
 int32_t read_dentry_by_name(const uint8_t* fname, dentry_t* dentry) {
-    int i;
-
     if (fname == NULL || dentry == NULL) {
         /* Fail if either parameter is null pointer */
         return -1;
-    } else {
-        uint32_t fname_length = strlen((int8_t*) fname);
-        if (fname_length > MAX_FILE_NAME_LENGTH) {
-            /* Given file name is too long to even compare.
-               We do this to avoid reading into file_type value as well
-               in case fname is too long.
-             */
-            return -1;
-        } else {
-            for(i = 0; i < fs_stat.num_dir_entries; i++) {
-                /* Compare given fname with current dentry's file_name */
-                if (strncmp((int8_t*) fname, (int8_t*) dentries[i].file_name, fname_length) == 0) {
-                    /* At this point, j is already incremented */
-                    if (fname_length < MAX_FILE_NAME_LENGTH && dentries[i].file_name[fname_length] != 0) {
-                        /* It means dentry's file_name is longer than given file_name */
-                        continue;
-                    } else {
-                        /* If we reach here, matching file name found */
-                        memcpy(dentry, &(dentries[i]), DENTRY_SIZE);
-                        return 0;
-                    }
-                } else {
-                    continue;
-                    /* Otherwise continue searching for next dentry */
-                }
-            }    
-            /* Not found */
-            return -1;            
-        }
     }
+    int32_t index = find_dentry_index(fname);
+    if (index == -1) {
+        return -1;
+    }
+    memcpy(dentry, get_dentry(index), DENTRY_SIZE);
+    return 0;
 }
 
 /* read_dentry_by_name()
@@ -93,7 +1247,7 @@ int32_t read_dentry_by_index(uint32_t index, dentry_t* dentry) {
     if (index >= fs_stat.num_dir_entries || dentry == NULL) {
         return -1;
     } else {
-        memcpy(dentry, &(dentries[index]), DENTRY_SIZE);
+        memcpy(dentry, get_dentry(index), DENTRY_SIZE);
         return 0;
     }
 }
@@ -109,18 +1263,84 @@ int32_t read_dentry_by_index(uint32_t index, dentry_t* dentry) {
             -1 on failure(invalid buf pointer, inode index range, 
             and invalid block number accessed outside of range)
    Side Effects : buf array filled with copied data from the file
+                  Each run of adjacent data blocks is copied with a single memcpy
+                  Blocks of a compressed image are read through the block cache
  */
 int32_t read_data(uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length) {
-    if (buf == NULL || inode >= fs_stat.num_inodes) {
-        /* Null check on buf, and range check on inode index */
+    indirect_cache_t cache;
+    cache.indices = NULL;
+    return read_data_cached(inode, offset, buf, length, &cache);
+}
+
+/* copy_run()
+   Visitor of read_data_cached, copies a run of the file to the caller's buffer
+   Input : src -- bytes of the run
+           length -- number of bytes in the run
+           arg -- pointer to where the run goes, advanced past it
+   Output : length
+   Side Effects : Copies the run
+ */
+static int32_t copy_run(const uint8_t* src, uint32_t length, void* arg) {
+    uint8_t** dst = (uint8_t **) arg;
+    memcpy(*dst, src, length);
+    *dst += length;
+    return length;
+}
+
+/* read_data_cached()
+   read_data for a caller that keeps the indirect block read last between calls,
+   so reading a file block by block walks each indirect block once
+   Input : inode, offset, buf, length -- see read_data
+           cache -- indirect block read last, updated by the read
+   Output : See read_data
+   Side Effects : See read_data
+ */
+static int32_t read_data_cached(uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length,
+                                indirect_cache_t* cache) {
+    if (buf == NULL) {
+        return -1;
+    }
+    return visit_data(inode, offset, length, cache, copy_run, &buf);
+}
+
+/* visit_data()
+   Hand the bytes of a file from offset location, at most length of them, to visit
+   where they lie, one run at a time. A run ends where the data stops being contiguous:
+   at the end of an extent, or of a block read through the block cache, which stays
+   in place until visit returns
+   Input : inode -- index of inode of the file
+           offset -- the starting position inside the file
+           length -- the maximum number of bytes to visit
+           cache -- indirect block read last, updated by the walk
+           visit -- called with each run and arg, returns how many of the run's bytes
+                    it took, or -1. Interrupts are disabled while it looks at a cached block
+           arg -- passed to visit
+   Output : Number of bytes visit took, which stops at the first run it does not take
+            in full
+            -1 on failure(inode index range, invalid block number accessed outside of
+            range, or visit failed on the first run)
+   Side Effects : Those of visit
+ */
+static int32_t visit_data(uint32_t inode, uint32_t offset, uint32_t length, indirect_cache_t* cache,
+                          int32_t (*visit)(const uint8_t* src, uint32_t length, void* arg), void* arg) {
+    if (inode >= fs_stat.num_inodes) {
+        /* Range check on inode index */
         return -1;
     }
     /* Initialize number of bytes read to 0 */
     int32_t bytes_read = 0;
 
     inode_t* my_inode = &inodes[inode];
+    /* Extents of the file, NULL if it has to be read block by block */
+    const inode_extents_t* map = (extent_map_enabled && inode < MAX_NUM_EXTENT_INODES &&
+                                  inode_extents[inode].num_extents > 0)? &inode_extents[inode] : NULL;
+    /* Nothing to visit at or past the end of the file. Compared unsigned, so an offset
+       far past the end cannot wrap into a positive remaining count */
+    if (offset >= my_inode->length) {
+        return 0;
+    }
     /* Total number of bytes that can be read from the file */
-    int32_t my_inode_remaining_bytes = my_inode->length - offset;
+    uint32_t my_inode_remaining_bytes = my_inode->length - offset;
 
     /* Initialize current block's position in inode using offset */
     uint32_t cur_block_num = offset / BLOCK_SIZE;
@@ -131,34 +1351,57 @@ int32_t read_data(uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length
        remaining bytes in file is greater than 0, 
     */
     while (length > 0 && my_inode_remaining_bytes > 0) {
-        /* current index of block in file system */
-        int32_t cur_block_index = my_inode->block_idx[cur_block_num];
-        if (cur_block_index >= fs_stat.num_data_blocks) {
-            /* invalid block's index; Fail! */
-            return -1;
-        }
-        data_block_t* cur_block = &data_blocks[cur_block_index];
-        int32_t cur_block_remaining_bytes = BLOCK_SIZE - cur_block_offset;
-        
-        /* Calculate number of bytes to be copied */
-        int32_t num_bytes_to_copy;
-        if (length >= cur_block_remaining_bytes) {/* If data to be read is exceeding current block */
-            /* If remaining file's length is longer than current block's remaining bytes, read all
-               remaining current block's remaining bytes.
-               Otherwise, it means file is ending before the end of block. Read upto end of the file
-            */
-            num_bytes_to_copy = (my_inode_remaining_bytes >= cur_block_remaining_bytes)?
-                cur_block_remaining_bytes : my_inode_remaining_bytes;
-        } else {/* Otherwise number of bytes to be read does not exceed current block */
-            /* If remaining file's length is longer than remaining bytes to be read, then read all
-               remaining bytes to be read.
-               Otherwise, it means file is ending before reading all requested bytes. Read upto end of the file.
-            */
-            num_bytes_to_copy = (my_inode_remaining_bytes >= length)? length : my_inode_remaining_bytes;
-        }
-
-        /* Copy bytes */
-        memcpy((buf + bytes_read), ((uint8_t *)cur_block + cur_block_offset), num_bytes_to_copy);
+        /* Where the bytes start, and how many can be copied before the data stops being contiguous */
+        const uint8_t* src;
+        uint32_t run_remaining_bytes;
+        uint32_t flags = 0;
+        if (map != NULL) {
+            /* The extents cover every block of the file, and their blocks were range checked at mount */
+            const extent_t* extent = find_extent(map, cur_block_num);
+            src = (uint8_t *) &data_blocks[extent->data_block + (cur_block_num - extent->file_block)] +
+                  cur_block_offset;
+            run_remaining_bytes = (extent->file_block + extent->num_blocks - cur_block_num) * BLOCK_SIZE -
+                                  cur_block_offset;
+        } else {
+            /* current index of block in file system */
+            uint32_t cur_block_index = get_file_block(inode, cur_block_num, cache);
+            if (cur_block_index >= fs_stat.num_data_blocks) {
+                /* invalid block's index; Fail! */
+                return -1;
+            }
+            if (data_blocks == NULL) {
+                flags = save_flags_and_cli();
+            }
+            src = get_data_block(cur_block_index);
+            if (src == NULL) {
+                restore_saved_flags(flags);
+                return -1;
+            }
+            src += cur_block_offset;
+            run_remaining_bytes = BLOCK_SIZE - cur_block_offset;
+        }
+
+        /* Copy up to the end of the run, the end of the file or the number of bytes requested,
+           whichever comes first */
+        uint32_t num_bytes_to_copy = run_remaining_bytes;
+        if (num_bytes_to_copy > my_inode_remaining_bytes) {
+            num_bytes_to_copy = my_inode_remaining_bytes;
+        }
+        if (num_bytes_to_copy > length) {
+            num_bytes_to_copy = length;
+        }
+
+        /* Hand the bytes over */
+        int32_t num_bytes_taken = visit(src, num_bytes_to_copy, arg);
+        if (data_blocks == NULL) {
+            restore_saved_flags(flags);
+        }
+        if (num_bytes_taken < 0) {
+            return (bytes_read > 0)? bytes_read : -1;
+        }
+        if ((uint32_t) num_bytes_taken < num_bytes_to_copy) {
+            return bytes_read + num_bytes_taken;
+        }
         /* Decrement number of bytes left in file */
         my_inode_remaining_bytes -= num_bytes_to_copy;
         /* Decrement number of bytes to be read */
@@ -166,37 +1409,178 @@ int32_t read_data(uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length
         /* Increment number of bytes read so far*/
         bytes_read += num_bytes_to_copy;
 
-        /* After first block, blocks should be copied from their starting positions */
-        cur_block_offset = 0;
-        /* Traverse next block in inode */
-        cur_block_num++;
+        /* Move past the copied bytes to the next block in inode */
+        cur_block_num += (cur_block_offset + num_bytes_to_copy) / BLOCK_SIZE;
+        cur_block_offset = (cur_block_offset + num_bytes_to_copy) % BLOCK_SIZE;
     }
     return bytes_read;
 }
 
-/* open_file()
-   Open a file with the given file name
-   Input : fname -- file name string
-   Output : address of the inode that corresponds to the searched file
-            -1 if the file with the given name does not exists, or fname is NULL
+/* get_file_length()
+   Get the number of bytes in the file described by the given inode
+   Input : inode -- index of inode of the file
+   Output : length of the file in bytes
+            -1 if inode index is out of range
    Side Effects : None
  */
-int32_t open_file(const uint8_t* filename) {
-    dentry_t dentry;
-    if (filename == NULL || read_dentry_by_name(filename, &dentry) == -1) {
+int32_t get_file_length(uint32_t inode) {
+    if (inode >= fs_stat.num_inodes) {
+        return -1;
+    }
+    return inodes[inode].length;
+}
+
+/* get_block_addr()
+   Get the address of the data block holding the given block of a file.
+   The file system image is identity mapped, so this is also its physical address
+   Input : inode -- index of inode of the file
+           block_num -- index of the block inside the file
+   Output : address of the data block
+            NULL if inode index, block number or data block index is out of range,
+            or the image is compressed or on a disk
+   Side Effects : None
+ */
+uint32_t get_block_addr(uint32_t inode, uint32_t block_num) {
+    if (data_blocks == NULL || inode >= fs_stat.num_inodes ||
+        block_num >= (inodes[inode].length + BLOCK_SIZE - 1) / BLOCK_SIZE) {
+        return NULL;
+    }
+    uint32_t block_index = get_file_block(inode, block_num, NULL);
+    if (block_index >= fs_stat.num_data_blocks) {
+        return NULL;
+    }
+    return (uint32_t) &data_blocks[block_index];
+}
+
+/* write_data()
+   Given the inode index, write length bytes from buf into the file starting from offset
+   location. Writing past the end of the file grows it; the new length is known from
+   offset and length, so nothing is rescanned
+   Input : inode -- index of inode of the file to be written
+           offset -- the starting position inside the file, at most the file's length
+           buf -- array of the data to be written
+           length -- the number of bytes to be written
+   Output : Number of written bytes, less than length if the file system is full
+            or the file reached its largest size
+            -1 on failure(invalid buf pointer, compressed image or image on a disk, inode index range, inode that
+            is not a file in use, offset past the end of the file, or no block could be allocated)
+   Side Effects : Copies data into the file's blocks, may allocate blocks and update
+                  the inode's length and the extent map
+                  Drops the cached shared image of the file, if it is a program
+ */
+int32_t write_data(uint32_t inode, uint32_t offset, const uint8_t* buf, uint32_t length) {
+    if (buf == NULL || data_blocks == NULL || inode >= fs_stat.num_inodes || inode >= MAX_NUM_BITMAP_INODES ||
+        !test_bit(inode_bitmap, inode) || offset > inodes[inode].length) {
+        return -1;
+    }
+    inode_t* my_inode = &inodes[inode];
+    uint32_t max_length = max_file_length;
+    indirect_cache_t cache;
+    if (length == 0) {
+        return 0;
+    }
+    if (length > max_length - offset) {
+        length = max_length - offset;
+    }
+
+    uint32_t old_num_blocks = (my_inode->length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    uint32_t held_bytes = reserve_blocks(inode, (offset + length + BLOCK_SIZE - 1) / BLOCK_SIZE) * BLOCK_SIZE;
+    if (held_bytes <= offset) {
+        return -1;
+    }
+    if (length > held_bytes - offset) {
+        length = held_bytes - offset;
+    }
+
+    uint32_t bytes_written = 0;
+    cache.indices = NULL;
+    while (bytes_written < length) {
+        uint32_t cur_block_num = (offset + bytes_written) / BLOCK_SIZE;
+        uint32_t cur_block_offset = (offset + bytes_written) % BLOCK_SIZE;
+        uint32_t num_bytes_to_copy = min(BLOCK_SIZE - cur_block_offset, length - bytes_written);
+        memcpy((uint8_t *) &data_blocks[get_file_block(inode, cur_block_num, &cache)] + cur_block_offset,
+               buf + bytes_written, num_bytes_to_copy);
+        bytes_written += num_bytes_to_copy;
+    }
+
+    if (offset + length > my_inode->length) {
+        /* Blocks past the new end stay reserved for the next append */
+        uint32_t new_num_blocks = (offset + length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        reserved_blocks[inode] = held_bytes / BLOCK_SIZE - new_num_blocks;
+        my_inode->length = offset + length;
+        update_extent_map(inode, old_num_blocks);
+    }
+    invalidate_shared_image(inode);
+    return length;
+}
+
+/* create_file()
+   Create an empty regular file with the given name
+   Input : fname -- name of the file to be created
+           dentry -- pointer to the directory entry to be filled in
+   Output : 0 on success
+            -1 on fail(invalid fname or dentry, compressed image or image on a disk, name already in use
+            or too long, directory full, or no free inode)
+   Side Effects : Adds a directory entry, claims an inode, fills in dentry
+                  A large directory gets the entry in its blocks and hash index
+                  The name is added to the sorted names
+ */
+int32_t create_file(const uint8_t* fname, dentry_t* dentry) {
+    uint32_t length;
+    int32_t inode;
+
+    if (fname == NULL || dentry == NULL || data_blocks == NULL) {
+        return -1;
+    }
+    uint32_t max_entries = (dir_header != NULL)? dir_header->max_entries : MAX_NUM_DENTRIES;
+    hash_file_name(fname, MAX_FILE_NAME_LENGTH + 1, &length);
+    if (length == 0 || length > MAX_FILE_NAME_LENGTH || find_dentry_index(fname) != -1 ||
+        fs_stat.num_dir_entries >= max_entries || (inode = alloc_inode()) == -1) {
         return -1;
+    }
+
+    dentry_t* new_dentry = get_dentry(fs_stat.num_dir_entries);
+    memset(new_dentry, 0, DENTRY_SIZE);
+    memcpy(new_dentry->file_name, fname, length);
+    new_dentry->file_type = FILE_TYPE_FILE;
+    new_dentry->inode_idx = inode;
+    insert_dentry_index(fs_stat.num_dir_entries);
+    insert_name_order(fs_stat.num_dir_entries);
+
+    fs_stat.num_dir_entries++;
+    if (dir_header != NULL) {
+        dir_header->num_entries = fs_stat.num_dir_entries;
     } else {
-        /* Update inode_ptr in PCB */
-        pcb_t* pcb_ptr = get_pcb_ptr();
-        uint32_t fd_index = find_free_fd_index(pcb_ptr); 
-        if(fd_index == -1)  
-          fd_index = MAX_FILE_INDEX;   
-        else
-          fd_index -= 1;
-        (pcb_ptr->file_array)[fd_index].inode_ptr = &inodes[dentry.inode_idx];
+        image_stat->num_dir_entries = fs_stat.num_dir_entries;
+    }
+    memcpy(dentry, new_dentry, DENTRY_SIZE);
+    return 0;
+}
+
+/* get_num_free_blocks()
+   Get the number of data blocks no file holds
+ */
+int32_t get_num_free_blocks(void) {
+    return num_free_blocks;
+}
 
-        return (int32_t) &inodes[dentry.inode_idx];
+/* open_file()
+   Open a regular file whose directory entry was already resolved by the caller
+   Input : dentry -- directory entry of the file to be opened
+           file_desc -- file descriptor being set up for the file
+   Output : 0 on success
+            -1 if dentry is NULL or does not describe a regular file
+   Side Effects : Binds the file's inode to the file descriptor, with no indirect block cached
+ */
+int32_t open_file(const dentry_t* dentry, file_desc_t* file_desc) {
+    if (dentry == NULL || file_desc == NULL || dentry->file_type != FILE_TYPE_FILE ||
+        dentry->inode_idx >= fs_stat.num_inodes) {
+        return -1;
     }
+    file_desc->inode_ptr = &inodes[dentry->inode_idx];
+    file_desc->inode_idx = dentry->inode_idx;
+    file_desc->indirect_cache.indices = NULL;
+    return 0;
 }
 
 /* read_file()
@@ -207,24 +1591,17 @@ int32_t open_file(const uint8_t* filename) {
            buf -- array to be filled in with read data
            length -- the maximum number of bytes to be read
    Output : Number of read bytes,
-            -1 on failure(invalid buf pointer, NULL inode pointer,
+            -1 on failure(invalid buf pointer, inode pointer outside of inode array,
              and invalid block number accessed outside of range)
    Side Effects : buf array filled with copied data from the file
 */
 int32_t read_file(inode_t* inode_ptr, uint32_t offset, uint8_t* buf, uint32_t length) {
-    if (inode_ptr == NULL) {
-        return -1;
-    } else {
-        int i;
-        /* Iterate through inodes and find a inode that points to the same inode as the input inode */
-        for (i = 0; i < fs_stat.num_inodes; i++) {
-            if (&inodes[i] == inode_ptr) {
-                return read_data(i,  offset, buf, length);
-            }
-        }
-        /* If matching inode is not found, retrun null */
+    if (inode_ptr < inodes || inode_ptr >= inodes + fs_stat.num_inodes) {
+        /* NULL or not pointing into the inode array */
         return -1;
     }
+    /* Inodes are laid out as an array, so the index is the distance from its beginning */
+    return read_data(inode_ptr - inodes, offset, buf, length);
 }
 
 /* read_file_wrapper()
@@ -234,88 +1611,215 @@ int32_t read_file(inode_t* inode_ptr, uint32_t offset, uint8_t* buf, uint32_t le
            buf -- array to be filled in with read data
            length -- the maximum number of bytes to be read
    Output : Number of read bytes,
-            -1 on failure(invalid buf pointer, NULL inode pointer,
-             and invalid block number accessed outside of range)
+            -1 on failure(invalid buf pointer, and invalid block number accessed outside of range)
    Side Effects : buf array filled with copied data from the file
+                  file_position advanced by the number of read bytes
+                  The indirect block read last stays cached in the file descriptor
 */
 int32_t read_file_wrapper(int32_t fd, uint8_t* buf, uint32_t length){
   pcb_t* pcb = get_pcb_ptr();
-  inode_t* inode_ptr = (((pcb -> file_array)[fd]).inode_ptr);
-  uint32_t offset = (((pcb -> file_array)[fd]).file_position);
+  file_desc_t* file_desc = get_file_desc(pcb, fd);
 
-  int32_t bytes_read = read_file(inode_ptr, offset, buf, length);
-  ((pcb -> file_array)[fd]).file_position += bytes_read;
+  int32_t bytes_read = read_data_cached(file_desc->inode_idx, file_desc->file_position, buf, length,
+                                       &file_desc->indirect_cache);
+  if (bytes_read > 0) {
+      file_desc->file_position += bytes_read;
+  }
   return bytes_read;
 }
 
+/* pread_file()
+   Given file descriptor of file, read the file's data starting from offset location,
+   and at most length bytes, into buffer array, without moving the file's position
+   Input : fd -- file descriptor of the file to be read
+           buf -- array to be filled in with read data
+           length -- the maximum number of bytes to be read
+           offset -- the starting position inside the file
+   Output : Number of read bytes, 0 at or past the end of the file
+            -1 on failure(invalid buf pointer, and invalid block number accessed outside of range)
+   Side Effects : buf array filled with copied data from the file
+                  The indirect block read last stays cached in the file descriptor
+*/
+int32_t pread_file(int32_t fd, uint8_t* buf, uint32_t length, uint32_t offset){
+  pcb_t* pcb = get_pcb_ptr();
+  file_desc_t* file_desc = get_file_desc(pcb, fd);
+
+  return read_data_cached(file_desc->inode_idx, offset, buf, length, &file_desc->indirect_cache);
+}
+
+/* seek_position()
+   Move a file descriptor's position, which may go anywhere from the start to the end
+   Input : file_desc -- file descriptor to be moved
+           offset -- where to, relative to whence
+           whence -- SEEK_SET from the start, SEEK_CUR from the position, SEEK_END from the end
+           end -- position of the end
+   Output : The new position
+            -1 if whence is unknown, the new position is before the start or past the end,
+            or too large to be returned
+   Side Effects : file_position set to the new position
+*/
+static int32_t seek_position(file_desc_t* file_desc, int32_t offset, int32_t whence, uint32_t end) {
+    uint32_t base;
+
+    if (whence == SEEK_SET) {
+        base = 0;
+    } else if (whence == SEEK_CUR) {
+        base = file_desc->file_position;
+    } else if (whence == SEEK_END) {
+        base = end;
+    } else {
+        return -1;
+    }
+    if (base > end || (offset < 0 && 0U - (uint32_t) offset > base) ||
+        (offset > 0 && (uint32_t) offset > end - base) || base + offset > MAX_SEEK_POSITION) {
+        return -1;
+    }
+    file_desc->file_position = base + offset;
+    return file_desc->file_position;
+}
+
+/* seek_file()
+   Given file descriptor of file, move its position. Nothing is read: the position only
+   picks where the next read or write starts, whose first block is found by the extent map
+   or the indirect blocks, however far into the file it is
+   Input : fd -- file descriptor of the file
+           offset, whence -- see seek_position, the end is the file's length
+   Output : The new position, -1 on failure(see seek_position)
+   Side Effects : file_position set to the new position
+*/
+int32_t seek_file(int32_t fd, int32_t offset, int32_t whence){
+  pcb_t* pcb = get_pcb_ptr();
+  file_desc_t* file_desc = get_file_desc(pcb, fd);
+  return seek_position(file_desc, offset, whence, inodes[file_desc->inode_idx].length);
+}
+
+/* send_run()
+   Visitor of send_file, writes a run of the file to the output file descriptor
+   Input : src -- bytes of the run
+           length -- number of bytes in the run
+           arg -- pointer to the output file descriptor
+   Output : Number of bytes the write function took, -1 if it failed or the output is
+            neither a regular file nor the terminal. A regular file can take part of a run,
+            the terminal, which skips NUL characters, takes all of it
+   Side Effects : Those of the output's write function
+ */
+static int32_t send_run(const uint8_t* src, uint32_t length, void* arg) {
+    int32_t out_fd = *(int32_t *) arg;
+    file_desc_t* out_desc = get_file_desc(get_pcb_ptr(), out_fd);
+    int32_t bytes_written;
+
+    if (out_desc->file_ops->write == write_file_wrapper) {
+        return write_file_wrapper(out_fd, 0, src, length);
+    }
+    if (out_desc->file_ops->write == terminal_write) {
+        bytes_written = terminal_write(out_fd, 0, src, length);
+        return (bytes_written < 0)? bytes_written : length;
+    }
+    return -1;
+}
+
+/* send_file()
+   Given file descriptors of an open file and of an output, write at most length bytes
+   of the file from its position to the output, straight from the data blocks or the
+   block cache. Each run of adjacent data is one call to the output's write function,
+   so nothing is copied on the way, and a whole file takes one system call
+   Input : in_fd -- file descriptor of the file to be sent
+           out_fd -- file descriptor of the output, a regular file or the terminal
+           length -- the maximum number of bytes to be sent
+   Output : Number of sent bytes, 0 at the end of the file,
+            -1 on failure(an output that is neither a regular file nor the terminal, invalid
+            block number accessed outside of range, or nothing could be written)
+   Side Effects : in_fd's file_position advanced by the number of sent bytes
+                  Those of the output's write function
+*/
+int32_t send_file(int32_t in_fd, int32_t out_fd, uint32_t length){
+  pcb_t* pcb = get_pcb_ptr();
+  file_desc_t* file_desc = get_file_desc(pcb, in_fd);
+  file_ops_t* out_ops = get_file_desc(pcb, out_fd)->file_ops;
+
+  /* Other outputs, such as the RTC, would take the file's bytes as their own arguments */
+  if (out_ops->write != write_file_wrapper && out_ops->write != terminal_write) {
+      return -1;
+  }
+  int32_t bytes_sent = visit_data(file_desc->inode_idx, file_desc->file_position, length,
+                                  &file_desc->indirect_cache, send_run, &out_fd);
+  if (bytes_sent > 0) {
+      file_desc->file_position += bytes_sent;
+  }
+  return bytes_sent;
+}
+
 /* write_file()
-   Write data into a file
-   It fails no matter what because the file system is read only
+   Given the inode's pointer, write data into the file starting from offset location
    Input : inode_ptr -- pointer to the inode of the file to be written
            offset -- the starting position inside the file to begin writing
            buf -- array of the data to be written
-           length -- the maximum number of bytes to be written
-   Output : -1 always, as it is impossible to write into the read-only file system
-   Side Effects : None
+           length -- the number of bytes to be written
+   Output : Number of written bytes,
+            -1 on failure(inode pointer outside of inode array, or see write_data)
+   Side Effects : See write_data
 */
-int32_t write_file(inode_t* inode_ptr, uint32_t offset, uint8_t* buf, uint32_t length) {
-    return -1;
+int32_t write_file(inode_t* inode_ptr, uint32_t offset, const uint8_t* buf, uint32_t length) {
+    if (inode_ptr < inodes || inode_ptr >= inodes + fs_stat.num_inodes) {
+        /* NULL or not pointing into the inode array */
+        return -1;
+    }
+    return write_data(inode_ptr - inodes, offset, buf, length);
+}
+
+/* write_file_wrapper()
+   Given file descriptor of file, write length bytes from buf into the file at its position
+   Input : fd -- file descriptor of the file to be written
+           offset -- unused, the file descriptor's position is used instead
+           buf -- array of the data to be written
+           length -- the number of bytes to be written
+   Output : Number of written bytes,
+            -1 on failure(see write_data)
+   Side Effects : file_position advanced by the number of written bytes
+*/
+int32_t write_file_wrapper(int32_t fd, uint32_t offset, const uint8_t* buf, uint32_t length){
+  pcb_t* pcb = get_pcb_ptr();
+  file_desc_t* file_desc = get_file_desc(pcb, fd);
+
+  int32_t bytes_written = write_data(file_desc->inode_idx, file_desc->file_position, buf, length);
+  if (bytes_written > 0) {
+      file_desc->file_position += bytes_written;
+  }
+  return bytes_written;
 }
 
 /* close_file()
    Close the file.
-   It fails no matter what because the file system is read only
+   Blocks allocated ahead by writes, past the end of the file, are given back
    Input : inode_ptr -- pointer to the inode of the file to be closed
-   Output : 0 always, as there is nothing to be done to close a file
-   Side Effects : None
+   Output : 0 on success
+            -1 if inode pointer is outside of inode array
+   Side Effects : Frees the file's reserved blocks
 */
 int32_t close_file(inode_t* inode_ptr) {
+    if (inode_ptr < inodes || inode_ptr >= inodes + fs_stat.num_inodes) {
+        return -1;
+    }
+    if (inode_ptr - inodes < MAX_NUM_BITMAP_INODES) {
+        release_reserved_blocks(inode_ptr - inodes);
+    }
     return 0;
 }
 
 /* open_dir()
-   Open a directory with the given file name
-   Input : fname -- file name string
-   Output : dir_index, representing the requested directory's directory entry index
-           -1 if the directory with the given name does not exists, or fname is NULL
-   Side Effects : None
+   Open a directory whose directory entry was already resolved by the caller
+   Input : dentry -- directory entry of the directory to be opened
+           file_desc -- file descriptor being set up for the directory
+   Output : 0 on success
+            -1 if dentry is NULL or does not describe a directory
+   Side Effects : None. Directory is read by dentry index kept in file_position
  */
-int32_t open_dir(const uint8_t* filename) {
-    dentry_t dentry;
-    if(filename == NULL || 
-        read_dentry_by_name(filename, &dentry) == -1 ||
-        dentry.file_type != FILE_TYPE_DIR) {
+int32_t open_dir(const dentry_t* dentry, file_desc_t* file_desc) {
+    if (dentry == NULL || file_desc == NULL || dentry->file_type != FILE_TYPE_DIR) {
         return -1;
-    } else {
-        int i;
-        uint32_t fname_length = strlen((int8_t*) filename);
-        if (fname_length > MAX_FILE_NAME_LENGTH) {
-            /* Given file name is too long to even compare.
-               We do this to avoid reading into file_type value as well
-               in case fname is too long.
-             */
-            return -1;
-        } else {
-            for(i = 0; i < fs_stat.num_dir_entries; i++) {
-                /* Compare given fname with current dentry's file_name */
-                if (strncmp((int8_t*) filename, (int8_t*) dentries[i].file_name, fname_length) == 0) {
-                    /* At this point, j is already incremented */
-                    if (fname_length < MAX_FILE_NAME_LENGTH && dentries[i].file_name[fname_length] != 0) {
-                        /* It means dentry's file_name is longer than given file_name */
-                        continue;
-                    } else {
-                        /* If we reach here, matching file name found */
-                        return i;
-                    }
-                } else {
-                    continue;
-                    /* Otherwise continue searching for next dentry */
-                }
-            }    
-            /* Not found */
-            return -1;            
-        }
     }
+    file_desc->inode_ptr = NULL;
+    return 0;
 }
 
 /* read_dir()
@@ -336,8 +1840,9 @@ int32_t read_dir(inode_t* inode_ptr, uint32_t offset, uint8_t* buf, uint32_t len
         return 0;
     } else {
         /* obtain the length of the name of file */
+        dentry_t* dentry = get_dentry(offset);
         for (i = 0; i < MAX_FILE_NAME_LENGTH; i++) {
-            if (dentries[offset].file_name[i] != NULL) {
+            if (dentry->file_name[i] != NULL) {
                 file_name_length++;
             }
             else {
@@ -349,7 +1854,7 @@ int32_t read_dir(inode_t* inode_ptr, uint32_t offset, uint8_t* buf, uint32_t len
         file_name_length = min(file_name_length, length);
        
         /* copy the file name into the buffer array */
-        strncpy((int8_t*)buf, (int8_t*)dentries[offset].file_name, file_name_length);
+        strncpy((int8_t*)buf, (int8_t*)dentry->file_name, file_name_length);
         
         return file_name_length;
     }
@@ -366,16 +1871,83 @@ int32_t read_dir(inode_t* inode_ptr, uint32_t offset, uint8_t* buf, uint32_t len
 */
 int32_t read_dir_wrapper(int32_t fd, uint8_t* buf, uint32_t length){
   pcb_t* pcb = get_pcb_ptr();
-  inode_t* inode_ptr = (((pcb -> file_array)[fd]).inode_ptr);
-  uint32_t offset = (((pcb -> file_array)[fd]).file_position);
+  file_desc_t* file_desc = get_file_desc(pcb, fd);
 
-  int32_t bytes_read = read_dir(inode_ptr, offset, buf, length);
+  int32_t bytes_read = read_dir(file_desc->inode_ptr, file_desc->file_position, buf, length);
   if (bytes_read > 0) {
-      ((pcb -> file_array)[fd]).file_position += 1;
+      file_desc->file_position += 1;
   }
   return bytes_read;
 }
 
+/* pread_dir()
+   Given the fd of the directory, read the (offset)'th directory entry's file name,
+   at most length bytes, into buffer array, without moving the directory's position
+   Input : fd -- file descriptor of the directory that's open
+           buf -- array to be filled in with file name
+           length -- the maximum number of bytes to be read
+           offset -- index of the directory entry
+   Output : Number of read bytes, 0 past the last entry
+   Side Effects : buf array filled with copied file name from the file
+*/
+int32_t pread_dir(int32_t fd, uint8_t* buf, uint32_t length, uint32_t offset){
+  pcb_t* pcb = get_pcb_ptr();
+  return read_dir(get_file_desc(pcb, fd)->inode_ptr, offset, buf, length);
+}
+
+/* seek_dir()
+   Given the fd of the directory, move its position, the index of the directory entry
+   the next read starts at
+   Input : fd -- file descriptor of the directory that's open
+           offset, whence -- see seek_position, the end is the number of directory entries
+   Output : The new position, -1 on failure(see seek_position)
+   Side Effects : file_position set to the new position
+*/
+int32_t seek_dir(int32_t fd, int32_t offset, int32_t whence){
+  pcb_t* pcb = get_pcb_ptr();
+  return seek_position(get_file_desc(pcb, fd), offset, whence, fs_stat.num_dir_entries);
+}
+
+/* read_dir_entries()
+   Given the fd of the directory, fill the buffer with as many dirent_t records as fit,
+   starting at the (fd's offset)'th directory entry
+   Input : fd -- file descriptor of the directory that's open
+           buf -- array to be filled in with records
+           length -- size of buf in bytes
+   Output : Number of bytes filled in(a multiple of the record size), 0 at the end of the directory
+            -1 if buf cannot hold a single record
+   Side Effects : buf array filled with records, file_position advanced by the number of records
+*/
+int32_t read_dir_entries(int32_t fd, uint8_t* buf, uint32_t length) {
+    pcb_t* pcb = get_pcb_ptr();
+    file_desc_t* file_desc = get_file_desc(pcb, fd);
+    uint32_t num_records = length / sizeof(dirent_t);
+    uint32_t offset = file_desc->file_position;
+    uint32_t i;
+
+    if (num_records == 0) {
+        return -1;
+    }
+    for (i = 0; i < num_records && offset + i < fs_stat.num_dir_entries; i++) {
+        dentry_t* dentry = get_dentry(offset + i);
+        dirent_t* record = &((dirent_t*) buf)[i];
+        uint32_t name_length = 0;
+        while (name_length < MAX_FILE_NAME_LENGTH && dentry->file_name[name_length] != NULL) {
+            name_length++;
+        }
+
+        record->inode_idx = dentry->inode_idx;
+        record->file_type = dentry->file_type;
+        record->file_size = (dentry->file_type == FILE_TYPE_FILE && dentry->inode_idx < fs_stat.num_inodes)?
+            inodes[dentry->inode_idx].length : 0;
+        record->name_length = name_length;
+        memcpy(record->file_name, dentry->file_name, name_length);
+        record->file_name[name_length] = NULL;
+    }
+    file_desc->file_position += i;
+    return i * sizeof(dirent_t);
+}
+
 /* write_dir()
    Write filename into a directory
    It fails no matter what because the file system is read only
@@ -435,9 +2007,10 @@ void test_file_system_driver(void) {
                     buf[j] = NULL;
                 }
                 /* Test open file */
-                inode_t *my_inode_ptr = (inode_t *)open_file(my_dentry.file_name);
+                file_desc_t file_desc;
+                open_file(&my_dentry, &file_desc);
                 /* Test read_file */
-                result = read_file(my_inode_ptr, 0, buf, buf_size);
+                result = read_file(file_desc.inode_ptr, 0, buf, buf_size);
                 printf("Number of read bytes : %d\n", result);
                 printf("First 80 bytes : \n");
                 for (j = 0; j < min(result, 80); j++) {
@@ -445,10 +2018,11 @@ void test_file_system_driver(void) {
                 }
                 printf("\nend of first 80 bytes for file %s\n", my_dentry.file_name);
             } else if (my_dentry.file_type == FILE_TYPE_DIR) {
-                temp = open_dir(my_dentry.file_name);
-                printf("index number for directory: %d\n", temp);
+                file_desc_t file_desc;
+                temp = open_dir(&my_dentry, &file_desc);
+                printf("open_dir result: %d\n", temp);
                   
-                result = read_dir(0, temp, buf2, file_name_length);
+                result = read_dir(file_desc.inode_ptr, i, buf2, file_name_length);
                 
                 printf("Number of read bytes for directory: %d\n", result);
                 int j;
@@ -462,3 +2036,216 @@ void test_file_system_driver(void) {
         }
     }
 }
+
+#if KERNEL_BENCH
+/* scan_dentry_by_name()
+   Reference lookup that compares the name against every dentry in order.
+   This is how read_dentry_by_name used to work; kept only to benchmark against
+   Input : fname -- name of the file to be searched
+   Output : index of the matching entry in dentries, -1 if not found
+ */
+static int32_t scan_dentry_by_name(const uint8_t* fname) {
+    int i;
+    uint32_t fname_length = strlen((int8_t*) fname);
+    if (fname_length > MAX_FILE_NAME_LENGTH) {
+        return -1;
+    }
+    for (i = 0; i < fs_stat.num_dir_entries; i++) {
+        const uint8_t* name = get_dentry(i)->file_name;
+        if (strncmp((int8_t*) fname, (int8_t*) name, fname_length) == 0 &&
+            (fname_length == MAX_FILE_NAME_LENGTH || name[fname_length] == 0)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* bench_lookup_names()
+   Look up every name of the mounted directory, plus one missing name,
+   BENCH_LOOKUP_ROUNDS times with both the linear scan and the name index,
+   and print the average cost of a single lookup
+   Input : label -- name of the image being measured
+ */
+static void bench_lookup_names(const int8_t* label) {
+    uint8_t names[MAX_NUM_DENTRIES + 1][MAX_FILE_NAME_LENGTH + 1];
+    uint32_t num_names = 0;
+    uint32_t scan_cycles = 0;
+    uint32_t hash_cycles = 0;
+    uint32_t start;
+    volatile int32_t sink;
+    int i, j;
+
+    for (i = 0; i < fs_stat.num_dir_entries && i < MAX_NUM_DENTRIES; i++) {
+        /* dentry names are not NUL terminated when they are 32 characters long */
+        strncpy((int8_t*) names[num_names], (int8_t*) get_dentry(i)->file_name, MAX_FILE_NAME_LENGTH);
+        names[num_names][MAX_FILE_NAME_LENGTH] = NULL;
+        num_names++;
+    }
+    strcpy((int8_t*) names[num_names++], "no_such_file");
+
+    for (i = 0; i < num_names; i++) {
+        start = rdtsc();
+        for (j = 0; j < BENCH_LOOKUP_ROUNDS; j++) {
+            sink = scan_dentry_by_name(names[i]);
+        }
+        scan_cycles += rdtsc() - start;
+
+        start = rdtsc();
+        for (j = 0; j < BENCH_LOOKUP_ROUNDS; j++) {
+            sink = find_dentry_index(names[i]);
+        }
+        hash_cycles += rdtsc() - start;
+    }
+    (void) sink;
+
+    printf("%s: %d names, scan %u cycles/lookup, hashed %u cycles/lookup\n", label, num_names,
+           scan_cycles / (num_names * BENCH_LOOKUP_ROUNDS), hash_cycles / (num_names * BENCH_LOOKUP_ROUNDS));
+}
+
+/* bench_dentry_lookup()
+   Compare the linear dentry scan with the name index, first on the mounted
+   image and then on a synthetic directory with the maximum of 63 entries.
+   Like test_file_system_driver, meant to be called by hand from kernel.c
+ */
+void bench_dentry_lookup(void) {
+    static dentry_t synthetic_dentries[MAX_NUM_DENTRIES];
+    dentry_t* saved_dentries = dentries;
+    dir_header_t* saved_dir_header = dir_header;
+    uint32_t saved_num_dir_entries = fs_stat.num_dir_entries;
+    int8_t num_buf[MAX_FILE_NAME_LENGTH];
+    int i;
+
+    bench_lookup_names("filesys_img");
+
+    /* Names share a long prefix, which is the worst case for strncmp */
+    for (i = 0; i < MAX_NUM_DENTRIES; i++) {
+        memset(&synthetic_dentries[i], 0, DENTRY_SIZE);
+        strcpy((int8_t*) synthetic_dentries[i].file_name, "synthetic_entry_");
+        itoa(i, num_buf, 10);
+        strcpy((int8_t*) synthetic_dentries[i].file_name + strlen("synthetic_entry_"), num_buf);
+        synthetic_dentries[i].file_type = FILE_TYPE_FILE;
+    }
+    dentries = synthetic_dentries;
+    dir_header = NULL;
+    fs_stat.num_dir_entries = MAX_NUM_DENTRIES;
+    build_dentry_index();
+
+    bench_lookup_names("synthetic 63 entries");
+
+    dentries = saved_dentries;
+    dir_header = saved_dir_header;
+    fs_stat.num_dir_entries = saved_num_dir_entries;
+    build_dentry_index();
+}
+
+/* read_file_by_search()
+   Reference read_file that turns the inode pointer back into an index by walking
+   the inode array. This is how read_file used to work; kept only to benchmark against
+ */
+static int32_t read_file_by_search(inode_t* inode_ptr, uint32_t offset, uint8_t* buf, uint32_t length) {
+    int i;
+    for (i = 0; i < fs_stat.num_inodes; i++) {
+        if (&inodes[i] == inode_ptr) {
+            return read_data(i, offset, buf, length);
+        }
+    }
+    return -1;
+}
+
+/* bench_read_file()
+   Read every regular file BENCH_READ_CHUNK bytes per call, once through the inode
+   search and once through the inode index, and print the average cycles per call
+ */
+void bench_read_file(void) {
+    uint8_t buf[BENCH_READ_CHUNK];
+    uint32_t search_cycles = 0;
+    uint32_t index_cycles = 0;
+    uint32_t num_calls = 0;
+    uint32_t start, offset;
+    int32_t bytes_read;
+    dentry_t dentry;
+    int i;
+
+    for (i = 0; read_dentry_by_index(i, &dentry) == 0; i++) {
+        if (dentry.file_type != FILE_TYPE_FILE) {
+            continue;
+        }
+        inode_t* inode_ptr = &inodes[dentry.inode_idx];
+
+        offset = 0;
+        start = rdtsc();
+        while ((bytes_read = read_file_by_search(inode_ptr, offset, buf, BENCH_READ_CHUNK)) > 0) {
+            offset += bytes_read;
+        }
+        search_cycles += rdtsc() - start;
+
+        offset = 0;
+        start = rdtsc();
+        while ((bytes_read = read_data(dentry.inode_idx, offset, buf, BENCH_READ_CHUNK)) > 0) {
+            offset += bytes_read;
+        }
+        index_cycles += rdtsc() - start;
+
+        num_calls += offset / BENCH_READ_CHUNK + 1;
+    }
+
+    printf("read %d byte(s) per call over %d inodes: search %u cycles/call, indexed %u cycles/call\n",
+           BENCH_READ_CHUNK, fs_stat.num_inodes, search_cycles / num_calls, index_cycles / num_calls);
+}
+
+/* read_disk_files()
+   Read the first regular files of the directory front to back, BLOCK_SIZE bytes per call,
+   stopping before their blocks would no longer fit in the block cache together
+   Input : buf -- array of BLOCK_SIZE bytes
+   Output : Number of bytes read
+ */
+static uint32_t read_disk_files(uint8_t* buf) {
+    uint32_t bytes = 0;
+    uint32_t cached_blocks = 0;
+    uint32_t offset;
+    int32_t bytes_read;
+    dentry_t dentry;
+    int i;
+
+    for (i = 0; read_dentry_by_index(i, &dentry) == 0; i++) {
+        if (dentry.file_type != FILE_TYPE_FILE) {
+            continue;
+        }
+        cached_blocks += (inodes[dentry.inode_idx].length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        if (cached_blocks > BLOCK_CACHE_SIZE) {
+            break;
+        }
+        offset = 0;
+        while ((bytes_read = read_data(dentry.inode_idx, offset, buf, BLOCK_SIZE)) > 0) {
+            offset += bytes_read;
+        }
+        bytes += offset;
+    }
+    return bytes;
+}
+
+/* bench_disk_read()
+   Read the files that fit in the block cache with the cache emptied, so every block
+   comes from the disk, then again with the cache filled, and print the cycles per KB
+   and the cache's hits and misses of each pass. Meant for an image mounted from a disk
+ */
+void bench_disk_read(void) {
+    uint8_t buf[BLOCK_SIZE];
+    block_cache_stats_t before, after;
+    uint32_t bytes, start, cycles, misses;
+    int32_t pass;
+
+    reset_block_cache();
+    for (pass = 0; pass < 2; pass++) {
+        get_block_cache_stats(&before);
+        start = rdtsc();
+        bytes = read_disk_files(buf);
+        cycles = rdtsc() - start;
+        get_block_cache_stats(&after);
+        misses = after.misses - before.misses;
+        printf("%s cache: %u bytes, %u cycles/KB, %u hits, %u misses, %u cycles/miss\n",
+               (pass == 0)? "cold" : "warm", bytes, cycles / (bytes / 1024 + 1), after.hits - before.hits,
+               misses, (misses > 0)? (after.fill_cycles - before.fill_cycles) / misses : 0);
+    }
+}
+#endif /* KERNEL_BENCH */
@@ -5,6 +5,7 @@
 #define _FILE_SYSTEM_H
 
 #include "types.h"
+#include "debug.h"
 
 #define FILE_TYPE_RTC 0
 #define FILE_TYPE_DIR 1
@@ -19,12 +20,79 @@
 #define RESERVED_BYTE_BOOT 13
 #define RESERVED_BYTE_DENTRY 6
 
+/* The boot block holds the statistics plus at most 63 directory entries */
+#define MAX_NUM_DENTRIES ((BLOCK_SIZE / DENTRY_SIZE) - 1)
+/* Number of slots in the name index. Power of two, at least twice MAX_NUM_DENTRIES */
+#define DENTRY_HASH_SIZE 128
+#define DENTRY_HASH_EMPTY -1
+/* Capacity of the names kept sorted for find_names. Past it a directory is scanned instead */
+#define MAX_NUM_SORTED_NAMES 8192
+/* Wildcards of find_names patterns: any run of characters, and any one character */
+#define GLOB_ANY '*'
+#define GLOB_ONE '?'
+#define MAX_GLOB_LENGTH 64
+/* Capacity of the extent map built at mount time. Inodes past MAX_NUM_EXTENT_INODES,
+   or files that do not fit in the remaining extents, are read block by block */
+#define MAX_NUM_EXTENTS 4096
+#define MAX_NUM_EXTENT_INODES 1024
+/* Capacity of the allocation bitmaps built at mount time. Blocks and inodes past them
+   are never allocated, and inodes past them cannot be written */
+#define MAX_NUM_BITMAP_BLOCKS 16384
+#define MAX_NUM_BITMAP_INODES 1024
+#define BITS_PER_WORD 32
+/* Blocks allocated at once when a write runs past the blocks a file holds */
+#define WRITE_BATCH_BLOCKS 8
+
+/* The directory is held by the inode named in fs_stat's dir_inode instead of the boot block,
+   so it can span several blocks. The directory's first block is a dir_header_t, followed by
+   the blocks of a hash index on the names, then the blocks of directory entries. The boot
+   block keeps a copy of the first entries for drivers that do not know the feature */
+#define FS_FEATURE_LARGE_DIR 0x2
+#define DENTRIES_PER_BLOCK (BLOCK_SIZE / DENTRY_SIZE)
+#define DIR_HASH_SLOTS_PER_BLOCK (BLOCK_SIZE / sizeof(dir_hash_slot_t))
+#define DIR_HASH_EMPTY 0xFFFFFFFF
+/* Name hash of directory indexes, FNV-1a. Part of the image format */
+#define FNV_OFFSET_BASIS 2166136261U
+#define FNV_PRIME 16777619U
+
+/* Inodes reach blocks past their first NUM_DIRECT_BLOCKS through indirect blocks of
+   INDICES_PER_BLOCK data block indexes: block_idx[SINGLE_INDIRECT_SLOT] is a single
+   indirect block, block_idx[DOUBLE_INDIRECT_SLOT] a block of single indirect blocks.
+   Without the feature every entry of block_idx is a data block */
+#define FS_FEATURE_INDIRECT 0x4
+#define NUM_DIRECT_BLOCKS (MAX_NUM_BLOCKS_IN_INODE - 2)
+#define SINGLE_INDIRECT_SLOT NUM_DIRECT_BLOCKS
+#define DOUBLE_INDIRECT_SLOT (NUM_DIRECT_BLOCKS + 1)
+#define INDICES_PER_BLOCK (BLOCK_SIZE / sizeof(uint32_t))
+/* Largest file with indirect blocks, whole blocks that fit in the 32-bit length */
+#define MAX_INDIRECT_FILE_LENGTH 0xFFFFF000
+#define INVALID_BLOCK 0xFFFFFFFF
+
+/* Data blocks are LZ4 compressed one by one. The inodes are followed by a table of
+   num_data_blocks + 1 offsets into the compressed bytes, then the compressed bytes.
+   A block whose compressed size is BLOCK_SIZE is stored as is. The image is read only */
+#define FS_FEATURE_COMPRESSED 0x1
+/* Number of blocks kept by the block cache */
+#define BLOCK_CACHE_SIZE 32
+#define BLOCK_CACHE_EMPTY -1
+/* Most inodes of an image mounted from a disk, whose inodes are all kept in memory */
+#define MAX_DISK_INODES 128
+
+/* Where a seek counts its offset from: the start, the position and the end of the file.
+   Positions past MAX_SEEK_POSITION cannot be returned */
+#define SEEK_SET 0
+#define SEEK_CUR 1
+#define SEEK_END 2
+#define MAX_SEEK_POSITION 0x7FFFFFFF
+
 /* File system's statistics information */
 typedef struct fs_stat_t {
     uint32_t num_dir_entries;
     uint32_t num_inodes;
     uint32_t num_data_blocks;
-    uint32_t reserved[RESERVED_BYTE_BOOT];
+    uint32_t features;      /* FS_FEATURE_* bits, 0 for the original layout */
+    uint32_t dir_inode;     /* inode holding the directory, with FS_FEATURE_LARGE_DIR */
+    uint32_t reserved[RESERVED_BYTE_BOOT - 2];
 } fs_stat_t;
 
 /* A single directory entry */
@@ -35,12 +103,80 @@ typedef struct dentry_t {
     uint32_t reserved[RESERVED_BYTE_DENTRY];
 } dentry_t;
 
+/* A slot of the name index built at mount time.
+   Name's hash and length are stored so most mismatches never touch the dentry */
+typedef struct dentry_hash_t {
+    uint32_t hash;
+    uint32_t name_length;
+    int32_t dentry_idx;
+} dentry_hash_t;
+
 /* An inode that contains number of bytes in file and blocks' indexes */
 typedef struct inode_t {
     uint32_t length;
     uint32_t block_idx[MAX_NUM_BLOCKS_IN_INODE];
 } inode_t;
 
+/* Indirect block a file descriptor read last, so a sequential read does not walk
+   the inode's indirect blocks again for every block */
+typedef struct indirect_cache_t {
+    uint32_t inode;             /* index of inode the indirect block belongs to */
+    uint32_t first_block;       /* block of the file the indirect block's first index maps */
+    uint32_t* indices;          /* NULL if nothing is cached */
+} indirect_cache_t;
+
+/* A run of physically adjacent data blocks holding consecutive blocks of a file */
+typedef struct extent_t {
+    uint32_t file_block;    /* index of the run's first block inside the file */
+    uint32_t data_block;    /* index of the run's first data block */
+    uint32_t num_blocks;
+} extent_t;
+
+/* The extents of one file, sorted by file_block. num_extents is 0 if the file has none */
+typedef struct inode_extents_t {
+    uint32_t first_extent;
+    uint32_t num_extents;
+} inode_extents_t;
+
+/* First block of a directory with FS_FEATURE_LARGE_DIR */
+typedef struct dir_header_t {
+    uint32_t num_entries;
+    uint32_t max_entries;       /* entries the entry blocks have room for */
+    uint32_t num_hash_slots;    /* power of two, at least twice max_entries */
+    uint32_t hash_block;        /* block of the directory where the hash index starts */
+    uint32_t entry_block;       /* block of the directory where the entries start */
+} dir_header_t;
+
+/* Slot of a directory's hash index, open addressing with linear probing */
+typedef struct dir_hash_slot_t {
+    uint32_t hash;
+    uint32_t dentry_idx;        /* DIR_HASH_EMPTY if the slot is free */
+} dir_hash_slot_t;
+
+/* A data block of a compressed image, decompressed, or of an image on a disk */
+typedef struct cached_block_t {
+    int32_t block_index;    /* BLOCK_CACHE_EMPTY if the slot holds no block */
+    uint32_t last_used;     /* value of the cache's clock when the block was last read */
+    uint8_t data[BLOCK_SIZE];
+} cached_block_t;
+
+/* Block cache statistics, since mount or the last reset_block_cache */
+typedef struct block_cache_stats_t {
+    uint32_t hits;
+    uint32_t misses;            /* each miss decompresses or reads one block */
+    uint32_t fill_cycles;       /* spent decompressing or reading the missed blocks */
+    uint32_t compressed_bytes;  /* compressed bytes decompressed by the misses */
+} block_cache_stats_t;
+
+/* Record filled in by the getdents system call, one per directory entry */
+typedef struct dirent_t {
+    uint32_t inode_idx;
+    uint32_t file_size;
+    uint32_t file_type;
+    uint32_t name_length;
+    uint8_t file_name[MAX_FILE_NAME_LENGTH + 1];    /* NUL terminated */
+} __attribute__((packed)) dirent_t;
+
 /* A single data block of size 4kB */
 typedef struct data_block_t {
     uint8_t data[BLOCK_SIZE];
@@ -59,32 +195,63 @@ typedef struct file_header_t {
     };
 } file_header_t;
 
+/* Declared in pcb.h, which includes this header, and in block_dev.h */
+struct file_desc_t;
+struct block_dev_t;
+
 void init_file_system(uint32_t start_addr, uint32_t end_addr);
+int32_t init_disk_file_system(struct block_dev_t* dev);
+int32_t is_disk_file_system(void);
 int32_t read_dentry_by_name(const uint8_t* fname, dentry_t* dentry);
 int32_t read_dentry_by_index(uint32_t index, dentry_t* dentry);
 int32_t read_data(uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length);
+int32_t get_file_length(uint32_t inode);
+uint32_t get_block_addr(uint32_t inode, uint32_t block_num);
+int32_t write_data(uint32_t inode, uint32_t offset, const uint8_t* buf, uint32_t length);
+int32_t create_file(const uint8_t* fname, dentry_t* dentry);
+int32_t get_num_free_blocks(void);
+uint32_t hash_file_name(const uint8_t* fname, uint32_t max_length, uint32_t* length);
+int32_t find_names(const uint8_t* pattern, uint8_t* buf, uint32_t length, uint32_t first);
+void get_block_cache_stats(block_cache_stats_t* stats);
+void use_extent_map(uint32_t enabled);
+void reset_block_cache(void);
 
 /* Open, read, write, close functions on files for system call functions support */
-int32_t open_file(const uint8_t* filename);
+int32_t open_file(const dentry_t* dentry, struct file_desc_t* file_desc);
 int32_t read_file(inode_t* inode_ptr, uint32_t offset, uint8_t* buf, uint32_t length);
-int32_t write_file(inode_t* inode_ptr, uint32_t offset, uint8_t* buf, uint32_t length);
+int32_t write_file(inode_t* inode_ptr, uint32_t offset, const uint8_t* buf, uint32_t length);
 int32_t close_file(inode_t* inode_ptr);
 
 int32_t read_file_wrapper(int32_t fd, uint8_t* buf, uint32_t length);
+int32_t pread_file(int32_t fd, uint8_t* buf, uint32_t length, uint32_t offset);
+int32_t seek_file(int32_t fd, int32_t offset, int32_t whence);
+int32_t send_file(int32_t in_fd, int32_t out_fd, uint32_t length);
+int32_t write_file_wrapper(int32_t fd, uint32_t offset, const uint8_t* buf, uint32_t length);
 int32_t read_dir_wrapper(int32_t fd, uint8_t* buf, uint32_t length);
+int32_t read_dir_entries(int32_t fd, uint8_t* buf, uint32_t length);
+int32_t pread_dir(int32_t fd, uint8_t* buf, uint32_t length, uint32_t offset);
+int32_t seek_dir(int32_t fd, int32_t offset, int32_t whence);
 
 /* Open, read, write, close functions on directories for system call functions support */
-int32_t open_dir(const uint8_t* filename);
+int32_t open_dir(const dentry_t* dentry, struct file_desc_t* file_desc);
 int32_t read_dir(inode_t* inode_ptr, uint32_t offset, uint8_t* buf, uint32_t length);
 int32_t write_dir(inode_t* inode_ptr, uint32_t offset, uint8_t* buf, uint32_t length);
 int32_t close_dir(inode_t* inode_ptr);
 
 void test_file_system_driver(void);
+#if KERNEL_BENCH
+void bench_dentry_lookup(void);
+void bench_read_file(void);
+void bench_disk_read(void);
+#endif
 
 /* Macros to help parsing the file system */
 #define FS_STAT_ADDR(BASE_ADDR) ((fs_stat_t*) BASE_ADDR)
 #define DENTRIES_ADDR(BASE_ADDR) ((dentry_t*) (BASE_ADDR + DENTRY_SIZE))
 #define INODES_ADDR(BASE_ADDR) ((inode_t*) (BASE_ADDR + BLOCK_SIZE))
 #define DATA_BLOCKS_ADDR(BASE_ADDR, NUM_INODES) ((data_block_t*) (BASE_ADDR + BLOCK_SIZE * (NUM_INODES + 1)))
+#define BLOCK_OFFSETS_ADDR(BASE_ADDR, NUM_INODES) ((uint32_t*) (BASE_ADDR + BLOCK_SIZE * (NUM_INODES + 1)))
+#define COMPRESSED_DATA_ADDR(BASE_ADDR, NUM_INODES, NUM_DATA_BLOCKS) \
+    ((uint8_t*) (BLOCK_OFFSETS_ADDR(BASE_ADDR, NUM_INODES) + NUM_DATA_BLOCKS + 1))
 
 #endif /* _FILE_SYSTEM_H */
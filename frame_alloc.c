@@ -0,0 +1,258 @@
+/* frame_alloc.c - Physical frame allocator. A buddy allocator over 4KB frames,
+ * fed at boot with the memory the multiboot memory map reports as available,
+ * minus the kernel and the modules. Process images take 4MB blocks from it,
+ * and shared program images single frames
+ * vim:ts=4 noexpandtab
+ */
+
+#include "frame_alloc.h"
+#include "lib.h"
+
+/* Multiboot information flags: mem_lower and mem_upper, the modules, the memory map */
+#define MULTIBOOT_FLAG_MEM 0x01
+#define MULTIBOOT_FLAG_MODS 0x08
+#define MULTIBOOT_FLAG_MMAP 0x40
+#define MMAP_TYPE_AVAILABLE 1
+/* mem_upper counts kilobytes from 1MB */
+#define UPPER_MEMORY_START 0x100000
+#define KB 1024
+#define FREE_MAP_BITS 32
+#define FREE_MAP_WORDS(order) ((MAX_NUM_FRAMES >> (order)) / FREE_MAP_BITS)
+
+/* One bitmap per order, bit set when the block of that order is free and is not
+   part of a larger free block. The bitmap of order n + 1 follows the one of order n */
+static uint32_t free_maps[2 * FREE_MAP_WORDS(0)];
+static uint32_t* free_map[FRAME_MAX_ORDER + 1];
+/* Free blocks of each order, and the first word of its bitmap that may have a bit set */
+static uint32_t num_free_blocks[FRAME_MAX_ORDER + 1];
+static uint32_t first_free_word[FRAME_MAX_ORDER + 1];
+
+/* set_free
+   Mark a block free in the bitmap of its order
+   Input : order -- order of the block
+   		   block -- index of the block among the blocks of its order
+   Output : None
+   Side Effect : Sets its bit, counts it and moves the search hint back to it
+*/
+static void set_free(uint32_t order, uint32_t block)
+{
+	uint32_t word = block / FREE_MAP_BITS;
+	free_map[order][word] |= 1U << (block % FREE_MAP_BITS);
+	num_free_blocks[order]++;
+	if (word < first_free_word[order])
+		first_free_word[order] = word;
+}
+
+/* clear_free
+   Mark a free block taken, or merged into a larger one
+   Input : order -- order of the block
+   		   block -- index of the block among the blocks of its order
+   Output : None
+   Side Effect : Clears its bit and uncounts it
+*/
+static void clear_free(uint32_t order, uint32_t block)
+{
+	free_map[order][block / FREE_MAP_BITS] &= ~(1U << (block % FREE_MAP_BITS));
+	num_free_blocks[order]--;
+}
+
+/* is_free
+   Whether a block is free, as a whole block of its order
+*/
+static int32_t is_free(uint32_t order, uint32_t block)
+{
+	return (free_map[order][block / FREE_MAP_BITS] >> (block % FREE_MAP_BITS)) & 1;
+}
+
+/* take_free_block
+   Take the lowest free block of an order that has one
+   Input : order -- order of the block, with num_free_blocks[order] > 0
+   Output : index of the block among the blocks of its order
+   Side Effect : Clears its bit, and moves the search hint past the empty words
+*/
+static uint32_t take_free_block(uint32_t order)
+{
+	uint32_t word = first_free_word[order];
+	uint32_t block;
+
+	while (free_map[order][word] == 0)
+		word++;
+	first_free_word[order] = word;
+	block = word * FREE_MAP_BITS + __builtin_ctz(free_map[order][word]);
+	clear_free(order, block);
+	return block;
+}
+
+/* alloc_frames
+   Take a block of 2^order contiguous frames, aligned to its size. A larger free
+   block is split when no block of the order is free, its unused halves going
+   back to the lower orders
+   Input : order -- order of the block, FRAME_ORDER_4M for a 4MB page
+   Output : physical address of the block
+   			NULL if order is too large or no free block is large enough
+   Side Effect : Takes the block from the free bitmaps
+*/
+uint32_t alloc_frames(uint32_t order)
+{
+	uint32_t cur_order, block;
+	uint32_t flags;
+
+	if (order > FRAME_MAX_ORDER)
+		return NULL;
+	flags = save_flags_and_cli();
+	for (cur_order = order; cur_order <= FRAME_MAX_ORDER && num_free_blocks[cur_order] == 0; cur_order++)
+		;
+	if (cur_order > FRAME_MAX_ORDER) {
+		restore_saved_flags(flags);
+		return NULL;
+	}
+	block = take_free_block(cur_order);
+	while (cur_order > order) {
+		/* Keep the lower half, free the upper one */
+		cur_order--;
+		block *= 2;
+		set_free(cur_order, block + 1);
+	}
+	restore_saved_flags(flags);
+	return block << (order + FRAME_SHIFT);
+}
+
+/* free_frames
+   Give back a block taken with alloc_frames, merging it with its buddy for as
+   long as the buddy is free too
+   Input : phys_addr -- physical address of the block
+   		   order -- order it was taken with
+   Output : None
+   Side Effect : Returns the block to the free bitmaps
+*/
+void free_frames(uint32_t phys_addr, uint32_t order)
+{
+	uint32_t block = phys_addr >> (order + FRAME_SHIFT);
+	uint32_t flags;
+
+	if (order > FRAME_MAX_ORDER || phys_addr >= FRAME_MEMORY_LIMIT)
+		return;
+	flags = save_flags_and_cli();
+	while (order < FRAME_MAX_ORDER && is_free(order, block ^ 1)) {
+		clear_free(order, block ^ 1);
+		block /= 2;
+		order++;
+	}
+	set_free(order, block);
+	restore_saved_flags(flags);
+}
+
+/* can_alloc_frames
+   Whether alloc_frames of an order would succeed now
+*/
+int32_t can_alloc_frames(uint32_t order)
+{
+	for (; order <= FRAME_MAX_ORDER; order++) {
+		if (num_free_blocks[order] != 0)
+			return 1;
+	}
+	return 0;
+}
+
+/* get_num_free_frames
+   Number of free 4KB frames, in blocks of every order
+*/
+uint32_t get_num_free_frames(void)
+{
+	uint32_t num_frames = 0;
+	uint32_t order;
+	for (order = 0; order <= FRAME_MAX_ORDER; order++)
+		num_frames += num_free_blocks[order] << order;
+	return num_frames;
+}
+
+/* add_frames
+   Give the allocator the whole frames of a range, as the largest aligned blocks
+   that fit in it
+   Input : start, end -- physical address range, end excluded
+   Output : None
+   Side Effect : Frees the frames, the range clipped to FRAME_MEMORY_START and FRAME_MEMORY_LIMIT
+*/
+static void add_frames(uint32_t start, uint32_t end)
+{
+	uint32_t order;
+
+	start = (start < FRAME_MEMORY_START) ? FRAME_MEMORY_START : start;
+	end = (end > FRAME_MEMORY_LIMIT) ? FRAME_MEMORY_LIMIT : end;
+	start = (start + FRAME_SIZE - 1) & ~(FRAME_SIZE - 1);
+	end &= ~(FRAME_SIZE - 1);
+	while (start < end) {
+		order = FRAME_MAX_ORDER;
+		while ((start & ((FRAME_SIZE << order) - 1)) != 0 || (FRAME_SIZE << order) > end - start)
+			order--;
+		free_frames(start, order);
+		start += FRAME_SIZE << order;
+	}
+}
+
+/* add_free_range
+   Give the allocator a range of available memory, less the modules inside it
+   Input : start, end -- physical address range, end excluded
+   		   mods, num_mods -- modules still to be cut out of the range
+   Output : None
+   Side Effect : Frees the frames no module overlaps
+*/
+static void add_free_range(uint32_t start, uint32_t end, const module_t* mods, uint32_t num_mods)
+{
+	uint32_t i;
+
+	if (start >= end)
+		return;
+	for (i = 0; i < num_mods; i++) {
+		if (mods[i].mod_start < end && mods[i].mod_end > start) {
+			add_free_range(start, mods[i].mod_start, mods + i + 1, num_mods - i - 1);
+			add_free_range(mods[i].mod_end, end, mods + i + 1, num_mods - i - 1);
+			return;
+		}
+	}
+	add_frames(start, end);
+}
+
+/* init_frame_alloc
+   Fill the allocator with the memory the boot loader reports as available past
+   FRAME_MEMORY_START: the regions of its memory map, or the upper memory if it
+   gave no map. The modules, such as the file system image, are left out
+   Input : mbi -- multiboot information
+   Output : None
+   Side Effect : Sets up the free bitmaps
+*/
+void init_frame_alloc(const multiboot_info_t* mbi)
+{
+	const module_t* mods = NULL;
+	uint32_t num_mods = 0;
+	uint32_t order, offset = 0;
+	memory_map_t* mmap;
+
+	for (order = 0; order <= FRAME_MAX_ORDER; order++) {
+		free_map[order] = &free_maps[offset];
+		offset += FREE_MAP_WORDS(order);
+		num_free_blocks[order] = 0;
+		first_free_word[order] = FREE_MAP_WORDS(order);
+	}
+	memset(free_maps, 0, sizeof(free_maps));
+
+	if (mbi->flags & MULTIBOOT_FLAG_MODS) {
+		mods = (const module_t *) mbi->mods_addr;
+		num_mods = mbi->mods_count;
+	}
+	if (mbi->flags & MULTIBOOT_FLAG_MMAP) {
+		for (mmap = (memory_map_t *) mbi->mmap_addr;
+		     (uint32_t) mmap < mbi->mmap_addr + mbi->mmap_length;
+		     mmap = (memory_map_t *) ((uint32_t) mmap + mmap->size + sizeof(mmap->size))) {
+			/* Memory past 4GB cannot be addressed without PAE */
+			if (mmap->type != MMAP_TYPE_AVAILABLE || mmap->base_addr_high != 0)
+				continue;
+			if (mmap->length_high != 0 || mmap->length_low > 0xFFFFFFFF - mmap->base_addr_low)
+				add_free_range(mmap->base_addr_low, 0xFFFFFFFF, mods, num_mods);
+			else
+				add_free_range(mmap->base_addr_low, mmap->base_addr_low + mmap->length_low, mods, num_mods);
+		}
+	} else if (mbi->flags & MULTIBOOT_FLAG_MEM) {
+		add_free_range(UPPER_MEMORY_START, UPPER_MEMORY_START + mbi->mem_upper * KB, mods, num_mods);
+	}
+}
@@ -0,0 +1,29 @@
+/* frame_alloc.h - Defines for the physical frame allocator, a buddy allocator
+ * over the 4KB frames the boot loader reports as free memory
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _FRAME_ALLOC_H
+#define _FRAME_ALLOC_H
+
+#include "types.h"
+#include "multiboot.h"
+
+#define FRAME_SIZE 4096
+#define FRAME_SHIFT 12
+/* Blocks are 2^order frames, up to a 4MB page, aligned to their size */
+#define FRAME_ORDER_4M 10
+#define FRAME_MAX_ORDER FRAME_ORDER_4M
+/* Memory below FRAME_MEMORY_START holds the kernel, its stacks and the video memory,
+   and memory past FRAME_MEMORY_LIMIT is left unused, so the bitmaps stay small */
+#define FRAME_MEMORY_START 0x800000
+#define FRAME_MEMORY_LIMIT 0x40000000
+#define MAX_NUM_FRAMES (FRAME_MEMORY_LIMIT / FRAME_SIZE)
+
+void init_frame_alloc(const multiboot_info_t* mbi);
+uint32_t alloc_frames(uint32_t order);
+void free_frames(uint32_t phys_addr, uint32_t order);
+int32_t can_alloc_frames(uint32_t order);
+uint32_t get_num_free_frames(void);
+
+#endif /* _FRAME_ALLOC_H */
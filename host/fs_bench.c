@@ -0,0 +1,1768 @@
+/* fs_bench.c - Checks and benchmarks the file system driver on the host,
+ * over a real file system image, as built, packed into the compressed layout,
+ * with a large directory, with indirect blocks and a file too large for the
+ * original inodes, mounted from a disk, and laid out again by the image builder,
+ * with the common programs first and every file's blocks adjacent.
+ * Writes go to a private copy of the image, the file on disk is never changed
+ * vim:ts=4 noexpandtab
+ */
+
+#include "types.h"
+#include "lib.h"
+#include "file_system.h"
+#include "pcb.h"
+#include "block_dev.h"
+#include "keyboard.h"
+#include "host_shim.h"
+#include "image_pack.h"
+#include "image_build.h"
+
+#define MAX_READ_SIZE 0x10000
+#define GUARD_BYTE 0xA5
+/* Lookups each lookup benchmark makes, spread over every name */
+#define LOOKUP_COUNT 200000
+/* Names the lookup benchmark can hold, and entries added to the large directory */
+#define MAX_BENCH_NAMES 8192
+#define LARGE_DIR_LINKS 4000
+/* Names whose two first characters are made into a prefix pattern by the find_names
+   checks, and the prefix searches each way the find_names benchmark makes */
+#define FIND_PREFIX_NAMES 16
+#define FIND_PREFIX_LENGTH 2
+#define FIND_COUNT 2000
+/* Image with indirect blocks: a file reaching into the double indirect block, free blocks
+   for a second one written through the driver, and the file descriptor streaming reads use */
+#define MAX_INDIRECT_IMAGE_SIZE 0x2000000
+#define LARGE_FILE_LENGTH ((NUM_DIRECT_BLOCKS + INDICES_PER_BLOCK + 60) * BLOCK_SIZE + 321)
+#define INDIRECT_WRITE_LENGTH ((NUM_DIRECT_BLOCKS + INDICES_PER_BLOCK + 5) * BLOCK_SIZE + 100)
+#define INDIRECT_FREE_BLOCKS 2200
+#define STREAM_FD 2
+#define STREAM_CHUNK 1000
+/* File descriptor send_file writes to, and the bytes per call of the send checks */
+#define SINK_FD 3
+#define SEND_CHUNK 3000
+/* Random positions each file is checked at, and reads of RECORD_SIZE each way the
+   seek benchmark makes at a position */
+#define NUM_RANDOM_SEEKS 20
+#define RECORD_SIZE 100
+#define SEEK_ROUNDS 1000
+#define NUM_SEEK_POINTS 4
+#define NUM_STREAM_SIZES 4
+/* Bytes each read benchmark moves. Small enough that the cycle count fits in 32 bits */
+#define BENCH_BYTES 0x100000
+#define NUM_READ_SIZES 8
+#define NUM_START_OFFSETS 3
+#define RAND_MULTIPLIER 1103515245U
+#define RAND_INCREMENT 12345U
+/* Largest image that can be restored between write checks and benchmarks */
+#define MAX_IMAGE_SIZE 0x1000000
+#define NUM_RECORD_SIZES 4
+#define APPEND_ROUNDS 20
+#define FILL_NAME_LENGTH 8
+#define PERCENT 100
+
+static const uint32_t read_sizes[NUM_READ_SIZES] = {1, 16, 64, 512, 1000, 4096, 16384, MAX_READ_SIZE};
+/* Starting offsets of the sequential scans: aligned, one byte in, and straddling a block */
+static const uint32_t start_offsets[NUM_START_OFFSETS] = {0, 1, BLOCK_SIZE - 1};
+static const uint32_t record_sizes[NUM_RECORD_SIZES] = {16, 64, 100, 512};
+static const uint32_t stream_sizes[NUM_STREAM_SIZES] = {64, 512, 4096, MAX_READ_SIZE};
+
+static uint8_t* image;
+/* Image the driver has mounted */
+static uint8_t* mounted_image;
+static uint32_t image_length;
+/* The image as it was mapped, so writes can be undone */
+static uint8_t pristine_image[MAX_IMAGE_SIZE];
+/* Uncompressed image reference_read follows. The mounted image, unless it is packed */
+static uint8_t* reference;
+static uint8_t packed_image[MAX_IMAGE_SIZE];
+static uint8_t large_dir_image[MAX_IMAGE_SIZE];
+static uint8_t indirect_image[MAX_INDIRECT_IMAGE_SIZE];
+static uint32_t indirect_length;
+/* Disk that serves an image from memory, and how many reads and sectors it was asked for */
+static block_dev_t ram_disk;
+static uint8_t* ram_disk_image;
+static uint32_t ram_disk_reads;
+static uint32_t ram_disk_sectors;
+static uint8_t bench_names[MAX_BENCH_NAMES + 1][MAX_FILE_NAME_LENGTH + 1];
+static uint8_t find_buf[MAX_BENCH_NAMES * (MAX_FILE_NAME_LENGTH + 1)];
+static uint8_t read_buf[MAX_READ_SIZE + 1];
+static uint8_t ref_buf[MAX_READ_SIZE];
+static uint32_t rand_state = 1;
+/* Output of send_file: where the last write went, and the file it should match
+   when sink_checking is set */
+static uint8_t sink_buf[MAX_READ_SIZE];
+static uint32_t sink_checking;
+static uint32_t sink_inode;
+static uint32_t sink_position;
+static uint32_t sink_mismatches;
+/* Calls send_file made to an output it should have refused */
+static uint32_t device_writes;
+
+/* Regular files of the image, so the benchmarks do not walk the directory */
+static uint32_t file_inodes[MAX_NUM_DENTRIES];
+static uint32_t file_lengths[MAX_NUM_DENTRIES];
+static uint32_t num_files;
+/* The first files, whose blocks all fit in the block cache together */
+static uint32_t num_cached_files;
+
+/* next_rand()
+   Linear congruential generator, so every run reads the same offsets
+ */
+static uint32_t next_rand(void) {
+	rand_state = rand_state * RAND_MULTIPLIER + RAND_INCREMENT;
+	return rand_state >> 8;
+}
+
+/* reference_block()
+   Find the data block holding a block of a file by following the image layout
+   directly, through the inode's indirect blocks if the image has them
+   Input : inode_words -- the file's inode
+           block_num -- index of the block inside the file
+   Output : Index of the data block, INVALID_BLOCK if it or an indirect block is out of range
+ */
+static uint32_t reference_block(const uint32_t* inode_words, uint32_t block_num) {
+	uint32_t num_inodes = ((uint32_t *) reference)[1];
+	uint32_t num_blocks = ((uint32_t *) reference)[2];
+	uint32_t features = ((uint32_t *) reference)[3];
+	uint8_t* blocks = reference + BLOCK_SIZE * (1 + num_inodes);
+	uint32_t table;
+
+	if (!(features & FS_FEATURE_INDIRECT) || block_num < NUM_DIRECT_BLOCKS) {
+		return (block_num < MAX_NUM_BLOCKS_IN_INODE)? inode_words[1 + block_num] : INVALID_BLOCK;
+	}
+	block_num -= NUM_DIRECT_BLOCKS;
+	if (block_num < INDICES_PER_BLOCK) {
+		table = inode_words[1 + SINGLE_INDIRECT_SLOT];
+	} else {
+		block_num -= INDICES_PER_BLOCK;
+		table = inode_words[1 + DOUBLE_INDIRECT_SLOT];
+		if (table >= num_blocks || block_num / INDICES_PER_BLOCK >= INDICES_PER_BLOCK) {
+			return INVALID_BLOCK;
+		}
+		table = ((uint32_t *) (blocks + BLOCK_SIZE * table))[block_num / INDICES_PER_BLOCK];
+		block_num %= INDICES_PER_BLOCK;
+	}
+	return (table < num_blocks)? ((uint32_t *) (blocks + BLOCK_SIZE * table))[block_num] : INVALID_BLOCK;
+}
+
+/* reference_read()
+   Read a file by following the image layout directly, without the driver.
+   Used to check what read_data returns
+   Input : inode -- index of inode of the file
+           offset, buf, length -- as for read_data
+   Output : Number of bytes read, -1 if a block index is out of range
+ */
+static int32_t reference_read(uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length) {
+	uint32_t num_inodes = ((uint32_t *) reference)[1];
+	uint32_t num_blocks = ((uint32_t *) reference)[2];
+	uint32_t* inode_words = (uint32_t *) (reference + BLOCK_SIZE * (1 + inode));
+	uint8_t* blocks = reference + BLOCK_SIZE * (1 + num_inodes);
+	uint32_t i;
+
+	if (offset >= inode_words[0]) {
+		return 0;
+	}
+	if (length > inode_words[0] - offset) {
+		length = inode_words[0] - offset;
+	}
+	for (i = 0; i < length; i++) {
+		uint32_t block = reference_block(inode_words, (offset + i) / BLOCK_SIZE);
+		if (block >= num_blocks) {
+			return -1;
+		}
+		buf[i] = blocks[block * BLOCK_SIZE + (offset + i) % BLOCK_SIZE];
+	}
+	return length;
+}
+
+/* check_read()
+   Compare one read_data call against reference_read, and make sure nothing past
+   the returned length was written
+   Output : 0 if they agree, -1 otherwise
+ */
+static int32_t check_read(uint32_t inode, uint32_t offset, uint32_t length) {
+	int32_t expected = reference_read(inode, offset, ref_buf, length);
+	int32_t actual;
+	uint32_t i;
+
+	memset(read_buf, GUARD_BYTE, length + 1);
+	actual = read_data(inode, offset, read_buf, length);
+	if (actual != expected) {
+		printf("FAIL read_data(inode %d, offset %u, length %u) returned %d, expected %d\n",
+		       inode, offset, length, actual, expected);
+		return -1;
+	}
+	for (i = 0; i < length + 1; i++) {
+		if ((int32_t) i < expected && read_buf[i] != ref_buf[i]) {
+			printf("FAIL read_data(inode %d, offset %u, length %u) differs at byte %u\n",
+			       inode, offset, length, i);
+			return -1;
+		}
+		if ((int32_t) i >= expected && read_buf[i] != GUARD_BYTE) {
+			printf("FAIL read_data(inode %d, offset %u, length %u) wrote past byte %d\n",
+			       inode, offset, length, expected);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* check_driver()
+   Look up every directory entry by name, and read every regular file at a set of
+   sizes and offsets around block boundaries and the end of the file
+   Output : Number of failed checks
+ */
+static int32_t check_driver(void) {
+	int32_t failures = 0;
+	uint32_t num_checks = 0;
+	uint8_t name[MAX_FILE_NAME_LENGTH + 1];
+	dentry_t dentry, found;
+	uint32_t i, j, k;
+
+	for (i = 0; read_dentry_by_index(i, &dentry) == 0; i++) {
+		strncpy((int8_t *) name, (int8_t *) dentry.file_name, MAX_FILE_NAME_LENGTH);
+		name[MAX_FILE_NAME_LENGTH] = NULL;
+		num_checks++;
+		if (read_dentry_by_name(name, &found) != 0 || found.inode_idx != dentry.inode_idx ||
+		    found.file_type != dentry.file_type) {
+			printf("FAIL read_dentry_by_name(\"%s\") does not find entry %u\n", name, i);
+			failures++;
+		}
+	}
+	num_checks++;
+	if (read_dentry_by_name((uint8_t *) "no such file", &found) != -1) {
+		printf("FAIL read_dentry_by_name found a file that does not exist\n");
+		failures++;
+	}
+
+	for (i = 0; i < num_files; i++) {
+		uint32_t length = file_lengths[i];
+		uint32_t offsets[] = {0, 1, BLOCK_SIZE - 1, BLOCK_SIZE, BLOCK_SIZE + 1,
+		                      length / 2, length - 1, length, length + 1};
+		for (j = 0; j < sizeof(offsets) / sizeof(offsets[0]); j++) {
+			for (k = 0; k < NUM_READ_SIZES; k++) {
+				num_checks++;
+				failures += (check_read(file_inodes[i], offsets[j], read_sizes[k]) != 0);
+			}
+		}
+	}
+	printf("%u checks, %d failed\n", num_checks, failures);
+	return failures;
+}
+
+/* reference_glob()
+   Match a NUL terminated name against a find_names pattern by trying every run of
+   characters for each '*', independently of the driver's matcher
+   Output : 1 if the whole name matches, 0 otherwise
+ */
+static int32_t reference_glob(const uint8_t* pattern, const uint8_t* name) {
+	if (*pattern == GLOB_ANY) {
+		do {
+			if (reference_glob(pattern + 1, name)) {
+				return 1;
+			}
+		} while (*name++ != NULL);
+		return 0;
+	}
+	if (*pattern == NULL || *name == NULL) {
+		return *pattern == *name;
+	}
+	return (*pattern == GLOB_ONE || *pattern == *name) && reference_glob(pattern + 1, name + 1);
+}
+
+/* check_pattern()
+   Check the names find_names returns for a pattern: every one matches, they come in
+   name order unless the directory has too many names to sort, there are as many as
+   the directory holds, and skipping the ones before each with first starts at that name
+   Output : 0 if every check passed, 1 otherwise
+ */
+static int32_t check_pattern(const uint8_t* pattern) {
+	uint8_t name[MAX_FILE_NAME_LENGTH + 1];
+	uint8_t single[MAX_FILE_NAME_LENGTH + 1];
+	uint32_t num_expected = 0;
+	uint32_t used = 0;
+	const uint8_t* previous = NULL;
+	dentry_t dentry;
+	int32_t num_found, i;
+	uint32_t sorted = (read_dentry_by_index(MAX_NUM_SORTED_NAMES, &dentry) != 0);
+
+	for (i = 0; read_dentry_by_index(i, &dentry) == 0; i++) {
+		strncpy((int8_t *) name, (int8_t *) dentry.file_name, MAX_FILE_NAME_LENGTH);
+		name[MAX_FILE_NAME_LENGTH] = NULL;
+		num_expected += (name[0] != NULL && reference_glob(pattern, name));
+	}
+	num_found = find_names(pattern, find_buf, sizeof(find_buf), 0);
+	if (num_found != num_expected) {
+		printf("FAIL find_names(\"%s\") found %d names, not %u\n", pattern, num_found, num_expected);
+		return 1;
+	}
+	for (i = 0; i < num_found; i++) {
+		const uint8_t* found = &find_buf[used];
+		used += strlen((int8_t *) found) + 1;
+		if (!reference_glob(pattern, found) || read_dentry_by_name(found, &dentry) != 0 ||
+		    (sorted && previous != NULL && strncmp((int8_t *) previous, (int8_t *) found, MAX_FILE_NAME_LENGTH) >= 0)) {
+			printf("FAIL find_names(\"%s\") returned \"%s\" out of order or not matching\n", pattern, found);
+			return 1;
+		}
+		if (i < FIND_PREFIX_NAMES && (find_names(pattern, single, sizeof(single), i) < 1 ||
+		                              strncmp((int8_t *) single, (int8_t *) found, MAX_FILE_NAME_LENGTH) != 0)) {
+			printf("FAIL find_names(\"%s\") skipping %d names does not return \"%s\" first\n", pattern, i, found);
+			return 1;
+		}
+		previous = found;
+	}
+	return 0;
+}
+
+/* check_find_names()
+   Check find_names with fixed patterns, with every name of the first entries, and
+   with prefixes of them; and that it refuses empty patterns and fills nothing
+   when no name fits
+   Output : Number of failed checks
+ */
+static int32_t check_find_names(void) {
+	static const int8_t* const patterns[] = {"*", "?", "*e*", "?e*", "*s", "*.txt", "f*e", "*?*?*?*",
+	                                         "link_12*", "link_??", "no such file*", "**"};
+	uint8_t pattern[MAX_FILE_NAME_LENGTH + 2];
+	uint32_t num_checks = 0;
+	int32_t failures = 0;
+	dentry_t dentry;
+	uint32_t i;
+
+	for (i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++) {
+		num_checks++;
+		failures += check_pattern((const uint8_t *) patterns[i]);
+	}
+	for (i = 0; i < FIND_PREFIX_NAMES && read_dentry_by_index(i, &dentry) == 0; i++) {
+		strncpy((int8_t *) pattern, (int8_t *) dentry.file_name, MAX_FILE_NAME_LENGTH);
+		pattern[MAX_FILE_NAME_LENGTH] = NULL;
+		if (pattern[0] == NULL) {
+			continue;
+		}
+		num_checks++;
+		failures += check_pattern(pattern);
+		pattern[FIND_PREFIX_LENGTH] = GLOB_ANY;
+		pattern[FIND_PREFIX_LENGTH + 1] = NULL;
+		num_checks++;
+		failures += check_pattern(pattern);
+	}
+	num_checks += 2;
+	if (find_names((uint8_t *) "", find_buf, sizeof(find_buf), 0) != -1) {
+		printf("FAIL find_names accepted an empty pattern\n");
+		failures++;
+	}
+	find_buf[1] = GUARD_BYTE;
+	if (find_names((uint8_t *) "*", find_buf, 1, 0) != 0 || find_buf[1] != GUARD_BYTE) {
+		printf("FAIL find_names put a name in a buffer too small for it\n");
+		failures++;
+	}
+	printf("find_names: %u checks, %d failed\n", num_checks, failures);
+	return failures;
+}
+
+/* bench_lookup()
+   Average cycles of read_dentry_by_name over every name in the directory and a miss
+ */
+static void bench_lookup(void) {
+	uint32_t num_names = 0;
+	uint32_t cycles = 0;
+	uint32_t start, round, num_rounds, i;
+	dentry_t dentry;
+
+	while (num_names < MAX_BENCH_NAMES && read_dentry_by_index(num_names, &dentry) == 0) {
+		strncpy((int8_t *) bench_names[num_names], (int8_t *) dentry.file_name, MAX_FILE_NAME_LENGTH);
+		bench_names[num_names][MAX_FILE_NAME_LENGTH] = NULL;
+		num_names++;
+	}
+	strcpy((int8_t *) bench_names[num_names++], "no such file");
+
+	num_rounds = LOOKUP_COUNT / num_names + 1;
+	for (round = 0; round < num_rounds; round++) {
+		start = rdtsc();
+		for (i = 0; i < num_names; i++) {
+			read_dentry_by_name(bench_names[i], &dentry);
+		}
+		cycles += rdtsc() - start;
+	}
+	printf("lookup: %u names, %u cycles/lookup\n", num_names, cycles / (num_rounds * num_names));
+}
+
+/* bench_listing()
+   Average cycles per entry of listing the whole directory with read_dir and with
+   read_dentry_by_index
+ */
+static void bench_listing(void) {
+	uint8_t name[MAX_FILE_NAME_LENGTH];
+	uint32_t num_entries = 0;
+	uint32_t start, dir_cycles, index_cycles;
+	dentry_t dentry;
+
+	start = rdtsc();
+	while (read_dir(NULL, num_entries, name, MAX_FILE_NAME_LENGTH) > 0) {
+		num_entries++;
+	}
+	dir_cycles = rdtsc() - start;
+	start = rdtsc();
+	for (num_entries = 0; read_dentry_by_index(num_entries, &dentry) == 0; num_entries++) {
+	}
+	index_cycles = rdtsc() - start;
+	printf("listing: %u entries, read_dir %u cycles/entry, read_dentry_by_index %u cycles/entry\n",
+	       num_entries, dir_cycles / (num_entries + 1), index_cycles / (num_entries + 1));
+}
+
+/* bench_find_names()
+   Average cycles of finding the names that start with the first characters of each
+   name, with find_names and by listing the whole directory with read_dir the way a
+   program has to without it
+ */
+static void bench_find_names(void) {
+	uint8_t prefixes[FIND_PREFIX_NAMES][FIND_PREFIX_LENGTH + 2];
+	uint32_t prefix_lengths[FIND_PREFIX_NAMES];
+	uint8_t name[MAX_FILE_NAME_LENGTH];
+	uint32_t num_prefixes = 0;
+	uint32_t find_cycles = 0;
+	uint32_t scan_cycles = 0;
+	uint32_t find_matches = 0;
+	uint32_t scan_matches = 0;
+	uint32_t start, round, num_rounds, offset, length, i;
+	int32_t name_length;
+	dentry_t dentry;
+
+	for (i = 0; num_prefixes < FIND_PREFIX_NAMES && read_dentry_by_index(i, &dentry) == 0; i++) {
+		if (dentry.file_name[0] == NULL) {
+			continue;
+		}
+		for (length = 0; length < FIND_PREFIX_LENGTH && dentry.file_name[length] != NULL; length++) {
+			prefixes[num_prefixes][length] = dentry.file_name[length];
+		}
+		prefixes[num_prefixes][length] = GLOB_ANY;
+		prefixes[num_prefixes][length + 1] = NULL;
+		prefix_lengths[num_prefixes++] = length;
+	}
+	if (num_prefixes == 0) {
+		return;
+	}
+
+	num_rounds = FIND_COUNT / num_prefixes + 1;
+	for (round = 0; round < num_rounds; round++) {
+		start = rdtsc();
+		for (i = 0; i < num_prefixes; i++) {
+			find_matches += find_names(prefixes[i], find_buf, sizeof(find_buf), 0);
+		}
+		find_cycles += rdtsc() - start;
+		start = rdtsc();
+		for (i = 0; i < num_prefixes; i++) {
+			for (offset = 0; (name_length = read_dir(NULL, offset, name, MAX_FILE_NAME_LENGTH)) > 0; offset++) {
+				scan_matches += (name_length >= prefix_lengths[i] &&
+				                 strncmp((int8_t *) name, (int8_t *) prefixes[i], prefix_lengths[i]) == 0);
+			}
+		}
+		scan_cycles += rdtsc() - start;
+	}
+	if (find_matches != scan_matches) {
+		printf("find_names: found %u names, the scan %u\n", find_matches, scan_matches);
+	}
+	printf("find_names: %u matches/prefix, find_names %u cycles/prefix, read_dir scan %u cycles/prefix\n",
+	       find_matches / (num_rounds * num_prefixes), find_cycles / (num_rounds * num_prefixes),
+	       scan_cycles / (num_rounds * num_prefixes));
+}
+
+/* print_read_result()
+   Finish a line of read benchmark results
+ */
+static void print_read_result(uint32_t size, uint32_t num_calls, uint32_t bytes, uint32_t cycles) {
+	printf("size %u: %u calls, %u cycles/call, %u cycles/KB\n",
+	       size, num_calls, cycles / num_calls, cycles / (bytes / 1024 + 1));
+}
+
+/* bench_sequential_read()
+   Read every regular file front to back, size bytes per call starting at
+   start_offset, going round the files until BENCH_BYTES have been read
+ */
+static void bench_sequential_read(uint32_t size, uint32_t start_offset) {
+	uint32_t bytes = 0;
+	uint32_t num_calls = 0;
+	uint32_t file = 0;
+	uint32_t offset = start_offset;
+	int32_t bytes_read;
+	uint32_t start = rdtsc();
+
+	while (bytes < BENCH_BYTES) {
+		bytes_read = read_data(file_inodes[file], offset, read_buf, size);
+		num_calls++;
+		if (bytes_read > 0) {
+			bytes += bytes_read;
+			offset += bytes_read;
+		} else {
+			file = (file + 1) % num_files;
+			offset = start_offset;
+		}
+	}
+	uint32_t cycles = rdtsc() - start;
+	printf("sequential offset %u, ", start_offset);
+	print_read_result(size, num_calls, bytes, cycles);
+}
+
+/* bench_random_read()
+   Read size bytes per call at a random offset of a random regular file,
+   until BENCH_BYTES have been read
+ */
+static void bench_random_read(uint32_t size) {
+	uint32_t bytes = 0;
+	uint32_t num_calls = 0;
+	uint32_t file;
+	int32_t bytes_read;
+	uint32_t start = rdtsc();
+
+	while (bytes < BENCH_BYTES) {
+		file = next_rand() % num_files;
+		bytes_read = read_data(file_inodes[file], next_rand() % file_lengths[file], read_buf, size);
+		num_calls++;
+		if (bytes_read > 0) {
+			bytes += bytes_read;
+		}
+	}
+	uint32_t cycles = rdtsc() - start;
+	printf("random, ");
+	print_read_result(size, num_calls, bytes, cycles);
+}
+
+/* bench_memcpy()
+   Copy BENCH_BYTES out of the image's data blocks, size bytes per memcpy, front to back.
+   The bandwidth read_data would reach if it cost nothing but the copy
+ */
+static void bench_memcpy(uint32_t size) {
+	uint32_t num_inodes = ((uint32_t *) image)[1];
+	uint32_t blocks_size = ((uint32_t *) image)[2] * BLOCK_SIZE;
+	uint8_t* blocks = image + BLOCK_SIZE * (1 + num_inodes);
+	uint32_t bytes = 0;
+	uint32_t num_calls = 0;
+	uint32_t offset = 0;
+	uint32_t start = rdtsc();
+
+	while (bytes < BENCH_BYTES) {
+		if (offset + size > blocks_size) {
+			offset = 0;
+		}
+		memcpy(read_buf, blocks + offset, size);
+		offset += size;
+		bytes += size;
+		num_calls++;
+	}
+	uint32_t cycles = rdtsc() - start;
+	printf("memcpy, ");
+	print_read_result(size, num_calls, bytes, cycles);
+}
+
+/* restore_image()
+   Undo every write to the image and mount it again
+ */
+static void restore_image(void) {
+	memcpy(image, pristine_image, image_length);
+	init_file_system((uint32_t) image, (uint32_t) image + image_length);
+}
+
+/* inode_of()
+   Pointer to an inode of the image, as close_file and write_file take it
+ */
+static inode_t* inode_of(uint32_t inode) {
+	return (inode_t *) (mounted_image + BLOCK_SIZE * (1 + inode));
+}
+
+/* record_byte()
+   Byte at a position of the data the write checks put in a file
+ */
+static uint8_t record_byte(uint32_t seed, uint32_t position) {
+	return (uint8_t) (seed * 131 + position * 7 + position / BLOCK_SIZE);
+}
+
+/* append_records()
+   Append records of growing sizes to a file until it is length bytes long or
+   the file system is full
+   Output : length of the file afterwards
+ */
+static uint32_t append_records(uint32_t inode, uint32_t seed, uint32_t length) {
+	uint32_t position = get_file_length(inode);
+	uint32_t size = 1;
+	uint32_t i;
+	int32_t written;
+
+	while (position < length) {
+		size = (size % 700) + 37;
+		size = (size > length - position)? length - position : size;
+		for (i = 0; i < size; i++) {
+			read_buf[i] = record_byte(seed, position + i);
+		}
+		written = write_data(inode, position, read_buf, size);
+		if (written <= 0) {
+			break;
+		}
+		position += written;
+	}
+	return position;
+}
+
+/* check_contents()
+   Compare a file written by append_records with what it should hold
+   Output : 0 if it matches, -1 otherwise
+ */
+static int32_t check_contents(uint32_t inode, uint32_t seed, uint32_t length) {
+	uint32_t offset, i;
+	int32_t bytes_read;
+
+	if (get_file_length(inode) != length) {
+		printf("FAIL inode %d is %d bytes long, expected %u\n", inode, get_file_length(inode), length);
+		return -1;
+	}
+	for (offset = 0; offset < length; offset += bytes_read) {
+		bytes_read = read_data(inode, offset, read_buf, BLOCK_SIZE + 3);
+		if (bytes_read <= 0) {
+			printf("FAIL inode %d cannot be read at offset %u\n", inode, offset);
+			return -1;
+		}
+		for (i = 0; i < bytes_read; i++) {
+			if (read_buf[i] != record_byte(seed, offset + i)) {
+				printf("FAIL inode %d differs at offset %u\n", inode, offset + i);
+				return -1;
+			}
+		}
+	}
+	return check_read(inode, 0, MAX_READ_SIZE) | check_read(inode, length / 3, MAX_READ_SIZE);
+}
+
+/* check_write()
+   Create files and write them through the driver: appends, an overwrite,
+   a write past the end, closing, and filling the file system and the directory.
+   The image is restored afterwards
+   Output : Number of failed checks
+ */
+static int32_t check_write(void) {
+	int32_t failures = 0;
+	int32_t free_blocks = get_num_free_blocks();
+	uint8_t name[FILL_NAME_LENGTH + 1] = "fill_000";
+	dentry_t dentry;
+	uint32_t length, num_created, i;
+	uint32_t fill_inodes[MAX_NUM_DENTRIES];
+	uint32_t fill_lengths[MAX_NUM_DENTRIES];
+
+	if (create_file((uint8_t *) "write_test", &dentry) != 0 ||
+	    create_file((uint8_t *) "write_test", &dentry) != -1 ||
+	    read_dentry_by_name((uint8_t *) "write_test", &dentry) != 0) {
+		printf("FAIL create_file of write_test\n");
+		restore_image();
+		return 1;
+	}
+
+	length = append_records(dentry.inode_idx, 1, 3 * BLOCK_SIZE + 123);
+	failures += (length != 3 * BLOCK_SIZE + 123 || check_contents(dentry.inode_idx, 1, length) != 0);
+
+	/* Overwrite the middle of the file with the same bytes at another seed's positions */
+	for (i = 0; i < BLOCK_SIZE; i++) {
+		read_buf[i] = record_byte(1, BLOCK_SIZE / 2 + i);
+	}
+	failures += (write_file(inode_of(dentry.inode_idx), BLOCK_SIZE / 2, read_buf, BLOCK_SIZE) != BLOCK_SIZE ||
+	             check_contents(dentry.inode_idx, 1, length) != 0);
+	if (write_data(dentry.inode_idx, length + 1, read_buf, 1) != -1) {
+		printf("FAIL write_data past the end of the file\n");
+		failures++;
+	}
+
+	close_file(inode_of(dentry.inode_idx));
+	if (get_num_free_blocks() != free_blocks - 4) {
+		printf("FAIL %d blocks free after close, expected %d\n", get_num_free_blocks(), free_blocks - 4);
+		failures++;
+	}
+
+	/* Fill the directory and the data blocks */
+	for (num_created = 0; create_file(name, &dentry) == 0; num_created++) {
+		fill_inodes[num_created] = dentry.inode_idx;
+		fill_lengths[num_created] = append_records(dentry.inode_idx, num_created + 2, 5 * BLOCK_SIZE);
+		close_file(inode_of(dentry.inode_idx));
+		name[FILL_NAME_LENGTH - 1]++;
+		if (name[FILL_NAME_LENGTH - 1] > '9') {
+			name[FILL_NAME_LENGTH - 1] = '0';
+			name[FILL_NAME_LENGTH - 2]++;
+		}
+	}
+	if (get_num_free_blocks() != 0) {
+		printf("FAIL %d blocks still free after filling the file system\n", get_num_free_blocks());
+		failures++;
+	}
+	for (i = 0; i < num_created; i++) {
+		failures += (check_contents(fill_inodes[i], i + 2, fill_lengths[i]) != 0);
+	}
+	failures += (check_driver() != 0);
+
+	printf("write: created %u files, %d failed\n", num_created + 1, failures);
+	restore_image();
+	return failures;
+}
+
+/* bench_append()
+   Append records of size bytes to a new file until the file system is full,
+   APPEND_ROUNDS times over a restored image, and print the throughput
+ */
+static void bench_append(uint32_t size) {
+	uint32_t bytes = 0;
+	uint32_t num_calls = 0;
+	uint32_t elapsed_us = 0;
+	uint32_t cycles = 0;
+	uint32_t round, start_us, start;
+	dentry_t dentry;
+	int32_t written;
+
+	memset(read_buf, 'x', size);
+	for (round = 0; round < APPEND_ROUNDS; round++) {
+		restore_image();
+		create_file((uint8_t *) "append_bench", &dentry);
+		start_us = host_time_us();
+		start = rdtsc();
+		while ((written = write_data(dentry.inode_idx, get_file_length(dentry.inode_idx), read_buf, size)) > 0) {
+			bytes += written;
+			num_calls++;
+		}
+		cycles += rdtsc() - start;
+		elapsed_us += host_time_us() - start_us;
+	}
+	restore_image();
+	printf("append, record %u: %u records, %u cycles/record, %u MB/s\n",
+	       size, num_calls, cycles / num_calls, bytes / (elapsed_us + 1));
+}
+
+/* check_sorted()
+   Check the image build_sorted_image made from the original: after the directory, the
+   entries named by DEFAULT_FIRST_NAMES come first, every file has the contents it had
+   under the same name, and every file is one run of blocks right after the previous file's
+   Output : Number of failed checks
+ */
+static int32_t check_sorted(void) {
+	static const int8_t* const first_names[] = DEFAULT_FIRST_NAMES;
+	const fs_stat_t* stat = (const fs_stat_t *) pristine_image;
+	const dentry_t* entries = (const dentry_t *) (pristine_image + DENTRY_SIZE);
+	uint32_t num_checks = 0;
+	uint32_t next_block = 0;
+	uint32_t next_inode = 0;
+	int32_t failures = 0;
+	uint32_t i, j, k, offset;
+	int32_t m;
+	dentry_t dentry;
+
+	reference = pristine_image;
+	for (i = 0, j = 0; j < sizeof(first_names) / sizeof(first_names[0]); j++) {
+		for (k = 0; k < stat->num_dir_entries; k++) {
+			if (strncmp((int8_t *) entries[k].file_name, first_names[j], MAX_FILE_NAME_LENGTH) == 0) {
+				break;
+			}
+		}
+		if (k == stat->num_dir_entries) {
+			continue;
+		}
+		/* Entry 0 is the directory */
+		num_checks++;
+		if (read_dentry_by_index(++i, &dentry) != 0 ||
+		    strncmp((int8_t *) dentry.file_name, first_names[j], MAX_FILE_NAME_LENGTH) != 0) {
+			printf("FAIL entry %u is not %s\n", i, first_names[j]);
+			failures++;
+		}
+	}
+
+	for (i = 0; read_dentry_by_index(i, &dentry) == 0; i++) {
+		if (dentry.file_type != FILE_TYPE_FILE) {
+			continue;
+		}
+		for (k = 0; k < stat->num_dir_entries; k++) {
+			if (strncmp((int8_t *) entries[k].file_name, (int8_t *) dentry.file_name, MAX_FILE_NAME_LENGTH) == 0) {
+				break;
+			}
+		}
+		num_checks++;
+		if (k == stat->num_dir_entries) {
+			printf("FAIL %s is not in the original image\n", dentry.file_name);
+			failures++;
+			continue;
+		}
+		int32_t length = get_file_length(dentry.inode_idx);
+		int32_t bytes_read = 0;
+		for (offset = 0; offset <= (uint32_t) length; offset += MAX_READ_SIZE) {
+			bytes_read = read_data(dentry.inode_idx, offset, read_buf, MAX_READ_SIZE);
+			if (bytes_read != reference_read(entries[k].inode_idx, offset, ref_buf, MAX_READ_SIZE)) {
+				break;
+			}
+			for (m = 0; m < bytes_read && read_buf[m] == ref_buf[m]; m++) {
+			}
+			if (m != bytes_read) {
+				break;
+			}
+		}
+		if (offset <= (uint32_t) length) {
+			printf("FAIL %s does not have its original contents\n", dentry.file_name);
+			failures++;
+		}
+
+		/* Inodes are handed out in entry order, a file whose inode is older shares it */
+		if (dentry.inode_idx < next_inode) {
+			continue;
+		}
+		inode_t* inode = inode_of(dentry.inode_idx);
+		num_checks++;
+		for (k = 0; k < (length + BLOCK_SIZE - 1) / BLOCK_SIZE && inode->block_idx[k] == next_block + k; k++) {
+		}
+		if (dentry.inode_idx != next_inode || k != (length + BLOCK_SIZE - 1) / BLOCK_SIZE) {
+			printf("FAIL %s is not one run of blocks after the previous file\n", dentry.file_name);
+			failures++;
+		}
+		next_inode = dentry.inode_idx + 1;
+		next_block += k;
+	}
+	printf("sorted layout: %u checks, %d failed\n", num_checks, failures);
+	return failures;
+}
+
+/* list_files()
+   List the regular files of the mounted image
+   Output : 0 on success, -1 if the image has no regular files
+ */
+static int32_t list_files(void) {
+	dentry_t dentry;
+	uint32_t i;
+	uint32_t cached_blocks = 0;
+
+	num_files = 0;
+	num_cached_files = 0;
+	for (i = 0; num_files < MAX_NUM_DENTRIES && read_dentry_by_index(i, &dentry) == 0; i++) {
+		if (dentry.file_type == FILE_TYPE_FILE && get_file_length(dentry.inode_idx) > 0) {
+			file_inodes[num_files] = dentry.inode_idx;
+			file_lengths[num_files] = get_file_length(dentry.inode_idx);
+			cached_blocks += (file_lengths[num_files] + BLOCK_SIZE - 1) / BLOCK_SIZE;
+			if (num_cached_files == num_files && (cached_blocks <= BLOCK_CACHE_SIZE || num_files == 0)) {
+				num_cached_files++;
+			}
+			num_files++;
+		}
+	}
+	if (num_files == 0) {
+		printf("no regular files in the image\n");
+		return -1;
+	}
+	return 0;
+}
+
+/* mount_image()
+   Mount an image and list its regular files
+   Output : 0 on success, -1 if the image has no regular files
+ */
+static int32_t mount_image(uint8_t* base, uint32_t length) {
+	init_file_system((uint32_t) base, (uint32_t) base + length);
+	mounted_image = base;
+	return list_files();
+}
+
+/* run_image()
+   Mount the image, check the driver against it and, unless check_only is set,
+   benchmark it
+   Output : 0 if every check passed, -1 otherwise
+ */
+static int32_t run_image(uint32_t length, int32_t check_only) {
+	uint32_t i, j;
+
+	reference = image;
+	if (mount_image(image, length) != 0) {
+		return -1;
+	}
+	if (check_driver() != 0 || check_find_names() != 0) {
+		return -1;
+	}
+	if (check_only) {
+		return 0;
+	}
+
+	bench_lookup();
+	bench_listing();
+	bench_find_names();
+	for (i = 0; i < NUM_READ_SIZES; i++) {
+		for (j = 0; j < NUM_START_OFFSETS; j++) {
+			bench_sequential_read(read_sizes[i], start_offsets[j]);
+		}
+	}
+	for (i = 0; i < NUM_READ_SIZES; i++) {
+		bench_random_read(read_sizes[i]);
+	}
+	return 0;
+}
+
+/* read_cached_files()
+   Read the files that fit in the block cache front to back, size bytes per call
+   Input : num_calls -- incremented by the number of read_data calls
+   Output : Number of bytes read
+ */
+static uint32_t read_cached_files(uint32_t size, uint32_t* num_calls) {
+	uint32_t bytes = 0;
+	uint32_t i, offset;
+	int32_t bytes_read;
+
+	for (i = 0; i < num_cached_files; i++) {
+		offset = 0;
+		do {
+			bytes_read = read_data(file_inodes[i], offset, read_buf, size);
+			(*num_calls)++;
+			if (bytes_read > 0) {
+				bytes += bytes_read;
+				offset += bytes_read;
+			}
+		} while (bytes_read > 0);
+	}
+	return bytes;
+}
+
+/* bench_cached_read()
+   Read the files that fit in the block cache over and over, until BENCH_BYTES have
+   been read. A cold cache is emptied before every pass, so each block is decompressed
+   or read from the disk once per pass; a warm cache is filled before timing starts
+ */
+static void bench_cached_read(uint32_t size, int32_t cold) {
+	block_cache_stats_t stats, total;
+	uint32_t bytes = 0;
+	uint32_t num_calls = 0;
+	uint32_t start;
+
+	reset_block_cache();
+	if (!cold) {
+		read_cached_files(size, &num_calls);
+		num_calls = 0;
+	}
+	get_block_cache_stats(&total);
+	total.hits = -total.hits;
+	total.misses = -total.misses;
+	total.fill_cycles = -total.fill_cycles;
+	start = rdtsc();
+	while (bytes < BENCH_BYTES) {
+		bytes += read_cached_files(size, &num_calls);
+		if (cold) {
+			/* Statistics are reset with the cache, so count them first */
+			get_block_cache_stats(&stats);
+			total.hits += stats.hits;
+			total.misses += stats.misses;
+			total.fill_cycles += stats.fill_cycles;
+			reset_block_cache();
+		}
+	}
+	uint32_t cycles = rdtsc() - start;
+	get_block_cache_stats(&stats);
+	total.hits += stats.hits;
+	total.misses += stats.misses;
+	total.fill_cycles += stats.fill_cycles;
+
+	printf("%s cache, ", cold? "cold" : "warm");
+	print_read_result(size, num_calls, bytes, cycles);
+	printf("    %u%% hits, %u blocks read in, %u cycles/block\n",
+	       total.hits * PERCENT / (total.hits + total.misses), total.misses,
+	       (total.misses > 0)? total.fill_cycles / total.misses : 0);
+}
+
+/* run_packed_image()
+   Pack the original image, mount the packed copy, check the driver against the
+   original and that the packed image refuses writes and mmap, and unless check_only
+   is set, benchmark reads with a cold and a warm block cache
+   Output : 0 if every check passed, -1 otherwise
+ */
+static int32_t run_packed_image(int32_t check_only) {
+	uint32_t num_inodes = ((uint32_t *) pristine_image)[1];
+	uint32_t num_blocks = ((uint32_t *) pristine_image)[2];
+	/* Everything past the inodes: the offset table and the compressed blocks */
+	uint32_t packed_data_size;
+	uint32_t packed_length = pack_image(pristine_image, image_length, packed_image, MAX_IMAGE_SIZE);
+	dentry_t dentry;
+	uint32_t i;
+	int32_t failures = 0;
+
+	if (packed_length == 0) {
+		printf("cannot pack the image\n");
+		return -1;
+	}
+	packed_data_size = packed_length - BLOCK_SIZE * (1 + num_inodes);
+	printf("packed: %u bytes into %u, data blocks packed to %u%% of their size\n", image_length, packed_length,
+	       packed_data_size * PERCENT / (num_blocks * BLOCK_SIZE + 1));
+	reference = pristine_image;
+	if (mount_image(packed_image, packed_length) != 0 || check_driver() != 0) {
+		return -1;
+	}
+	failures += (write_data(file_inodes[0], 0, read_buf, 1) != -1);
+	failures += (create_file((uint8_t *) "packed", &dentry) != -1);
+	failures += (get_block_addr(file_inodes[0], 0) != NULL);
+	failures += (get_num_free_blocks() != 0);
+	printf("read only: 4 checks, %d failed\n", failures);
+	if (failures != 0 || check_only) {
+		return -failures;
+	}
+
+	for (i = 0; i < NUM_READ_SIZES; i++) {
+		bench_cached_read(read_sizes[i], 1);
+		bench_cached_read(read_sizes[i], 0);
+	}
+	return 0;
+}
+
+/* check_large_dir()
+   Check what only a large directory can do: list every entry with read_dir, create
+   a file past the 63 entries of the boot block, and find it again after a remount
+   Input : length -- size of the mounted large directory image
+   Output : Number of failed checks
+ */
+static int32_t check_large_dir(uint32_t length) {
+	uint8_t name[MAX_FILE_NAME_LENGTH];
+	uint32_t num_entries, num_listed;
+	int32_t failures = 0;
+	dentry_t dentry, found;
+
+	for (num_entries = 0; read_dentry_by_index(num_entries, &dentry) == 0; num_entries++) {
+	}
+	for (num_listed = 0; read_dir(NULL, num_listed, name, MAX_FILE_NAME_LENGTH) > 0; num_listed++) {
+	}
+	if (num_entries <= MAX_NUM_DENTRIES || num_listed != num_entries) {
+		printf("FAIL large directory has %u entries, read_dir lists %u\n", num_entries, num_listed);
+		failures++;
+	}
+	if (create_file((uint8_t *) "created_in_large", &dentry) != 0 ||
+	    write_data(dentry.inode_idx, 0, (uint8_t *) "large", strlen("large")) != strlen("large")) {
+		printf("FAIL cannot create a file in the large directory\n");
+		return failures + 1;
+	}
+	if (find_names((uint8_t *) "created_in_l*", find_buf, sizeof(find_buf), 0) != 1 ||
+	    strncmp((int8_t *) find_buf, "created_in_large", strlen("created_in_large") + 1) != 0) {
+		printf("FAIL find_names does not find the created file\n");
+		failures++;
+	}
+	init_file_system((uint32_t) large_dir_image, (uint32_t) large_dir_image + length);
+	if (read_dentry_by_name((uint8_t *) "created_in_large", &found) != 0 || found.inode_idx != dentry.inode_idx ||
+	    read_dentry_by_index(num_entries, &found) != 0 || found.inode_idx != dentry.inode_idx ||
+	    get_file_length(found.inode_idx) != strlen("large")) {
+		printf("FAIL created file is not in the large directory after a remount\n");
+		failures++;
+	}
+	if (create_file((uint8_t *) "created_in_large", &dentry) != -1) {
+		printf("FAIL created a second file with the same name\n");
+		failures++;
+	}
+	printf("large directory: %u entries, 5 checks, %d failed\n", num_entries, failures);
+	return failures;
+}
+
+/* run_large_dir_image()
+   Convert the original image to a large directory with LARGE_DIR_LINKS more entries,
+   check the driver against it and, unless check_only is set, benchmark lookups and
+   listings at that size
+   Output : 0 if every check passed, -1 otherwise
+ */
+static int32_t run_large_dir_image(int32_t check_only) {
+	uint32_t length = build_large_dir_image(pristine_image, image_length, large_dir_image, MAX_IMAGE_SIZE,
+	                                        LARGE_DIR_LINKS);
+	if (length == 0) {
+		printf("cannot build a large directory\n");
+		return -1;
+	}
+	reference = large_dir_image;
+	if (mount_image(large_dir_image, length) != 0 || check_driver() != 0 || check_find_names() != 0) {
+		return -1;
+	}
+	if (!check_only) {
+		bench_lookup();
+		bench_listing();
+		bench_find_names();
+	}
+	return (check_large_dir(length) == 0)? 0 : -1;
+}
+
+/* open_stream()
+   Open a file on STREAM_FD of the host's process, the way the open system call does
+   Output : The file descriptor
+ */
+static file_desc_t* open_stream(const dentry_t* dentry) {
+	file_desc_t* file_desc = get_file_desc(get_pcb_ptr(), STREAM_FD);
+	open_file(dentry, file_desc);
+	file_desc->file_position = 0;
+	return file_desc;
+}
+
+/* terminal_write()
+   Stands in for the kernel's terminal as the write function of SINK_FD. Copies the
+   bytes into sink_buf, MAX_READ_SIZE at a time, the way the terminal copies them to
+   video memory, and with sink_checking compares them with the file at sink_position
+   Output : length
+ */
+int32_t terminal_write(uint32_t fd, uint32_t offset, const uint8_t* buf, uint32_t length) {
+	uint32_t done, size, i;
+
+	for (done = 0; done < length; done += size) {
+		size = min(length - done, MAX_READ_SIZE);
+		memcpy(sink_buf, buf + done, size);
+		if (!sink_checking) {
+			continue;
+		}
+		if (reference_read(sink_inode, sink_position, ref_buf, size) != size) {
+			sink_mismatches++;
+		}
+		for (i = 0; i < size && sink_buf[i] == ref_buf[i]; i++) {
+		}
+		sink_mismatches += (i < size);
+		sink_position += size;
+	}
+	return length;
+}
+
+/* device_write()
+   Write function of a device other than the terminal, such as the RTC, which send_file
+   must not hand the bytes of a file to
+   Output : length
+ */
+static int32_t device_write(int32_t fd, uint32_t offset, const uint8_t* buf, uint32_t length) {
+	device_writes++;
+	return length;
+}
+
+/* open_sink()
+   Open SINK_FD of the host's process on terminal_write, or on a regular file
+   Input : dentry -- the regular file, NULL for terminal_write
+ */
+static void open_sink(const dentry_t* dentry) {
+	static file_ops_t sink_ops = {NULL, NULL, terminal_write, NULL};
+	static file_ops_t file_ops = {NULL, NULL, write_file_wrapper, NULL};
+	file_desc_t* file_desc = get_file_desc(get_pcb_ptr(), SINK_FD);
+
+	file_desc->file_ops = &sink_ops;
+	if (dentry != NULL) {
+		open_file(dentry, file_desc);
+		file_desc->file_ops = &file_ops;
+		file_desc->file_position = get_file_length(dentry->inode_idx);
+	}
+}
+
+/* check_send()
+   Send every regular file to terminal_write, SEND_CHUNK bytes per call, and on a writable
+   image the first one whole in one call to a new file, and compare what arrived with
+   the reference image. The image is restored afterwards if it was written
+   Output : Number of failed checks
+ */
+static int32_t check_send(void) {
+	static file_ops_t device_ops = {NULL, NULL, device_write, NULL};
+	uint32_t num_checks = 0;
+	int32_t failures = 0;
+	uint32_t i, length, sent, offset;
+	int32_t bytes_sent, bytes_read;
+	dentry_t dentry, first, copy;
+	file_desc_t* stream;
+
+	open_sink(NULL);
+	sink_checking = 1;
+	first.file_type = FILE_TYPE_RTC;
+	for (i = 0; read_dentry_by_index(i, &dentry) == 0; i++) {
+		if (dentry.file_type != FILE_TYPE_FILE) {
+			continue;
+		}
+		if (first.file_type != FILE_TYPE_FILE) {
+			first = dentry;
+		}
+		num_checks++;
+		length = get_file_length(dentry.inode_idx);
+		open_stream(&dentry);
+		sink_inode = dentry.inode_idx;
+		sink_position = 0;
+		sink_mismatches = 0;
+		for (sent = 0; (bytes_sent = send_file(STREAM_FD, SINK_FD, SEND_CHUNK)) > 0; sent += bytes_sent) {
+		}
+		if (bytes_sent != 0 || sent != length || sink_position != length || sink_mismatches != 0) {
+			printf("FAIL sending inode %u: %u of %u bytes, %u differ\n", dentry.inode_idx, sent, length,
+			       sink_mismatches);
+			failures++;
+		}
+	}
+	sink_checking = 0;
+
+	/* A device other than the terminal is refused, and nothing is written to it or read */
+	if (first.file_type == FILE_TYPE_FILE) {
+		num_checks++;
+		stream = open_stream(&first);
+		get_file_desc(get_pcb_ptr(), SINK_FD)->file_ops = &device_ops;
+		device_writes = 0;
+		bytes_sent = send_file(STREAM_FD, SINK_FD, SEND_CHUNK);
+		if (bytes_sent != -1 || device_writes != 0 || stream->file_position != 0) {
+			printf("FAIL sending inode %u to a device: %d bytes sent, %u writes\n", first.inode_idx,
+			       bytes_sent, device_writes);
+			failures++;
+		}
+		open_sink(NULL);
+	}
+
+	/* A regular file as the output */
+	if (first.file_type == FILE_TYPE_FILE && create_file((uint8_t *) "sent", &copy) == 0) {
+		num_checks++;
+		length = get_file_length(first.inode_idx);
+		open_stream(&first);
+		open_sink(&copy);
+		bytes_sent = send_file(STREAM_FD, SINK_FD, length + 1);
+		for (offset = 0; offset < length; offset += bytes_read) {
+			bytes_read = read_data(copy.inode_idx, offset, read_buf, MAX_READ_SIZE);
+			if (bytes_read <= 0 || reference_read(first.inode_idx, offset, ref_buf, bytes_read) != bytes_read) {
+				break;
+			}
+			for (i = 0; i < bytes_read && read_buf[i] == ref_buf[i]; i++) {
+			}
+			if (i < bytes_read) {
+				break;
+			}
+		}
+		if (bytes_sent != length || get_file_length(copy.inode_idx) != length || offset < length) {
+			printf("FAIL sending inode %u to a file: %d of %u bytes, copy differs at offset %u\n",
+			       first.inode_idx, bytes_sent, length, offset);
+			failures++;
+		}
+		restore_image();
+	}
+	printf("send_file: %u checks, %d failed\n", num_checks, failures);
+	return failures;
+}
+
+/* bench_send()
+   Move every regular file to terminal_write, size bytes per call, as a program that reads
+   into its buffer and writes it out does, then with send_file, until BENCH_BYTES have been
+   moved each way. Prints the calls and cycles per KB of both
+ */
+static void bench_send(uint32_t size) {
+	uint32_t bytes[2] = {0, 0};
+	uint32_t calls[2] = {0, 0};
+	uint32_t cycles[2] = {0, 0};
+	int32_t bytes_moved;
+	uint32_t start, way, i;
+	dentry_t dentry;
+
+	open_sink(NULL);
+	for (way = 0; way < 2; way++) {
+		while (bytes[way] < BENCH_BYTES) {
+			for (i = 0; read_dentry_by_index(i, &dentry) == 0; i++) {
+				if (dentry.file_type != FILE_TYPE_FILE) {
+					continue;
+				}
+				open_stream(&dentry);
+				start = rdtsc();
+				do {
+					if (way == 0) {
+						bytes_moved = read_file_wrapper(STREAM_FD, read_buf, size);
+						if (bytes_moved > 0) {
+							terminal_write(SINK_FD, 0, read_buf, bytes_moved);
+							calls[way]++;
+						}
+					} else {
+						bytes_moved = send_file(STREAM_FD, SINK_FD, size);
+					}
+					calls[way]++;
+					bytes[way] += (bytes_moved > 0)? bytes_moved : 0;
+				} while (bytes_moved > 0);
+				cycles[way] += rdtsc() - start;
+			}
+		}
+	}
+	printf("size %u: read and write %u calls, %u cycles/KB, send_file %u calls, %u cycles/KB\n", size,
+	       calls[0], cycles[0] / (bytes[0] / 1024 + 1), calls[1], cycles[1] / (bytes[1] / 1024 + 1));
+}
+
+/* check_positioned_read()
+   Seek STREAM_FD to position and read from there, then read there with pread_file,
+   and compare both with the reference image. Neither pread_file nor a failed seek
+   may move the position
+   Output : 0 if they agree, -1 otherwise
+ */
+static int32_t check_positioned_read(uint32_t inode, uint32_t position) {
+	int32_t expected = reference_read(inode, position, ref_buf, SEND_CHUNK);
+	uint32_t length = get_file_length(inode);
+	int32_t i;
+
+	if (seek_file(STREAM_FD, position, SEEK_SET) != position ||
+	    read_file_wrapper(STREAM_FD, read_buf, SEND_CHUNK) != expected) {
+		return -1;
+	}
+	for (i = 0; i < expected && read_buf[i] == ref_buf[i]; i++) {
+	}
+	if (i < expected || seek_file(STREAM_FD, -expected, SEEK_CUR) != position ||
+	    pread_file(STREAM_FD, read_buf, SEND_CHUNK, position) != expected) {
+		return -1;
+	}
+	for (i = 0; i < expected && read_buf[i] == ref_buf[i]; i++) {
+	}
+	if (i < expected || seek_file(STREAM_FD, length + 1, SEEK_SET) != -1 ||
+	    seek_file(STREAM_FD, -(position + 1), SEEK_CUR) != -1 || seek_file(STREAM_FD, 1, SEEK_END) != -1 ||
+	    seek_file(STREAM_FD, 0, SEEK_END + 1) != -1 || seek_file(STREAM_FD, 0, SEEK_CUR) != position) {
+		return -1;
+	}
+	return (seek_file(STREAM_FD, -(length - position), SEEK_END) == position)? 0 : -1;
+}
+
+/* check_seek()
+   Check seeks and positioned reads of every regular file, around block boundaries,
+   the end of the file and at random positions, and of the directory, entry by entry
+   Output : Number of failed checks
+ */
+static int32_t check_seek(void) {
+	uint32_t num_checks = 0;
+	int32_t failures = 0;
+	uint8_t name[MAX_FILE_NAME_LENGTH];
+	uint32_t i, j, length, num_entries;
+	dentry_t dentry, dir;
+
+	dir.file_type = FILE_TYPE_RTC;
+	for (num_entries = 0; read_dentry_by_index(num_entries, &dentry) == 0; num_entries++) {
+		if (dentry.file_type == FILE_TYPE_DIR) {
+			dir = dentry;
+		}
+		if (dentry.file_type != FILE_TYPE_FILE) {
+			continue;
+		}
+		num_checks++;
+		length = get_file_length(dentry.inode_idx);
+		uint32_t positions[] = {0, 1, BLOCK_SIZE - 1, BLOCK_SIZE, length / 2, length - 1, length};
+		open_stream(&dentry);
+		for (i = 0; i < sizeof(positions) / sizeof(positions[0]) + NUM_RANDOM_SEEKS; i++) {
+			j = (i < sizeof(positions) / sizeof(positions[0]))? positions[i] : next_rand() % (length + 1);
+			if (j <= length && check_positioned_read(dentry.inode_idx, j) != 0) {
+				printf("FAIL seek or pread of inode %u at %u\n", dentry.inode_idx, j);
+				failures++;
+				break;
+			}
+		}
+
+		/* Offsets at or past the end read nothing, even ones length - offset wraps for */
+		num_checks++;
+		uint32_t past_end[] = {length, length + 1, 0x80000000, 0xFFFFF000};
+		for (i = 0; i < sizeof(past_end) / sizeof(past_end[0]); i++) {
+			if (pread_file(STREAM_FD, read_buf, SEND_CHUNK, past_end[i]) != 0 ||
+			    read_data(dentry.inode_idx, past_end[i], read_buf, SEND_CHUNK) != 0) {
+				printf("FAIL pread of inode %u at %u, past its end\n", dentry.inode_idx, past_end[i]);
+				failures++;
+				break;
+			}
+		}
+	}
+
+	if (dir.file_type == FILE_TYPE_DIR) {
+		file_desc_t* file_desc = get_file_desc(get_pcb_ptr(), STREAM_FD);
+		num_checks++;
+		open_dir(&dir, file_desc);
+		file_desc->file_position = 0;
+		for (i = num_entries; i-- > 0; ) {
+			read_dentry_by_index(i, &dentry);
+			length = strlen((int8_t *) dentry.file_name);
+			length = min(length, MAX_FILE_NAME_LENGTH);
+			if (seek_dir(STREAM_FD, i, SEEK_SET) != i || read_dir_wrapper(STREAM_FD, name, MAX_FILE_NAME_LENGTH) != length ||
+			    strncmp((int8_t *) name, (int8_t *) dentry.file_name, length) != 0 ||
+			    pread_dir(STREAM_FD, name, MAX_FILE_NAME_LENGTH, i) != length ||
+			    strncmp((int8_t *) name, (int8_t *) dentry.file_name, length) != 0 ||
+			    seek_dir(STREAM_FD, 0, SEEK_CUR) != i + 1) {
+				printf("FAIL seek or pread of directory entry %u\n", i);
+				failures++;
+				break;
+			}
+		}
+		if (seek_dir(STREAM_FD, 0, SEEK_END) != num_entries || seek_dir(STREAM_FD, 1, SEEK_END) != -1 ||
+		    pread_dir(STREAM_FD, name, MAX_FILE_NAME_LENGTH, num_entries) != 0) {
+			printf("FAIL seek or pread past the last directory entry\n");
+			failures++;
+		}
+	}
+	printf("seek: %u checks, %d failed\n", num_checks, failures);
+	return failures;
+}
+
+/* check_indirect()
+   Check reads around the boundaries between direct, single indirect and double
+   indirect blocks, a streaming read through a file descriptor, and a file written
+   through the driver into its double indirect block
+   Input : length -- size of the mounted image
+   Output : Number of failed checks
+ */
+static int32_t check_indirect(uint32_t length) {
+	uint32_t boundaries[] = {NUM_DIRECT_BLOCKS * BLOCK_SIZE, (NUM_DIRECT_BLOCKS + INDICES_PER_BLOCK) * BLOCK_SIZE,
+	                         LARGE_FILE_LENGTH};
+	uint32_t sizes[] = {1, BLOCK_SIZE, MAX_READ_SIZE};
+	int32_t deltas[] = {-BLOCK_SIZE - 1, -1, 0, 1};
+	uint32_t num_checks = 0;
+	int32_t failures = 0;
+	uint32_t i, j, k, position;
+	int32_t bytes_read, free_blocks;
+	dentry_t dentry;
+
+	if (read_dentry_by_name((uint8_t *) "large_file", &dentry) != 0 ||
+	    get_file_length(dentry.inode_idx) != LARGE_FILE_LENGTH) {
+		printf("FAIL large_file is missing\n");
+		return 1;
+	}
+	for (i = 0; i < sizeof(boundaries) / sizeof(boundaries[0]); i++) {
+		for (j = 0; j < sizeof(deltas) / sizeof(deltas[0]); j++) {
+			for (k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++) {
+				num_checks++;
+				failures += (check_read(dentry.inode_idx, boundaries[i] + deltas[j], sizes[k]) != 0);
+			}
+		}
+	}
+
+	/* Front to back through a file descriptor, which keeps the indirect block read last */
+	num_checks++;
+	open_stream(&dentry);
+	for (position = 0; (bytes_read = read_file_wrapper(STREAM_FD, read_buf, STREAM_CHUNK)) > 0;
+	     position += bytes_read) {
+		for (i = 0; i < bytes_read && read_buf[i] == large_file_byte(position + i); i++) {
+		}
+		if (i < bytes_read) {
+			break;
+		}
+	}
+	if (bytes_read != 0 || position != LARGE_FILE_LENGTH) {
+		printf("FAIL streaming read of large_file differs at offset %u\n", position + i);
+		failures++;
+	}
+
+	/* Appends that allocate the single, double and one more indirect block */
+	num_checks++;
+	free_blocks = get_num_free_blocks();
+	if (create_file((uint8_t *) "indirect_write", &dentry) != 0 ||
+	    append_records(dentry.inode_idx, 3, INDIRECT_WRITE_LENGTH) != INDIRECT_WRITE_LENGTH ||
+	    check_contents(dentry.inode_idx, 3, INDIRECT_WRITE_LENGTH) != 0) {
+		printf("FAIL cannot write a file past its direct blocks\n");
+		return failures + 1;
+	}
+	close_file(inode_of(dentry.inode_idx));
+	uint32_t used_blocks = (INDIRECT_WRITE_LENGTH + BLOCK_SIZE - 1) / BLOCK_SIZE + 3;
+	num_checks++;
+	if (get_num_free_blocks() != free_blocks - used_blocks) {
+		printf("FAIL %d blocks free after close, expected %d\n", get_num_free_blocks(), free_blocks - used_blocks);
+		failures++;
+	}
+	num_checks++;
+	init_file_system((uint32_t) indirect_image, (uint32_t) indirect_image + length);
+	if (get_num_free_blocks() != free_blocks - used_blocks ||
+	    check_contents(dentry.inode_idx, 3, INDIRECT_WRITE_LENGTH) != 0) {
+		printf("FAIL written file or free blocks differ after a remount\n");
+		failures++;
+	}
+	printf("indirect blocks: %u checks, %d failed\n", num_checks, failures);
+	return failures;
+}
+
+/* stream_file()
+   Read a file front to back, size bytes per call, through STREAM_FD or read_data
+   Input : bytes -- incremented by the number of bytes read
+   Output : Cycles the reads took
+ */
+static uint32_t stream_file(const dentry_t* dentry, uint32_t size, int32_t use_fd, uint32_t* bytes) {
+	uint32_t offset = 0;
+	int32_t bytes_read;
+	uint32_t start;
+
+	open_stream(dentry);
+	start = rdtsc();
+	do {
+		bytes_read = use_fd? read_file_wrapper(STREAM_FD, read_buf, size) :
+		                     read_data(dentry->inode_idx, offset, read_buf, size);
+		offset += (bytes_read > 0)? bytes_read : 0;
+	} while (bytes_read > 0);
+	*bytes += offset;
+	return rdtsc() - start;
+}
+
+/* bench_large_file()
+   Compare streaming large_file with streaming the small files, size bytes per call:
+   copying whole extents, block by block with the indirect block cached in the file
+   descriptor, and block by block with read_data, which walks the indirect blocks
+   again on every call
+ */
+static void bench_large_file(uint32_t size) {
+	uint32_t small_bytes = 0;
+	uint32_t small_cycles = 0;
+	uint32_t bytes[3] = {0, 0, 0};
+	uint32_t cycles[3];
+	dentry_t large, dentry;
+	uint32_t i;
+
+	read_dentry_by_name((uint8_t *) "large_file", &large);
+	/* Touch the large file once first, so no variant pays for the first pass over it */
+	stream_file(&large, MAX_READ_SIZE, 1, &bytes[0]);
+	bytes[0] = 0;
+	while (small_bytes < BENCH_BYTES) {
+		for (i = 0; read_dentry_by_index(i, &dentry) == 0; i++) {
+			if (dentry.file_type == FILE_TYPE_FILE && dentry.inode_idx != large.inode_idx) {
+				small_cycles += stream_file(&dentry, size, 1, &small_bytes);
+			}
+		}
+	}
+	cycles[0] = stream_file(&large, size, 1, &bytes[0]);
+	use_extent_map(0);
+	cycles[1] = stream_file(&large, size, 1, &bytes[1]);
+	cycles[2] = stream_file(&large, size, 0, &bytes[2]);
+	use_extent_map(1);
+	printf("size %u: small files %u cycles/KB, large file %u cycles/KB, block by block %u cycles/KB, "
+	       "without the cache %u cycles/KB\n", size, small_cycles / (small_bytes / 1024 + 1),
+	       cycles[0] / (bytes[0] / 1024 + 1), cycles[1] / (bytes[1] / 1024 + 1), cycles[2] / (bytes[2] / 1024 + 1));
+}
+
+/* bench_seek()
+   Cycles to read RECORD_SIZE bytes at a set of positions of large_file: by reading
+   through the file up to the position, STREAM_CHUNK bytes per call, as the only way
+   there was, by seeking first, and by a positioned read. Then seeking and reading at
+   random positions
+ */
+static void bench_seek(void) {
+	uint32_t length, position, i, j, start;
+	uint32_t cycles[3];
+	dentry_t large;
+
+	read_dentry_by_name((uint8_t *) "large_file", &large);
+	length = get_file_length(large.inode_idx);
+	open_stream(&large);
+	for (i = 0; i < NUM_SEEK_POINTS; i++) {
+		position = length / NUM_SEEK_POINTS * i;
+		position -= position % BLOCK_SIZE;
+		position += BLOCK_SIZE / 2;
+
+		open_stream(&large);
+		start = rdtsc();
+		for (j = 0; j < position; j += read_file_wrapper(STREAM_FD, read_buf, min(STREAM_CHUNK, position - j))) {
+		}
+		read_file_wrapper(STREAM_FD, read_buf, RECORD_SIZE);
+		cycles[0] = rdtsc() - start;
+
+		start = rdtsc();
+		for (j = 0; j < SEEK_ROUNDS; j++) {
+			seek_file(STREAM_FD, position, SEEK_SET);
+			read_file_wrapper(STREAM_FD, read_buf, RECORD_SIZE);
+		}
+		cycles[1] = (rdtsc() - start) / SEEK_ROUNDS;
+
+		start = rdtsc();
+		for (j = 0; j < SEEK_ROUNDS; j++) {
+			pread_file(STREAM_FD, read_buf, RECORD_SIZE, position);
+		}
+		cycles[2] = (rdtsc() - start) / SEEK_ROUNDS;
+		printf("position %u: reading up to it %u cycles, seek and read %u cycles, pread %u cycles\n",
+		       position, cycles[0], cycles[1], cycles[2]);
+	}
+
+	start = rdtsc();
+	for (j = 0; j < SEEK_ROUNDS; j++) {
+		seek_file(STREAM_FD, next_rand() % length, SEEK_SET);
+		read_file_wrapper(STREAM_FD, read_buf, RECORD_SIZE);
+	}
+	printf("random positions: seek and read %u cycles\n", (rdtsc() - start) / SEEK_ROUNDS);
+}
+
+/* run_indirect_image()
+   Convert the original image to inodes with indirect blocks and add large_file,
+   check the driver against it and, unless check_only is set, benchmark streaming reads
+   Output : 0 if every check passed, -1 otherwise
+ */
+static int32_t run_indirect_image(int32_t check_only) {
+	uint32_t length = build_indirect_image(pristine_image, image_length, indirect_image, MAX_INDIRECT_IMAGE_SIZE,
+	                                       "large_file", LARGE_FILE_LENGTH, INDIRECT_FREE_BLOCKS);
+	uint32_t i;
+
+	if (length == 0) {
+		printf("cannot build an image with indirect blocks\n");
+		return -1;
+	}
+	indirect_length = length;
+	reference = indirect_image;
+	if (mount_image(indirect_image, length) != 0 || check_driver() != 0) {
+		return -1;
+	}
+	if (!check_only) {
+		for (i = 0; i < NUM_STREAM_SIZES; i++) {
+			bench_large_file(stream_sizes[i]);
+		}
+		bench_seek();
+	}
+	return (check_seek() == 0 && check_indirect(length) == 0)? 0 : -1;
+}
+
+/* read_ram_disk()
+   Read sectors of ram_disk_image, as a disk driver would
+   Output : 0 on success, -1 if a sector is past the end of the disk
+ */
+static int32_t read_ram_disk(block_dev_t* dev, uint32_t sector, uint32_t count, uint8_t* buf) {
+	if (sector > dev->num_sectors || count > dev->num_sectors - sector) {
+		return -1;
+	}
+	memcpy(buf, ram_disk_image + sector * SECTOR_SIZE, count * SECTOR_SIZE);
+	ram_disk_reads++;
+	ram_disk_sectors += count;
+	return 0;
+}
+
+/* mount_ram_disk()
+   Mount an image from ram_disk, and list its regular files
+   Output : 0 on success, -1 if the mount fails or the image has no regular files
+ */
+static int32_t mount_ram_disk(uint8_t* base, uint32_t length) {
+	ram_disk.unit = 0;
+	ram_disk.num_sectors = length / SECTOR_SIZE;
+	ram_disk.read_sectors = read_ram_disk;
+	ram_disk.submit_read = NULL;
+	ram_disk.wait_request = NULL;
+	ram_disk_image = base;
+	if (init_disk_file_system(&ram_disk) != 0) {
+		printf("cannot mount the image from a disk\n");
+		return -1;
+	}
+	mounted_image = NULL;
+	return list_files();
+}
+
+/* check_disk()
+   Check what is particular to an image on a disk: it refuses writes and mmap, a file
+   read twice is read from the disk once, block by block, and an image
+   that does not fit on the disk is not mounted
+   Input : length -- size of the image on ram_disk
+   Output : Number of failed checks
+ */
+static int32_t check_disk(uint32_t length) {
+	uint32_t num_bytes = min(file_lengths[0], MAX_READ_SIZE);
+	uint32_t num_blocks = (num_bytes + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	block_cache_stats_t stats;
+	dentry_t dentry;
+	int32_t failures = 0;
+
+	failures += (write_data(file_inodes[0], 0, read_buf, 1) != -1);
+	failures += (create_file((uint8_t *) "on_disk", &dentry) != -1);
+	failures += (get_block_addr(file_inodes[0], 0) != NULL);
+	failures += (get_num_free_blocks() != 0);
+	if (failures != 0) {
+		printf("FAIL image on a disk is not read only\n");
+	}
+
+	reset_block_cache();
+	ram_disk_reads = 0;
+	ram_disk_sectors = 0;
+	if (read_data(file_inodes[0], 0, read_buf, num_bytes) != num_bytes ||
+	    read_data(file_inodes[0], 0, read_buf, num_bytes) != num_bytes) {
+		printf("FAIL cannot read the first file twice\n");
+		failures++;
+	}
+	get_block_cache_stats(&stats);
+	if (stats.misses != num_blocks || stats.hits != num_blocks ||
+	    ram_disk_reads != num_blocks || ram_disk_sectors != num_blocks * (BLOCK_SIZE / SECTOR_SIZE)) {
+		printf("FAIL reading %u blocks twice took %u misses, %u hits and %u disk reads of %u sectors\n",
+		       num_blocks, stats.misses, stats.hits, ram_disk_reads, ram_disk_sectors);
+		failures++;
+	}
+
+	ram_disk.num_sectors = (length - BLOCK_SIZE) / SECTOR_SIZE;
+	if (init_disk_file_system(&ram_disk) != -1) {
+		printf("FAIL mounted an image larger than its disk\n");
+		failures++;
+	}
+	printf("disk: 7 checks, %d failed\n", failures);
+	return failures;
+}
+
+/* run_disk_image()
+   Mount the original image, then the one with indirect blocks if it was built, from a
+   disk that serves them from memory, check the driver against them and, unless check_only
+   is set, benchmark reads with a cold and a warm block cache
+   Output : 0 if every check passed, -1 otherwise
+ */
+static int32_t run_disk_image(int32_t check_only) {
+	uint32_t i;
+
+	reference = pristine_image;
+	if (mount_ram_disk(pristine_image, image_length) != 0 || check_driver() != 0 ||
+	    check_send() != 0 || check_disk(image_length) != 0) {
+		return -1;
+	}
+	if (!check_only) {
+		mount_ram_disk(pristine_image, image_length);
+		for (i = 0; i < NUM_READ_SIZES; i++) {
+			bench_cached_read(read_sizes[i], 1);
+			bench_cached_read(read_sizes[i], 0);
+		}
+	}
+	if (indirect_length == 0) {
+		return 0;
+	}
+	reference = indirect_image;
+	return (mount_ram_disk(indirect_image, indirect_length) == 0 && check_driver() == 0)? 0 : -1;
+}
+
+/* main()
+   Usage : fs_bench [--check] <image>
+   Check the driver against the image as it is, check writes, check it packed into
+   the compressed layout, converted to a large directory, converted to indirect blocks,
+   mounted from a disk, and laid out again by build_sorted_image.
+   Unless --check is given, benchmark reads on every layout and appends
+   Output : 0 if every check passed, 1 otherwise
+ */
+int32_t main(int32_t argc, int8_t** argv) {
+	static const int8_t* const first_names[] = DEFAULT_FIRST_NAMES;
+	int32_t check_only = (argc == 3 && strncmp(argv[1], "--check", strlen("--check") + 1) == 0);
+	uint32_t length;
+	uint32_t i;
+
+	if (argc != 2 && !check_only) {
+		printf("usage: fs_bench [--check] <image>\n");
+		return 1;
+	}
+	image = host_map_file(argv[argc - 1], &length);
+	if (image == NULL || length > MAX_IMAGE_SIZE) {
+		printf("cannot map %s\n", argv[argc - 1]);
+		return 1;
+	}
+	image_length = length;
+	memcpy(pristine_image, image, length);
+
+	if (!check_only) {
+		for (i = 0; i < NUM_READ_SIZES; i++) {
+			bench_memcpy(read_sizes[i]);
+		}
+	}
+	printf("image layout as built:\n");
+	if (run_image(length, check_only) != 0 || check_write() != 0 || check_send() != 0 ||
+	    check_seek() != 0) {
+		return 1;
+	}
+	if (!check_only) {
+		for (i = 0; i < NUM_RECORD_SIZES; i++) {
+			bench_append(record_sizes[i]);
+		}
+		for (i = 0; i < NUM_STREAM_SIZES; i++) {
+			bench_send(stream_sizes[i]);
+		}
+	}
+	/* An image that was already converted can be neither packed nor converted again */
+	if (!(((fs_stat_t *) pristine_image)->features & (FS_FEATURE_LARGE_DIR | FS_FEATURE_INDIRECT))) {
+		printf("packed image:\n");
+		if (run_packed_image(check_only) != 0) {
+			return 1;
+		}
+		printf("large directory image:\n");
+		if (run_large_dir_image(check_only) != 0) {
+			return 1;
+		}
+		printf("indirect blocks image:\n");
+		if (run_indirect_image(check_only) != 0) {
+			return 1;
+		}
+	}
+	printf("image on a disk:\n");
+	if (run_disk_image(check_only) != 0) {
+		return 1;
+	}
+	/* Only an image as built can be laid out again */
+	if (((fs_stat_t *) pristine_image)->features != 0) {
+		return 0;
+	}
+	length = build_sorted_image(pristine_image, image_length, image, image_length, first_names,
+	                            sizeof(first_names) / sizeof(first_names[0]));
+	if (length == 0) {
+		printf("cannot lay out the image sorted\n");
+		return 1;
+	}
+	printf("image layout sorted, with contiguous files:\n");
+	if (run_image(length, check_only) != 0 || check_sorted() != 0) {
+		return 1;
+	}
+	return 0;
+}
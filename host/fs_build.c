@@ -0,0 +1,133 @@
+/* fs_build.c - Converts a file system image so its directory can hold
+ * more than the 63 entries of the boot block, or so its files can be larger
+ * than 1023 blocks, or lays it out again with the files used most often first
+ * and every file's blocks adjacent
+ * vim:ts=4 noexpandtab
+ */
+
+#include "types.h"
+#include "lib.h"
+#include "file_system.h"
+#include "image_build.h"
+#include "host_shim.h"
+
+/* Largest image that can be built */
+#define MAX_BUILT_SIZE 0x2000000
+#define DECIMAL 10
+
+static uint8_t built_image[MAX_BUILT_SIZE];
+static const int8_t* const default_first_names[] = DEFAULT_FIRST_NAMES;
+
+/* parse_number()
+   Parse a decimal number
+   Output : 0 on success, -1 if str is empty or not a number
+ */
+static int32_t parse_number(const int8_t* str, uint32_t* value) {
+	*value = 0;
+	if (*str == NULL) {
+		return -1;
+	}
+	for (; *str != NULL; str++) {
+		if (*str < '0' || *str > '9') {
+			return -1;
+		}
+		*value = *value * DECIMAL + (*str - '0');
+	}
+	return 0;
+}
+
+/* print_layout()
+   Print the extent table of an image without indirect blocks: for each entry that is a
+   file, its inode, its first data block, its number of blocks, and whether they are all
+   adjacent
+   Input : image -- the image
+   Output : None
+ */
+static void print_layout(const uint8_t* image) {
+	const fs_stat_t* stat = (const fs_stat_t *) image;
+	const dentry_t* entries = (const dentry_t *) (image + DENTRY_SIZE);
+	const inode_t* inodes = (const inode_t *) (image + BLOCK_SIZE);
+	uint32_t i, k, num_blocks, adjacent;
+	uint8_t name[MAX_FILE_NAME_LENGTH + 1];
+
+	printf("entry inode first_block blocks adjacent\n");
+	for (i = 0; i < stat->num_dir_entries && i < MAX_NUM_DENTRIES; i++) {
+		const inode_t* inode = &inodes[entries[i].inode_idx];
+		if (entries[i].file_type != FILE_TYPE_FILE || entries[i].inode_idx >= stat->num_inodes) {
+			continue;
+		}
+		num_blocks = min((inode->length + BLOCK_SIZE - 1) / BLOCK_SIZE, MAX_NUM_BLOCKS_IN_INODE);
+		adjacent = 1;
+		for (k = 1; k < num_blocks; k++) {
+			adjacent &= (inode->block_idx[k] == inode->block_idx[0] + k);
+		}
+		strncpy((int8_t *) name, (const int8_t *) entries[i].file_name, MAX_FILE_NAME_LENGTH);
+		name[MAX_FILE_NAME_LENGTH] = NULL;
+		printf("%s %u %u %u %s\n", name, entries[i].inode_idx, (num_blocks > 0)? inode->block_idx[0] : 0,
+		       num_blocks, adjacent? "yes" : "no");
+	}
+}
+
+/* main()
+   Usage : fs_build <image> <new image> dir <number of links>
+           fs_build <image> <new image> file <name> <length> <number of free blocks>
+           fs_build <image> <new image> sort [name ...]
+   The first form gives the image a large directory, the second indirect blocks and
+   a new file. Running the second and then the first on its output gives both.
+   The third puts the named entries first, or the shell and common programs if none are
+   named, lays every file's blocks out adjacent and prints the resulting extents
+   Output : 0 on success, 1 otherwise
+ */
+int32_t main(int32_t argc, int8_t** argv) {
+	uint32_t length, built_length;
+	uint32_t num_links, file_length, num_free_blocks;
+	uint32_t num_entries;
+	uint8_t* image;
+	dentry_t dentry;
+	int32_t dir_mode = (argc == 5 && strncmp(argv[3], "dir", strlen("dir") + 1) == 0 &&
+	                    parse_number(argv[4], &num_links) == 0);
+	int32_t file_mode = (argc == 7 && strncmp(argv[3], "file", strlen("file") + 1) == 0 &&
+	                     parse_number(argv[5], &file_length) == 0 && parse_number(argv[6], &num_free_blocks) == 0);
+	int32_t sort_mode = (argc >= 4 && strncmp(argv[3], "sort", strlen("sort") + 1) == 0);
+
+	if (!dir_mode && !file_mode && !sort_mode) {
+		printf("usage: fs_build <image> <new image> dir <number of links>\n"
+		       "       fs_build <image> <new image> file <name> <length> <number of free blocks>\n"
+		       "       fs_build <image> <new image> sort [name ...]\n");
+		return 1;
+	}
+	image = host_map_file(argv[1], &length);
+	if (image == NULL) {
+		printf("cannot map %s\n", argv[1]);
+		return 1;
+	}
+	if (sort_mode && argc > 4) {
+		built_length = build_sorted_image(image, length, built_image, MAX_BUILT_SIZE,
+		                                  (const int8_t* const*) &argv[4], argc - 4);
+	} else if (sort_mode) {
+		built_length = build_sorted_image(image, length, built_image, MAX_BUILT_SIZE, default_first_names,
+		                                  sizeof(default_first_names) / sizeof(default_first_names[0]));
+	} else if (dir_mode) {
+		built_length = build_large_dir_image(image, length, built_image, MAX_BUILT_SIZE, num_links);
+	} else {
+		built_length = build_indirect_image(image, length, built_image, MAX_BUILT_SIZE, argv[4], file_length,
+		                                    num_free_blocks);
+	}
+	if (built_length == 0) {
+		printf("cannot convert %s\n", argv[1]);
+		return 1;
+	}
+	if (host_write_file(argv[2], built_image, built_length) != 0) {
+		printf("cannot write %s\n", argv[2]);
+		return 1;
+	}
+	/* Mount the new image, so what is reported is what the driver sees */
+	init_file_system((uint32_t) built_image, (uint32_t) built_image + built_length);
+	for (num_entries = 0; read_dentry_by_index(num_entries, &dentry) == 0; num_entries++) {
+	}
+	printf("%s: %u entries, %u bytes\n", argv[2], num_entries, built_length);
+	if (sort_mode) {
+		print_layout(built_image);
+	}
+	return 0;
+}
@@ -0,0 +1,44 @@
+/* fs_pack.c - Packs a file system image into the compressed layout the
+ * kernel reads through its block cache
+ * vim:ts=4 noexpandtab
+ */
+
+#include "types.h"
+#include "lib.h"
+#include "image_pack.h"
+#include "host_shim.h"
+
+/* Largest packed image; a packed image is never much larger than the original */
+#define MAX_PACKED_SIZE 0x1000000
+
+static uint8_t packed_image[MAX_PACKED_SIZE];
+
+/* main()
+   Usage : fs_pack <image> <packed image>
+   Output : 0 on success, 1 otherwise
+ */
+int32_t main(int32_t argc, int8_t** argv) {
+	uint32_t length, packed_length;
+	uint8_t* image;
+
+	if (argc != 3) {
+		printf("usage: fs_pack <image> <packed image>\n");
+		return 1;
+	}
+	image = host_map_file(argv[1], &length);
+	if (image == NULL) {
+		printf("cannot map %s\n", argv[1]);
+		return 1;
+	}
+	packed_length = pack_image(image, length, packed_image, MAX_PACKED_SIZE);
+	if (packed_length == 0) {
+		printf("%s is not an uncompressed file system image, or is too large\n", argv[1]);
+		return 1;
+	}
+	if (host_write_file(argv[2], packed_image, packed_length) != 0) {
+		printf("cannot write %s\n", argv[2]);
+		return 1;
+	}
+	printf("%s: %u bytes packed into %u bytes\n", argv[2], length, packed_length);
+	return 0;
+}
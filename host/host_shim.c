@@ -0,0 +1,197 @@
+/* host_shim.c - Linux user space stand-ins for the kernel services the
+ * file system driver needs. There is no 32-bit libc on the build hosts,
+ * so the program starts at _start and talks to Linux with int $0x80
+ * vim:ts=4 noexpandtab
+ */
+
+#include "types.h"
+#include "lib.h"
+#include "pcb.h"
+#include "host_shim.h"
+
+/* i386 Linux system call numbers */
+#define SYS_EXIT 1
+#define SYS_WRITE 4
+#define SYS_OPEN 5
+#define SYS_CLOSE 6
+#define SYS_LSEEK 19
+#define SYS_CLOCK_GETTIME 265
+#define SYS_MMAP2 192
+
+#define STDOUT_FD 1
+#define O_WRONLY 0x1
+#define O_CREAT 0x40
+#define O_TRUNC 0x200
+#define CREATE_MODE 0644
+#define SEEK_END 2
+#define PROT_READ 0x1
+#define PROT_WRITE 0x2
+#define MAP_PRIVATE 0x2
+#define CLOCK_MONOTONIC 1
+/* Linux returns -errno, so any result in the last page of the address space is an error */
+#define SYSCALL_ERROR(ret) ((uint32_t) (ret) >= (uint32_t) -4095)
+
+#define OUT_BUF_SIZE 4096
+
+static uint8_t out_buf[OUT_BUF_SIZE];
+static uint32_t out_len;
+
+/* The only process the driver ever sees. Its first chunk of file descriptors backs
+   read_file_wrapper */
+static pcb_t host_pcb;
+static file_desc_t host_fds[FDS_PER_CHUNK];
+
+/* host_syscall()
+   Issue a Linux system call with up to six arguments
+   Output : value Linux returned in eax
+ */
+static int32_t host_syscall(int32_t num, int32_t a, int32_t b, int32_t c, int32_t d, int32_t e, int32_t f) {
+	int32_t ret;
+	asm volatile("pushl %%ebp\n"
+	             "movl %7, %%ebp\n"
+	             "int $0x80\n"
+	             "popl %%ebp"
+	             : "=a"(ret)
+	             : "a"(num), "b"(a), "c"(b), "d"(c), "S"(d), "D"(e), "m"(f)
+	             : "memory");
+	return ret;
+}
+
+/* flush_output()
+   Write everything putc has buffered to standard output
+ */
+static void flush_output(void) {
+	if (out_len > 0) {
+		host_syscall(SYS_WRITE, STDOUT_FD, (int32_t) out_buf, out_len, 0, 0, 0);
+		out_len = 0;
+	}
+}
+
+/* putc()
+   Replaces lib.c's putc, which is weakened when the host build copies lib.o,
+   so the kernel's own printf writes to standard output instead of video memory
+ */
+void putc(uint8_t c) {
+	out_buf[out_len++] = c;
+	if (out_len == OUT_BUF_SIZE || c == '\n') {
+		flush_output();
+	}
+}
+
+/* Terminal state only read by lib.c's video memory putc, which is never called */
+int get_key_press(void) {
+	return 0;
+}
+
+int32_t get_current_terminal(void) {
+	return 0;
+}
+
+int32_t get_displayed_terminal(void) {
+	return 0;
+}
+
+/* The image is mapped by host_map_file, there is no page table to fill */
+void enable_global_pages(uint32_t start_addr, uint32_t end_addr) {
+}
+
+pcb_t* get_pcb_ptr(void) {
+	host_pcb.fd_chunks[0] = host_fds;
+	return &host_pcb;
+}
+
+/* No program runs on the host, so no shared program image can go stale */
+void invalidate_shared_image(uint32_t inode_idx) {
+}
+
+/* Interrupts cannot be disabled from user space, and the host has nothing to interrupt the driver */
+uint32_t save_flags_and_cli(void) {
+	return 0;
+}
+
+void restore_saved_flags(uint32_t flags) {
+}
+
+/* host_time_us()
+   Read the monotonic clock
+   Output : Time in microseconds, wrapping every 71 minutes
+ */
+uint32_t host_time_us(void) {
+	int32_t ts[2];	/* 32-bit struct timespec: seconds, nanoseconds */
+	host_syscall(SYS_CLOCK_GETTIME, CLOCK_MONOTONIC, (int32_t) ts, 0, 0, 0, 0);
+	return ts[0] * 1000000 + ts[1] / 1000;
+}
+
+/* host_map_file()
+   Map a private copy of a whole file. Writes stay in memory and never reach the file
+   Input : path -- NUL terminated path of the file
+           length -- filled in with the length of the file
+   Output : Address of the mapping, NULL if the file cannot be opened or is empty
+ */
+uint8_t* host_map_file(const int8_t* path, uint32_t* length) {
+	int32_t fd = host_syscall(SYS_OPEN, (int32_t) path, 0, 0, 0, 0, 0);
+	if (SYSCALL_ERROR(fd)) {
+		return NULL;
+	}
+	int32_t size = host_syscall(SYS_LSEEK, fd, 0, SEEK_END, 0, 0, 0);
+	int32_t addr = -1;
+	if (!SYSCALL_ERROR(size) && size > 0) {
+		addr = host_syscall(SYS_MMAP2, 0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	}
+	host_syscall(SYS_CLOSE, fd, 0, 0, 0, 0, 0);
+	if (SYSCALL_ERROR(addr)) {
+		return NULL;
+	}
+	*length = size;
+	return (uint8_t *) addr;
+}
+
+/* host_write_file()
+   Create or truncate a file and write a buffer to it
+   Input : path -- NUL terminated path of the file
+           buf, length -- bytes to write
+   Output : 0 on success, -1 if the file cannot be created or written in full
+ */
+int32_t host_write_file(const int8_t* path, const uint8_t* buf, uint32_t length) {
+	int32_t fd = host_syscall(SYS_OPEN, (int32_t) path, O_WRONLY | O_CREAT | O_TRUNC, CREATE_MODE, 0, 0, 0);
+	uint32_t written = 0;
+	if (SYSCALL_ERROR(fd)) {
+		return -1;
+	}
+	while (written < length) {
+		int32_t ret = host_syscall(SYS_WRITE, fd, (int32_t) (buf + written), length - written, 0, 0, 0);
+		if (SYSCALL_ERROR(ret) || ret == 0) {
+			break;
+		}
+		written += ret;
+	}
+	host_syscall(SYS_CLOSE, fd, 0, 0, 0, 0, 0);
+	return (written == length)? 0 : -1;
+}
+
+/* host_exit()
+   Write buffered output and end the process with the given exit status
+ */
+void host_exit(int32_t status) {
+	flush_output();
+	host_syscall(SYS_EXIT, status, 0, 0, 0, 0, 0);
+}
+
+int32_t main(int32_t argc, int8_t** argv);
+
+/* host_start()
+   Called by _start with the initial stack pointer, which holds argc then argv
+ */
+__attribute__((used, force_align_arg_pointer)) static void host_start(int32_t* sp) {
+	host_exit(main(sp[0], (int8_t **) (sp + 1)));
+}
+
+asm(".globl _start\n"
+    "_start:\n"
+    "	xorl %ebp, %ebp\n"
+    "	movl %esp, %eax\n"
+    "	andl $-16, %esp\n"
+    "	subl $12, %esp\n"
+    "	pushl %eax\n"
+    "	call host_start\n"
+    "	hlt\n");
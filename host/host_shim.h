@@ -0,0 +1,20 @@
+/* host_shim.h - Linux user space stand-ins for the kernel services the
+ * file system driver needs, so it can be built and benchmarked on the host
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _HOST_SHIM_H
+#define _HOST_SHIM_H
+
+#include "types.h"
+
+/* Map a private, writable copy of a whole file. Returns its address, NULL on failure */
+uint8_t* host_map_file(const int8_t* path, uint32_t* length);
+/* Create or truncate a file and write length bytes to it. Returns 0 on success, -1 on failure */
+int32_t host_write_file(const int8_t* path, const uint8_t* buf, uint32_t length);
+/* Monotonic time in microseconds */
+uint32_t host_time_us(void);
+/* Write buffered output and end the process */
+void host_exit(int32_t status);
+
+#endif /* _HOST_SHIM_H */
@@ -0,0 +1,416 @@
+/* image_build.c - Builds file system images whose directory is held by an
+ * inode, spans several blocks and carries a hash index on the names, so an
+ * image is no longer limited to the 63 entries of the boot block, and images
+ * whose inodes have indirect blocks, so a file is no longer limited to 1023 blocks.
+ * Also lays images out again, with the files read most often first and every
+ * file's blocks adjacent, so sequential reads copy whole runs of blocks
+ * vim:ts=4 noexpandtab
+ */
+
+#include "types.h"
+#include "lib.h"
+#include "file_system.h"
+#include "image_build.h"
+
+/* Digits of the largest number itoa writes, plus its NUL */
+#define NUM_BUF_SIZE 11
+#define DECIMAL 10
+/* Inode of the source image build_sorted_image has not placed yet */
+#define INODE_NOT_PLACED 0xFFFFFFFF
+
+/* insert_name()
+   Add a directory entry's name to a hash index being built
+   Input : slots, num_slots -- the index, num_slots a power of two with a free slot
+           entries -- the directory's entries so far
+           dentry_idx -- index of the entry to add
+   Output : 0 on success, -1 if the name is empty or an entry already has it
+   Side Effects : Fills a free slot
+ */
+static int32_t insert_name(dir_hash_slot_t* slots, uint32_t num_slots, const dentry_t* entries, uint32_t dentry_idx) {
+	uint32_t length;
+	uint32_t hash = hash_file_name(entries[dentry_idx].file_name, MAX_FILE_NAME_LENGTH, &length);
+	uint32_t slot = hash & (num_slots - 1);
+
+	if (length == 0) {
+		return -1;
+	}
+	while (slots[slot].dentry_idx != DIR_HASH_EMPTY) {
+		if (slots[slot].hash == hash &&
+		    strncmp((int8_t *) entries[slots[slot].dentry_idx].file_name, (int8_t *) entries[dentry_idx].file_name,
+		            MAX_FILE_NAME_LENGTH) == 0) {
+			return -1;
+		}
+		slot = (slot + 1) & (num_slots - 1);
+	}
+	slots[slot].hash = hash;
+	slots[slot].dentry_idx = dentry_idx;
+	return 0;
+}
+
+/* build_large_dir_image()
+   Convert an image to the FS_FEATURE_LARGE_DIR layout. A new inode, placed after the
+   existing ones, holds the directory; its blocks follow the existing data blocks. The
+   directory gets every entry of the boot block, then num_links entries named
+   LINK_NAME_PREFIX and a number, each naming one of the regular files in turn. The
+   boot block is left as it was, so drivers without the feature still read the image
+   Input : src, src_len -- image without a large directory
+           dst, dst_cap -- array for the new image and its size
+           num_links -- number of entries to add
+   Output : size of the new image, 0 if src is not a valid image, has no regular file
+            to link to, or the directory or image would be too large
+   Side Effects : dst filled in
+ */
+uint32_t build_large_dir_image(const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_cap,
+                               uint32_t num_links) {
+	const fs_stat_t* stat = (const fs_stat_t *) src;
+	const dentry_t* boot_entries = (const dentry_t *) (src + DENTRY_SIZE);
+	uint32_t num_boot_entries, max_entries, num_slots, num_dir_blocks, size, i;
+	uint32_t num_files = 0;
+
+	if (src_len < BLOCK_SIZE || (stat->features & (FS_FEATURE_COMPRESSED | FS_FEATURE_LARGE_DIR)) ||
+	    stat->num_dir_entries > MAX_NUM_DENTRIES ||
+	    src_len / BLOCK_SIZE < stat->num_inodes + 1 + stat->num_data_blocks) {
+		return 0;
+	}
+	num_boot_entries = stat->num_dir_entries;
+	for (i = 0; i < num_boot_entries; i++) {
+		num_files += (boot_entries[i].file_type == FILE_TYPE_FILE);
+	}
+	if (num_links > 0 && num_files == 0) {
+		return 0;
+	}
+
+	/* Room for the spare entries in whole blocks, and twice as many hash slots */
+	max_entries = num_boot_entries + num_links + DIR_SPARE_ENTRIES;
+	max_entries = (max_entries + DENTRIES_PER_BLOCK - 1) / DENTRIES_PER_BLOCK * DENTRIES_PER_BLOCK;
+	for (num_slots = DIR_HASH_SLOTS_PER_BLOCK; num_slots < 2 * max_entries; num_slots *= 2) {
+	}
+	num_dir_blocks = 1 + num_slots / DIR_HASH_SLOTS_PER_BLOCK + max_entries / DENTRIES_PER_BLOCK;
+	size = BLOCK_SIZE * (1 + stat->num_inodes + 1 + stat->num_data_blocks + num_dir_blocks);
+	/* Direct blocks only, so the directory reads the same with and without indirect blocks */
+	if (num_dir_blocks > NUM_DIRECT_BLOCKS || size > dst_cap) {
+		return 0;
+	}
+
+	/* Boot block and inodes, then the directory's inode */
+	uint32_t inodes_size = BLOCK_SIZE * (1 + stat->num_inodes);
+	memcpy(dst, src, inodes_size);
+	fs_stat_t* new_stat = (fs_stat_t *) dst;
+	new_stat->features |= FS_FEATURE_LARGE_DIR;
+	new_stat->dir_inode = stat->num_inodes;
+	new_stat->num_inodes = stat->num_inodes + 1;
+	new_stat->num_data_blocks = stat->num_data_blocks + num_dir_blocks;
+	inode_t* dir_inode = (inode_t *) (dst + inodes_size);
+	memset(dir_inode, 0, BLOCK_SIZE);
+	dir_inode->length = num_dir_blocks * BLOCK_SIZE;
+	for (i = 0; i < num_dir_blocks; i++) {
+		dir_inode->block_idx[i] = stat->num_data_blocks + i;
+	}
+
+	/* Data blocks as they were, then the directory */
+	memcpy(dst + inodes_size + BLOCK_SIZE, src + inodes_size, BLOCK_SIZE * stat->num_data_blocks);
+	uint8_t* dir = dst + BLOCK_SIZE * (1 + new_stat->num_inodes + stat->num_data_blocks);
+	dir_header_t* header = (dir_header_t *) dir;
+	dir_hash_slot_t* slots = (dir_hash_slot_t *) (dir + BLOCK_SIZE);
+	dentry_t* entries = (dentry_t *) (dir + BLOCK_SIZE * (1 + num_slots / DIR_HASH_SLOTS_PER_BLOCK));
+	memset(dir, 0, BLOCK_SIZE * num_dir_blocks);
+	memset(slots, 0xFF, num_slots * sizeof(dir_hash_slot_t));
+	header->max_entries = max_entries;
+	header->num_hash_slots = num_slots;
+	header->hash_block = 1;
+	header->entry_block = 1 + num_slots / DIR_HASH_SLOTS_PER_BLOCK;
+
+	uint32_t num_entries = 0;
+	for (i = 0; i < num_boot_entries; i++) {
+		entries[num_entries] = boot_entries[i];
+		/* A nameless or repeated entry is kept, but only the first of a name can be looked up */
+		insert_name(slots, num_slots, entries, num_entries);
+		num_entries++;
+	}
+	uint32_t file = 0;
+	for (i = 0; i < num_links; i++) {
+		int8_t num_buf[NUM_BUF_SIZE];
+		while (boot_entries[file].file_type != FILE_TYPE_FILE) {
+			file = (file + 1) % num_boot_entries;
+		}
+		memset(&entries[num_entries], 0, DENTRY_SIZE);
+		strcpy((int8_t *) entries[num_entries].file_name, LINK_NAME_PREFIX);
+		strcpy((int8_t *) entries[num_entries].file_name + strlen(LINK_NAME_PREFIX), itoa(i, num_buf, DECIMAL));
+		entries[num_entries].file_type = FILE_TYPE_FILE;
+		entries[num_entries].inode_idx = boot_entries[file].inode_idx;
+		file = (file + 1) % num_boot_entries;
+		/* A link whose name a file of the image already has is left out */
+		if (insert_name(slots, num_slots, entries, num_entries) == 0) {
+			num_entries++;
+		}
+	}
+	header->num_entries = num_entries;
+	return size;
+}
+
+/* num_indirect_blocks()
+   Number of indirect blocks a file of num_blocks blocks goes through
+ */
+static uint32_t num_indirect_blocks(uint32_t num_blocks) {
+	if (num_blocks <= NUM_DIRECT_BLOCKS) {
+		return 0;
+	}
+	if (num_blocks <= NUM_DIRECT_BLOCKS + INDICES_PER_BLOCK) {
+		return 1;
+	}
+	/* The single indirect block, the double indirect block and the blocks it points at */
+	return 2 + (num_blocks - NUM_DIRECT_BLOCKS - INDICES_PER_BLOCK + INDICES_PER_BLOCK - 1) / INDICES_PER_BLOCK;
+}
+
+/* set_file_block()
+   Record the data block holding a block of a file in an inode with indirect blocks.
+   Blocks are set in file order, and each indirect block is taken from next_block
+   when the first block it maps is set
+   Input : inode -- inode of the file
+           block_num -- index of the block inside the file
+           block_index -- index of the data block
+           blocks -- the image's data blocks
+           next_block -- index of the next free data block, advanced past any indirect block
+   Output : None
+   Side Effects : Updates the inode and its indirect blocks
+ */
+static void set_file_block(inode_t* inode, uint32_t block_num, uint32_t block_index, uint8_t* blocks,
+                           uint32_t* next_block) {
+	uint32_t* indices;
+
+	if (block_num < NUM_DIRECT_BLOCKS) {
+		inode->block_idx[block_num] = block_index;
+		return;
+	}
+	block_num -= NUM_DIRECT_BLOCKS;
+	if (block_num < INDICES_PER_BLOCK) {
+		if (block_num == 0) {
+			inode->block_idx[SINGLE_INDIRECT_SLOT] = (*next_block)++;
+		}
+		indices = (uint32_t *) (blocks + BLOCK_SIZE * inode->block_idx[SINGLE_INDIRECT_SLOT]);
+	} else {
+		block_num -= INDICES_PER_BLOCK;
+		if (block_num == 0) {
+			inode->block_idx[DOUBLE_INDIRECT_SLOT] = (*next_block)++;
+		}
+		uint32_t* root = (uint32_t *) (blocks + BLOCK_SIZE * inode->block_idx[DOUBLE_INDIRECT_SLOT]);
+		if (block_num % INDICES_PER_BLOCK == 0) {
+			root[block_num / INDICES_PER_BLOCK] = (*next_block)++;
+		}
+		indices = (uint32_t *) (blocks + BLOCK_SIZE * root[block_num / INDICES_PER_BLOCK]);
+		block_num %= INDICES_PER_BLOCK;
+	}
+	indices[block_num] = block_index;
+}
+
+/* large_file_byte()
+   Byte at a position of the file build_indirect_image adds. Differs between blocks,
+   so a block read from the wrong place is noticed
+ */
+uint8_t large_file_byte(uint32_t position) {
+	return (uint8_t) (position * 13 + position / BLOCK_SIZE * 101 + 7);
+}
+
+/* build_indirect_image()
+   Convert an image to the FS_FEATURE_INDIRECT layout and add a file too large for the
+   original inodes. Existing files keep their data blocks; a file with more than
+   NUM_DIRECT_BLOCKS blocks gets a single indirect block for the rest. The new file's
+   blocks follow the existing data blocks and are adjacent, then come the indirect
+   blocks, then num_free_blocks free blocks for writes
+   Input : src, src_len -- image without indirect blocks or a large directory
+           dst, dst_cap -- array for the new image and its size
+           name -- name of the new file, a new entry of the boot block
+           file_length -- length of the new file in bytes
+           num_free_blocks -- number of free data blocks to add
+   Output : size of the new image, 0 if src is not a valid image, already has the name,
+            has no room for another entry, or the image would be too large
+   Side Effects : dst filled in
+ */
+uint32_t build_indirect_image(const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_cap,
+                              const int8_t* name, uint32_t file_length, uint32_t num_free_blocks) {
+	const fs_stat_t* stat = (const fs_stat_t *) src;
+	uint32_t name_length = strlen(name);
+	uint32_t file_blocks = (file_length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	uint32_t num_indirect = num_indirect_blocks(file_blocks);
+	uint32_t i, k;
+
+	if (src_len < BLOCK_SIZE ||
+	    (stat->features & (FS_FEATURE_COMPRESSED | FS_FEATURE_LARGE_DIR | FS_FEATURE_INDIRECT)) ||
+	    stat->num_dir_entries >= MAX_NUM_DENTRIES || name_length == 0 || name_length > MAX_FILE_NAME_LENGTH ||
+	    file_length > MAX_INDIRECT_FILE_LENGTH ||
+	    src_len / BLOCK_SIZE < stat->num_inodes + 1 + stat->num_data_blocks) {
+		return 0;
+	}
+	const dentry_t* boot_entries = (const dentry_t *) (src + DENTRY_SIZE);
+	for (i = 0; i < stat->num_dir_entries; i++) {
+		if (strncmp((int8_t *) boot_entries[i].file_name, name, MAX_FILE_NAME_LENGTH) == 0) {
+			return 0;
+		}
+	}
+	const inode_t* src_inodes = (const inode_t *) (src + BLOCK_SIZE);
+	for (i = 0; i < stat->num_inodes; i++) {
+		uint32_t num_blocks = min((src_inodes[i].length + BLOCK_SIZE - 1) / BLOCK_SIZE, MAX_NUM_BLOCKS_IN_INODE);
+		num_indirect += num_indirect_blocks(num_blocks);
+	}
+	uint32_t num_blocks = stat->num_data_blocks + file_blocks + num_indirect + num_free_blocks;
+	if (file_blocks > dst_cap / BLOCK_SIZE || num_free_blocks > dst_cap / BLOCK_SIZE ||
+	    num_blocks + stat->num_inodes + 2 > dst_cap / BLOCK_SIZE) {
+		return 0;
+	}
+	uint32_t size = BLOCK_SIZE * (1 + stat->num_inodes + 1 + num_blocks);
+
+	/* Boot block with the new entry, inodes with the new file's inode last */
+	uint32_t inodes_size = BLOCK_SIZE * (1 + stat->num_inodes);
+	memcpy(dst, src, inodes_size);
+	fs_stat_t* new_stat = (fs_stat_t *) dst;
+	new_stat->features |= FS_FEATURE_INDIRECT;
+	new_stat->num_inodes = stat->num_inodes + 1;
+	new_stat->num_data_blocks = num_blocks;
+	dentry_t* entry = (dentry_t *) (dst + DENTRY_SIZE) + new_stat->num_dir_entries++;
+	memset(entry, 0, DENTRY_SIZE);
+	memcpy(entry->file_name, name, name_length);
+	entry->file_type = FILE_TYPE_FILE;
+	entry->inode_idx = stat->num_inodes;
+
+	/* Data blocks as they were, the new file, then indirect and free blocks */
+	uint8_t* blocks = dst + inodes_size + BLOCK_SIZE;
+	inode_t* new_inodes = (inode_t *) (dst + BLOCK_SIZE);
+	uint32_t next_block = stat->num_data_blocks + file_blocks;
+	memcpy(blocks, src + inodes_size, BLOCK_SIZE * stat->num_data_blocks);
+	memset(blocks + BLOCK_SIZE * stat->num_data_blocks, 0, BLOCK_SIZE * (num_blocks - stat->num_data_blocks));
+	for (i = 0; i < file_length; i++) {
+		blocks[BLOCK_SIZE * stat->num_data_blocks + i] = large_file_byte(i);
+	}
+	for (i = 0; i < stat->num_inodes; i++) {
+		uint32_t num_file_blocks = min((src_inodes[i].length + BLOCK_SIZE - 1) / BLOCK_SIZE,
+		                               MAX_NUM_BLOCKS_IN_INODE);
+		for (k = NUM_DIRECT_BLOCKS; k < num_file_blocks; k++) {
+			set_file_block(&new_inodes[i], k, src_inodes[i].block_idx[k], blocks, &next_block);
+		}
+	}
+	inode_t* file_inode = &new_inodes[stat->num_inodes];
+	memset(file_inode, 0, BLOCK_SIZE);
+	file_inode->length = file_length;
+	for (k = 0; k < file_blocks; k++) {
+		set_file_block(file_inode, k, stat->num_data_blocks + k, blocks, &next_block);
+	}
+	return size;
+}
+
+/* find_entry()
+   Find a directory entry of the boot block by name
+   Input : entries, num_entries -- entries of the boot block
+           name -- name to look for
+   Output : index of the entry, -1 if none has the name
+ */
+static int32_t find_entry(const dentry_t* entries, uint32_t num_entries, const int8_t* name) {
+	uint32_t i;
+	for (i = 0; i < num_entries; i++) {
+		if (strncmp((int8_t *) entries[i].file_name, name, MAX_FILE_NAME_LENGTH) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/* build_sorted_image()
+   Lay an image out again. Directory entries come first, then the entries named in
+   first_names in that order, then the others in the order they had. Files get inodes
+   and data blocks in the order of their entries, each file's blocks adjacent, so a
+   file is one extent and files read one after another are next to each other. Entries
+   that share an inode still do. The image keeps its numbers of inodes and data blocks,
+   and the ones no entry uses are left free at the end
+   Input : src, src_len -- image without compression, a large directory or indirect blocks
+           dst, dst_cap -- array for the new image and its size
+           first_names, num_first_names -- names of the entries to put first, those the
+                                           image does not have are skipped
+   Output : size of the new image, 0 if src is not a valid image or dst is too small
+   Side Effects : dst filled in
+ */
+uint32_t build_sorted_image(const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_cap,
+                            const int8_t* const* first_names, uint32_t num_first_names) {
+	const fs_stat_t* stat = (const fs_stat_t *) src;
+	uint32_t order[MAX_NUM_DENTRIES];
+	uint8_t placed[MAX_NUM_DENTRIES];
+	uint32_t new_inode_idx[MAX_NUM_BITMAP_INODES];
+	uint32_t num_placed = 0;
+	uint32_t next_inode = 0;
+	uint32_t next_block = 0;
+	uint32_t i, k;
+	int32_t found;
+
+	if (src_len < BLOCK_SIZE || stat->features != 0 || stat->num_dir_entries > MAX_NUM_DENTRIES ||
+	    stat->num_inodes > MAX_NUM_BITMAP_INODES ||
+	    src_len / BLOCK_SIZE < 1 + stat->num_inodes + stat->num_data_blocks ||
+	    dst_cap / BLOCK_SIZE < 1 + stat->num_inodes + stat->num_data_blocks) {
+		return 0;
+	}
+	const dentry_t* src_entries = (const dentry_t *) (src + DENTRY_SIZE);
+	const inode_t* src_inodes = (const inode_t *) (src + BLOCK_SIZE);
+	const uint8_t* src_blocks = src + BLOCK_SIZE * (1 + stat->num_inodes);
+	uint32_t size = BLOCK_SIZE * (1 + stat->num_inodes + stat->num_data_blocks);
+
+	/* Order of the entries */
+	memset(placed, 0, sizeof(placed));
+	for (i = 0; i < stat->num_dir_entries; i++) {
+		if (src_entries[i].file_type == FILE_TYPE_DIR) {
+			order[num_placed++] = i;
+			placed[i] = 1;
+		}
+	}
+	for (i = 0; i < num_first_names; i++) {
+		found = find_entry(src_entries, stat->num_dir_entries, first_names[i]);
+		if (found >= 0 && !placed[found]) {
+			order[num_placed++] = found;
+			placed[found] = 1;
+		}
+	}
+	for (i = 0; i < stat->num_dir_entries; i++) {
+		if (!placed[i]) {
+			order[num_placed++] = i;
+		}
+	}
+
+	/* Entries in their new order, files with their inodes and blocks in the same order */
+	memset(dst, 0, size);
+	fs_stat_t* new_stat = (fs_stat_t *) dst;
+	new_stat->num_dir_entries = stat->num_dir_entries;
+	new_stat->num_inodes = stat->num_inodes;
+	new_stat->num_data_blocks = stat->num_data_blocks;
+	dentry_t* new_entries = (dentry_t *) (dst + DENTRY_SIZE);
+	inode_t* new_inodes = (inode_t *) (dst + BLOCK_SIZE);
+	uint8_t* new_blocks = dst + BLOCK_SIZE * (1 + stat->num_inodes);
+	for (i = 0; i < stat->num_inodes; i++) {
+		new_inode_idx[i] = INODE_NOT_PLACED;
+	}
+	for (i = 0; i < num_placed; i++) {
+		const dentry_t* entry = &src_entries[order[i]];
+		new_entries[i] = *entry;
+		if (entry->file_type != FILE_TYPE_FILE) {
+			continue;
+		}
+		if (entry->inode_idx >= stat->num_inodes) {
+			return 0;
+		}
+		if (new_inode_idx[entry->inode_idx] == INODE_NOT_PLACED) {
+			const inode_t* src_inode = &src_inodes[entry->inode_idx];
+			inode_t* new_inode = &new_inodes[next_inode];
+			uint32_t num_blocks = (src_inode->length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+			if (num_blocks > MAX_NUM_BLOCKS_IN_INODE || num_blocks > stat->num_data_blocks - next_block) {
+				return 0;
+			}
+			new_inode->length = src_inode->length;
+			for (k = 0; k < num_blocks; k++) {
+				if (src_inode->block_idx[k] >= stat->num_data_blocks) {
+					return 0;
+				}
+				memcpy(new_blocks + BLOCK_SIZE * next_block, src_blocks + BLOCK_SIZE * src_inode->block_idx[k],
+				       BLOCK_SIZE);
+				new_inode->block_idx[k] = next_block++;
+			}
+			new_inode_idx[entry->inode_idx] = next_inode++;
+		}
+		new_entries[i].inode_idx = new_inode_idx[entry->inode_idx];
+	}
+	return size;
+}
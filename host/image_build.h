@@ -0,0 +1,36 @@
+/* image_build.h - Builds file system images with a large directory, indirect
+ * blocks, or every file's blocks adjacent, on the host
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _IMAGE_BUILD_H
+#define _IMAGE_BUILD_H
+
+#include "types.h"
+
+/* Entries a large directory has room for past the ones it was built with, so files can be created */
+#define DIR_SPARE_ENTRIES 64
+/* Names of the extra entries, followed by their number */
+#define LINK_NAME_PREFIX "link_"
+
+/* Convert an image to inodes with indirect blocks, adding a file of file_length bytes
+   called name and num_free_blocks free blocks. Returns the new image's size, 0 on failure */
+uint32_t build_indirect_image(const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_cap,
+                              const int8_t* name, uint32_t file_length, uint32_t num_free_blocks);
+/* Byte at a position of the file build_indirect_image adds */
+uint8_t large_file_byte(uint32_t position);
+
+/* Convert an image to a large directory, adding num_links entries that name existing
+   files. Returns the new image's size, 0 on failure */
+uint32_t build_large_dir_image(const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_cap,
+                               uint32_t num_links);
+
+/* Entries to put first when none are named: the shell, then the programs run most */
+#define DEFAULT_FIRST_NAMES {"shell", "ls", "cat", "grep", "hello", "counter"}
+
+/* Rebuild an image with its entries in a set order, first_names first, and every file's
+   data blocks adjacent, in the order of its entries. Returns the new image's size, 0 on failure */
+uint32_t build_sorted_image(const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_cap,
+                            const int8_t* const* first_names, uint32_t num_first_names);
+
+#endif /* _IMAGE_BUILD_H */
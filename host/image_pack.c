@@ -0,0 +1,184 @@
+/* image_pack.c - Builds compressed file system images on the host. Each data
+ * block is compressed on its own with a greedy LZ4 compressor, so the kernel
+ * can decompress any block without reading the blocks before it
+ * vim:ts=4 noexpandtab
+ */
+
+#include "types.h"
+#include "lib.h"
+#include "lz4.h"
+#include "file_system.h"
+#include "image_pack.h"
+
+/* Positions of recent 4 byte sequences, indexed by their hash */
+#define HASH_BITS 12
+#define HASH_SIZE (1 << HASH_BITS)
+#define HASH_MULTIPLIER 2654435761U
+
+/* hash4()
+   Hash the 4 bytes at p into HASH_BITS bits
+ */
+static uint32_t hash4(const uint8_t* p) {
+	uint32_t word = p[0] | (p[1] << 8) | (p[2] << 16) | (p[3] << 24);
+	return (word * HASH_MULTIPLIER) >> (32 - HASH_BITS);
+}
+
+/* same4()
+   Whether the 4 bytes at a and b are equal
+ */
+static int32_t same4(const uint8_t* a, const uint8_t* b) {
+	return a[0] == b[0] && a[1] == b[1] && a[2] == b[2] && a[3] == b[3];
+}
+
+/* write_length()
+   Write the extension bytes of a length whose token nibble is LZ4_NIBBLE_MAX
+   Input : dst, dst_cap -- output block
+           pos -- where the bytes go, advanced past them
+           length -- length minus the LZ4_NIBBLE_MAX already in the token
+   Output : 0 on success, -1 if dst is full
+ */
+static int32_t write_length(uint8_t* dst, uint32_t dst_cap, uint32_t* pos, uint32_t length) {
+	while (1) {
+		if (*pos >= dst_cap) {
+			return -1;
+		}
+		if (length < LZ4_LENGTH_BYTE_MAX) {
+			dst[(*pos)++] = length;
+			return 0;
+		}
+		dst[(*pos)++] = LZ4_LENGTH_BYTE_MAX;
+		length -= LZ4_LENGTH_BYTE_MAX;
+	}
+}
+
+/* write_sequence()
+   Write one sequence: a token, the literals, and a match unless match_length is 0
+   Input : dst, dst_cap, pos -- output block and where the sequence goes
+           literals, num_literals -- bytes copied as they are
+           offset, match_length -- how far back the match starts and its length
+   Output : 0 on success, -1 if dst is full
+ */
+static int32_t write_sequence(uint8_t* dst, uint32_t dst_cap, uint32_t* pos, const uint8_t* literals,
+                              uint32_t num_literals, uint32_t offset, uint32_t match_length) {
+	uint32_t match_code = (match_length > 0)? match_length - LZ4_MIN_MATCH : 0;
+
+	if (*pos >= dst_cap) {
+		return -1;
+	}
+	dst[(*pos)++] = (min(num_literals, LZ4_NIBBLE_MAX) << 4) | min(match_code, LZ4_NIBBLE_MAX);
+	if (num_literals >= LZ4_NIBBLE_MAX &&
+	    write_length(dst, dst_cap, pos, num_literals - LZ4_NIBBLE_MAX) != 0) {
+		return -1;
+	}
+	if (num_literals > dst_cap - *pos) {
+		return -1;
+	}
+	memcpy(dst + *pos, literals, num_literals);
+	*pos += num_literals;
+	if (match_length == 0) {
+		return 0;
+	}
+	if (dst_cap - *pos < 2) {
+		return -1;
+	}
+	dst[(*pos)++] = offset & 0xFF;
+	dst[(*pos)++] = offset >> 8;
+	if (match_code >= LZ4_NIBBLE_MAX &&
+	    write_length(dst, dst_cap, pos, match_code - LZ4_NIBBLE_MAX) != 0) {
+		return -1;
+	}
+	return 0;
+}
+
+/* lz4_compress()
+   Compress a buffer into an LZ4 block, taking the first match found for each position
+   Input : src, src_len -- bytes to compress
+           dst, dst_cap -- array for the compressed block and its size
+   Output : size of the compressed block
+            0 if it would take dst_cap bytes or more, so src is better stored as is
+   Side Effects : dst filled in
+ */
+uint32_t lz4_compress(const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_cap) {
+	/* Position + 1 of the last 4 bytes with each hash, 0 if none */
+	uint32_t table[HASH_SIZE];
+	uint32_t in = 0;
+	uint32_t anchor = 0;
+	uint32_t out = 0;
+
+	memset(table, 0, sizeof(table));
+	while (src_len > LZ4_MATCH_LIMIT && in < src_len - LZ4_MATCH_LIMIT) {
+		uint32_t hash = hash4(src + in);
+		uint32_t candidate = table[hash];
+		table[hash] = in + 1;
+		if (candidate == 0 || in - (candidate - 1) > LZ4_MAX_OFFSET ||
+		    !same4(src + candidate - 1, src + in)) {
+			in++;
+			continue;
+		}
+		candidate--;
+		uint32_t length = LZ4_MIN_MATCH;
+		while (in + length < src_len - LZ4_LAST_LITERALS && src[candidate + length] == src[in + length]) {
+			length++;
+		}
+		if (write_sequence(dst, dst_cap, &out, src + anchor, in - anchor, in - candidate, length) != 0) {
+			return 0;
+		}
+		in += length;
+		anchor = in;
+	}
+	if (write_sequence(dst, dst_cap, &out, src + anchor, src_len - anchor, 0, 0) != 0 || out >= dst_cap) {
+		return 0;
+	}
+	return out;
+}
+
+/* pack_image()
+   Pack a file system image into the compressed layout: the boot block and inodes as
+   they are, with FS_FEATURE_COMPRESSED set, then num_data_blocks + 1 offsets, then
+   every data block compressed on its own, or stored as is if it does not compress
+   Input : src, src_len -- uncompressed image
+           dst, dst_cap -- array for the packed image and its size
+   Output : size of the packed image, 0 if src is not a valid uncompressed image,
+            has a large directory or indirect blocks, or dst is too small
+   Side Effects : dst filled in
+ */
+uint32_t pack_image(const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_cap) {
+	fs_stat_t stat;
+	uint32_t header_size, table_size, out, i;
+
+	if (src_len < sizeof(stat)) {
+		return 0;
+	}
+	memcpy(&stat, src, sizeof(stat));
+	header_size = BLOCK_SIZE * (stat.num_inodes + 1);
+	table_size = sizeof(uint32_t) * (stat.num_data_blocks + 1);
+	/* A large directory and indirect blocks are read in place, so their blocks cannot be compressed */
+	if ((stat.features & (FS_FEATURE_COMPRESSED | FS_FEATURE_LARGE_DIR | FS_FEATURE_INDIRECT)) ||
+	    src_len / BLOCK_SIZE < stat.num_inodes + 1 + stat.num_data_blocks ||
+	    dst_cap < header_size + table_size) {
+		return 0;
+	}
+	memcpy(dst, src, header_size);
+	((fs_stat_t *) dst)->features |= FS_FEATURE_COMPRESSED;
+
+	uint32_t* offsets = BLOCK_OFFSETS_ADDR((uint32_t) dst, stat.num_inodes);
+	uint8_t* data = COMPRESSED_DATA_ADDR((uint32_t) dst, stat.num_inodes, stat.num_data_blocks);
+	uint32_t data_cap = dst_cap - header_size - table_size;
+	const uint8_t* blocks = src + header_size;
+	out = 0;
+	for (i = 0; i < stat.num_data_blocks; i++) {
+		const uint8_t* block = blocks + i * BLOCK_SIZE;
+		uint32_t size = lz4_compress(block, BLOCK_SIZE, data + out, min(data_cap - out, BLOCK_SIZE));
+		if (size == 0) {
+			if (data_cap - out < BLOCK_SIZE) {
+				return 0;
+			}
+			memcpy(data + out, block, BLOCK_SIZE);
+			size = BLOCK_SIZE;
+		}
+		offsets[i] = out;
+		out += size;
+	}
+	offsets[stat.num_data_blocks] = out;
+	return header_size + table_size + out;
+}
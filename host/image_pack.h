@@ -0,0 +1,15 @@
+/* image_pack.h - Builds compressed file system images on the host
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _IMAGE_PACK_H
+#define _IMAGE_PACK_H
+
+#include "types.h"
+
+/* Compress src into an LZ4 block. Returns its size, 0 if it would not be smaller than dst_cap */
+uint32_t lz4_compress(const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_cap);
+/* Pack an image into the compressed layout. Returns the packed size, 0 on failure */
+uint32_t pack_image(const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_cap);
+
+#endif /* _IMAGE_PACK_H */
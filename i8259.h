@@ -21,6 +21,8 @@
  * of each word */
 
 #define IRQs  8
+/* IRQs of both PICs together */
+#define NR_PIC_IRQS (2 * IRQs)
 #define SLAVEIRQ  2
 
 // vector offset : 0x08 for master, 0x70 for slave
@@ -7,6 +7,7 @@
 #include "pcb.h"
 #include "i8259.h"
 #include "scheduler.h"
+#include "virtio_blk.h"
 
 /* Build assembly linkages for exceptions */
 BUILD_IRQ(0x00)
@@ -80,25 +81,32 @@ int32_t is_exception = 0;
    A common interrupt handler that gets called every time an exception,
    interrupt, or system call is invoked.
    Input : i -- interrupt vector
+           error_code -- error code pushed by the processor, -1 if the vector has none
+           cs -- code segment selector of the interrupted code, pushed by the processor
    Output : None
    Side Effect : Handle interrupt(or exception and system call)
    Issue EOI(End Of Interrupt) to unmask handled interrupt   
    Saves and Restores Regs
 */
-void common_handler(int i) {
+void common_handler(int i, uint32_t error_code, uint32_t cs) {
     SAVE_ALL
     /* Exceptions */
     if(i >= VEC_LOWEST_EXCEPTION && i <= VEC_HIGHEST_EXCEPTION) {
-        /* Call Halt to Squash Exceptions */
-        printf("Exception %x Reached\n", i);
-        is_exception = 1;
-        asm volatile("movl $1, %eax; int $0x80;");
+        if (i == VEC_PAGE_FAULT && page_fault_handler(error_code) == 0) {
+            /* Page was filled in by demand paging. Retry the faulting instruction */
+        } else {
+            /* Call Halt to Squash Exceptions */
+            printf("Exception %x Reached\n", i);
+            is_exception = 1;
+            asm volatile("movl $1, %eax; int $0x80;");
+        }
     } 
     /* Regular Interrupts */
     else if (i >= VEC_LOWEST_IRQ && i <= VEC_HIGHEST_IRQ) {
 		if(i==VEC_PIT_INT)
 		{
-			pit_handler();
+			/* The privilege level of the interrupted code segment tells if a program was interrupted */
+			pit_handler((cs & USER_LEVEL) == USER_LEVEL);
 		}
 	
         else if (i == VEC_KEYBOARD_INT) {
@@ -111,7 +119,8 @@ void common_handler(int i) {
 			rtc_handler(i);	
 			
 		
-		} else {
+		} else if (virtio_blk_handler(i - VEC_LOWEST_IRQ) != 0) {
+            /* Not the virtio disk's IRQ either, which PCI assigns */
             printf("Interrupts %x Reached\n", i);
         }
     } else {
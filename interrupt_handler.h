@@ -15,6 +15,7 @@
 #define VEC_LOWEST_IRQ 			0x20
 #define VEC_HIGHEST_IRQ 		0x2F
 
+#define VEC_PAGE_FAULT 			0x0E
 #define VEC_KEYBOARD_INT 		0x21
 #define VEC_RTC_INT 			0x28
 #define VEC_SYSTEM_CALL 		0x80
@@ -27,28 +28,33 @@
 #define IRQ_NAME(nr) 	IRQ_NAME2(IRQ##nr)
 
 /* Linkage For 
- Interrupts That Push Error Codes */
+ Interrupts That Push Error Codes.
+ common_handler gets the vector, a copy of the error code and the interrupted CS */
 #define BUILD_IRQ_ERRCODE(nr) \
 void IRQ_NAME(nr); \
 __asm__( \
 "\n.align 4\n" \
 "IRQ" #nr "_interrupt:\n\t" \
+"pushl 8(%esp);" \
+"pushl 4(%esp);" \
 "push $(" #nr ") ; " \
 "call common_handler;" \
-"addl $8, %esp;" \
+"addl $16, %esp;" \
 "iret;");
 
 /* Linkage For
- Interrupts That Do Not Push Error Codes */
+ Interrupts That Do Not Push Error Codes.
+ common_handler gets the vector, -1 and the interrupted CS */
 #define BUILD_IRQ(nr) \
 void IRQ_NAME(nr); \
 __asm__( \
 "\n.align 4\n" \
 "IRQ" #nr "_interrupt:\n\t" \
+"pushl 4(%esp);" \
 "pushl $-1;" \
 "push $(" #nr ") ; " \
 "call common_handler;" \
-"addl $8, %esp;" \
+"addl $12, %esp;" \
 "iret;");
 
 /* System Call Linkage */
@@ -0,0 +1,310 @@
+/* io_ring.c - Submission and completion rings a process shares with the kernel.
+ * The program queues many file operations and the kernel runs them in a batch
+ * on one system call, or a few at a time on timer ticks that interrupt the program
+ * vim:ts=4 noexpandtab
+ */
+
+#include "io_ring.h"
+#include "system_call.h"
+#include "pcb.h"
+#include "paging.h"
+#include "lib.h"
+#include "kmalloc.h"
+#include "debug.h"
+
+/* System call numbers the benchmark makes through int 0x80 */
+#define SYS_READ 3
+#define SYS_OPEN 5
+#define SYS_CLOSE 6
+#define SYS_LSEEK 16
+#define SYS_IO_ENTER 19
+/* Bytes each read of the benchmark asks for, and the reads it makes each way */
+#define IO_BENCH_RECORD 64
+#define IO_BENCH_OPS 4096
+
+extern file_ops_t file_ops_ptrs[FILE_OPS_PTRS_SIZE];
+
+/* run_sqe
+   Run one submitted operation through the system call of the same name, which
+   checks its file descriptor and arguments
+   Input : sqe -- the kernel's copy of the entry
+   Output : what the system call returned, -1 for an unknown opcode
+   Side Effect : Those of the system call
+*/
+static int32_t run_sqe(const io_sqe_t* sqe)
+{
+	switch (sqe->opcode) {
+	case IO_OP_READ:
+		return sys_read(sqe->fd, (void *) sqe->addr, sqe->length);
+	case IO_OP_WRITE:
+		return sys_write(sqe->fd, (const void *) sqe->addr, sqe->length);
+	case IO_OP_OPEN:
+		return sys_open((const uint8_t *) sqe->addr);
+	case IO_OP_CLOSE:
+		return sys_close(sqe->fd);
+	case IO_OP_PREAD:
+		return sys_pread(sqe->fd, (void *) sqe->addr, sqe->length, sqe->offset);
+	default:
+		return -1;
+	}
+}
+
+/* may_block
+   Whether an operation could wait for input or for the disk, or take long. A timer
+   tick runs with interrupts off, so it leaves to io_enter reads of the terminal and
+   the RTC, reads and writes of more than IO_RING_TICK_MAX_BYTES, and on a disk mount
+   every operation with a buffer or a name: a block of the file may miss in the block
+   cache, and touching the buffer may fault a page of the program in from the disk
+   Input : pcb -- process that queued the entry
+   		   sqe -- the kernel's copy of the entry
+   Output : 1 if the operation is a read of something other than a file or directory,
+   			a read or write of more than IO_RING_TICK_MAX_BYTES, or any operation but
+   			close on the file system mounted from a disk
+   			0 otherwise
+*/
+static int32_t may_block(pcb_t* pcb, const io_sqe_t* sqe)
+{
+	file_desc_t* file_desc;
+
+	if (sqe->opcode != IO_OP_READ && sqe->opcode != IO_OP_PREAD &&
+	    sqe->opcode != IO_OP_WRITE && sqe->opcode != IO_OP_OPEN)
+		return 0;
+	if (is_disk_file_system())
+		return 1;
+	if (sqe->opcode == IO_OP_OPEN)
+		return 0;
+	if (sqe->length > IO_RING_TICK_MAX_BYTES)
+		return 1;
+	if (sqe->opcode == IO_OP_WRITE)
+		return 0;
+	file_desc = get_open_file_desc(pcb, sqe->fd);
+	if (file_desc == NULL)
+		return 0;
+	return file_desc->file_ops != &file_ops_ptrs[REG_FILE_OPS_IDX] &&
+	       file_desc->file_ops != &file_ops_ptrs[DIR_FILE_OPS_IDX];
+}
+
+/* process_ring
+   Take submitted entries in order and post their results, until max entries are
+   done, the submission ring is empty or the completion ring is full
+   Input : pcb -- process whose ring to process
+   		   max -- most entries to process
+   		   in_background -- nonzero on a timer tick, which stops at an entry that may block
+   Output : number of entries processed
+   Side Effect : Advances sq_head and cq_tail
+*/
+static uint32_t process_ring(pcb_t* pcb, uint32_t max, int32_t in_background)
+{
+	io_ring_t* ring = pcb->io_ring;
+	io_cqe_t* cqe;
+	io_sqe_t sqe;
+	uint32_t done = 0;
+
+	while (done < max && ring->sq_head != ring->sq_tail &&
+	       ring->cq_tail - ring->cq_head < IO_RING_ENTRIES) {
+		/* The program can rewrite the slot meanwhile, so the kernel works on a copy */
+		sqe = ring->sqes[ring->sq_head & IO_RING_MASK];
+		if (in_background && may_block(pcb, &sqe))
+			break;
+		ring->sq_head++;
+		cqe = &ring->cqes[ring->cq_tail & IO_RING_MASK];
+		cqe->user_data = sqe.user_data;
+		cqe->result = run_sqe(&sqe);
+		ring->cq_tail++;
+		done++;
+	}
+	return done;
+}
+
+/* sys_io_setup
+   Maps the caller's rings into its mmap region, emptied out. A second call
+   returns the rings already mapped
+   Input : None
+   Output : virtual address of the io_ring_t
+   			-1 if there is no free page in the mmap region or in the kernel heap
+   Side Effect : Takes the ring page from the kernel heap and maps it in the
+   				 caller's page directory
+*/
+int32_t sys_io_setup(void)
+{
+	pcb_t* pcb = get_pcb_ptr();
+	io_ring_t* ring;
+	uint32_t addr;
+
+	if (pcb->io_ring != NULL)
+		return pcb->io_ring_addr;
+	if (get_proc_index(pcb) == -1)
+		return -1;
+
+	/* A page of the heap is page aligned, and identity mapped like the rest of the kernel */
+	ring = kmalloc(sizeof(io_ring_t));
+	if (ring == NULL)
+		return -1;
+	addr = find_free_pages(MMAP_VIRT_ADDR, 1, pcb->pg_dir);
+	if (addr == NULL ||
+	    map_page_4k(addr, (uint32_t) ring, PAGING_USER_SUPERVISOR | PAGING_READ_WRITE, pcb->pg_dir) != 0) {
+		kfree(ring);
+		return -1;
+	}
+
+	memset(ring, 0, sizeof(io_ring_t));
+	pcb->io_ring = ring;
+	pcb->io_ring_addr = addr;
+	return addr;
+}
+
+/* sys_io_enter
+   Runs up to to_submit of the operations the caller queued, in order
+   Input : to_submit -- most entries to process
+   Output : number of entries processed, fewer if the submission ring ran
+   			empty or the completion ring filled up
+   			-1 if the caller has no rings or its submission ring holds more
+   			entries than it has room for
+   Side Effect : Those of the operations
+*/
+int32_t sys_io_enter(uint32_t to_submit)
+{
+	pcb_t* pcb = get_pcb_ptr();
+
+	if (pcb->io_ring == NULL || pcb->io_ring->sq_tail - pcb->io_ring->sq_head > IO_RING_ENTRIES)
+		return -1;
+	return process_ring(pcb, to_submit, 0);
+}
+
+/* io_ring_tick
+   Processes a few of the current process's queued operations on a timer tick, so
+   a program that polls its completion ring needs no system call. Called only when
+   the tick interrupted user mode, never in the middle of a system call
+   Input : None
+   Output : None
+   Side Effect : Those of the operations
+*/
+void io_ring_tick(void)
+{
+	pcb_t* pcb = get_pcb_ptr();
+
+	if (pcb->io_ring == NULL || pcb->io_ring->sq_tail - pcb->io_ring->sq_head > IO_RING_ENTRIES)
+		return;
+	process_ring(pcb, IO_RING_TICK_BATCH, 1);
+}
+
+/* close_io_ring
+   Unmaps the rings of a process that halts and gives their page back to the
+   kernel heap. Queued operations are dropped
+   Input : pcb -- process that halts
+   Output : None
+   Side Effect : Clears the page table entry of the rings
+*/
+void close_io_ring(pcb_t* pcb)
+{
+	if (pcb->io_ring == NULL)
+		return;
+	unmap_page(pcb->io_ring_addr, pcb->pg_dir);
+	kfree(pcb->io_ring);
+	pcb->io_ring = NULL;
+	pcb->io_ring_addr = NULL;
+}
+
+#if KERNEL_BENCH
+/* kernel_syscall
+   Make a system call through int 0x80, as a program does
+   Input : num -- system call number
+   		   arg1, arg2, arg3, arg4 -- arguments, in ebx, ecx, edx and esi
+   Output : what the system call returned
+*/
+static int32_t kernel_syscall(int32_t num, uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4)
+{
+	int32_t ret;
+	asm volatile("int $0x80"
+	             : "=a"(ret)
+	             : "a"(num), "b"(arg1), "c"(arg2), "d"(arg3), "S"(arg4)
+	             : "memory", "cc");
+	return ret;
+}
+
+/* bench_io_ring
+   Read the first regular file of the file system IO_BENCH_RECORD bytes at a time,
+   IO_BENCH_OPS times each way: once with a read system call per record, and once
+   queueing a ring full of reads per io_enter call, starting over at the end of the
+   file both times. Runs on the kernel's PCB, lending it file descriptors and a ring.
+   Prints the cycles each way took
+*/
+void bench_io_ring(void)
+{
+	static file_desc_t bench_fds[FDS_PER_CHUNK];
+	static io_ring_t bench_ring;
+	static uint8_t buf[IO_BENCH_RECORD];
+	pcb_t* pcb = get_pcb_ptr();
+	uint32_t read_cycles, ring_cycles, start, calls, batch;
+	int32_t fd, done, result, at_end;
+	dentry_t dentry;
+	int i;
+
+	for (i = 0; read_dentry_by_index(i, &dentry) == 0; i++) {
+		if (dentry.file_type == FILE_TYPE_FILE && get_file_length(dentry.inode_idx) >= IO_BENCH_RECORD)
+			break;
+	}
+	if (dentry.file_type != FILE_TYPE_FILE) {
+		printf("bench_io_ring: no regular file of %d bytes\n", IO_BENCH_RECORD);
+		return;
+	}
+
+	memset(pcb->fd_chunks, 0, sizeof(pcb->fd_chunks));
+	memset(pcb->fd_bitmap, 0, sizeof(pcb->fd_bitmap));
+	memset(bench_fds, 0, sizeof(bench_fds));
+	pcb->fd_chunks[0] = bench_fds;
+	claim_fd(pcb, 0);
+	claim_fd(pcb, 1);
+	memset(&bench_ring, 0, sizeof(bench_ring));
+	pcb->io_ring = &bench_ring;
+
+	fd = kernel_syscall(SYS_OPEN, (uint32_t) dentry.file_name, 0, 0, 0);
+	if (fd == -1) {
+		printf("bench_io_ring: cannot open inode %d\n", dentry.inode_idx);
+	} else {
+		start = rdtsc();
+		for (i = 0; i < IO_BENCH_OPS; i++) {
+			if (kernel_syscall(SYS_READ, fd, (uint32_t) buf, IO_BENCH_RECORD, 0) == 0)
+				kernel_syscall(SYS_LSEEK, fd, 0, SEEK_SET, 0);
+		}
+		read_cycles = rdtsc() - start;
+
+		kernel_syscall(SYS_LSEEK, fd, 0, SEEK_SET, 0);
+		calls = 0;
+		start = rdtsc();
+		for (i = 0; i < IO_BENCH_OPS; i += batch) {
+			batch = IO_BENCH_OPS - i < IO_RING_ENTRIES ? IO_BENCH_OPS - i : IO_RING_ENTRIES;
+			for (done = 0; done < batch; done++) {
+				io_sqe_t* sqe = &bench_ring.sqes[bench_ring.sq_tail & IO_RING_MASK];
+				sqe->opcode = IO_OP_READ;
+				sqe->fd = fd;
+				sqe->addr = (uint32_t) buf;
+				sqe->length = IO_BENCH_RECORD;
+				sqe->user_data = i + done;
+				bench_ring.sq_tail++;
+			}
+			kernel_syscall(SYS_IO_ENTER, batch, 0, 0, 0);
+			calls++;
+			at_end = 0;
+			while (bench_ring.cq_head != bench_ring.cq_tail) {
+				result = bench_ring.cqes[bench_ring.cq_head & IO_RING_MASK].result;
+				if (result == 0)
+					at_end = 1;
+				bench_ring.cq_head++;
+			}
+			if (at_end)
+				kernel_syscall(SYS_LSEEK, fd, 0, SEEK_SET, 0);
+		}
+		ring_cycles = rdtsc() - start;
+
+		kernel_syscall(SYS_CLOSE, fd, 0, 0, 0);
+		printf("%d reads of %d bytes: read %u cycles, io ring %u cycles in %u io_enter calls\n",
+		       IO_BENCH_OPS, IO_BENCH_RECORD, read_cycles, ring_cycles, calls);
+	}
+
+	pcb->io_ring = NULL;
+	destroy_fd(pcb, 0);
+	destroy_fd(pcb, 1);
+	pcb->fd_chunks[0] = NULL;
+}
+#endif /* KERNEL_BENCH */
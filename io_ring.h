@@ -0,0 +1,73 @@
+/* io_ring.h - Defines for the submission and completion rings a process
+ * shares with the kernel to queue file operations
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _IO_RING_H
+#define _IO_RING_H
+
+#include "types.h"
+#include "debug.h"
+
+/* The rings fill one page mapped into the process */
+#define IO_RING_SIZE 4096
+/* Entries in each ring, a power of two. Head and tail count up freely and are masked on use */
+#define IO_RING_ENTRIES 64
+#define IO_RING_MASK (IO_RING_ENTRIES - 1)
+/* Entries a timer tick processes in the background, and the most bytes a read or write
+   it runs may move, one file system block, so a tick stays short */
+#define IO_RING_TICK_BATCH 4
+#define IO_RING_TICK_MAX_BYTES 4096
+
+/* Operations of a submission entry, each runs the system call of the same name */
+#define IO_OP_READ 0
+#define IO_OP_WRITE 1
+#define IO_OP_OPEN 2
+#define IO_OP_CLOSE 3
+#define IO_OP_PREAD 4
+
+/* An operation the program queues. addr is the buffer, or the file name to open */
+typedef struct io_sqe_t {
+	uint32_t opcode;
+	int32_t fd;
+	uint32_t addr;
+	uint32_t length;
+	uint32_t offset;    /* only for IO_OP_PREAD */
+	uint32_t user_data; /* copied to the completion entry */
+	uint32_t reserved[2];
+} io_sqe_t;
+
+/* The result of an operation, what its system call returned */
+typedef struct io_cqe_t {
+	uint32_t user_data;
+	int32_t result;
+} io_cqe_t;
+
+/* The program fills sqes and advances sq_tail, the kernel advances sq_head as it takes them.
+   The kernel fills cqes and advances cq_tail, the program advances cq_head as it reaps them */
+typedef struct io_ring_t {
+	volatile uint32_t sq_head;
+	volatile uint32_t sq_tail;
+	volatile uint32_t cq_head;
+	volatile uint32_t cq_tail;
+	uint32_t reserved[12];
+	io_sqe_t sqes[IO_RING_ENTRIES];
+	io_cqe_t cqes[IO_RING_ENTRIES];
+} __attribute__((aligned(IO_RING_SIZE))) io_ring_t;
+
+extern int32_t sys_io_setup(void);
+
+extern int32_t sys_io_enter(uint32_t to_submit);
+
+/* Process queued operations of the current process in the background on a timer tick */
+void io_ring_tick(void);
+
+/* Unmap the rings of a process that halts */
+struct pcb_t;
+void close_io_ring(struct pcb_t* pcb);
+
+#if KERNEL_BENCH
+void bench_io_ring(void);
+#endif
+
+#endif /* _IO_RING_H */
@@ -12,7 +12,16 @@
 #include "rtc.h"
 #include "keyboard.h"
 #include "file_system.h"
+#include "ata.h"
+#include "pci.h"
+#include "virtio_blk.h"
 #include "scheduler.h"
+#include "syscall_exec.h"
+#include "system_call.h"
+#include "io_ring.h"
+#include "frame_alloc.h"
+#include "kmalloc.h"
+#include "pcb.h"
 
 /* Macros. */
 /* Check if the bit BIT in FLAGS is set. */
@@ -109,6 +118,14 @@ entry (unsigned long magic, unsigned long addr)
 					(unsigned) mmap->length_low);
 	}
 
+	/* Hand the free memory past the kernel to the frame allocator, which backs processes */
+	init_frame_alloc(mbi);
+	printf("frame allocator: %u free 4KB frames\n", get_num_free_frames());
+
+	/* Set up the kernel heap, then the PCB caches and the boot stack's PCB */
+	init_kmalloc();
+	init_pcbs();
+
 	/* Construct an LDT entry in the GDT */
 	{
 		seg_desc_t the_ldt_desc;
@@ -171,9 +188,27 @@ entry (unsigned long magic, unsigned long addr)
 	/* Initialize devices, memory, filesystem, enable device interrupts on the
 	 * PIC, any other initialization stuff... */
 	 
-    /* Initialize the Read-only File System */
-    module_t* fs_mod = (module_t*)mbi->mods_addr;
-    init_file_system(fs_mod->mod_start, fs_mod->mod_end);
+    /* Initialize the File System, from the image on the virtio disk or the primary
+       channel's slave disk if there is one, otherwise from the image loaded as the first module */
+    pci_init();
+    virtio_blk_init();
+    ata_init();
+    if (init_disk_file_system(virtio_blk_get_device()) != 0 &&
+        init_disk_file_system(ata_get_device(ATA_SLAVE)) != 0) {
+        module_t* fs_mod = (module_t*)mbi->mods_addr;
+        /* The boot loader puts the module right after the kernel's bss, and the kernel
+           stacks below 8MB would overwrite the part of it that reaches them */
+        if (!CHECK_FLAG(mbi->flags, 3) || mbi->mods_count == 0) {
+            printf("No file system: no disk image and no module\n");
+            return;
+        }
+        if (fs_mod->mod_end > KERNEL_STACKS_START) {
+            printf("File system module ends at 0x%#x, past the kernel stacks at 0x%#x\n",
+                   (unsigned) fs_mod->mod_end, (unsigned) KERNEL_STACKS_START);
+            return;
+        }
+        init_file_system(fs_mod->mod_start, fs_mod->mod_end);
+    }
 
 	/* Initialize Paging */
 	init_paging();
@@ -187,6 +222,16 @@ entry (unsigned long magic, unsigned long addr)
 	terminal_open();
 	/* Test file_system driver */
     //test_file_system_driver();
+	/* Benchmarks, built only with KERNEL_BENCH set in debug.h */
+	//bench_dentry_lookup();
+	//bench_read_file();
+	//bench_disk_read();
+	//bench_block_dev(ata_get_device(ATA_SLAVE));
+	//bench_block_dev(virtio_blk_get_device());
+	//bench_exec_loader();
+	//bench_mmap_scan();
+	//bench_io_ring();
+	//print_kmem_stats();
 	//Test for pit
 	pit_init(0,2,20);
     /* Test the RTC driver */
@@ -5,6 +5,7 @@
 #include "pcb.h"
 #include "system_call.h"
 #include "debug.h"
+#include "frame_alloc.h"
 
 /* Keyboard Keys without Shift Press in Increasing Scan Code Order */
 char keys[] = {
@@ -275,8 +276,9 @@ void change_terminal(int32_t new_terminal)
 		return;
 	}
 
-	/* Case where we try to launch shell with max_num_process already running */
-	if(num_progs[TERMINAL_1] + num_progs[TERMINAL_2] + num_progs[TERMINAL_3] >= MAX_NUM_PROCESS && 
+	/* Case where we try to launch shell with max_num_process already running, or without memory for it */
+	if((num_progs[TERMINAL_1] + num_progs[TERMINAL_2] + num_progs[TERMINAL_3] >= MAX_NUM_PROCESS ||
+	    !can_alloc_frames(FRAME_ORDER_4M)) && 
 	   num_progs[new_terminal] == 0){
 	   	printf("Reached maximum number of programs! Can't fire new shell in new terminal!391OS> ");
 		return;
@@ -428,29 +430,16 @@ int32_t terminal_read(uint32_t dummy, uint8_t* buf,uint32_t nbytes)
    		   buf - char buf with data to write to terminal
    		   nbytes -- number of bytes to write to terminal
    Output : Return number of bytes written to terminal including '\n' if any
-   Side Effect : Writes to Terminal 
+   Side Effect : Writes to Terminal, skipping Null characters 
 */
 int32_t terminal_write(uint32_t dummy, uint32_t dummy1, const uint8_t* buf, uint32_t nbytes)
 {	
-	int i;
-	int n = 0;
-
 	/* Invalid Args */
 	if(buf == NULL || nbytes <= 0)
 		return -1;
 
-	/* Print string in buf until 
-	 * Reached End of String */
-	for (i = 0; i < nbytes; i++) {
-		/* Don't print Null characters */
-		if (buf[i] != NULL) {
-			putc(buf[i]);
-			n++;
-		} 
-	}
-
-	/* Return # of bytes written */
-	return n; 
+	/* Whole buffer at once, the cursor is moved only at its end */
+	return putbuf(buf, nbytes); 
 }
 
 /* update_terminal_buf function
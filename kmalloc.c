@@ -0,0 +1,296 @@
+/* kmalloc.c - Kernel heap. Pages of a heap in the kernel's bss are handed to
+ * slab caches, each serving objects of one size: PCBs, file descriptor chunks,
+ * page directories and page tables, and the power of two sizes of kmalloc.
+ * Taking and giving back an object are constant time
+ * vim:ts=4 noexpandtab
+ */
+
+#include "kmalloc.h"
+#include "lib.h"
+#include "debug.h"
+
+/* A page of the heap, free or holding a slab of some cache */
+typedef struct kmem_slab_t {
+	kmem_cache_t* cache;        /* NULL while the page is free */
+	void* free_list;            /* objects given back, linked through their first word */
+	uint16_t num_used;
+	uint16_t num_carved;        /* objects handed out at least once, the rest of the page is untouched */
+	struct kmem_slab_t* next;   /* in the cache's partial list, or the list of free pages */
+	struct kmem_slab_t* prev;
+} kmem_slab_t;
+
+static uint8_t heap[KMEM_HEAP_SIZE] __attribute__((aligned(KMEM_PAGE_SIZE)));
+static kmem_slab_t slabs[KMEM_NUM_PAGES];
+static kmem_slab_t* free_pages;
+static uint32_t num_free_pages;
+
+static kmem_cache_t caches[KMEM_MAX_CACHES];
+static uint32_t num_caches;
+static kmem_cache_t* kmalloc_caches[KMALLOC_NUM_CACHES];
+static const char* kmalloc_names[KMALLOC_NUM_CACHES] = {
+	"kmalloc-64", "kmalloc-128", "kmalloc-256", "kmalloc-512",
+	"kmalloc-1024", "kmalloc-2048", "kmalloc-4096"
+};
+
+/* slab_page
+   First byte of the page a slab describes
+*/
+static uint8_t* slab_page(kmem_slab_t* slab)
+{
+	return &heap[(slab - slabs) << KMEM_PAGE_SHIFT];
+}
+
+/* addr_to_slab
+   Slab of the page holding an address
+   Output : NULL if the address is outside the heap
+*/
+static kmem_slab_t* addr_to_slab(const void* addr)
+{
+	if (!is_kmem_addr(addr))
+		return NULL;
+	return &slabs[((const uint8_t *) addr - heap) >> KMEM_PAGE_SHIFT];
+}
+
+/* push_slab
+   Put a slab at the front of a cache's partial list
+*/
+static void push_slab(kmem_cache_t* cache, kmem_slab_t* slab)
+{
+	slab->prev = NULL;
+	slab->next = cache->partial;
+	if (cache->partial != NULL)
+		cache->partial->prev = slab;
+	cache->partial = slab;
+}
+
+/* unlink_slab
+   Take a slab out of a cache's partial list
+*/
+static void unlink_slab(kmem_cache_t* cache, kmem_slab_t* slab)
+{
+	if (slab->prev != NULL)
+		slab->prev->next = slab->next;
+	else
+		cache->partial = slab->next;
+	if (slab->next != NULL)
+		slab->next->prev = slab->prev;
+}
+
+/* is_kmem_addr
+   Whether an address lies in the kernel heap
+*/
+int32_t is_kmem_addr(const void* addr)
+{
+	return (const uint8_t *) addr >= heap && (const uint8_t *) addr < heap + KMEM_HEAP_SIZE;
+}
+
+/* get_num_free_heap_pages
+   Pages of the heap no cache holds
+*/
+uint32_t get_num_free_heap_pages(void)
+{
+	return num_free_pages;
+}
+
+/* kmem_cache_create
+   Make a cache of objects of one size
+   Input : name -- name printed with its statistics, kept by reference
+   		   size -- bytes of each object, at most a page
+   Output : the cache
+   			NULL if size is 0 or larger than a page, or every cache is taken
+   Side Effect : Takes an entry of the cache table
+*/
+kmem_cache_t* kmem_cache_create(const char* name, uint32_t size)
+{
+	kmem_cache_t* cache;
+
+	if (size == 0 || size > KMEM_PAGE_SIZE || num_caches == KMEM_MAX_CACHES) {
+		LOG("Cannot create cache %s of %d bytes\n", name, size);
+		return NULL;
+	}
+	cache = &caches[num_caches++];
+	memset(cache, 0, sizeof(kmem_cache_t));
+	cache->name = name;
+	cache->obj_size = (size + KMEM_CACHE_LINE - 1) & ~(KMEM_CACHE_LINE - 1);
+	cache->objs_per_slab = KMEM_PAGE_SIZE / cache->obj_size;
+	return cache;
+}
+
+/* kmem_cache_alloc
+   Take an object of a cache: one given back to the first partial slab, or the next
+   untouched one of it, or the first of a page taken from the heap when no slab has room
+   Input : cache -- cache to take from
+   Output : the object, cache line aligned and not cleared
+   			NULL if the heap has no free page
+   Side Effect : Counts the allocation in the cache's statistics
+*/
+void* kmem_cache_alloc(kmem_cache_t* cache)
+{
+	kmem_slab_t* slab;
+	void* obj;
+	uint32_t flags;
+
+	if (cache == NULL)
+		return NULL;
+	flags = save_flags_and_cli();
+	slab = cache->partial;
+	if (slab == NULL) {
+		slab = free_pages;
+		if (slab == NULL) {
+			cache->num_failed++;
+			restore_saved_flags(flags);
+			return NULL;
+		}
+		free_pages = slab->next;
+		num_free_pages--;
+		slab->cache = cache;
+		slab->free_list = NULL;
+		slab->num_used = 0;
+		slab->num_carved = 0;
+		push_slab(cache, slab);
+		cache->num_slabs++;
+	}
+
+	if (slab->free_list != NULL) {
+		obj = slab->free_list;
+		slab->free_list = *(void **) obj;
+	} else {
+		obj = slab_page(slab) + slab->num_carved * cache->obj_size;
+		slab->num_carved++;
+	}
+	/* A full slab leaves the partial list until an object comes back to it */
+	if (++slab->num_used == cache->objs_per_slab)
+		unlink_slab(cache, slab);
+
+	cache->num_allocs++;
+	if (++cache->num_active > cache->max_active)
+		cache->max_active = cache->num_active;
+	restore_saved_flags(flags);
+	return obj;
+}
+
+/* free_obj
+   Give an object back to its slab. A slab left empty gives its page back to the heap
+   Input : slab -- slab of the page holding the object
+   		   obj -- the object
+   Output : None
+   Side Effect : Counts the free in the cache's statistics
+*/
+static void free_obj(kmem_slab_t* slab, void* obj)
+{
+	kmem_cache_t* cache = slab->cache;
+	uint32_t flags = save_flags_and_cli();
+
+	if (slab->num_used == cache->objs_per_slab)
+		push_slab(cache, slab);
+	*(void **) obj = slab->free_list;
+	slab->free_list = obj;
+	slab->num_used--;
+	cache->num_frees++;
+	cache->num_active--;
+
+	if (slab->num_used == 0) {
+		unlink_slab(cache, slab);
+		cache->num_slabs--;
+		slab->cache = NULL;
+		slab->next = free_pages;
+		free_pages = slab;
+		num_free_pages++;
+	}
+	restore_saved_flags(flags);
+}
+
+/* kmem_cache_free
+   Give back an object taken with kmem_cache_alloc
+   Input : cache -- cache it was taken from
+   		   obj -- the object, NULL is ignored
+   Output : None
+   Side Effect : The object may be handed out again
+*/
+void kmem_cache_free(kmem_cache_t* cache, void* obj)
+{
+	kmem_slab_t* slab = addr_to_slab(obj);
+
+	if (obj == NULL)
+		return;
+	if (slab == NULL || slab->cache != cache) {
+		LOG("Object %x was not taken from cache %s\n", obj, cache->name);
+		return;
+	}
+	free_obj(slab, obj);
+}
+
+/* kmalloc
+   Take size bytes from the smallest kmalloc cache they fit in
+   Input : size -- bytes needed, at most a page
+   Output : the memory, cache line aligned, page aligned for a page
+   			NULL if size is 0 or larger than a page, or the heap is full
+*/
+void* kmalloc(uint32_t size)
+{
+	uint32_t shift = KMALLOC_MIN_SHIFT;
+
+	if (size == 0 || size > (1U << KMALLOC_MAX_SHIFT))
+		return NULL;
+	while ((1U << shift) < size)
+		shift++;
+	return kmem_cache_alloc(kmalloc_caches[shift - KMALLOC_MIN_SHIFT]);
+}
+
+/* kfree
+   Give back memory taken with kmalloc, or an object of any cache
+   Input : obj -- the memory, NULL is ignored
+   Output : None
+*/
+void kfree(void* obj)
+{
+	kmem_slab_t* slab = addr_to_slab(obj);
+
+	if (obj == NULL)
+		return;
+	if (slab == NULL || slab->cache == NULL) {
+		LOG("Freeing %x, which is not in the kernel heap\n", obj);
+		return;
+	}
+	free_obj(slab, obj);
+}
+
+/* print_kmem_stats
+   Print the statistics of every cache, and the pages left in the heap
+*/
+void print_kmem_stats(void)
+{
+	uint32_t i;
+	kmem_cache_t* cache;
+
+	for (i = 0; i < num_caches; i++) {
+		cache = &caches[i];
+		printf("%s: %u bytes, %u active (max %u) in %u slabs, %u allocs, %u frees, %u failed\n",
+		       cache->name, cache->obj_size, cache->num_active, cache->max_active,
+		       cache->num_slabs, cache->num_allocs, cache->num_frees, cache->num_failed);
+	}
+	printf("kernel heap: %u of %u pages free\n", num_free_pages, KMEM_NUM_PAGES);
+}
+
+/* init_kmalloc
+   Put every page of the heap on the free list, in address order, and make the
+   kmalloc caches. Runs before any other cache is made
+   Input : None
+   Output : None
+   Side Effect : Sets up the heap
+*/
+void init_kmalloc(void)
+{
+	int32_t i;
+
+	free_pages = NULL;
+	for (i = KMEM_NUM_PAGES - 1; i >= 0; i--) {
+		slabs[i].cache = NULL;
+		slabs[i].next = free_pages;
+		free_pages = &slabs[i];
+	}
+	num_free_pages = KMEM_NUM_PAGES;
+	num_caches = 0;
+	for (i = 0; i < KMALLOC_NUM_CACHES; i++)
+		kmalloc_caches[i] = kmem_cache_create(kmalloc_names[i], 1U << (i + KMALLOC_MIN_SHIFT));
+}
@@ -0,0 +1,54 @@
+/* kmalloc.h - Defines for the kernel heap, slab caches of fixed size objects
+ * carved out of the pages of a heap inside the kernel's 4MB page
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _KMALLOC_H
+#define _KMALLOC_H
+
+#include "types.h"
+
+/* The heap is identity mapped with the kernel, so the address of an object is also
+   its physical address, and page directories and page tables can come from it */
+#define KMEM_HEAP_SIZE 0x100000
+#define KMEM_PAGE_SIZE 4096
+#define KMEM_PAGE_SHIFT 12
+#define KMEM_NUM_PAGES (KMEM_HEAP_SIZE / KMEM_PAGE_SIZE)
+/* Objects are a whole number of cache lines, and start on one */
+#define KMEM_CACHE_LINE 64
+#define KMEM_MAX_CACHES 16
+/* kmalloc serves powers of two from a cache line up to a page */
+#define KMALLOC_MIN_SHIFT 6
+#define KMALLOC_MAX_SHIFT 12
+#define KMALLOC_NUM_CACHES (KMALLOC_MAX_SHIFT - KMALLOC_MIN_SHIFT + 1)
+
+struct kmem_slab_t;
+
+/* A cache of objects of one size. Each slab is one page of the heap */
+typedef struct kmem_cache_t {
+	const char* name;
+	uint32_t obj_size;          /* requested size rounded up to KMEM_CACHE_LINE */
+	uint32_t objs_per_slab;
+	struct kmem_slab_t* partial; /* slabs with both taken and free objects */
+	/* Statistics */
+	uint32_t num_allocs;
+	uint32_t num_frees;
+	uint32_t num_failed;        /* allocations that found the heap full */
+	uint32_t num_active;        /* objects taken now */
+	uint32_t max_active;
+	uint32_t num_slabs;         /* pages held now */
+} kmem_cache_t;
+
+void init_kmalloc(void);
+kmem_cache_t* kmem_cache_create(const char* name, uint32_t size);
+void* kmem_cache_alloc(kmem_cache_t* cache);
+void kmem_cache_free(kmem_cache_t* cache, void* obj);
+
+void* kmalloc(uint32_t size);
+void kfree(void* obj);
+
+int32_t is_kmem_addr(const void* addr);
+uint32_t get_num_free_heap_pages(void);
+void print_kmem_stats(void);
+
+#endif /* _KMALLOC_H */
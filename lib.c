@@ -190,39 +190,22 @@ puts(int8_t* s)
 }
 
 /*
-* void putc(uint8_t c);
-*   Inputs: uint_8* c = character to print
+* static void put_char(uint8_t c, int32_t curr_terminal);
+*   Inputs: uint_8 c = character to print
+*			int32_t curr_terminal = terminal whose screen video_mem points to
 *   Return Value: void
-*	Function: Output a character to the console 
+*	Function: Write a character at the terminal's position and move past it,
+*			  scrolling at the bottom of the screen. The cursor is left where it was
 */
 
-void
-putc(uint8_t c)
+static void
+put_char(uint8_t c, int32_t curr_terminal)
 {
-	int key_press = get_key_press();
-	int32_t curr_terminal;
-
-	/* If putc is called by system call */
-	if(key_press == 0){
-		asm volatile ("cli"); // Protect with cli
-		curr_terminal = get_current_terminal();	
-	}
-	/* If putc is called by keyboard interrupt */
-	else{
-		curr_terminal = get_displayed_terminal();	//want to write to displayed terminal
-		video_mem = (char *)VIDEO;	
-	}
-	
-	/* Get the terminal the caller is executing in */	
-	//curr_terminal = get_current_terminal();
-	
     if(c == '\n' || c == '\r') {
     	/* If not at bottom row, don't provide Scrolling */
     	if(screen_y[curr_terminal] != NUM_ROWS - 1){
         	screen_y[curr_terminal]++;
         	screen_x[curr_terminal]= 0;
-       		if(curr_terminal == get_displayed_terminal())
-        		update_cursor(screen_y[curr_terminal], screen_x[curr_terminal]);
     	}
     	/* At Bottom Row - Provide Scrolling */
     	else{
@@ -230,8 +213,6 @@ putc(uint8_t c)
     		memcpy(video_mem, video_mem + ((NUM_COLS * 1 + 0) << 1), (NUM_COLS * (NUM_ROWS - 1) * 2));
         	screen_x[curr_terminal] = 0;
         	clear_row(NUM_ROWS - 1);
-        	if(curr_terminal == get_displayed_terminal())
-        		update_cursor(screen_y[curr_terminal], screen_x[curr_terminal]);
     	}
     } 
     else {
@@ -245,18 +226,43 @@ putc(uint8_t c)
         	memcpy(video_mem, video_mem + ((NUM_COLS * 1 + 0) << 1), (NUM_COLS * (NUM_ROWS - 1) * 2));
         	screen_x[curr_terminal] = 0;
         	clear_row(NUM_ROWS - 1);
-        	if(curr_terminal == get_displayed_terminal())
-        		update_cursor(screen_y[curr_terminal], screen_x[curr_terminal]);
         }
         /* Not at Bottom-Right of Screen, don't Provide Scrolling */
        	else{    
         	screen_y[curr_terminal] = (screen_y[curr_terminal] + (screen_x[curr_terminal] / (NUM_COLS - 1))) % NUM_ROWS;
         	screen_x[curr_terminal]++;
         	screen_x[curr_terminal] %= NUM_COLS;
-        	if(curr_terminal == get_displayed_terminal())
-        		update_cursor(screen_y[curr_terminal], screen_x[curr_terminal]);
         }
  	}
+}
+
+/*
+* void putc(uint8_t c);
+*   Inputs: uint_8* c = character to print
+*   Return Value: void
+*	Function: Output a character to the console 
+*/
+
+void
+putc(uint8_t c)
+{
+	int key_press = get_key_press();
+	int32_t curr_terminal;
+
+	/* If putc is called by system call */
+	if(key_press == 0){
+		asm volatile ("cli"); // Protect with cli
+		curr_terminal = get_current_terminal();	
+	}
+	/* If putc is called by keyboard interrupt */
+	else{
+		curr_terminal = get_displayed_terminal();	//want to write to displayed terminal
+		video_mem = (char *)VIDEO;	
+	}
+	
+	put_char(c, curr_terminal);
+	if(curr_terminal == get_displayed_terminal())
+		update_cursor(screen_y[curr_terminal], screen_x[curr_terminal]);
 
  	/* Point video_mem back to USER_VIDEO */
  	if(key_press == 1)
@@ -267,6 +273,51 @@ putc(uint8_t c)
 		asm volatile ("sti");
 }
 
+/*
+* int32_t putbuf(const uint8_t* buf, uint32_t n);
+*   Inputs: const uint8_t* buf = characters to print
+*			uint32_t n = number of characters in buf
+*   Return Value: Number of characters printed, NUL characters are skipped
+*	Function: Output a run of characters to the console. Interrupts are disabled
+*			  and the terminal is looked up once for the whole run, and the cursor,
+*			  which costs four port writes, is moved once at its end.
+*			  Interrupts are left as the caller had them
+*/
+
+int32_t
+putbuf(const uint8_t* buf, uint32_t n)
+{
+	int key_press = get_key_press();
+	int32_t curr_terminal;
+	uint32_t flags = 0;
+	int32_t printed = 0;
+	uint32_t i;
+
+	if(key_press == 0){
+		flags = save_flags_and_cli();
+		curr_terminal = get_current_terminal();
+	}
+	else{
+		curr_terminal = get_displayed_terminal();
+		video_mem = (char *)VIDEO;
+	}
+
+	for(i = 0; i < n; i++) {
+		if(buf[i] != '\0') {
+			put_char(buf[i], curr_terminal);
+			printed++;
+		}
+	}
+	if(curr_terminal == get_displayed_terminal())
+		update_cursor(screen_y[curr_terminal], screen_x[curr_terminal]);
+
+	if(key_press == 1)
+		video_mem = (char *)USER_VIDEO;
+	else
+		restore_saved_flags(flags);
+	return printed;
+}
+
 /*
 * int8_t* itoa(uint32_t value, int8_t* buf, int32_t radix);
 *   Inputs: uint32_t value = number to convert
@@ -778,3 +829,25 @@ int32_t index_of_char(const int8_t* str, int8_t c) {
 int32_t min(int32_t a, int32_t b) {
     return (a < b)? a : b; 
 }
+
+/* save_flags_and_cli()
+  Function form of cli_and_save, for code that is also built outside the kernel
+  Input : None
+  Output : EFLAGS before interrupts were disabled
+  Side Effects : Disables interrupts
+*/
+uint32_t save_flags_and_cli(void) {
+    uint32_t flags;
+    cli_and_save(flags);
+    return flags;
+}
+
+/* restore_saved_flags()
+  Function form of restore_flags
+  Input : flags -- EFLAGS returned by save_flags_and_cli
+  Output : None
+  Side Effects : Re-enables interrupts if they were enabled before
+*/
+void restore_saved_flags(uint32_t flags) {
+    restore_flags(flags);
+}
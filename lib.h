@@ -20,6 +20,7 @@
 
 int32_t printf(int8_t *format, ...);
 void putc(uint8_t c);
+int32_t putbuf(const uint8_t* buf, uint32_t n);
 int32_t puts(int8_t *s);
 int8_t *itoa(uint32_t value, int8_t* buf, int32_t radix);
 int8_t *strrev(int8_t* s);
@@ -52,6 +53,9 @@ int32_t index_of_char(const int8_t* str, int8_t c);
 
 int32_t min(int32_t a, int32_t b);
 
+uint32_t save_flags_and_cli(void);
+void restore_saved_flags(uint32_t flags);
+
 /* Port read functions */
 /* Inb reads a byte and returns its value as a zero-extended 32-bit
  * unsigned int */
@@ -92,6 +96,30 @@ static inline uint32_t inl(port)
 	return val;
 }
 
+/* Reads count two-byte words from "port" into buf, as the data
+ * register of a disk controller hands them out */
+static inline void insw(uint32_t port, void* buf, uint32_t count)
+{
+	asm volatile("cld\n   \
+			rep insw"
+			: "+D"(buf), "+c"(count)
+			: "d"(port)
+			: "memory" );
+}
+
+/* Reads the low 32 bits of the time-stamp counter.
+ * Differences between two reads are valid as long as the measured
+ * interval is shorter than 2^32 cycles */
+static inline uint32_t rdtsc(void)
+{
+	uint32_t lo;
+	asm volatile("rdtsc"
+			: "=a"(lo)
+			:
+			: "edx");
+	return lo;
+}
+
 /* Writes a byte to a port */
 #define outb(data, port)                \
 do {                                    \
@@ -113,7 +141,7 @@ do {                                    \
 /* Writes four bytes to four consecutive ports */
 #define outl(data, port)                \
 do {                                    \
-	asm volatile("outl  %l1, (%w0)"     \
+	asm volatile("outl  %1, (%w0)"      \
 			:                           \
 			: "d" (port), "a" (data)    \
 			: "memory", "cc" );         \
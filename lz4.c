@@ -0,0 +1,88 @@
+/* lz4.c - Decompressor for the LZ4 block format, used for compressed
+ * file system images
+ * vim:ts=4 noexpandtab
+ */
+
+#include "lz4.h"
+#include "lib.h"
+
+/* read_length()
+   Add the extension bytes of a literal or match length to length.
+   Extension bytes follow while they are LZ4_LENGTH_BYTE_MAX
+   Input : src, src_len -- compressed block
+           pos -- position of the first extension byte, advanced past the last one
+           length -- length from the token
+   Output : the full length, -1 if the block ends inside the length
+ */
+static int32_t read_length(const uint8_t* src, uint32_t src_len, uint32_t* pos, uint32_t length) {
+	uint8_t byte;
+	do {
+		if (*pos >= src_len) {
+			return -1;
+		}
+		byte = src[(*pos)++];
+		length += byte;
+	} while (byte == LZ4_LENGTH_BYTE_MAX);
+	return length;
+}
+
+/* lz4_decompress()
+   Decompress an LZ4 block. Every length and offset is checked, so a corrupt block
+   can never read or write out of bounds
+   Input : src -- compressed block
+           src_len -- size of the compressed block in bytes
+           dst -- array to be filled in with decompressed data
+           dst_len -- size of dst in bytes
+   Output : number of decompressed bytes
+            -1 if the block is corrupt or does not fit in dst
+   Side Effects : dst filled in with the decompressed data
+ */
+int32_t lz4_decompress(const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_len) {
+	uint32_t in = 0;
+	uint32_t out = 0;
+	int32_t length;
+	uint32_t offset, i, step, copy;
+
+	while (in < src_len) {
+		uint8_t token = src[in++];
+
+		/* Literals */
+		length = token >> 4;
+		if (length == LZ4_NIBBLE_MAX && (length = read_length(src, src_len, &in, length)) < 0) {
+			return -1;
+		}
+		if (length > src_len - in || length > dst_len - out) {
+			return -1;
+		}
+		memcpy(dst + out, src + in, length);
+		in += length;
+		out += length;
+		if (in == src_len) {
+			/* Block ends with literals */
+			break;
+		}
+
+		/* Match */
+		if (src_len - in < 2) {
+			return -1;
+		}
+		offset = src[in] | (src[in + 1] << 8);
+		in += 2;
+		length = token & LZ4_NIBBLE_MAX;
+		if (length == LZ4_NIBBLE_MAX && (length = read_length(src, src_len, &in, length)) < 0) {
+			return -1;
+		}
+		length += LZ4_MIN_MATCH;
+		if (offset == 0 || offset > out || length > dst_len - out) {
+			return -1;
+		}
+		/* A match that overlaps the bytes it produces repeats the last offset bytes.
+		   Everything copied so far repeats them too, so each copy can be twice as long */
+		for (i = 0, step = offset; i < length; i += copy, step *= 2) {
+			copy = min(step, length - i);
+			memcpy(dst + out + i, dst + out + i - step, copy);
+		}
+		out += length;
+	}
+	return out;
+}
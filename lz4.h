@@ -0,0 +1,22 @@
+/* lz4.h - Decompressor for the LZ4 block format
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _LZ4_H
+#define _LZ4_H
+
+#include "types.h"
+
+/* Shortest match the format can encode, and the most a sequence token's nibble holds */
+#define LZ4_MIN_MATCH 4
+#define LZ4_NIBBLE_MAX 15
+#define LZ4_LENGTH_BYTE_MAX 255
+#define LZ4_MAX_OFFSET 0xFFFF
+/* The last match starts at least this many bytes before the end, and
+   the last LZ4_LAST_LITERALS bytes are always literals */
+#define LZ4_MATCH_LIMIT 12
+#define LZ4_LAST_LITERALS 5
+
+int32_t lz4_decompress(const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_len);
+
+#endif /* _LZ4_H */
@@ -6,17 +6,20 @@
 #include "lib.h"
 #include "pcb.h"
 #include "debug.h"
+#include "frame_alloc.h"
+#include "kmalloc.h"
 
 /* Page Directory */
 pde_t pg_dir[NUM_PDE] __attribute__((aligned(PAGE_TABLE_SIZE)));
 /* Page Table */
 pte_t pg_table[NUM_PTE] __attribute__((aligned(PAGE_TABLE_SIZE)));
 
-/* Page Directories for each process. Up to six */
-pde_t pg_dirs[MAX_NUM_PROCESS][NUM_PDE] __attribute__((aligned(PAGE_TABLE_SIZE)));
+/* Page Directories and Page Tables of processes come from the kernel heap, which is
+   identity mapped, so an entry can hold the address of the table it points to */
+static kmem_cache_t* pg_table_cache;
 
-/* Page Tables for each process. Up to six */
-pte_t pg_tables[MAX_NUM_PROCESS][NUM_PTE] __attribute__((aligned(PAGE_TABLE_SIZE)));
+/* Program images shared by every process executing the same file */
+static shared_image_t shared_images[SHARED_IMAGE_SLOTS];
 
 
 
@@ -58,6 +61,8 @@ extern char* video_mem;
    +-------------------+----------+-----+-------+---+----+---+---+-----+-----+-----+-----+---+
 */
 void init_paging(void) {
+    pg_table_cache = kmem_cache_create("page table", PAGE_TABLE_SIZE);
+
     /* Initialize first 4KB Page directory entry 
        and first page directory entry to be pointing to 4KB page table */
     pg_dir[0].val = PAGE_BASE_ADDRESS_4K(((int)pg_table)) | PAGING_READ_WRITE | PAGING_PRESENT;
@@ -82,10 +87,11 @@ void init_paging(void) {
     cr4 |= 0x10;
     asm volatile("mov %0, %%cr4"::"b"(cr4));
 	
-    /* Turn on paging; Set PG flag(bit31 of CR0) */
+    /* Turn on paging; Set PG flag(bit31 of CR0)
+       Also set WP flag(bit16 of CR0) so that kernel writes to read-only shared pages fault too */
     unsigned int cr0;
     asm volatile("mov %%cr0, %0": "=b"(cr0));
-    cr0 |= 0x80000000;
+    cr0 |= 0x80010000;
     asm volatile("mov %0, %%cr0"::"b"(cr0));
 
     video_mem = (char* )USER_VIDEO;
@@ -130,26 +136,105 @@ void enable_global_pages(uint32_t start_addr, uint32_t end_addr) {
     }
 }
 
-/*get_proc_index_for_pg_dir()
-  Given pointer to page directory, returns process's index that is bound to given PD
-  Input : pg_dir - page directory to search
-  Output : index of process in global_pcb_ptrs array that is bound to given page directory
-           -1 if no matching process index is found
+/*alloc_pg_dir()
+  Take an empty page directory for a new process from the kernel heap
+  Input : None
+  Output : Pointer to page directory
+           NULL if the kernel heap is full
  */
-int32_t get_proc_index_for_pg_dir(pde_t* pg_dir) {
-  int i;
-  for(i = 0; i < MAX_NUM_PROCESS; i++){
-    if(pg_dir == pg_dirs[i])
-    break;
-  }
-  if(i == MAX_NUM_PROCESS)
-    return -1;
-  else
-    return i;
+pde_t* alloc_pg_dir(void) {
+    pde_t* new_pg_dir = kmem_cache_alloc(pg_table_cache);
+    if (new_pg_dir != NULL) {
+        memset(new_pg_dir, 0, PAGE_TABLE_SIZE);
+    }
+    return new_pg_dir;
+}
+
+/*alloc_pg_table()
+  Cover the 4MB region containing virt_addr with a page table taken from the kernel heap,
+  installed with map_page_table
+  Input : virt_addr - Virtual address inside the 4MB region, above the first 4MB
+          flag - Flag values to be used for the page directory entry
+          pg_dir - Pointer to a process's page directory
+  Output : 0 on success, -1 if the kernel heap is full or map_page_table fails
+  Side Effects : Update Page Directory Entry
+ */
+int32_t alloc_pg_table(uint32_t virt_addr, uint32_t flag, pde_t* pg_dir) {
+    pte_t* new_pg_table = kmem_cache_alloc(pg_table_cache);
+    if (new_pg_table == NULL) {
+        return -1;
+    }
+    if (map_page_table(virt_addr, new_pg_table, flag, pg_dir) != 0) {
+        kmem_cache_free(pg_table_cache, new_pg_table);
+        return -1;
+    }
+    return 0;
+}
+
+/*find_pg_table()
+  Find the page table covering the 4MB region containing virt_addr. A region of a
+  process's page directory without one gets a page table from the kernel heap, so
+  4KB pages can be mapped anywhere; the kernel's page directory only has pg_table.
+  The directory entry allows user access and writes, the page table entries decide
+  Input : virt_addr - Virtual address inside the 4MB region
+          cur_pg_dir - Pointer to page directory to operate on
+  Output : Pointer to the page table
+           NULL if the region is a 4MB page, or no page table can be installed
+  Side Effects : May take a page table from the kernel heap and fill in the Page Directory Entry
+ */
+static pte_t* find_pg_table(uint32_t virt_addr, pde_t* cur_pg_dir) {
+    pde_t* pde = &cur_pg_dir[PAGE_DIR_OFFSET(virt_addr)];
+    pte_t* cur_pg_table;
+    if (pde->val & PAGING_PRESENT) {
+        if (pde->val & PAGING_PAGE_SIZE) {
+            return NULL;
+        }
+        return (pte_t *) PAGE_BASE_ADDRESS_4K(pde->val);
+    }
+    if (cur_pg_dir == pg_dir && virt_addr < PAGE_BEGINNING_ADDR_4M) {
+        cur_pg_table = pg_table;
+    } else if (!is_kmem_addr(cur_pg_dir) ||
+               (cur_pg_table = kmem_cache_alloc(pg_table_cache)) == NULL) {
+        return NULL;
+    } else {
+        memset(cur_pg_table, 0, PAGE_TABLE_SIZE);
+    }
+    pde->val = PAGE_BASE_ADDRESS_4K((uint32_t) cur_pg_table) | PAGING_PRESENT |
+        PAGING_READ_WRITE | PAGING_USER_SUPERVISOR;
+    return cur_pg_table;
+}
+
+/*map_page_4k()
+  Map a 4KB page at any virtual address outside a 4MB page, installing a page table
+  for its 4MB region on first use
+  Input : virt_addr - Virtual address of the page to map from
+          phys_addr - Physical address of the page to be mapped to
+          flag - Flag values to be used; 
+                 supports PAGING_READ_WRITE, PAGING_GLOBAL_PAGE, PAGING_USER_SUPERVISOR
+          cur_pg_dir - Pointer to page directory to operate on
+  Output : 0 on success, -1 on failure(page is already mapped, region is a 4MB page,
+           or the kernel heap is full)
+  Side Effects : Update Page Table Entry, and Page Directory Entry if the region had none
+*/
+int32_t map_page_4k(uint32_t virt_addr, uint32_t phys_addr, uint32_t flag, pde_t* cur_pg_dir) {
+    pte_t* cur_pg_table = find_pg_table(virt_addr, cur_pg_dir);
+    if (cur_pg_table == NULL) {
+        return -1;
+    }
+    pte_t* pte = &cur_pg_table[PAGE_TABLE_OFFSET(virt_addr)];
+    if (pte->val & PAGING_PRESENT) {
+        LOG("You cannot map a page that is already mapped(Present bit is 1 already)\n");
+        return -1;
+    }
+    pte->val = PAGE_BASE_ADDRESS_4K(phys_addr) | PAGING_PRESENT |
+        (flag & (PAGING_READ_WRITE | PAGING_GLOBAL_PAGE | PAGING_USER_SUPERVISOR));
+    return 0;
 }
 
 /*map_page()
-  Map given virtual address to physical address with flag variable, at given pg_dir
+  Map given virtual address to physical address with flag variable, at given pg_dir.
+  Below 4MB, and in a region already covered by a page table, a 4KB page is mapped
+  with map_page_4k; elsewhere a 4MB page
   Input : virt_addr - Virtual address of the page to map from
           phys_addr - Physical address of the page to be mapped to
           flag - Flag values to be used; 
@@ -160,56 +245,55 @@ int32_t get_proc_index_for_pg_dir(pde_t* pg_dir) {
                  virtual address to physical address
 */
 int32_t map_page(uint32_t virt_addr, uint32_t phys_addr, uint32_t flag, pde_t* cur_pg_dir) {
-    if (virt_addr < PAGE_BEGINNING_ADDR_4M) {
-      uint32_t read_write = flag & PAGING_READ_WRITE;
-      uint32_t global_page = flag & PAGING_GLOBAL_PAGE;
-      uint32_t user_supervisor = flag & PAGING_USER_SUPERVISOR;
-
-      /* Find Process # */
-      int i = get_proc_index_for_pg_dir(cur_pg_dir);
-      if(i == -1 && cur_pg_dir != pg_dir)
+    pde_t* pde = &cur_pg_dir[PAGE_DIR_OFFSET(virt_addr)];
+    if (virt_addr < PAGE_BEGINNING_ADDR_4M ||
+        ((pde->val & PAGING_PRESENT) && !(pde->val & PAGING_PAGE_SIZE))) {
+        return map_page_4k(virt_addr, phys_addr, flag, cur_pg_dir);
+    }
+    if (pde->val & PAGING_PRESENT) {
+        /* Since we are not implementing swap now, treat PRESENT bit as existence of pde/pte or not*/
+        LOG("You cannot map a page that is already mapped(Present bit is 1 already)\n");
         return -1;
-
-      pte_t* cur_pg_table;
-      if(cur_pg_dir == pg_dir)
-        cur_pg_table = pg_table;
-      else
-        cur_pg_table = pg_tables[i];
+    }
+    uint32_t read_write = flag & PAGING_READ_WRITE;
+    uint32_t global_page = flag & PAGING_GLOBAL_PAGE;
+    uint32_t user_supervisor = flag & PAGING_USER_SUPERVISOR;
       
-      /* Fill in PDE */
-      pde_t* pde = &cur_pg_dir[PAGE_DIR_OFFSET(virt_addr)]; 
-      if (!(pde->val & PAGING_PRESENT)) {
-        pde->val = PAGE_BASE_ADDRESS_4K((uint32_t) cur_pg_table) | PAGING_PRESENT | read_write |
-                                        global_page | user_supervisor;
-      }
-
-      pte_t* pte = &cur_pg_table[PAGE_TABLE_OFFSET(virt_addr)];
-    
-      /* Fill in PTE */
-      if(pte->val & PAGING_PRESENT)
-        return -1;
-      pte->val = PAGE_BASE_ADDRESS_4K(phys_addr) | PAGING_PRESENT | read_write |
+    pde->val = PAGE_BASE_ADDRESS_4M(phys_addr) | PAGING_PAGE_SIZE | PAGING_PRESENT |
         read_write | global_page | user_supervisor;
-      return 0;
-    } else {
-      pde_t* pde = &cur_pg_dir[PAGE_DIR_OFFSET(virt_addr)];
-      if (pde->val & PAGING_PRESENT) {
-          /* Since we are not implementing swap now, treat PRESENT bit as existence of pde/pte or not*/
-          LOG("You cannot map a page that is already mapped(Present bit is 1 already)\n");
-          return -1;
-      }
-      uint32_t read_write = flag & PAGING_READ_WRITE;
-      uint32_t global_page = flag & PAGING_GLOBAL_PAGE;
-      uint32_t user_supervisor = flag & PAGING_USER_SUPERVISOR;
-      
-      pde->val = PAGE_BASE_ADDRESS_4M(phys_addr) | PAGING_PAGE_SIZE | PAGING_PRESENT |
-          read_write | global_page | user_supervisor;
-      return 0;
+    return 0;
+}
+
+/*map_page_table()
+  Cover the 4MB region containing virt_addr with a page table instead of a 4MB page.
+  Every entry of the page table is cleared, so pages in the region start out not present
+  and are filled in later by map_page.
+  Input : virt_addr - Virtual address inside the 4MB region, above the first 4MB
+          pg_table - Page table to be installed
+          flag - Flag values to be used for the page directory entry;
+                 supports PAGING_READ_WRITE, PAGING_USER_SUPERVISOR
+          pg_dir - Pointer to page directory to operate on
+  Output : 0 on success, -1 on failure(region is already mapped or lies in the first 4MB)
+  Side Effects : Update Page Directory Entry and clear the given page table
+*/
+int32_t map_page_table(uint32_t virt_addr, pte_t* pg_table, uint32_t flag, pde_t* pg_dir) {
+    pde_t* pde = &pg_dir[PAGE_DIR_OFFSET(virt_addr)];
+    if (virt_addr < PAGE_BEGINNING_ADDR_4M || (pde->val & PAGING_PRESENT)) {
+        LOG("Cannot install a page table over a mapped region\n");
+        return -1;
     }
+    int i;
+    for (i = 0; i < NUM_PTE; i++) {
+        pg_table[i].val = NULL;
+    }
+    pde->val = PAGE_BASE_ADDRESS_4K((uint32_t) pg_table) | PAGING_PRESENT |
+        (flag & (PAGING_READ_WRITE | PAGING_USER_SUPERVISOR));
+    return 0;
 }
 
 /*remap_page()
-  Mostly same as map_page function, but unlike it, it 'overwrites' the current page
+  Mostly same as map_page function, but unlike it, it 'overwrites' the current page.
+  A 4KB page is only remapped in a process's page directory
   Input : virt_addr - Virtual address of the page to map from
           phys_addr - Physical address of the page to be mapped to
           flag - Flag values to be used; 
@@ -220,62 +304,61 @@ int32_t map_page(uint32_t virt_addr, uint32_t phys_addr, uint32_t flag, pde_t* c
                  virtual address to physical address
 */
 int32_t remap_page(uint32_t virt_addr, uint32_t phys_addr, uint32_t flag, pde_t* pg_dir) {
-    if (virt_addr < PAGE_BEGINNING_ADDR_4M) {
-      uint32_t read_write = flag & PAGING_READ_WRITE;
-      uint32_t global_page = flag & PAGING_GLOBAL_PAGE;
-      uint32_t user_supervisor = flag & PAGING_USER_SUPERVISOR;
-      /* Find Process # */
-      int i = get_proc_index_for_pg_dir(pg_dir);
-      if(i == -1)
+    pde_t* pde = &pg_dir[PAGE_DIR_OFFSET(virt_addr)];
+    uint32_t read_write = flag & PAGING_READ_WRITE;
+    uint32_t global_page = flag & PAGING_GLOBAL_PAGE;
+    uint32_t user_supervisor = flag & PAGING_USER_SUPERVISOR;
+    if (!(pde->val & PAGING_PRESENT)) {
+        /* Since we are not implementing swap now, treat PRESENT bit as existence of pde/pte or not*/
+        LOG("You cannot remap a page that is not already mapped(Present bit is 0)\n");
         return -1;
-
-      /* Fill in PDE - Make sure that we have a page mapped already, so we can re-map it */
-      pde_t* pde = &pg_dir[PAGE_DIR_OFFSET(virt_addr)]; 
-      if ((pde->val & PAGING_PRESENT)) {
-        pde->val = PAGE_BASE_ADDRESS_4K((uint32_t) pg_tables[i]) | PAGING_PRESENT | read_write |
-                                        global_page | user_supervisor;
-      }
-      else
-        LOG("Trying to remap a page that has not been mapped!\n");
-
-      /* Fill in PTE */
-      pte_t* pte = &pg_tables[i][PAGE_TABLE_OFFSET(virt_addr)];
-      if(!(pte->val & PAGING_PRESENT))
-        return -1;
-      pte->val = PAGE_BASE_ADDRESS_4K(phys_addr) | PAGING_PRESENT | read_write |
-        read_write | global_page | user_supervisor;
-      return 0;
-    } else {
-      pde_t* pde = &pg_dir[PAGE_DIR_OFFSET(virt_addr)];
-      if (!(pde->val & PAGING_PRESENT)) {
-          /* Since we are not implementing swap now, treat PRESENT bit as existence of pde/pte or not*/
-          LOG("You cannot remap a page that is not already mapped(Present bit is 0)\n");
-          return -1;
-      }
-      uint32_t read_write = flag & PAGING_READ_WRITE;
-      uint32_t global_page = flag & PAGING_GLOBAL_PAGE;
-      uint32_t user_supervisor = flag & PAGING_USER_SUPERVISOR;
-      
-      pde->val = PAGE_BASE_ADDRESS_4M(phys_addr) | PAGING_PAGE_SIZE | PAGING_PRESENT |
-          read_write | global_page | user_supervisor;
-      return 0;
     }
+    if (!(pde->val & PAGING_PAGE_SIZE)) {
+        /* Only a process's page directory, which comes from the heap */
+        if (!is_kmem_addr(pg_dir)) {
+            return -1;
+        }
+        pte_t* pte = &((pte_t *) PAGE_BASE_ADDRESS_4K(pde->val))[PAGE_TABLE_OFFSET(virt_addr)];
+        if (!(pte->val & PAGING_PRESENT)) {
+            return -1;
+        }
+        pte->val = PAGE_BASE_ADDRESS_4K(phys_addr) | PAGING_PRESENT | read_write |
+            global_page | user_supervisor;
+        return 0;
+    }
+    pde->val = PAGE_BASE_ADDRESS_4M(phys_addr) | PAGING_PAGE_SIZE | PAGING_PRESENT |
+        read_write | global_page | user_supervisor;
+    return 0;
 }
 
 
-/*get_pg_dir()
-  Given process's index in global_pcb_ptrs, find the page directory that belongs to 
-  given index's PCB
-  Input : proc_index - index of PCB in global_pcb_ptrs
-  Output : Pointer to page directory
-           NULL if not found
+/*find_free_pages()
+  Find num_pages consecutive not present 4KB pages inside a 4MB region, for map_page_4k.
+  A region without a page table yet is all free
+  Input : region_addr - Virtual address of the beginning of the 4MB region
+          num_pages - Number of pages needed
+          pg_dir - Pointer to page directory to search
+  Output : Virtual address of the first page of the range
+           NULL if the region is a 4MB page or has no such range
  */
-pde_t* get_pg_dir(int32_t proc_index) {
-    if (proc_index < 0 || proc_index >= MAX_NUM_PROCESS) {
-        LOG("process index out of bound");
+uint32_t find_free_pages(uint32_t region_addr, uint32_t num_pages, pde_t* pg_dir) {
+    pde_t* pde = &pg_dir[PAGE_DIR_OFFSET(region_addr)];
+    if ((pde->val & PAGING_PAGE_SIZE) || num_pages == 0 || num_pages > NUM_PTE) {
         return NULL;
     }
-    return pg_dirs[proc_index];
+    if (!(pde->val & PAGING_PRESENT)) {
+        return PAGE_BASE_ADDRESS_4M(region_addr);
+    }
+    pte_t* cur_pg_table = (pte_t *) PAGE_BASE_ADDRESS_4K(pde->val);
+    uint32_t run = 0;
+    uint32_t i;
+    for (i = 0; i < NUM_PTE; i++) {
+        run = (cur_pg_table[i].val & PAGING_PRESENT)? 0 : run + 1;
+        if (run == num_pages) {
+            return PAGE_BASE_ADDRESS_4M(region_addr) + (i + 1 - num_pages) * PAGE_SIZE_4K;
+        }
+    }
+    return NULL;
 }
 
 /*set_cr3_reg()
@@ -288,25 +371,304 @@ void set_cr3_reg(pde_t* pg_dir) {
 }
 
 /*cleanup_pg_dir()
-  When page directory is not being used anymore, clean up all page directory entries
-  and page table entries corresponding to given pointer by setting them to 0s.
+  When a process's page directory is not being used anymore, give it and the page
+  tables its entries point to back to the kernel heap. It must not be in CR3
   Input : pg_dir - Pointer to page directory to be cleaned up
-  Output : 0 on success, -1 on failure
-  Side Effects : Update a Page directory and Page table
+  Output : 0 on success, -1 on failure(pg_dir is not a process's page directory)
+  Side Effects : Frees a Page directory and its Page tables
  */
 int32_t cleanup_pg_dir(pde_t* pg_dir) {
   int i;
-  int index;
+  if (!is_kmem_addr(pg_dir))
+    return -1;
   for (i = 0; i < NUM_PDE; i++) {
-    pg_dir[i].val = NULL;
+    if ((pg_dir[i].val & PAGING_PRESENT) && !(pg_dir[i].val & PAGING_PAGE_SIZE)) {
+      kmem_cache_free(pg_table_cache, (pte_t *) PAGE_BASE_ADDRESS_4K(pg_dir[i].val));
+    }
   }
+  kmem_cache_free(pg_table_cache, pg_dir);
+  return 0;
+}
+
+/*invalidate_page()
+  Drop the TLB entry of a single page after its present mapping was changed
+  Input : virt_addr - Virtual address inside the page
+ */
+static void invalidate_page(uint32_t virt_addr) {
+  asm volatile("invlpg (%0)":: "r"(virt_addr): "memory");
+}
 
-  index = get_proc_index_for_pg_dir(pg_dir);
-  if(index == -1)
+/*unmap_page()
+  Remove a 4KB page mapped with map_page_4k. Its page table stays installed until
+  the page directory is cleaned up
+  Input : virt_addr - Virtual address of the page
+          pg_dir - Pointer to page directory to operate on
+  Output : 0 on success, -1 if the page is not mapped through a page table
+  Side Effects : Clear the Page Table Entry and drop its TLB entry
+ */
+int32_t unmap_page(uint32_t virt_addr, pde_t* pg_dir) {
+  pde_t* pde = &pg_dir[PAGE_DIR_OFFSET(virt_addr)];
+  if (!(pde->val & PAGING_PRESENT) || (pde->val & PAGING_PAGE_SIZE)) {
     return -1;
-  pte_t* cur_pg_table = pg_tables[index];
-  for (i = 0; i < NUM_PTE; i++) {
-    cur_pg_table[i].val = NULL;
   }
+  pte_t* pte = &((pte_t *) PAGE_BASE_ADDRESS_4K(pde->val))[PAGE_TABLE_OFFSET(virt_addr)];
+  if (!(pte->val & PAGING_PRESENT)) {
+    return -1;
+  }
+  pte->val = NULL;
+  invalidate_page(virt_addr);
+  return 0;
+}
+
+/*get_task_pte()
+  Find the page table entry of a 4KB page in the demand paged task page
+  Input : pcb_ptr - PCB of the process
+          page_addr - Virtual address of the page
+  Output : Pointer to the page table entry
+ */
+static pte_t* get_task_pte(pcb_t* pcb_ptr, uint32_t page_addr) {
+  pte_t* task_table = (pte_t *) PAGE_BASE_ADDRESS_4K(pcb_ptr->pg_dir[PAGE_DIR_OFFSET(page_addr)].val);
+  return &task_table[PAGE_TABLE_OFFSET(page_addr)];
+}
+
+/*fill_image_page()
+  Fill a mapped, writable page of the task page with the bytes of the program image
+  that fall inside it, and zero the rest of the page
+  Input : pcb_ptr - PCB of the process whose image is being filled
+          page_addr - Virtual address of the page
+  Output : 1 if the page overlaps the image, 0 if it was only zeroed, -1 on read failure
+ */
+static int32_t fill_image_page(pcb_t* pcb_ptr, uint32_t page_addr) {
+  uint32_t page_end = page_addr + PAGE_SIZE_4K;
+  uint32_t image_start = (page_addr > TASK_BEGIN_VIRT_ADDR)? page_addr : TASK_BEGIN_VIRT_ADDR;
+  uint32_t image_end = TASK_BEGIN_VIRT_ADDR + pcb_ptr->exec_length;
+  image_end = (page_end < image_end)? page_end : image_end;
+
+  if (image_start >= image_end) {
+    memset((void *) page_addr, 0, PAGE_SIZE_4K);
+    return 0;
+  }
+  memset((void *) page_addr, 0, image_start - page_addr);
+  if (read_data(pcb_ptr->exec_inode_idx, image_start - TASK_BEGIN_VIRT_ADDR,
+                (uint8_t *) image_start, image_end - image_start) != image_end - image_start) {
+    return -1;
+  }
+  memset((void *) image_end, 0, page_end - image_end);
+  return 1;
+}
+
+/*is_shared_frame()
+  Check whether a page of the task page is mapped to its frame of the shared image
+  Input : pcb_ptr - PCB of the process
+          page_addr - Virtual address of the page
+          phys_addr - Physical address the page is mapped to
+ */
+static int32_t is_shared_frame(pcb_t* pcb_ptr, uint32_t page_addr, uint32_t phys_addr) {
+  uint32_t page_num = (page_addr - TASK_BEGIN_VIRT_ADDR) / PAGE_SIZE_4K;
+  return pcb_ptr->shared_image != NULL && page_addr >= TASK_BEGIN_VIRT_ADDR &&
+         page_num < SHARED_IMAGE_MAX_PAGES && pcb_ptr->shared_image->frames[page_num] == phys_addr;
+}
+
+/*get_shared_image()
+  Take a reference to the shared copy of a program image, creating an empty one
+  (no page loaded yet) if the image is not cached
+  Input : inode_idx - inode of the executable
+          length - length of the executable in bytes
+  Output : Pointer to the shared image
+           NULL if the image is too big to be shared or every slot is in use
+  Side Effects : Increment the image's reference count
+ */
+shared_image_t* get_shared_image(uint32_t inode_idx, uint32_t length) {
+  shared_image_t* free_slot = NULL;
+  int i;
+  if (length > SHARED_IMAGE_MAX_PAGES * PAGE_SIZE_4K) {
+    return NULL;
+  }
+  for (i = 0; i < SHARED_IMAGE_SLOTS; i++) {
+    if (shared_images[i].refcount == 0) {
+      free_slot = (free_slot == NULL)? &shared_images[i] : free_slot;
+    } else if (shared_images[i].inode_idx == inode_idx && shared_images[i].length == length &&
+               !shared_images[i].stale) {
+      shared_images[i].refcount++;
+      return &shared_images[i];
+    }
+  }
+  if (free_slot != NULL) {
+    memset(free_slot, 0, sizeof(shared_image_t));
+    free_slot->inode_idx = inode_idx;
+    free_slot->length = length;
+    free_slot->refcount = 1;
+  }
+  return free_slot;
+}
+
+/*put_shared_image()
+  Drop a reference to a shared program image. The last reference releases its frames
+  Input : image - shared image, NULL is ignored
+  Side Effects : Decrement the image's reference count, may give frames back to the frame allocator
+ */
+void put_shared_image(shared_image_t* image) {
+  int i;
+  if (image == NULL || image->refcount == 0) {
+    return;
+  }
+  if (--image->refcount > 0) {
+    return;
+  }
+  for (i = 0; i < SHARED_IMAGE_MAX_PAGES; i++) {
+    if (image->frames[i] != NULL) {
+      free_frames(image->frames[i], 0);
+      image->frames[i] = NULL;
+    }
+  }
+}
+
+/*invalidate_shared_image()
+  Stop handing out the shared copy of a program whose file was written.
+  Processes already using it keep it until they halt
+  Input : inode_idx - inode of the file that was written
+  Side Effects : Marks the file's shared image stale
+ */
+void invalidate_shared_image(uint32_t inode_idx) {
+  int i;
+  for (i = 0; i < SHARED_IMAGE_SLOTS; i++) {
+    if (shared_images[i].refcount > 0 && shared_images[i].inode_idx == inode_idx) {
+      shared_images[i].stale = 1;
+    }
+  }
+}
+
+/*map_shared_image()
+  Map every page of a shared image that is already loaded, read-only, into a task page,
+  so a repeated execute does not fault on them
+  Input : image - shared image, NULL is ignored
+          cur_pg_dir - page directory whose task page is covered by map_page_table
+  Output : Number of pages mapped
+ */
+int32_t map_shared_image(shared_image_t* image, pde_t* cur_pg_dir) {
+  int32_t num_mapped = 0;
+  int i;
+  if (image == NULL) {
+    return 0;
+  }
+  for (i = 0; i < SHARED_IMAGE_MAX_PAGES; i++) {
+    if (image->frames[i] != NULL &&
+        map_page_4k(TASK_BEGIN_VIRT_ADDR + i * PAGE_SIZE_4K, image->frames[i],
+                    PAGING_USER_SUPERVISOR, cur_pg_dir) == 0) {
+      num_mapped++;
+    }
+  }
+  return num_mapped;
+}
+
+/*map_image_page_shared()
+  Back a not present page of the program image with the shared copy, loading it
+  into a new frame if no other instance has touched it yet. The page is mapped read-only
+  Input : pcb_ptr - PCB of the faulting process
+          page_addr - Virtual address of the page, inside the program image
+  Output : 0 on success, -1 if no frame could be found(caller falls back to a private page)
+ */
+static int32_t map_image_page_shared(pcb_t* pcb_ptr, uint32_t page_addr) {
+  shared_image_t* image = pcb_ptr->shared_image;
+  uint32_t page_num = (page_addr - TASK_BEGIN_VIRT_ADDR) / PAGE_SIZE_4K;
+
+  if (image->frames[page_num] != NULL) {
+    pcb_ptr->shared_page_faults++;
+    return map_page_4k(page_addr, image->frames[page_num], PAGING_USER_SUPERVISOR, pcb_ptr->pg_dir);
+  }
+
+  uint32_t frame = alloc_frames(0);
+  if (frame == NULL) {
+    return -1;
+  }
+  /* Map writable while filling. Kernel writes obey read-only pages, since CR0.WP is set */
+  if (map_page_4k(page_addr, frame, PAGING_USER_SUPERVISOR | PAGING_READ_WRITE, pcb_ptr->pg_dir) != 0 ||
+      fill_image_page(pcb_ptr, page_addr) < 0) {
+    get_task_pte(pcb_ptr, page_addr)->val = NULL;
+    free_frames(frame, 0);
+    return -1;
+  }
+  get_task_pte(pcb_ptr, page_addr)->val &= ~PAGING_READ_WRITE;
+  invalidate_page(page_addr);
+
+  image->frames[page_num] = frame;
+  pcb_ptr->file_page_faults++;
+  return 0;
+}
+
+/*copy_on_write()
+  Give the process a private, writable copy of a shared image page it wrote to.
+  The copy lives in the process's own 4MB block of physical memory
+  Input : pcb_ptr - PCB of the faulting process
+          page_addr - Virtual address of the page
+  Output : 0 on success, -1 if the page is not a shared image page
+ */
+static int32_t copy_on_write(pcb_t* pcb_ptr, uint32_t page_addr) {
+  /* Exceptions run with interrupts off, so a single bounce buffer is enough */
+  static uint8_t cow_buf[PAGE_SIZE_4K];
+  pte_t* pte = get_task_pte(pcb_ptr, page_addr);
+  if (!(pte->val & PAGING_PRESENT) || !is_shared_frame(pcb_ptr, page_addr, PAGE_BASE_ADDRESS_4K(pte->val))) {
+    return -1;
+  }
+  uint32_t phys_addr = pcb_ptr->task_frame + (page_addr - TASK_PAGE_VIRT_ADDR);
+
+  memcpy(cow_buf, (void *) page_addr, PAGE_SIZE_4K);
+  pte->val = PAGE_BASE_ADDRESS_4K(phys_addr) | PAGING_PRESENT | PAGING_USER_SUPERVISOR | PAGING_READ_WRITE;
+  invalidate_page(page_addr);
+  memcpy((void *) page_addr, cow_buf, PAGE_SIZE_4K);
+
+  pcb_ptr->cow_page_faults++;
+  return 0;
+}
+
+/*page_fault_handler()
+  Resolve a page fault on a demand paged program.
+  A not present page of the program image is mapped read-only from the shared copy
+  of the image, if the process has one. Any other not present page inside the task page
+  is backed by the matching 4KB of the process's 4MB block, and filled with the
+  program image's bytes that fall in it(the rest of the page is zeroed).
+  A write to a read-only shared page is resolved with a private copy
+  Input : error_code - error code pushed by the processor for the page fault
+  Output : 0 if the fault was resolved and the faulting instruction can be retried,
+           -1 if it is not a fault demand paging is responsible for
+  Side Effects : Maps a page in current process's page table, updates its fault counters
+ */
+int32_t page_fault_handler(uint32_t error_code) {
+  uint32_t start = rdtsc();
+  uint32_t fault_addr;
+  asm volatile("movl %%cr2, %0": "=r"(fault_addr));
+
+  pcb_t* pcb_ptr = get_pcb_ptr();
+  int32_t proc_index = get_proc_index(pcb_ptr);
+  if (proc_index == -1 || !pcb_ptr->demand_paged ||
+      fault_addr < TASK_PAGE_VIRT_ADDR || fault_addr >= TASK_PAGE_VIRT_ADDR + PAGE_SIZE_4M) {
+    return -1;
+  }
+
+  uint32_t page_addr = PAGE_BASE_ADDRESS_4K(fault_addr);
+  int32_t in_image = (page_addr >= TASK_BEGIN_VIRT_ADDR &&
+                      page_addr < TASK_BEGIN_VIRT_ADDR + pcb_ptr->exec_length);
+
+  if (error_code & PF_ERR_PRESENT) {
+    /* Protection violation. Only writes to shared image pages can be resolved */
+    if (!(error_code & PF_ERR_WRITE) || copy_on_write(pcb_ptr, page_addr) != 0) {
+      return -1;
+    }
+  } else if (!(in_image && pcb_ptr->shared_image != NULL &&
+               map_image_page_shared(pcb_ptr, page_addr) == 0)) {
+    uint32_t phys_addr = pcb_ptr->task_frame + (page_addr - TASK_PAGE_VIRT_ADDR);
+    if (map_page_4k(page_addr, phys_addr, PAGING_USER_SUPERVISOR | PAGING_READ_WRITE, pcb_ptr->pg_dir) != 0) {
+      return -1;
+    }
+    int32_t filled = fill_image_page(pcb_ptr, page_addr);
+    if (filled < 0) {
+      return -1;
+    } else if (filled) {
+      pcb_ptr->file_page_faults++;
+    } else {
+      pcb_ptr->zero_page_faults++;
+    }
+  }
+  pcb_ptr->fault_cycles += rdtsc() - start;
   return 0;
 }
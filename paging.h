@@ -28,6 +28,22 @@
 #define PAGE_BASE_ADDRESS_4K(addr) (addr & 0xFFFFF000)
 #define PAGE_BASE_ADDRESS_4M(addr) (addr & 0xFFC00000)
 
+/* Page fault error code bits */
+#define PF_ERR_PRESENT 0x1           /* 0: page not present, 1: protection violation */
+#define PF_ERR_WRITE 0x2             /* 0: read access, 1: write access */
+#define PF_ERR_USER 0x4              /* 0: fault in supervisor mode, 1: fault in user mode */
+
+/* User program's 4MB page at 128MB, and where the program image is loaded inside it */
+#define TASK_PAGE_VIRT_ADDR 0x8000000
+#define TASK_BEGIN_VIRT_ADDR 0x8048000
+
+/* Number of distinct programs that can be shared at once, and the largest shareable image */
+#define SHARED_IMAGE_SLOTS 8
+#define SHARED_IMAGE_MAX_PAGES 64
+
+/* 4MB region right after the task page where files are mapped with mmap */
+#define MMAP_VIRT_ADDR 0x8400000
+
 #define PAGE_DIR_OFFSET(addr) ((addr & 0xFFC00000) >> 22)
 #define PAGE_TABLE_OFFSET(addr) ((addr & 0x003FF000) >> 12)
 
@@ -73,18 +89,40 @@ typedef union pte_t {
 
 
 
+/* A program image loaded once and mapped read-only into every process executing it */
+typedef struct shared_image_t {
+	uint32_t inode_idx;
+	uint32_t length;
+	uint32_t refcount;
+	uint32_t stale;		/* file was written since, so the image is not handed out again */
+	uint32_t frames[SHARED_IMAGE_MAX_PAGES];	/* physical address of each page, NULL until loaded */
+} shared_image_t;
+
 void init_paging(void);
 void enable_global_pages(uint32_t start_addr, uint32_t end_addr);
 
 int32_t map_page(uint32_t virt_addr, uint32_t phys_addr, uint32_t flag, pde_t* pg_dir);
+int32_t map_page_4k(uint32_t virt_addr, uint32_t phys_addr, uint32_t flag, pde_t* pg_dir);
 int32_t remap_page(uint32_t virt_addr, uint32_t phys_addr, uint32_t flag, pde_t* pg_dir);
 
 int32_t map_page_vid(uint32_t virt_addr, uint32_t phys_addr, uint32_t flag, pde_t* pg_dir);
 
-pde_t* get_pg_dir(int32_t proc_index);
+int32_t map_page_table(uint32_t virt_addr, pte_t* pg_table, uint32_t flag, pde_t* pg_dir);
+
+pde_t* alloc_pg_dir(void);
+int32_t alloc_pg_table(uint32_t virt_addr, uint32_t flag, pde_t* pg_dir);
+uint32_t find_free_pages(uint32_t region_addr, uint32_t num_pages, pde_t* pg_dir);
+int32_t unmap_page(uint32_t virt_addr, pde_t* pg_dir);
 void set_cr3_reg(pde_t* pg_dir);
 int32_t cleanup_pg_dir(pde_t* pg_dir);
 
+int32_t page_fault_handler(uint32_t error_code);
+
+shared_image_t* get_shared_image(uint32_t inode_idx, uint32_t length);
+void put_shared_image(shared_image_t* image);
+void invalidate_shared_image(uint32_t inode_idx);
+int32_t map_shared_image(shared_image_t* image, pde_t* pg_dir);
+
 extern pde_t pg_dir[];
 #endif /* _PAGING_H */
 
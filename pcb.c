@@ -4,25 +4,71 @@
 #include "rtc.h"
 #include "keyboard.h"
 #include "debug.h"
+#include "frame_alloc.h"
+#include "kmalloc.h"
 
 static const pcb_t empty_pcb;
 static const file_desc_t empty_file_desc;
 
 pcb_t* global_pcb_ptrs[MAX_NUM_PROCESS];
 
+/* PCB of the kernel, the parent of the first shell. It owns the boot stack */
+static pcb_t kernel_pcb;
+
+/* Kernel stack slots no process holds, taken from the top */
+static int32_t free_slots[MAX_NUM_PROCESS];
+static int32_t num_free_slots;
+
+/* PCBs and chunks of file descriptors come from the kernel heap */
+static kmem_cache_t* pcb_cache;
+static kmem_cache_t* fd_chunk_cache;
+
+static int32_t alloc_fd_chunk(pcb_t* pcb, int32_t chunk);
+
 /* 0: RTC, 1: Directory, 2: Regular file, 3: stdin, 4: stdout */
 file_ops_t file_ops_ptrs[] = {
-    {rtc_open, rtc_read, rtc_write, rtc_close},
-    {open_dir, read_dir_wrapper, write_dir, close_dir},
-    {open_file, read_file_wrapper, write_file, close_file},
-    {NULL, terminal_read, NULL, NULL},
-    {NULL, NULL, terminal_write, NULL}
+    {rtc_open, rtc_read, rtc_write, rtc_close, NULL, NULL},
+    {open_dir, read_dir_wrapper, write_dir, close_dir, seek_dir, pread_dir},
+    {open_file, read_file_wrapper, write_file_wrapper, close_file, seek_file, pread_file},
+    {NULL, terminal_read, NULL, NULL, NULL, NULL},
+    {NULL, NULL, terminal_write, NULL, NULL, NULL}
 };
 
+/*stack_pcb_slot()
+  Bottom word of a kernel stack, which points to the PCB of the process running on it
+  Input : proc_index - kernel stack slot, -1 for the boot stack
+  Output : Pointer to the word
+ */
+static pcb_t** stack_pcb_slot(int32_t proc_index) {
+    return (pcb_t **)(PHYSICAL_MEM_8MB - KERNEL_STACK_SIZE * (proc_index + 2));
+}
+
+/*init_pcbs()
+  Make the caches PCBs and file descriptor chunks come from, mark every kernel
+  stack slot free, and point the boot stack to the kernel's PCB.
+  Runs after init_kmalloc, before anything calls get_pcb_ptr
+  Input : None
+  Output : None
+  Side Effects : Sets up the free slot stack
+ */
+void init_pcbs(void) {
+    int32_t i;
+    pcb_cache = kmem_cache_create("pcb", sizeof(pcb_t));
+    fd_chunk_cache = kmem_cache_create("fd chunk", sizeof(file_desc_t) * FDS_PER_CHUNK);
+    /* Slot 0 ends up on top, so processes take the slots in order */
+    num_free_slots = 0;
+    for (i = MAX_NUM_PROCESS - 1; i >= 0; i--) {
+        global_pcb_ptrs[i] = NULL;
+        free_slots[num_free_slots++] = i;
+    }
+    kernel_pcb.proc_index = -1;
+    *stack_pcb_slot(-1) = &kernel_pcb;
+}
+
 /*get_new_pcb_ptr()
-  Find a space for a new PCB block, and return(if found) pointer of the
-  new pcb block.
-  The call to the function fails if there is no more space available for new PCB.
+  Take a PCB from its cache, emptied out, and a free kernel stack slot for it,
+  whose bottom word is pointed to the PCB.
+  The call to the function fails if every slot is taken or the kernel heap is full.
   The OS only supports at most MAX_NUM_PROCESS pcbs.
   Input : None
   Output : pointer to the new PCB block
@@ -30,22 +76,29 @@ file_ops_t file_ops_ptrs[] = {
   Side Effects : Change global_pcb_ptrs, by updating pointer to newly allocated PCB
  */
 pcb_t* get_new_pcb_ptr() {
-    int i;
-    for (i = 0; i < MAX_NUM_PROCESS; i++) {
-        /* Find first empty pcb and claim it. 
-           TBD Synchronize*/
-        if (global_pcb_ptrs[i] == NULL) {
-            global_pcb_ptrs[i] = (pcb_t *)(PHYSICAL_MEM_8MB - KERNEL_STACK_SIZE * (i + 2));
-            return global_pcb_ptrs[i];
-        }
+    pcb_t* pcb_ptr;
+    int32_t i;
+    uint32_t flags = save_flags_and_cli();
+    if (num_free_slots == 0 || (pcb_ptr = kmem_cache_alloc(pcb_cache)) == NULL) {
+        restore_saved_flags(flags);
+        LOG("No space is available for a new PCB.\n");
+        return NULL;
     }
-    LOG("No space is available for a new PCB.\n");
-    return NULL;
+    i = free_slots[--num_free_slots];
+    *pcb_ptr = empty_pcb;
+    pcb_ptr->proc_index = i;
+    global_pcb_ptrs[i] = pcb_ptr;
+    *stack_pcb_slot(i) = pcb_ptr;
+    restore_saved_flags(flags);
+    return pcb_ptr;
 }
 
 /*destroy_pcb_ptr()
   Clean up a pcb pointed by given pcb pointer.
   Cleaned up pcb can be used by other processes in future
+  Reference to the shared program image, if any, is dropped, and the file descriptor
+  chunks, the 4MB block backing its task page, the PCB and its kernel stack slot are
+  given back. Until the slot is taken again its stack points to the kernel's PCB
   Input : pcb_ptr - pointer to PCB block to be cleaned up
   Output : 0 on success
            -1 on failure, if pcb_ptr is invalid
@@ -53,28 +106,50 @@ pcb_t* get_new_pcb_ptr() {
  */
 int32_t destroy_pcb_ptr(pcb_t* pcb_ptr) {
     int32_t i = get_proc_index(pcb_ptr);
-    if (i == -1) {
+    int32_t j;
+    uint32_t flags;
+    if (i == -1 || global_pcb_ptrs[i] != pcb_ptr) {
         LOG("Unable to destroy PCB becuase no matching PCB was found.\n");
         return -1;
     }
-    *(global_pcb_ptrs[i]) = empty_pcb;
+    put_shared_image(pcb_ptr->shared_image);
+    if (pcb_ptr->task_frame != NULL) {
+        free_frames(pcb_ptr->task_frame, FRAME_ORDER_4M);
+    }
+    for (j = 0; j < MAX_FD_CHUNKS; j++) {
+        kmem_cache_free(fd_chunk_cache, pcb_ptr->fd_chunks[j]);
+    }
+    flags = save_flags_and_cli();
+    *stack_pcb_slot(i) = &kernel_pcb;
     global_pcb_ptrs[i] = NULL;
+    free_slots[num_free_slots++] = i;
+    kmem_cache_free(pcb_cache, pcb_ptr);
+    restore_saved_flags(flags);
     return 0;
 }
 
+/*destroy_fd()
+  Empty out a file descriptor, so find_free_fd_index can hand it out again
+  Input : pcb_ptr - PCB the file descriptor belongs to
+          fd - index of the file descriptor, whose chunk was taken
+  Output : 0
+  Side Effects : Clears the file descriptor and its bit in the PCB's bitmap
+ */
 int32_t destroy_fd(pcb_t* pcb_ptr, int32_t fd){
-  pcb_ptr -> file_array[fd] = empty_file_desc;
+  *get_file_desc(pcb_ptr, fd) = empty_file_desc;
+  pcb_ptr -> fd_bitmap[fd / BITS_PER_WORD] &= ~(1U << (fd % BITS_PER_WORD));
   return 0;
 }
 /*get_pcb_ptr()
-  Get current PCB's pointer calculated by manipulating bits of current ESP
+  Get current PCB's pointer from the bottom word of the current kernel stack,
+  found by manipulating bits of current ESP
   Output : Current kernel stack's PCB's pointer
  */
 pcb_t* get_pcb_ptr() {
     uint32_t ptr;
     asm volatile("movl %%esp, %0": "=b"(ptr));
-    ptr = ptr & ~0x1FFF;
-    return (pcb_t *) ptr;
+    ptr = ptr & ~(KERNEL_STACK_SIZE - 1);
+    return *(pcb_t **) ptr;
 }
 
 /*get_global_pcb()
@@ -82,59 +157,105 @@ pcb_t* get_pcb_ptr() {
   which is used as parent process's PCB of the first process(shell)
  */
 pcb_t* get_global_pcb(){
-    return (pcb_t *)(PHYSICAL_MEM_8MB - KERNEL_STACK_SIZE);
+    return &kernel_pcb;
 }
 
 /*get_proc_index()
-  Given pointer to PCB pointer, returns the index that corresponds to
-  index of this pointer in global_pcb_ptrs.
-  This index is used for statically assigning PCB, physical pages, page directories
-  for different processes
+  Given pointer to PCB pointer, returns the kernel stack slot of its process,
+  its index in global_pcb_ptrs
   Input : pcb_ptr -- the pcb_ptr of the process
   Output : Index of given pcb_ptr in global_pcb_ptrs
-           -1 if not found
+           -1 for the kernel's PCB or NULL
  */
 int32_t get_proc_index(pcb_t* pcb_ptr) {
-    int i;
-    for (i = 0; i < MAX_NUM_PROCESS; i++) {
-        if (global_pcb_ptrs[i] == pcb_ptr) {
-            return i;
-        }
+    if (pcb_ptr == NULL) {
+        return -1;
     }
-    /* No match */
-    return -1;
+    return pcb_ptr->proc_index;
 }
 
 /*init_pcb()
   Initialize newly created PCB block
-  Setup file descriptor elements for stdin and stdout
-  Input : new_pcb_ptr - pointer to PCB that needs to be initialized
-  Output : 0
+  Give it its first chunk of file descriptors, and setup stdin and stdout in it
+  Input : new_pcb_ptr - pointer to PCB that needs to be initialized, already in global_pcb_ptrs
+  Output : 0 on success
+           -1 if the kernel heap has no room for the chunk
  */
 int32_t init_pcb(pcb_t* new_pcb_ptr) {
+    memset(new_pcb_ptr->fd_chunks, 0, sizeof(new_pcb_ptr->fd_chunks));
+    memset(new_pcb_ptr->fd_bitmap, 0, sizeof(new_pcb_ptr->fd_bitmap));
+    if (alloc_fd_chunk(new_pcb_ptr, 0) != 0) {
+        return -1;
+    }
+
     /*stdin*/ 
-    (new_pcb_ptr->file_array)[0].file_ops = &file_ops_ptrs[STDIN_FILE_OPS_IDX]; 
-    (new_pcb_ptr->file_array)[0].flags = 1;
+    claim_fd(new_pcb_ptr, 0);
+    get_file_desc(new_pcb_ptr, 0)->file_ops = &file_ops_ptrs[STDIN_FILE_OPS_IDX]; 
 
     /*stdout*/
-    (new_pcb_ptr->file_array)[1].file_ops = &file_ops_ptrs[STDOUT_FILE_OPS_IDX];
-    (new_pcb_ptr->file_array)[1].flags = 1;
+    claim_fd(new_pcb_ptr, 1);
+    get_file_desc(new_pcb_ptr, 1)->file_ops = &file_ops_ptrs[STDOUT_FILE_OPS_IDX];
 
+    new_pcb_ptr->shared_image = NULL;
+    memset(new_pcb_ptr->mmaps, 0, sizeof(new_pcb_ptr->mmaps));
+    new_pcb_ptr->io_ring = NULL;
+    new_pcb_ptr->io_ring_addr = NULL;
+    new_pcb_ptr->task_frame = NULL;
+    return 0;
+}
+
+/*alloc_fd_chunk()
+  Take a chunk of file descriptors from its cache for a process, emptied out
+  Input : pcb - Pointer to PCB
+          chunk - index of the chunk in the PCB, whose chunks before it were taken
+  Output : 0 on success
+           -1 if the kernel heap is full
+  Side Effects : Sets the PCB's pointer to the chunk
+ */
+static int32_t alloc_fd_chunk(pcb_t* pcb, int32_t chunk)
+{
+    file_desc_t* fds = kmem_cache_alloc(fd_chunk_cache);
+    if(fds == NULL){
+        LOG("No room is left in the kernel heap for file descriptors.\n");
+        return -1;
+    }
+    memset(fds, 0, sizeof(file_desc_t) * FDS_PER_CHUNK);
+    pcb -> fd_chunks[chunk] = fds;
     return 0;
 }
 
 /*find_free_fd_index()
-  Given a pointer to PCB block, find the first unused file descriptor and return it
+  Given a pointer to PCB block, find the first unused file descriptor and return it.
+  The first word of the bitmap with a clear bit gives it, and when it falls in a chunk
+  the process has not taken yet, the chunk is taken from its cache
   Input : pcb - Pointer to PCB
   Output : Index of free file descriptor for PCB
            -1 if no free FD is available
+  Side Effects : May take a chunk of file descriptors from the kernel heap
  */
 int32_t find_free_fd_index(pcb_t* pcb)
 {
-    int32_t i;
-    for(i = 2; i < FILE_ARRAY_SIZE; i++){
-        if((pcb -> file_array[i]).flags == 0)
-            return i;
+    int32_t i, fd;
+    for(i = 0; i < FD_BITMAP_WORDS; i++){
+        if(pcb -> fd_bitmap[i] != ALL_FDS_OPEN){
+            fd = i * BITS_PER_WORD + __builtin_ctz(~(pcb -> fd_bitmap[i]));
+            if(pcb -> fd_chunks[fd / FDS_PER_CHUNK] == NULL && alloc_fd_chunk(pcb, fd / FDS_PER_CHUNK) != 0)
+                return -1;
+            return fd;
+        }
     }
     return -1;
 }
+
+/*claim_fd()
+  Mark a file descriptor returned by find_free_fd_index as open
+  Input : pcb - Pointer to PCB
+          fd - index of the file descriptor
+  Output : None
+  Side Effects : Sets its flags and its bit in the PCB's bitmap
+ */
+void claim_fd(pcb_t* pcb, int32_t fd)
+{
+    get_file_desc(pcb, fd) -> flags = 1;
+    pcb -> fd_bitmap[fd / BITS_PER_WORD] |= 1U << (fd % BITS_PER_WORD);
+}
@@ -3,13 +3,28 @@
 
 #include "file_system.h"
 #include "paging.h"
+#include "io_ring.h"
 
 #define MAX_COMMAND_LENGTH 128
-#define MAX_NUM_PROCESS 6
+/* Kernel stack slots below 8MB. A process's PCB comes from a slab cache of the kernel
+   heap, and the bottom word of its kernel stack points to it. Executing also needs a
+   free 4MB block from the frame allocator, so installed memory can allow fewer processes */
+#define MAX_NUM_PROCESS 16
 #define PHYSICAL_MEM_8MB 0x800000
 #define KERNEL_STACK_SIZE 0x2000
-#define FILE_ARRAY_SIZE 8
-#define MAX_FILE_INDEX 7
+/* Lowest byte of the kernel stacks, the boot stack's included. Nothing the boot loader
+   placed, such as the file system module, may reach past it */
+#define KERNEL_STACKS_START (PHYSICAL_MEM_8MB - KERNEL_STACK_SIZE * (MAX_NUM_PROCESS + 1))
+#define MAX_NUM_MMAPS 4
+
+/* File descriptors live in chunks of FDS_PER_CHUNK outside the PCB. A process starts
+   with one chunk, and takes more from a slab cache of the kernel heap as it opens more
+   files, up to MAX_NUM_FDS */
+#define FDS_PER_CHUNK 16
+#define MAX_FD_CHUNKS 4
+#define MAX_NUM_FDS (FDS_PER_CHUNK * MAX_FD_CHUNKS)
+#define FD_BITMAP_WORDS (MAX_NUM_FDS / BITS_PER_WORD)
+#define ALL_FDS_OPEN 0xFFFFFFFF
 
 #define RTC_FILE_OPS_IDX 0
 #define DIR_FILE_OPS_IDX 1
@@ -23,18 +38,30 @@ typedef struct file_ops_t {
   int32_t (*read)();
   int32_t (*write)();
   int32_t (*close)();
+  int32_t (*seek)();        /* NULL if the position cannot be moved */
+  int32_t (*pread)();       /* NULL if it cannot be read at a given position */
 } file_ops_t;
 
 typedef struct file_desc_t {
   file_ops_t* file_ops;
   inode_t* inode_ptr;
+  uint32_t inode_idx;       /* index of inode_ptr in the inode array */
   uint32_t file_position;
   uint32_t flags;
+  indirect_cache_t indirect_cache;  /* indirect block of the file read last */
 } file_desc_t;
 
+/* A file mapped read-only into the mmap region */
+typedef struct mmap_region_t {
+  uint32_t addr;            /* virtual address of the first page, NULL if unused */
+  uint32_t num_pages;
+} mmap_region_t;
+
 typedef struct pcb_t {
   uint32_t pid;
-  file_desc_t file_array[FILE_ARRAY_SIZE];
+  int32_t proc_index;       /* kernel stack slot, -1 for the kernel's PCB */
+  file_desc_t* fd_chunks[MAX_FD_CHUNKS];   /* NULL past the chunks taken so far */
+  uint32_t fd_bitmap[FD_BITMAP_WORDS];      /* bit set for each open file descriptor */
   struct pcb_t* parent_pcb;        /* pointer to parent pcb */
   pde_t* pg_dir;            /* pointer to page directory */
   int8_t cmd_name[MAX_COMMAND_LENGTH];
@@ -46,8 +73,27 @@ typedef struct pcb_t {
   uint32_t esp0;
   uint32_t ss0;
   uint32_t ebp;
+
+  /* Demand paging: the program image is filled into the task page on first touch */
+  uint32_t demand_paged;
+  uint32_t exec_inode_idx;
+  uint32_t exec_length;
+  shared_image_t* shared_image; /* read-only copy of the image shared with other instances */
+  uint32_t file_page_faults;   /* pages filled from the file system */
+  uint32_t shared_page_faults; /* pages mapped from an image another instance already loaded */
+  uint32_t cow_page_faults;    /* shared pages copied on write */
+  uint32_t zero_page_faults;   /* pages past the image, zero filled */
+  uint32_t fault_cycles;       /* cycles spent resolving page faults */
+
+  mmap_region_t mmaps[MAX_NUM_MMAPS];
+
+  uint32_t task_frame;   /* 4MB block of physical memory backing the task page, NULL if none */
+
+  io_ring_t* io_ring;    /* rings mapped by sys_io_setup, NULL if none */
+  uint32_t io_ring_addr; /* where the process sees them */
 } pcb_t;
 
+void init_pcbs(void);
 pcb_t* get_new_pcb_ptr();
 pcb_t* get_pcb_ptr();
 pcb_t* get_global_pcb();
@@ -59,6 +105,28 @@ int32_t destroy_pcb_ptr(pcb_t* pcb_ptr);
 int32_t destroy_fd(pcb_t* pcb_ptr, int32_t fd);
 
 int32_t find_free_fd_index(pcb_t* pcb);
+void claim_fd(pcb_t* pcb, int32_t fd);
 uint32_t fill_fd_entry(pcb_t* pcb, const uint8_t* filename, uint32_t filetype, uint32_t fd); 
 
+/* get_file_desc()
+  File descriptor fd of a process, open or not
+  Output : Pointer to the file descriptor
+           NULL if fd is out of range or its chunk was never taken
+ */
+static inline file_desc_t* get_file_desc(pcb_t* pcb, int32_t fd) {
+  if (fd < 0 || fd >= MAX_NUM_FDS || pcb->fd_chunks[fd / FDS_PER_CHUNK] == NULL)
+    return NULL;
+  return &pcb->fd_chunks[fd / FDS_PER_CHUNK][fd % FDS_PER_CHUNK];
+}
+
+/* get_open_file_desc()
+  File descriptor fd of a process, if it is open
+  Output : Pointer to the file descriptor
+           NULL if fd is out of range or not open
+ */
+static inline file_desc_t* get_open_file_desc(pcb_t* pcb, int32_t fd) {
+  file_desc_t* file_desc = get_file_desc(pcb, fd);
+  return (file_desc != NULL && file_desc->flags)? file_desc : NULL;
+}
+
 #endif
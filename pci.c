@@ -0,0 +1,140 @@
+/* pci.c - Enumerates the functions on the PCI buses through configuration
+ * space, so their drivers can find them
+ * vim:ts=4 noexpandtab
+ */
+
+#include "pci.h"
+#include "lib.h"
+
+/* Functions found by pci_init, in bus, slot and function order */
+static pci_dev_t pci_devices[MAX_PCI_DEVICES];
+static uint32_t num_pci_devices;
+
+/* config_address()
+   Address of a register of a function for PCI_CONFIG_ADDRESS
+   Input : bus, slot, func -- the function
+           offset -- offset of the register, a multiple of 4
+   Output : the address
+   Side Effects : None
+ */
+static uint32_t config_address(uint32_t bus, uint32_t slot, uint32_t func, uint32_t offset) {
+	return PCI_CONFIG_ENABLE | (bus << 16) | (slot << 11) | (func << 8) | (offset & 0xFC);
+}
+
+/* read_config()
+   Read a 32-bit register of the configuration space of a function
+   Input : bus, slot, func -- the function
+           offset -- offset of the register, a multiple of 4
+   Output : the register, all ones if there is no such function
+   Side Effects : None
+ */
+static uint32_t read_config(uint32_t bus, uint32_t slot, uint32_t func, uint32_t offset) {
+	outl(config_address(bus, slot, func, offset), PCI_CONFIG_ADDRESS);
+	return inl(PCI_CONFIG_DATA);
+}
+
+/* add_function()
+   Read the header of a function that is present, and keep it
+   Input : bus, slot, func -- the function
+   Output : None
+   Side Effects : Adds it to pci_devices, unless the table is full
+ */
+static void add_function(uint32_t bus, uint32_t slot, uint32_t func) {
+	pci_dev_t* dev;
+	uint32_t id = read_config(bus, slot, func, PCI_REG_ID);
+	uint32_t i;
+
+	if (num_pci_devices == MAX_PCI_DEVICES) {
+		return;
+	}
+	dev = &pci_devices[num_pci_devices++];
+	dev->bus = bus;
+	dev->slot = slot;
+	dev->func = func;
+	dev->vendor_id = id & 0xFFFF;
+	dev->device_id = id >> 16;
+	dev->class_code = read_config(bus, slot, func, PCI_REG_CLASS);
+	dev->irq = read_config(bus, slot, func, PCI_REG_INTERRUPT) & 0xFF;
+	for (i = 0; i < PCI_NUM_BARS; i++) {
+		dev->bar[i] = read_config(bus, slot, func, PCI_REG_BAR0 + i * sizeof(uint32_t));
+	}
+}
+
+/* pci_init()
+   Find every function on every bus. Functions other than 0 of a slot are only looked
+   for when function 0 says it is a multifunction device
+   Input : None
+   Output : None
+   Side Effects : Fills in pci_devices, keeping the first MAX_PCI_DEVICES functions
+ */
+void pci_init(void) {
+	uint32_t bus, slot, func, num_funcs;
+
+	num_pci_devices = 0;
+	for (bus = 0; bus < PCI_NUM_BUSES; bus++) {
+		for (slot = 0; slot < PCI_NUM_SLOTS; slot++) {
+			if ((read_config(bus, slot, 0, PCI_REG_ID) & 0xFFFF) == PCI_VENDOR_NONE) {
+				continue;
+			}
+			num_funcs = ((read_config(bus, slot, 0, PCI_REG_HEADER) >> 16) & PCI_HEADER_MULTIFUNCTION)?
+			            PCI_NUM_FUNCS : 1;
+			for (func = 0; func < num_funcs; func++) {
+				if ((read_config(bus, slot, func, PCI_REG_ID) & 0xFFFF) != PCI_VENDOR_NONE) {
+					add_function(bus, slot, func);
+				}
+			}
+		}
+	}
+}
+
+/* pci_read_config()
+   Read a 32-bit register of the configuration space of a function
+   Input : dev -- the function, from pci_find_device
+           offset -- offset of the register, a multiple of 4
+   Output : the register
+   Side Effects : None
+ */
+uint32_t pci_read_config(const pci_dev_t* dev, uint32_t offset) {
+	return read_config(dev->bus, dev->slot, dev->func, offset);
+}
+
+/* pci_write_config()
+   Write a 32-bit register of the configuration space of a function
+   Input : dev -- the function, from pci_find_device
+           offset -- offset of the register, a multiple of 4
+           value -- value to be written
+   Output : None
+   Side Effects : Writes the register
+ */
+void pci_write_config(const pci_dev_t* dev, uint32_t offset, uint32_t value) {
+	outl(config_address(dev->bus, dev->slot, dev->func, offset), PCI_CONFIG_ADDRESS);
+	outl(value, PCI_CONFIG_DATA);
+}
+
+/* pci_find_device()
+   Find the first function pci_init found with the given IDs
+   Input : vendor_id, device_id -- IDs of the function
+   Output : the function, NULL if there is none
+   Side Effects : None
+ */
+pci_dev_t* pci_find_device(uint16_t vendor_id, uint16_t device_id) {
+	uint32_t i;
+	for (i = 0; i < num_pci_devices; i++) {
+		if (pci_devices[i].vendor_id == vendor_id && pci_devices[i].device_id == device_id) {
+			return &pci_devices[i];
+		}
+	}
+	return NULL;
+}
+
+/* pci_enable_bus_master()
+   Let a function decode its I/O ports and read and write memory on its own
+   Input : dev -- the function, from pci_find_device
+   Output : None
+   Side Effects : Sets the I/O space and bus master bits of its command register,
+                  leaving its status register as it is
+ */
+void pci_enable_bus_master(const pci_dev_t* dev) {
+	uint32_t command = pci_read_config(dev, PCI_REG_COMMAND) & 0xFFFF;
+	pci_write_config(dev, PCI_REG_COMMAND, command | PCI_COMMAND_IO | PCI_COMMAND_BUS_MASTER);
+}
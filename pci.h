@@ -0,0 +1,60 @@
+/* pci.h - Defines for PCI configuration space access and enumeration,
+ * through configuration mechanism #1
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _PCI_H
+#define _PCI_H
+
+#include "types.h"
+
+/* Ports of configuration mechanism #1 */
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA 0xCFC
+#define PCI_CONFIG_ENABLE 0x80000000
+
+#define PCI_NUM_BUSES 256
+#define PCI_NUM_SLOTS 32
+#define PCI_NUM_FUNCS 8
+#define PCI_NUM_BARS 6
+
+/* Offsets of the registers of a configuration space header, all read as 32-bit words */
+#define PCI_REG_ID 0x00                 /* vendor in the low half, device in the high half */
+#define PCI_REG_COMMAND 0x04            /* command in the low half */
+#define PCI_REG_CLASS 0x08              /* class, subclass, interface and revision */
+#define PCI_REG_HEADER 0x0C             /* header type in bits 16-23 */
+#define PCI_REG_BAR0 0x10
+#define PCI_REG_INTERRUPT 0x3C          /* interrupt line in the low byte */
+
+#define PCI_VENDOR_NONE 0xFFFF
+#define PCI_HEADER_MULTIFUNCTION 0x80
+#define PCI_COMMAND_IO 0x0001
+#define PCI_COMMAND_BUS_MASTER 0x0004
+/* Low bit of a BAR set for I/O space, whose port number is above the low two bits */
+#define PCI_BAR_IO 0x1
+#define PCI_BAR_IO_MASK 0xFFFFFFFC
+/* Interrupt line of a function wired to no IRQ of the PIC */
+#define PCI_IRQ_NONE 0xFF
+
+/* Most functions pci_init keeps */
+#define MAX_PCI_DEVICES 32
+
+/* A function found on the bus */
+typedef struct pci_dev_t {
+	uint8_t bus;
+	uint8_t slot;
+	uint8_t func;
+	uint8_t irq;				/* IRQ of the PIC, PCI_IRQ_NONE if it has none */
+	uint16_t vendor_id;
+	uint16_t device_id;
+	uint32_t class_code;		/* class in bits 24-31, then subclass, interface and revision */
+	uint32_t bar[PCI_NUM_BARS];
+} pci_dev_t;
+
+void pci_init(void);
+uint32_t pci_read_config(const pci_dev_t* dev, uint32_t offset);
+void pci_write_config(const pci_dev_t* dev, uint32_t offset, uint32_t value);
+pci_dev_t* pci_find_device(uint16_t vendor_id, uint16_t device_id);
+void pci_enable_bus_master(const pci_dev_t* dev);
+
+#endif /* _PCI_H */
@@ -3,6 +3,7 @@
 #include "debug.h"
 #include "lib.h"
 #include "i8259.h"
+#include "io_ring.h"
 
 extern pcb_t* top_process[NUM_TERMINALS];
 extern int32_t num_progs[NUM_TERMINALS];
@@ -12,11 +13,15 @@ extern int32_t num_progs[NUM_TERMINALS];
  *   DESCRIPTION: Pit handler is being called when IRQ0 is raised (0x20)
  *   Every time IRQ0 is raised (0x20,with 50HZ), the pit handler calls the switch_task 
  *   which takes input of task number to switch to. 
- *   INPUTS: NONE
+ *   A tick that interrupted a program first runs a few of the file operations
+ *   it queued on its io ring.
+ *   INPUTS: from_user - nonzero if the tick interrupted user mode
  *   OUTPUTS: None
  *   SIDE EFFECTS: Switch to next task every 50HZ 
  */   
-void pit_handler(){
+void pit_handler(uint32_t from_user){
+	if(from_user)
+		io_ring_tick();
 	int32_t next_task_num = get_next_task_number(); //Gets the next task number
 	if(next_task_num == -1){  //Check if there is no task to switch
 		LOG("No Next Task!\n");
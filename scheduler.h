@@ -30,7 +30,7 @@
 #define PIT_HIGH_BYTE	8
 int pit_init(int channel, int mode, int freq);
 
-void pit_handler();
+void pit_handler(uint32_t from_user);
 void switch_task(int32_t new_task_number);
 int32_t get_next_task_number();
 
@@ -5,20 +5,25 @@
 #include "pcb.h"
 #include "paging.h"
 #include "debug.h"
+#include "syscall_exec.h"
+#include "frame_alloc.h"
 
 #define MAX_CMD_NAME_LENGTH 32
 #define MAX_CMD_ARG_LENGTH 32
-#define TASK_PAGE_VIRT_ADDR 0x8000000  /* 128MB */
-#define TASK_BEGIN_VIRT_ADDR 0x8048000
 #define TASK_ENTRY_PTR_VIRT_ADDR 0x8000000
-#define LOADER_BUFFER_SIZE 16
+#define TASK_MAX_IMAGE_SIZE (TASK_PAGE_VIRT_ADDR + PAGE_SIZE_4M - TASK_BEGIN_VIRT_ADDR)
+#define LEGACY_LOADER_BUFFER_SIZE 16
+#define BENCH_LOADER_SCRATCH_SIZE 0x10000
+#define BENCH_LOADER_ROUNDS 20
 #define TASK_MEM_PADDING 16
 #define EFLAGS_BASE 2
 #define EFLAGS_STI (1 << 9)
 
+
 static int32_t parse_command(const int8_t* command, int8_t* exec_name, int8_t* exec_args);
-static int32_t check_executable(const int8_t* exec_name, uint32_t* entry_addr);
-static int32_t load_executable(const int8_t* exec_name);
+static int32_t check_executable(const int8_t* exec_name, dentry_t* dentry, uint32_t* entry_addr);
+static int32_t map_task_page(uint32_t task_frame, pde_t* new_pg_dir);
+static int32_t load_executable(pcb_t* new_pcb_ptr, const dentry_t* dentry);
 
 extern pcb_t* top_process[NUM_TERMINALS];
 extern int32_t num_progs[NUM_TERMINALS];
@@ -47,6 +52,8 @@ int32_t do_execute(const int8_t* command) {
     asm volatile("cli");
     LOG("do_execute called\n");
     int32_t ret_val = 0;
+    uint32_t exec_start = rdtsc();
+    uint32_t load_cycles;
 
     pcb_t* new_pcb_ptr = get_new_pcb_ptr();
     if (new_pcb_ptr == NULL) {
@@ -57,7 +64,11 @@ int32_t do_execute(const int8_t* command) {
     pcb_t* cur_pcb_ptr = get_pcb_ptr();
 
     /* Initialize PCB */
-    init_pcb(new_pcb_ptr);
+    if (init_pcb(new_pcb_ptr) != 0) {
+        LOG("No room for the file descriptors of a new process\n");
+        destroy_pcb_ptr(new_pcb_ptr);
+        return -1;
+    }
 
     /* Update Parent Process */
     LOG("new process with parent process %d\n", get_proc_index(get_pcb_ptr()));
@@ -84,16 +95,29 @@ int32_t do_execute(const int8_t* command) {
     const int8_t* exec_name = new_pcb_ptr->cmd_name;
 
     /* Exec check & file existence check */
+    dentry_t exec_dentry;
     uint32_t entry_addr;
-    if (check_executable(exec_name, &entry_addr) != 0) {
+    if (check_executable(exec_name, &exec_dentry, &entry_addr) != 0) {
         LOG("File is not an executable or the file does not exist\n");
         destroy_pcb_ptr(new_pcb_ptr);
         return -1;
     }
 
-    /* Setup Paging. Virt 128MB -> Physical 8MB, 12MB, 16MB, ... */
-    pde_t* new_pg_dir = get_pg_dir(get_proc_index(new_pcb_ptr));
-    
+    /* Back the task page with a 4MB block of physical memory */
+    new_pcb_ptr->task_frame = alloc_frames(FRAME_ORDER_4M);
+    if (new_pcb_ptr->task_frame == NULL) {
+        LOG("No physical memory is left for a new process\n");
+        destroy_pcb_ptr(new_pcb_ptr);
+        return -1;
+    }
+
+    /* Setup Paging. Virt 128MB -> the block */
+    pde_t* new_pg_dir = alloc_pg_dir();
+    if (new_pg_dir == NULL) {
+        LOG("No room for the page directory of a new process\n");
+        destroy_pcb_ptr(new_pcb_ptr);
+        return -1;
+    }
 
     /* Map the Video memory and Video memory buffers */
     if((map_page(VIDEO_BUF_1, VIDEO_BUF_1,
@@ -110,8 +134,7 @@ int32_t do_execute(const int8_t* command) {
         return -1;
     }
 
-    if ((map_page(TASK_PAGE_VIRT_ADDR, PHYSICAL_MEM_8MB + (PAGE_SIZE_4M * get_proc_index(new_pcb_ptr)), 
-                  PAGING_USER_SUPERVISOR | PAGING_READ_WRITE, new_pg_dir) != 0) ||
+    if ((map_task_page(new_pcb_ptr->task_frame, new_pg_dir) != 0) ||
         (map_page(PAGE_BEGINNING_ADDR_4M, PAGE_BEGINNING_ADDR_4M, 
                   PAGING_USER_SUPERVISOR | PAGING_READ_WRITE | PAGING_GLOBAL_PAGE, new_pg_dir) != 0) ||
         (map_page(VIDEO, VIDEO, 
@@ -130,16 +153,23 @@ int32_t do_execute(const int8_t* command) {
     new_pcb_ptr->pg_dir = new_pg_dir;
     
     /* Load the executable file */
-    if (load_executable(exec_name) != 0) {
+    load_cycles = rdtsc();
+    if (load_executable(new_pcb_ptr, &exec_dentry) != 0) {
         LOG("Failed to load executable");
         destroy_pcb_ptr(new_pcb_ptr);
-        cleanup_pg_dir(new_pg_dir);
         if(cur_pcb_ptr == get_global_pcb())
             set_cr3_reg(pg_dir);
         else
             set_cr3_reg(cur_pcb_ptr -> pg_dir);
+        cleanup_pg_dir(new_pg_dir);
         return -1;
     }
+    load_cycles = rdtsc() - load_cycles;
+
+    if (EXEC_BENCH) {
+        printf("execute %s: %u cycles to IRET, %u cycles loading %d bytes\n", exec_name,
+               rdtsc() - exec_start, load_cycles, get_file_length(exec_dentry.inode_idx));
+    }
 
     /* Manipulate the TSS's ESP0 and SS0 to point to new process's stack */
     tss.ss0 = KERNEL_DS;
@@ -221,15 +251,15 @@ static int32_t parse_command(const int8_t* command, int8_t* exec_name, int8_t* e
   check(if found) that the file is an executable file, and fill entry_addr
   with the entry address of the program.
   Input : exec_name - Name of executable file to be found
+          dentry - pointer to directory entry to be filled, reused by the loader
           entry_addr - pointer to user program's entry point to be filled
   Output : 0 on success, 
            -1 on failure(if file is not found, or file is not an executable)
  */
-static int32_t check_executable(const int8_t* exec_name, uint32_t* entry_addr) {
+static int32_t check_executable(const int8_t* exec_name, dentry_t* dentry, uint32_t* entry_addr) {
     file_header_t file_header;
-    /* Open the file and read the header */
-    inode_t* inode_ptr = (inode_t *) open_file((uint8_t *) exec_name);
-    if (!inode_ptr) {
+    /* Find the file and read the header */
+    if (read_dentry_by_name((uint8_t *) exec_name, dentry) != 0 || dentry->file_type != FILE_TYPE_FILE) {
         LOG("Nonexistent file\n");
         return -1;
     }
@@ -237,7 +267,7 @@ static int32_t check_executable(const int8_t* exec_name, uint32_t* entry_addr) {
     /* If number of read bytes is less than size of file header,
        first four bytes are not 0x7f, 'E', 'L', 'F',
        or entry pointer to executable is not in the correct range, return error */
-    int32_t count = read_file(inode_ptr, 0, file_header.data, FILE_HEADER_SIZE);
+    int32_t count = read_data(dentry->inode_idx, 0, file_header.data, FILE_HEADER_SIZE);
     if (count < FILE_HEADER_SIZE) {
         LOG("The bytes read are not enough to analyze the executable file\n");
         return -1;
@@ -254,27 +284,113 @@ static int32_t check_executable(const int8_t* exec_name, uint32_t* entry_addr) {
     return 0;
 }
 
+/*map_task_page()
+  Map the 128MB task page of a new process to the 4MB block it took from the frame allocator.
+  With EXEC_DEMAND_PAGING the page is covered by a page table whose entries start
+  out not present; page_fault_handler backs them with the same block 4KB at a time
+  Input : task_frame - physical address of the block
+          new_pg_dir - page directory of the new process
+  Output : 0 on success, -1 on failure
+ */
+static int32_t map_task_page(uint32_t task_frame, pde_t* new_pg_dir) {
+    if (EXEC_DEMAND_PAGING) {
+        return alloc_pg_table(TASK_PAGE_VIRT_ADDR, PAGING_USER_SUPERVISOR | PAGING_READ_WRITE, new_pg_dir);
+    } else {
+        return map_page(TASK_PAGE_VIRT_ADDR, task_frame,
+                        PAGING_USER_SUPERVISOR | PAGING_READ_WRITE, new_pg_dir);
+    }
+}
+
 /*load_executable()
-  Given the name of file, load the program at virtual memory 0x8048000
-  Input : exec_name - Name of the executable file to be loaded
-  Output : 0 on success, -1 on failure(file does not exist)
+  Given the directory entry of the file, load the program at virtual memory 0x8048000.
+  Data blocks are copied straight into the user page, a whole block per copy.
+  With EXEC_DEMAND_PAGING nothing is copied here; the image is only recorded in the
+  PCB, and each page is filled in by page_fault_handler when it is first touched.
+  Image pages are then shared read-only between instances of the same program
+  Input : new_pcb_ptr - PCB of the process being executed
+          dentry - Directory entry of the executable file, resolved by check_executable
+  Output : 0 on success, -1 on failure(file could not be read, or does not fit in the page)
   Side Effects : Update virtual memory page between 128MB ~ 132MB
  */
-static int32_t load_executable(const int8_t* exec_name) {
-    uint8_t buf[LOADER_BUFFER_SIZE];
-    inode_t* inode_ptr = (inode_t *) open_file((uint8_t *) exec_name);
-    if (!inode_ptr) {
-        LOG("Nonexistent file\n");
+static int32_t load_executable(pcb_t* new_pcb_ptr, const dentry_t* dentry) {
+    int32_t length = get_file_length(dentry->inode_idx);
+    if (length < 0 || length > TASK_MAX_IMAGE_SIZE) {
+        LOG("Executable does not fit in the task page\n");
         return -1;
     }
-    
+
+    new_pcb_ptr->demand_paged = EXEC_DEMAND_PAGING;
+    new_pcb_ptr->exec_inode_idx = dentry->inode_idx;
+    new_pcb_ptr->exec_length = length;
+    new_pcb_ptr->file_page_faults = 0;
+    new_pcb_ptr->shared_page_faults = 0;
+    new_pcb_ptr->cow_page_faults = 0;
+    new_pcb_ptr->zero_page_faults = 0;
+    new_pcb_ptr->fault_cycles = 0;
+    if (EXEC_DEMAND_PAGING) {
+        /* Share the image with other instances of the program. Pages they already
+           loaded are mapped read-only right away; the rest are loaded on first touch */
+        new_pcb_ptr->shared_image = get_shared_image(dentry->inode_idx, length);
+        map_shared_image(new_pcb_ptr->shared_image, new_pcb_ptr->pg_dir);
+        return 0;
+    }
+
     /* Copy executable */
-    int32_t bytes_read;
-    int32_t count = 0;
-    while ((bytes_read = read_file(inode_ptr, count, buf, LOADER_BUFFER_SIZE)) != 0) {
-        memcpy((uint8_t *)(TASK_BEGIN_VIRT_ADDR + count), buf, bytes_read);
-        count += bytes_read;
+    if (read_data(dentry->inode_idx, 0, (uint8_t *) TASK_BEGIN_VIRT_ADDR, length) != length) {
+        LOG("Failed to read executable\n");
+        return -1;
     }
 
     return 0;
 }
+
+#if KERNEL_BENCH
+/*bench_exec_loader()
+  Compare the old loader, which copied the program through a 16-byte stack buffer,
+  with the block-granular copy, for every executable small enough to fit in a
+  scratch buffer. The scratch buffer stands in for the user page so this can run
+  before any process exists. Meant to be called by hand from kernel.c
+ */
+void bench_exec_loader(void) {
+    static uint8_t scratch[BENCH_LOADER_SCRATCH_SIZE];
+    uint8_t buf[LEGACY_LOADER_BUFFER_SIZE];
+    int8_t name[MAX_FILE_NAME_LENGTH + 1];
+    uint32_t bounce_cycles, block_cycles, start;
+    int32_t bytes_read, count, length;
+    dentry_t dentry;
+    uint32_t entry_addr;
+    int i, round;
+
+    for (i = 0; read_dentry_by_index(i, &dentry) == 0; i++) {
+        /* dentry names are not NUL terminated when they are 32 characters long */
+        strncpy(name, (int8_t *) dentry.file_name, MAX_FILE_NAME_LENGTH);
+        name[MAX_FILE_NAME_LENGTH] = NULL;
+        if (check_executable(name, &dentry, &entry_addr) != 0) {
+            continue;
+        }
+        length = get_file_length(dentry.inode_idx);
+        if (length > BENCH_LOADER_SCRATCH_SIZE) {
+            continue;
+        }
+
+        start = rdtsc();
+        for (round = 0; round < BENCH_LOADER_ROUNDS; round++) {
+            count = 0;
+            while ((bytes_read = read_data(dentry.inode_idx, count, buf, LEGACY_LOADER_BUFFER_SIZE)) > 0) {
+                memcpy(scratch + count, buf, bytes_read);
+                count += bytes_read;
+            }
+        }
+        bounce_cycles = (rdtsc() - start) / BENCH_LOADER_ROUNDS;
+
+        start = rdtsc();
+        for (round = 0; round < BENCH_LOADER_ROUNDS; round++) {
+            read_data(dentry.inode_idx, 0, scratch, length);
+        }
+        block_cycles = (rdtsc() - start) / BENCH_LOADER_ROUNDS;
+
+        printf("load %s (%d bytes): 16-byte bounce %u cycles, block copy %u cycles\n",
+               name, length, bounce_cycles, block_cycles);
+    }
+}
+#endif /* KERNEL_BENCH */
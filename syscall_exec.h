@@ -1,6 +1,16 @@
 #ifndef _SYSCALL_EXEC_H
 #define _SYSCALL_EXEC_H
 
+#include "debug.h"
+
+/* Set to 1 to fill the program image in on page faults instead of copying it at execute */
+#define EXEC_DEMAND_PAGING 1
+/* Set to 1 to print execute-to-IRET latency of every execute, and page faults at halt */
+#define EXEC_BENCH 0
+
 int32_t do_execute(const int8_t* command);
+#if KERNEL_BENCH
+void bench_exec_loader(void);
+#endif
 
 #endif
@@ -8,13 +8,14 @@
 #include "debug.h"
 #include "keyboard.h" // only for NUM_TERMINALS
 #include "interrupt_handler.h"
+#include "io_ring.h"
 
 #define FD_ENTRY_MIN 2
-#define FD_ENTRY_MAX 7
 #define HALT_ARG_BITMASK 0xFF
-#define TASK_BEGIN_VIRT_ADDR 0x8048000
 #define HALT_DUE_TO_EXCEPTION 256
 
+static int32_t open_by_name (const uint8_t* filename, int32_t create);
+
 extern void* halt_ret;
 extern file_ops_t file_ops_ptrs[FILE_OPS_PTRS_SIZE];
 extern inode_t* inodes;
@@ -49,14 +50,30 @@ int32_t halt(uint8_t status)
 	pcb_t* parent_pcb_ptr = current_pcb_ptr->parent_pcb;
 	int32_t current_terminal = get_current_terminal();
 
+	if (EXEC_BENCH) {
+		printf("halt %s: %u pages filled from file, %u shared, %u copied on write, %u zero filled, "
+			"%u cycles in page faults\n",
+			current_pcb_ptr->cmd_name, current_pcb_ptr->file_page_faults,
+			current_pcb_ptr->shared_page_faults, current_pcb_ptr->cow_page_faults,
+			current_pcb_ptr->zero_page_faults, current_pcb_ptr->fault_cycles);
+	}
+
 	/* Close opened files except for stdin, stdout */
 	int i;
-	for (i = FD_ENTRY_MIN; i <= FD_ENTRY_MAX; i++) {
-		if (current_pcb_ptr -> file_array[i].flags) {
+	for (i = FD_ENTRY_MIN; i < MAX_NUM_FDS; i++) {
+		if (get_open_file_desc(current_pcb_ptr, i) != NULL) {
 			sys_close(i);
 		}
 	}
 
+	/* Remove file mappings */
+	for (i = 0; i < MAX_NUM_MMAPS; i++) {
+		if (current_pcb_ptr -> mmaps[i].addr != NULL) {
+			sys_munmap((void *) current_pcb_ptr -> mmaps[i].addr);
+		}
+	}
+	close_io_ring(current_pcb_ptr);
+
 	if(num_progs[current_terminal] == 1){
 		tss.esp0 = PHYSICAL_MEM_8MB - (KERNEL_STACK_SIZE * (get_proc_index(current_pcb_ptr) + 1));
 		tss.ss0 = KERNEL_DS;
@@ -147,16 +164,16 @@ int32_t sys_execute(const uint8_t* command)
 int32_t sys_read(int32_t fd, void* buf, int32_t nbytes)
 {
 	LOG("sys_read\n");
-	// get current pcb
-	pcb_t* pcb = get_pcb_ptr();
+	// get current pcb's file descriptor, NULL if fd is out of range or unopened
+	file_desc_t* file_desc = get_open_file_desc(get_pcb_ptr(), fd);
 	/* Buffer Null Check */
 	if(buf == NULL)
 		return -1;
 	/* Check for out of range fd, or reads on unopened file descriptors or stdout */
-	if(fd > FD_ENTRY_MAX || fd < 0 || fd == 1 || ((pcb ->file_array)[fd]).flags == 0)
+	if(file_desc == NULL || fd == 1)
 		return -1;
 	// call read function and return number of bytes read
-	return (((pcb -> file_array)[fd]).file_ops -> read)(fd, buf, nbytes);
+	return (file_desc -> file_ops -> read)(fd, buf, nbytes);
 }
 
 /* sys_write
@@ -171,16 +188,92 @@ int32_t sys_read(int32_t fd, void* buf, int32_t nbytes)
 int32_t sys_write(int32_t fd, const void* buf, int32_t nbytes)
 {
 	LOG("sys_write\n");
-	pcb_t* pcb = get_pcb_ptr();
+	file_desc_t* file_desc = get_open_file_desc(get_pcb_ptr(), fd);
 
 	/* Buffer Null Check */
 	if(buf == NULL)
 		return -1;
 	/* Checks for out of range fd, write on unopened file descriptor or stdin */ 
-	if(fd > FD_ENTRY_MAX || fd <= 0 || ((pcb -> file_array)[fd]).flags == 0)
+	if(file_desc == NULL || fd == 0)
+		return -1;
+
+	return (file_desc -> file_ops -> write)(fd, 0, buf, nbytes);
+}
+
+/* sys_sendfile
+   Writes a regular file to another file descriptor inside the kernel, from the file's
+   data blocks to the output's write function, with no user buffer in between.
+   "cat" of a whole file to stdout is a single call
+   Input : out_fd -- the index of the output, the terminal or an open regular file
+   		   in_fd -- the index of an open regular file, read from its position
+   		   nbytes -- the maximum number of bytes to be sent
+   Output : Returns the number of bytes sent, 0 at the end of the file
+   			-1 on failure
+   Side Effect : Advances in_fd's position by the number of bytes sent
+*/
+int32_t sys_sendfile(int32_t out_fd, int32_t in_fd, int32_t nbytes)
+{
+	LOG("sys_sendfile\n");
+	pcb_t* pcb = get_pcb_ptr();
+	file_desc_t* in_desc = get_open_file_desc(pcb, in_fd);
+	file_desc_t* out_desc = get_open_file_desc(pcb, out_fd);
+
+	if(nbytes < 0 || out_fd == in_fd)
+		return -1;
+	/* Checks for out of range fds, unopened file descriptors and an input that is not a regular file.
+	   send_file refuses an output that is neither the terminal nor a regular file */
+	if(in_desc == NULL || in_fd < FD_ENTRY_MIN || in_desc -> file_ops != &file_ops_ptrs[REG_FILE_OPS_IDX])
+		return -1;
+	if(out_desc == NULL || out_fd == 0)
+		return -1;
+
+	return send_file(in_fd, out_fd, nbytes);
+}
+
+/* sys_lseek
+   Moves the position of a regular file or directory, where its next read or write starts.
+   A directory's position is the index of a directory entry
+   Input : fd -- the index in the file descriptor array
+   		   offset -- the new position, relative to whence
+   		   whence -- SEEK_SET from the start, SEEK_CUR from the position, SEEK_END from the end
+   Output : Returns the new position
+   			-1 on failure(fd cannot seek, unknown whence, or a position before the start or past the end)
+   Side Effect : None
+*/
+int32_t sys_lseek(int32_t fd, int32_t offset, int32_t whence)
+{
+	LOG("sys_lseek\n");
+	file_desc_t* file_desc = get_open_file_desc(get_pcb_ptr(), fd);
+
+	/* Checks for out of range fd, unopened file descriptor or one that cannot seek */
+	if(file_desc == NULL || fd < FD_ENTRY_MIN || file_desc -> file_ops -> seek == NULL)
+		return -1;
+
+	return (file_desc -> file_ops -> seek)(fd, offset, whence);
+}
+
+/* sys_pread
+   Reads a regular file or directory at the given position, leaving its position as it is
+   Input : fd -- the index in the file descriptor array
+   		   buf -- array to be filled in with read data
+   		   nbytes -- the number of bytes to be read
+   		   offset -- where to read, a byte offset, or the index of a directory entry
+   Output : the number of bytes read, 0 at or past the end
+   			-1 on failure
+   Side Effect : None
+*/
+int32_t sys_pread(int32_t fd, void* buf, int32_t nbytes, uint32_t offset)
+{
+	LOG("sys_pread\n");
+	file_desc_t* file_desc = get_open_file_desc(get_pcb_ptr(), fd);
+
+	if(buf == NULL || nbytes < 0)
+		return -1;
+	/* Checks for out of range fd, unopened file descriptor or one without positions */
+	if(file_desc == NULL || fd < FD_ENTRY_MIN || file_desc -> file_ops -> pread == NULL)
 		return -1;
 
-	return (((pcb -> file_array)[fd]).file_ops -> write)(fd, 0, buf, nbytes);
+	return (file_desc -> file_ops -> pread)(fd, buf, nbytes, offset);
 }
 
 /* sys_open
@@ -193,34 +286,71 @@ int32_t sys_write(int32_t fd, const void* buf, int32_t nbytes)
 int32_t sys_open (const uint8_t* filename)
 {
 	LOG("sys_open\n");
+	return open_by_name(filename, 0);
+}
+
+/* sys_create
+   Opens the given regular file for appending, creating it empty if it does not exist.
+   The file descriptor starts at the end of the file
+   Input : filename -- the name of file to be opened or created
+   Output : Return the index of the newly allocated file descriptor
+   			-1 on failure(name is not a regular file, or the file cannot be created)
+   Side Effect : Allocates an unused file descriptor, may add a file to the file system
+*/
+int32_t sys_create (const uint8_t* filename)
+{
+	LOG("sys_create\n");
+	return open_by_name(filename, 1);
+}
+
+/* open_by_name
+   Shared body of sys_open and sys_create.
+   The name is resolved once here, and the resulting directory entry is handed to
+   the open function of the file type so it does not need to look it up again
+   Input : filename -- the name of file to be opened
+   		   create -- nonzero to create a missing regular file and start at the end of the file
+   Output : Return the index of the newly allocated file descriptor
+   			-1 on failure
+   Side Effect : Allocates an unused file descriptor 
+*/
+static int32_t open_by_name (const uint8_t* filename, int32_t create)
+{
 	pcb_t* pcb_ptr = get_pcb_ptr();
 
 	/* Find Free Space */
-	uint32_t fd_index = find_free_fd_index(pcb_ptr);
+	int32_t fd_index = find_free_fd_index(pcb_ptr);
 	if(fd_index == -1){
 		LOG("No Free Space in File Array. Can't Open!");
 		return -1;
 	}
 	/* Check for existing filename */
 	dentry_t curr_file;
-	if(read_dentry_by_name(filename, &curr_file) == -1)
+	if(read_dentry_by_name(filename, &curr_file) == -1 &&
+	   (!create || create_file(filename, &curr_file) == -1))
+		return -1;
+	if(create && curr_file.file_type != FILE_TYPE_FILE)
 		return -1;
 
 	/* Update pcb according to filetype */
-	(pcb_ptr->file_array)[fd_index].flags = 1;
-	(pcb_ptr->file_array)[fd_index].file_position = 0;
+	file_desc_t* file_desc = get_file_desc(pcb_ptr, fd_index);
+	claim_fd(pcb_ptr, fd_index);
+	file_desc->file_position = 0;
 
 	if(curr_file.file_type == FILE_TYPE_RTC) {
-		(pcb_ptr->file_array)[fd_index].file_ops = &file_ops_ptrs[RTC_FILE_OPS_IDX];
+		file_desc->file_ops = &file_ops_ptrs[RTC_FILE_OPS_IDX];
 	} else if (curr_file.file_type == FILE_TYPE_DIR) {
-		(pcb_ptr->file_array)[fd_index].file_ops = &file_ops_ptrs[DIR_FILE_OPS_IDX];
+		file_desc->file_ops = &file_ops_ptrs[DIR_FILE_OPS_IDX];
 	} else {
-		(pcb_ptr->file_array)[fd_index].file_ops = &file_ops_ptrs[REG_FILE_OPS_IDX];
+		file_desc->file_ops = &file_ops_ptrs[REG_FILE_OPS_IDX];
 	}
 
-	/* Call Open Function */
-	if((((pcb_ptr -> file_array)[fd_index]).file_ops -> open)((int32_t) filename) == -1)
+	/* Call Open Function with the resolved directory entry */
+	if((file_desc->file_ops->open)(&curr_file, file_desc) == -1) {
 		destroy_fd(pcb_ptr, fd_index);
+		return -1;
+	}
+	if(create)
+		file_desc->file_position = get_file_length(curr_file.inode_idx);
 
 	return fd_index;
 }
@@ -237,16 +367,17 @@ int32_t sys_close (int32_t fd)
 	LOG("sys_close\n");
 	
 	/* Check if out of bounds */
-	if(fd < FD_ENTRY_MIN || fd > FD_ENTRY_MAX)
+	if(fd < FD_ENTRY_MIN || fd >= MAX_NUM_FDS)
 		return -1;
 
 	/* Check for closing unopened file descriptor */
 	pcb_t* pcb_ptr = get_pcb_ptr();
-	if(((pcb_ptr -> file_array)[fd].flags) == 0)
+	file_desc_t* file_desc = get_open_file_desc(pcb_ptr, fd);
+	if(file_desc == NULL)
 		return -1;
 
 	/* Call Close */
-	(((pcb_ptr -> file_array)[fd]).file_ops -> close)((int32_t)(pcb_ptr -> file_array[fd]).inode_ptr);
+	(file_desc -> file_ops -> close)((int32_t) file_desc -> inode_ptr);
 
 	/* Empty out file array */
 	destroy_fd(pcb_ptr, fd);
@@ -318,3 +449,230 @@ int32_t sys_sigreturn(void)
 {
 	return 0;
 }
+
+/* sys_getdents
+   Reads as many directory entries as fit into buf in a single call.
+   Each entry is a dirent_t record holding its name, name length, file type,
+   inode index and file size
+   Input : fd -- file descriptor of an open directory
+   		   buf -- array to be filled in with records
+   		   nbytes -- size of buf in bytes
+   Output : the number of bytes filled in, 0 when every entry has been read
+   			-1 on failure(fd is not an open directory, or buf cannot hold a record)
+   Side Effect : Advances the directory's position by the number of records read
+*/
+int32_t sys_getdents(int32_t fd, void* buf, int32_t nbytes)
+{
+	LOG("sys_getdents\n");
+	file_desc_t* file_desc = get_open_file_desc(get_pcb_ptr(), fd);
+
+	if(buf == NULL || nbytes < 0)
+		return -1;
+	if(file_desc == NULL || fd < FD_ENTRY_MIN || file_desc -> file_ops != &file_ops_ptrs[DIR_FILE_OPS_IDX])
+		return -1;
+
+	return read_dir_entries(fd, buf, nbytes);
+}
+
+/* sys_findnames
+   Finds the names in the directory that match a pattern, in one call and in name
+   order, so a program completing or expanding a name need not read every entry.
+   '*' in the pattern matches any run of characters and '?' any one character
+   Input : pattern -- the pattern, such as a prefix followed by '*'
+   		   buf -- array filled with the matching names, each followed by a NUL
+   		   nbytes -- size of buf in bytes
+   		   first -- number of matches to skip, to continue after a buf that filled up
+   Output : the number of names put in buf
+   			-1 on failure(pattern or buf is NULL, or the pattern is empty or too long)
+   Side Effect : None
+*/
+int32_t sys_findnames(const uint8_t* pattern, void* buf, int32_t nbytes, uint32_t first)
+{
+	LOG("sys_findnames\n");
+	if(nbytes < 0)
+		return -1;
+	return find_names(pattern, buf, nbytes, first);
+}
+
+/* unmap_pages
+   Remove num_pages consecutive pages mapped by map_file_pages
+   Input : addr -- virtual address of the first page
+   		   num_pages -- number of pages to remove
+   		   pg_dir -- page directory holding the mapping
+   Output : None
+   Side Effect : Clears the page table entries and their TLB entries
+*/
+static void unmap_pages(uint32_t addr, uint32_t num_pages, pde_t* pg_dir)
+{
+	uint32_t i;
+	for(i = 0; i < num_pages; i++)
+		unmap_page(addr + i * PAGE_SIZE_4K, pg_dir);
+}
+
+/* map_file_pages
+   Map the data blocks of a file read-only, one 4KB page per block, into the first
+   free range of the mmap region that is large enough. Nothing is copied: the pages
+   are the file system image's own blocks
+   Input : inode -- index of inode of the file
+   		   num_pages -- number of pages of the file
+   		   pg_dir -- page directory whose mmap region is not a 4MB page
+   Output : virtual address of the first page
+   			NULL if no free range is large enough or a block is out of range
+   Side Effect : Fills page table entries of the mmap region, installing its page
+   				 table on the first mapping
+*/
+static uint32_t map_file_pages(uint32_t inode, uint32_t num_pages, pde_t* pg_dir)
+{
+	uint32_t addr = find_free_pages(MMAP_VIRT_ADDR, num_pages, pg_dir);
+	uint32_t block_addr;
+	uint32_t i;
+
+	if(addr == NULL)
+		return NULL;
+	for(i = 0; i < num_pages; i++) {
+		block_addr = get_block_addr(inode, i);
+		if(block_addr == NULL ||
+		   map_page_4k(addr + i * PAGE_SIZE_4K, block_addr, PAGING_USER_SUPERVISOR, pg_dir) != 0) {
+			unmap_pages(addr, i, pg_dir);
+			return NULL;
+		}
+	}
+	return addr;
+}
+
+/* sys_mmap
+   Maps a whole regular file read-only into the caller's mmap region.
+   The bytes between the end of the file and the end of its last page are whatever
+   the last data block holds there
+   Input : fd -- file descriptor of an open regular file
+   Output : virtual address the file is mapped at
+   			-1 on failure(fd is not an open regular file, file is empty,
+   			or there is no free mapping slot or address range)
+   Side Effect : Maps pages in the caller's page directory
+*/
+int32_t sys_mmap(int32_t fd)
+{
+	LOG("sys_mmap\n");
+	pcb_t* pcb = get_pcb_ptr();
+	mmap_region_t* region = NULL;
+	int i;
+
+	file_desc_t* file_desc = get_open_file_desc(pcb, fd);
+	if(file_desc == NULL || fd < FD_ENTRY_MIN || file_desc -> file_ops != &file_ops_ptrs[REG_FILE_OPS_IDX])
+		return -1;
+
+	uint32_t inode = file_desc -> inode_idx;
+	int32_t length = get_file_length(inode);
+	if(length <= 0)
+		return -1;
+
+	for(i = 0; i < MAX_NUM_MMAPS; i++) {
+		if(pcb->mmaps[i].addr == NULL) {
+			region = &pcb->mmaps[i];
+			break;
+		}
+	}
+	if(region == NULL)
+		return -1;
+
+	uint32_t num_pages = (length + PAGE_SIZE_4K - 1) / PAGE_SIZE_4K;
+	uint32_t addr = map_file_pages(inode, num_pages, pcb->pg_dir);
+	if(addr == NULL)
+		return -1;
+
+	region->addr = addr;
+	region->num_pages = num_pages;
+	return addr;
+}
+
+/* sys_munmap
+   Removes a mapping made by sys_mmap
+   Input : addr -- address returned by sys_mmap
+   Output : 0 on success
+   			-1 if addr is not the start of a mapping
+   Side Effect : Unmaps the pages from the caller's page directory
+*/
+int32_t sys_munmap(void* addr)
+{
+	LOG("sys_munmap\n");
+	pcb_t* pcb = get_pcb_ptr();
+	int i;
+
+	if(addr == NULL)
+		return -1;
+	for(i = 0; i < MAX_NUM_MMAPS; i++) {
+		if(pcb->mmaps[i].addr == (uint32_t) addr) {
+			unmap_pages(pcb->mmaps[i].addr, pcb->mmaps[i].num_pages, pcb->pg_dir);
+			pcb->mmaps[i].addr = NULL;
+			pcb->mmaps[i].num_pages = 0;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+#if KERNEL_BENCH
+/* bench_mmap_scan
+   Sum every byte of every regular file twice: once reading it BLOCK_SIZE bytes at a time
+   with read_data into a buffer, as a program calling read does, and once through
+   a read-only mapping of its blocks, including the cost of mapping and unmapping.
+   Runs on the kernel's page directory, borrowing its mmap region. Prints the cycles
+   each scan took over all files
+*/
+void bench_mmap_scan(void)
+{
+	static pte_t bench_pg_table[NUM_PTE] __attribute__((aligned(PAGE_TABLE_SIZE)));
+	static uint8_t buf[BLOCK_SIZE];
+	uint32_t read_cycles = 0;
+	uint32_t mmap_cycles = 0;
+	uint32_t total_bytes = 0;
+	uint32_t read_sum, mmap_sum, start, offset, addr, num_pages;
+	int32_t bytes_read, length, j;
+	dentry_t dentry;
+	int i;
+
+	if(map_page_table(MMAP_VIRT_ADDR, bench_pg_table, PAGING_READ_WRITE, pg_dir) != 0) {
+		printf("bench_mmap_scan: mmap region of the kernel is in use\n");
+		return;
+	}
+
+	for(i = 0; read_dentry_by_index(i, &dentry) == 0; i++) {
+		if(dentry.file_type != FILE_TYPE_FILE)
+			continue;
+		length = get_file_length(dentry.inode_idx);
+		if(length <= 0)
+			continue;
+
+		read_sum = 0;
+		offset = 0;
+		start = rdtsc();
+		while((bytes_read = read_data(dentry.inode_idx, offset, buf, BLOCK_SIZE)) > 0) {
+			for(j = 0; j < bytes_read; j++)
+				read_sum += buf[j];
+			offset += bytes_read;
+		}
+		read_cycles += rdtsc() - start;
+
+		mmap_sum = 0;
+		num_pages = (length + PAGE_SIZE_4K - 1) / PAGE_SIZE_4K;
+		start = rdtsc();
+		addr = map_file_pages(dentry.inode_idx, num_pages, pg_dir);
+		if(addr == NULL) {
+			printf("bench_mmap_scan: cannot map inode %d\n", dentry.inode_idx);
+			continue;
+		}
+		for(j = 0; j < length; j++)
+			mmap_sum += ((uint8_t *) addr)[j];
+		unmap_pages(addr, num_pages, pg_dir);
+		mmap_cycles += rdtsc() - start;
+
+		if(read_sum != mmap_sum)
+			printf("bench_mmap_scan: inode %d differs between read and mmap\n", dentry.inode_idx);
+		total_bytes += length;
+	}
+
+	pg_dir[PAGE_DIR_OFFSET(MMAP_VIRT_ADDR)].val = NULL;
+	set_cr3_reg(pg_dir);
+	printf("scan %u bytes: read %u cycles, mmap %u cycles\n", total_bytes, read_cycles, mmap_cycles);
+}
+#endif /* KERNEL_BENCH */
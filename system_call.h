@@ -2,6 +2,7 @@
 #define _SYSTEM_CALL_H
 
 #include "types.h"
+#include "debug.h"
 
 extern int32_t halt(uint8_t status);
 
@@ -23,4 +24,24 @@ extern int32_t sys_set_handler(int32_t signum, void* handler_address);
 
 extern int32_t sys_sigreturn(void);
 
+extern int32_t sys_getdents(int32_t fd, void* buf, int32_t nbytes);
+
+extern int32_t sys_mmap(int32_t fd);
+
+extern int32_t sys_munmap(void* addr);
+
+extern int32_t sys_create (const uint8_t* filename);
+
+extern int32_t sys_sendfile(int32_t out_fd, int32_t in_fd, int32_t nbytes);
+
+extern int32_t sys_lseek(int32_t fd, int32_t offset, int32_t whence);
+
+extern int32_t sys_pread(int32_t fd, void* buf, int32_t nbytes, uint32_t offset);
+
+extern int32_t sys_findnames(const uint8_t* pattern, void* buf, int32_t nbytes, uint32_t first);
+
+#if KERNEL_BENCH
+void bench_mmap_scan(void);
+#endif
+
 #endif 
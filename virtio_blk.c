@@ -0,0 +1,280 @@
+/* virtio_blk.c - Driver for the virtio block device QEMU emulates on PCI.
+ * Reads are requests on a split virtqueue, several of which can be in flight
+ * at once; the device raises an IRQ as it completes them
+ * vim:ts=4 noexpandtab
+ */
+
+#include "virtio_blk.h"
+#include "pci.h"
+#include "i8259.h"
+#include "lib.h"
+
+/* Offset of the used ring from the start of a queue of n descriptors: the descriptors,
+   then the available ring's flags, index, n entries and used event, rounded up to VIRTQ_ALIGN */
+#define VIRTQ_USED_OFFSET(n) (((n) * sizeof(virtq_desc_t) + (3 + (n)) * sizeof(uint16_t) + \
+                               VIRTQ_ALIGN - 1) & ~(VIRTQ_ALIGN - 1))
+/* Bytes of a queue of n descriptors: the used ring holds its flags, index, n elements and avail event */
+#define VIRTQ_SIZE(n) (VIRTQ_USED_OFFSET(n) + (n) * sizeof(virtq_used_elem_t) + 3 * sizeof(uint16_t))
+
+/* The device, num_sectors is 0 if virtio_blk_init did not find it */
+static block_dev_t virtio_disk;
+static uint32_t io_base;
+static uint32_t virtio_irq = PCI_IRQ_NONE;
+/* The queue, which the device reads and writes at its physical address. Kernel memory
+   is identity mapped, so that is its address here */
+static uint8_t queue_mem[VIRTQ_SIZE(VIRTQ_MAX_SIZE)] __attribute__((aligned(VIRTQ_ALIGN)));
+static uint32_t queue_size;
+static volatile virtq_desc_t* descs;
+static volatile virtq_avail_t* avail;
+static volatile virtq_used_t* used;
+/* Used ring index up to which completed requests were taken off the ring */
+static uint16_t last_used_idx;
+static virtio_blk_req_t requests[VIRTIO_BLK_MAX_REQUESTS];
+static uint32_t max_requests;
+
+static int32_t virtio_blk_read_sectors(block_dev_t* dev, uint32_t sector, uint32_t count, uint8_t* buf);
+static int32_t virtio_blk_submit_read(block_dev_t* dev, uint32_t sector, uint32_t count, uint8_t* buf);
+static int32_t virtio_blk_wait_request(block_dev_t* dev, int32_t req);
+
+/* virtio_blk_init()
+   Find the device on PCI, and set up its queue by the legacy interface. No optional
+   features are negotiated
+   Input : None
+   Output : None
+   Side Effects : Resets the device, gives it the queue, enables its IRQ on the PIC
+ */
+void virtio_blk_init(void) {
+	pci_dev_t* pci = pci_find_device(VIRTIO_VENDOR_ID, VIRTIO_BLK_DEVICE_ID);
+	uint32_t i;
+
+	virtio_disk.unit = 0;
+	virtio_disk.num_sectors = 0;
+	virtio_disk.read_sectors = virtio_blk_read_sectors;
+	virtio_disk.submit_read = virtio_blk_submit_read;
+	virtio_disk.wait_request = virtio_blk_wait_request;
+	if (pci == NULL || !(pci->bar[0] & PCI_BAR_IO)) {
+		return;
+	}
+	io_base = pci->bar[0] & PCI_BAR_IO_MASK;
+	pci_enable_bus_master(pci);
+
+	outb(0, io_base + VIRTIO_REG_DEVICE_STATUS);
+	outb(VIRTIO_STATUS_ACKNOWLEDGE, io_base + VIRTIO_REG_DEVICE_STATUS);
+	outb(VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER, io_base + VIRTIO_REG_DEVICE_STATUS);
+	outl(0, io_base + VIRTIO_REG_GUEST_FEATURES);
+
+	outw(0, io_base + VIRTIO_REG_QUEUE_SELECT);
+	queue_size = inw(io_base + VIRTIO_REG_QUEUE_SIZE);
+	if (queue_size < VIRTIO_BLK_DESC_PER_REQUEST || queue_size > VIRTQ_MAX_SIZE) {
+		outb(VIRTIO_STATUS_FAILED, io_base + VIRTIO_REG_DEVICE_STATUS);
+		return;
+	}
+	memset(queue_mem, 0, sizeof(queue_mem));
+	descs = (virtq_desc_t *) queue_mem;
+	avail = (virtq_avail_t *) (queue_mem + queue_size * sizeof(virtq_desc_t));
+	used = (virtq_used_t *) (queue_mem + VIRTQ_USED_OFFSET(queue_size));
+	last_used_idx = 0;
+	max_requests = min(VIRTIO_BLK_MAX_REQUESTS, queue_size / VIRTIO_BLK_DESC_PER_REQUEST);
+	for (i = 0; i < VIRTIO_BLK_MAX_REQUESTS; i++) {
+		requests[i].state = VIRTIO_BLK_REQ_FREE;
+	}
+	outl((uint32_t) queue_mem / VIRTQ_ALIGN, io_base + VIRTIO_REG_QUEUE_ADDRESS);
+	outb(VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK,
+	     io_base + VIRTIO_REG_DEVICE_STATUS);
+
+	/* Disks past 2^32 sectors are used up to there */
+	virtio_disk.num_sectors = (inl(io_base + VIRTIO_REG_BLK_CAPACITY + sizeof(uint32_t)) != 0)?
+	                          0xFFFFFFFF : inl(io_base + VIRTIO_REG_BLK_CAPACITY);
+	virtio_irq = pci->irq;
+	if (virtio_irq < NR_PIC_IRQS) {
+		enable_irq(virtio_irq);
+	}
+}
+
+/* virtio_blk_get_device()
+   Get the virtio disk as a block device
+   Input : None
+   Output : the disk, NULL if virtio_blk_init did not find it
+   Side Effects : None
+ */
+block_dev_t* virtio_blk_get_device(void) {
+	return (virtio_disk.num_sectors != 0)? &virtio_disk : NULL;
+}
+
+/* reap_used()
+   Mark every request the device returned on the used ring since the last call as done.
+   Called with interrupts disabled
+   Input : None
+   Output : None
+   Side Effects : Advances last_used_idx
+ */
+static void reap_used(void) {
+	while (last_used_idx != used->idx) {
+		uint32_t id = used->ring[last_used_idx % queue_size].id / VIRTIO_BLK_DESC_PER_REQUEST;
+		/* A request given up on was freed, and its late completion is dropped */
+		if (id < max_requests && requests[id].state == VIRTIO_BLK_REQ_IN_FLIGHT) {
+			requests[id].state = VIRTIO_BLK_REQ_DONE;
+		}
+		last_used_idx++;
+	}
+}
+
+/* virtio_blk_handler()
+   Interrupt handler of the virtio disk
+   Input : irq -- IRQ that was raised
+   Output : 0 if it was the disk's IRQ, -1 otherwise
+   Side Effects : Acknowledges the interrupt, marks completed requests done, sends EOI
+ */
+int32_t virtio_blk_handler(uint32_t irq) {
+	if (virtio_disk.num_sectors == 0 || irq != virtio_irq) {
+		return -1;
+	}
+	inb(io_base + VIRTIO_REG_ISR_STATUS);
+	reap_used();
+	send_eoi(irq);
+	return 0;
+}
+
+/* virtio_blk_submit_read()
+   Make a read request available to the device and notify it, without waiting
+   Input : dev -- the virtio disk
+           sector -- first sector
+           count -- number of sectors, at most VIRTIO_BLK_MAX_REQUEST_SECTORS
+           buf -- identity mapped kernel memory of count * SECTOR_SIZE bytes, which
+                  the device fills in before the request completes
+   Output : number of the request for virtio_blk_wait_request
+            -1 if the sectors are out of range or every request slot is in use
+   Side Effects : Takes a request slot and its descriptors
+ */
+static int32_t virtio_blk_submit_read(block_dev_t* dev, uint32_t sector, uint32_t count, uint8_t* buf) {
+	uint32_t flags, i, desc;
+	virtio_blk_req_t* req;
+
+	if (count == 0 || count > VIRTIO_BLK_MAX_REQUEST_SECTORS || sector > dev->num_sectors ||
+	    count > dev->num_sectors - sector) {
+		return -1;
+	}
+	flags = save_flags_and_cli();
+	for (i = 0; i < max_requests && requests[i].state != VIRTIO_BLK_REQ_FREE; i++) {
+	}
+	if (i == max_requests) {
+		restore_saved_flags(flags);
+		return -1;
+	}
+	req = &requests[i];
+	req->state = VIRTIO_BLK_REQ_IN_FLIGHT;
+	req->header.type = VIRTIO_BLK_T_IN;
+	req->header.reserved = 0;
+	req->header.sector = sector;
+	req->header.sector_high = 0;
+
+	/* The request's descriptors are always the same three, in a chain */
+	desc = i * VIRTIO_BLK_DESC_PER_REQUEST;
+	descs[desc].addr = (uint32_t) &req->header;
+	descs[desc].len = sizeof(req->header);
+	descs[desc].flags = VIRTQ_DESC_F_NEXT;
+	descs[desc].next = desc + 1;
+	descs[desc + 1].addr = (uint32_t) buf;
+	descs[desc + 1].len = count * SECTOR_SIZE;
+	descs[desc + 1].flags = VIRTQ_DESC_F_NEXT | VIRTQ_DESC_F_WRITE;
+	descs[desc + 1].next = desc + 2;
+	descs[desc + 2].addr = (uint32_t) &req->status;
+	descs[desc + 2].len = sizeof(req->status);
+	descs[desc + 2].flags = VIRTQ_DESC_F_WRITE;
+
+	avail->ring[avail->idx % queue_size] = desc;
+	/* The device must see the ring entry before the index that makes it available */
+	asm volatile("" : : : "memory");
+	avail->idx++;
+	asm volatile("" : : : "memory");
+	outw(0, io_base + VIRTIO_REG_QUEUE_NOTIFY);
+	restore_saved_flags(flags);
+	return i;
+}
+
+/* virtio_blk_wait_request()
+   Wait for a request to complete, sleeping until the disk's IRQ if interrupts are
+   enabled and the disk has an IRQ, and polling the used ring otherwise, at most
+   VIRTIO_BLK_POLL_LIMIT times
+   Input : dev -- the virtio disk
+           req -- number returned by virtio_blk_submit_read
+   Output : 0 if the device read the sectors, -1 if it failed, did not complete the
+            request in time, or req is not in flight
+   Side Effects : Frees the request slot
+ */
+static int32_t virtio_blk_wait_request(block_dev_t* dev, int32_t req) {
+	uint32_t flags;
+	uint32_t polls = 0;
+	int32_t result;
+
+	if (req < 0 || req >= (int32_t) max_requests) {
+		return -1;
+	}
+	flags = save_flags_and_cli();
+	if (requests[req].state == VIRTIO_BLK_REQ_FREE) {
+		restore_saved_flags(flags);
+		return -1;
+	}
+	while (1) {
+		reap_used();
+		if (requests[req].state == VIRTIO_BLK_REQ_DONE) {
+			break;
+		}
+		if ((flags & EFLAGS_IF) && virtio_irq < NR_PIC_IRQS) {
+			/* sti only takes effect after hlt, so the IRQ cannot slip in between */
+			asm volatile("sti; hlt; cli" : : : "memory");
+		} else if (++polls == VIRTIO_BLK_POLL_LIMIT) {
+			/* The device never posted the request */
+			requests[req].state = VIRTIO_BLK_REQ_FREE;
+			restore_saved_flags(flags);
+			return -1;
+		}
+	}
+	result = (requests[req].status == VIRTIO_BLK_S_OK)? 0 : -1;
+	requests[req].state = VIRTIO_BLK_REQ_FREE;
+	restore_saved_flags(flags);
+	return result;
+}
+
+/* virtio_blk_read_sectors()
+   Read sectors as requests of up to VIRTIO_BLK_MAX_REQUEST_SECTORS, putting as many
+   requests in flight as there are free slots before waiting for them
+   Input : dev -- the virtio disk
+           sector -- first sector
+           count -- number of sectors
+           buf -- identity mapped kernel memory of count * SECTOR_SIZE bytes
+   Output : 0 on success, -1 if a sector is out of range or a request fails
+   Side Effects : buf filled in with the sectors
+ */
+static int32_t virtio_blk_read_sectors(block_dev_t* dev, uint32_t sector, uint32_t count, uint8_t* buf) {
+	int32_t reqs[VIRTIO_BLK_MAX_REQUESTS];
+	uint32_t num_reqs, i;
+	int32_t result = 0;
+
+	if (sector > dev->num_sectors || count > dev->num_sectors - sector) {
+		return -1;
+	}
+	while (count > 0) {
+		for (num_reqs = 0; count > 0 && num_reqs < max_requests; num_reqs++) {
+			uint32_t req_sectors = min(count, VIRTIO_BLK_MAX_REQUEST_SECTORS);
+			reqs[num_reqs] = virtio_blk_submit_read(dev, sector, req_sectors, buf);
+			if (reqs[num_reqs] < 0) {
+				/* Every slot is in use, the requests already made free some */
+				break;
+			}
+			sector += req_sectors;
+			count -= req_sectors;
+			buf += req_sectors * SECTOR_SIZE;
+		}
+		if (num_reqs == 0) {
+			return -1;
+		}
+		for (i = 0; i < num_reqs; i++) {
+			result |= virtio_blk_wait_request(dev, reqs[i]);
+		}
+		if (result != 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,106 @@
+/* virtio_blk.h - Defines for the virtio block device driver, legacy PCI
+ * interface with one split virtqueue
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _VIRTIO_BLK_H
+#define _VIRTIO_BLK_H
+
+#include "types.h"
+#include "block_dev.h"
+
+/* IDs of a transitional virtio block device, which has the legacy I/O port interface */
+#define VIRTIO_VENDOR_ID 0x1AF4
+#define VIRTIO_BLK_DEVICE_ID 0x1001
+
+/* Registers of the legacy interface, offsets into the I/O ports of BAR 0 */
+#define VIRTIO_REG_DEVICE_FEATURES 0x00
+#define VIRTIO_REG_GUEST_FEATURES 0x04
+#define VIRTIO_REG_QUEUE_ADDRESS 0x08   /* page number of the queue */
+#define VIRTIO_REG_QUEUE_SIZE 0x0C
+#define VIRTIO_REG_QUEUE_SELECT 0x0E
+#define VIRTIO_REG_QUEUE_NOTIFY 0x10
+#define VIRTIO_REG_DEVICE_STATUS 0x12
+#define VIRTIO_REG_ISR_STATUS 0x13      /* reading it acknowledges the interrupt */
+#define VIRTIO_REG_BLK_CAPACITY 0x14    /* 64-bit number of sectors, low word first */
+
+#define VIRTIO_STATUS_ACKNOWLEDGE 0x01
+#define VIRTIO_STATUS_DRIVER 0x02
+#define VIRTIO_STATUS_DRIVER_OK 0x04
+#define VIRTIO_STATUS_FAILED 0x80
+#define VIRTIO_ISR_QUEUE 0x01
+
+/* The legacy interface places the used ring on the page boundary after the available ring */
+#define VIRTQ_ALIGN 4096
+#define VIRTQ_MAX_SIZE 1024
+#define VIRTQ_DESC_F_NEXT 0x1
+#define VIRTQ_DESC_F_WRITE 0x2
+
+#define VIRTIO_BLK_T_IN 0
+#define VIRTIO_BLK_S_OK 0
+
+/* States of a request slot */
+#define VIRTIO_BLK_REQ_FREE 0
+#define VIRTIO_BLK_REQ_IN_FLIGHT 1
+#define VIRTIO_BLK_REQ_DONE 2
+/* Times the used ring is polled for a request before it is given up on, as for the ATA disk */
+#define VIRTIO_BLK_POLL_LIMIT 1000000
+/* Interrupt flag of EFLAGS */
+#define EFLAGS_IF 0x200
+
+/* Requests in flight at once. Each takes VIRTIO_BLK_DESC_PER_REQUEST descriptors:
+   its header, its data, and the status byte the device writes */
+#define VIRTIO_BLK_MAX_REQUESTS 32
+#define VIRTIO_BLK_DESC_PER_REQUEST 3
+/* Most sectors of one request; read_sectors splits a longer read into requests that are
+   all in flight together */
+#define VIRTIO_BLK_MAX_REQUEST_SECTORS 128
+
+/* Descriptor of a buffer the device reads or writes */
+typedef struct virtq_desc_t {
+	uint32_t addr;				/* physical address, low word */
+	uint32_t addr_high;
+	uint32_t len;
+	uint16_t flags;
+	uint16_t next;
+} __attribute__((packed)) virtq_desc_t;
+
+/* Ring of descriptor chains the driver made available, ring has the queue's size */
+typedef struct virtq_avail_t {
+	uint16_t flags;
+	uint16_t idx;
+	uint16_t ring[];
+} __attribute__((packed)) virtq_avail_t;
+
+typedef struct virtq_used_elem_t {
+	uint32_t id;				/* first descriptor of the chain */
+	uint32_t len;
+} __attribute__((packed)) virtq_used_elem_t;
+
+/* Ring of descriptor chains the device is done with */
+typedef struct virtq_used_t {
+	uint16_t flags;
+	uint16_t idx;
+	virtq_used_elem_t ring[];
+} __attribute__((packed)) virtq_used_t;
+
+/* Header the device reads at the start of every request */
+typedef struct virtio_blk_req_header_t {
+	uint32_t type;
+	uint32_t reserved;
+	uint32_t sector;			/* low word of the 64-bit sector */
+	uint32_t sector_high;
+} __attribute__((packed)) virtio_blk_req_header_t;
+
+/* A request slot, with the header and status byte its descriptors point at */
+typedef struct virtio_blk_req_t {
+	virtio_blk_req_header_t header;
+	volatile uint8_t status;	/* written by the device, VIRTIO_BLK_S_OK on success */
+	volatile uint8_t state;		/* VIRTIO_BLK_REQ_*, DONE once the used ring returns it */
+} virtio_blk_req_t;
+
+void virtio_blk_init(void);
+block_dev_t* virtio_blk_get_device(void);
+int32_t virtio_blk_handler(uint32_t irq);
+
+#endif /* _VIRTIO_BLK_H */